@@ -23,6 +23,7 @@ typedef struct am_intheader
 extern int AM_RootPageNum; /* The page number of the root */
 extern int AM_LeftPageNum; /* The page Number of the leftmost leaf */
 extern int AM_Errno; /* last error in AM layer */
+extern int AM_PageSize; /* page size of the index being changed */
 //conflicting with stdlib probably
 /* extern char *calloc();
 extern char *malloc(); */
@@ -54,6 +55,8 @@ extern char *malloc(); */
 # define NOT_EQUAL 6
 # define MAXSCANS 20
 # define AM_MAXATTRLENGTH 256
+# define AM_MAX_PAGE_SIZE 16384 /* largest index page: offsets in a page
+				   are shorts */
 
 
 # define AME_OK 0
@@ -68,6 +71,7 @@ extern char *malloc(); */
 # define AME_INVALIDATTRTYPE -9
 # define AME_FD -10
 # define AME_INVALIDVALUE -11
+# define AME_PAGESIZE -12
 
 
 void AM_Compact(
@@ -203,6 +207,13 @@ int indexNo, /*number of this index for file */
 char attrType, /* 'c' for char ,'i' for int ,'f' for float */
 int attrLength /* 4 for 'i' or 'f', 1-255 for 'c' */
 );
+int AM_CreateIndexWithPageSize(
+char *fileName,/* Name of indexed file */
+int indexNo, /*number of this index for file */
+char attrType, /* 'c' for char ,'i' for int ,'f' for float */
+int attrLength, /* 4 for 'i' or 'f', 1-255 for 'c' */
+int pageSize /* # of bytes in a page */
+);
 int AM_InsertEntry(
 int fileDesc, /* file Descriptor */
 char attrType, /* 'i' or 'c' or 'f' */
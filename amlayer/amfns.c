@@ -12,6 +12,21 @@ int indexNo, /*number of this index for file */
 char attrType, /* 'c' for char ,'i' for int ,'f' for float */
 int attrLength /* 4 for 'i' or 'f', 1-255 for 'c' */
 )
+{
+	return(AM_CreateIndexWithPageSize(fileName,indexNo,attrType,
+					  attrLength,PF_PAGE_SIZE));
+}
+
+
+/* Creates a secondary index file called fileName.indexNo whose pages
+are pageSize bytes, from PF_MIN_PAGE_SIZE up to AM_MAX_PAGE_SIZE */
+int AM_CreateIndexWithPageSize(
+char *fileName,/* Name of indexed file */
+int indexNo, /*number of this index for file */
+char attrType, /* 'c' for char ,'i' for int ,'f' for float */
+int attrLength, /* 4 for 'i' or 'f', 1-255 for 'c' */
+int pageSize /* # of bytes in a page */
+)
 {
 	char *pageBuf; /* buffer for holding a page */
 	char indexfName[AM_MAX_FNAME_LENGTH]; /* String to store the indexed
@@ -41,12 +56,18 @@ int attrLength /* 4 for 'i' or 'f', 1-255 for 'c' */
 			 AM_Errno = AME_INVALIDATTRLENGTH;
 			 return(AME_INVALIDATTRLENGTH);
                         }
+
+	if (pageSize > AM_MAX_PAGE_SIZE)
+		{
+		 AM_Errno = AME_PAGESIZE;
+		 return(AME_PAGESIZE);
+		}
 	
 	header = &head;
 	
 	/* Get the filename with extension and create a paged file by that name*/
 	sprintf(indexfName,"%s.%d",fileName,indexNo);
-	errVal = PF_CreateFile(indexfName);
+	errVal = PF_CreateFileWithPageSize(indexfName,pageSize);
 	AM_Check;
 
 	/* open the new file */
@@ -64,14 +85,14 @@ int attrLength /* 4 for 'i' or 'f', 1-255 for 'c' */
 	/* initialise the header */
 	header->pageType = 'l';
 	header->nextLeafPage = AM_NULL_PAGE;
-	header->recIdPtr = PF_PAGE_SIZE;
+	header->recIdPtr = pageSize;
 	header->keyPtr = AM_sl;
 	header->freeListPtr = AM_NULL;
 	header->numinfreeList = 0;
 	header->attrLength = attrLength;
 	header->numKeys = 0;
 	/* the maximum keys in an internal node- has to be even always*/
-	maxKeys = (PF_PAGE_SIZE - AM_sint - AM_si)/(AM_si + attrLength);
+	maxKeys = (pageSize - AM_sint - AM_si)/(AM_si + attrLength);
 	if (( maxKeys % 2) != 0) 
 		header->maxKeys = maxKeys - 1;
 	else 
@@ -284,6 +305,8 @@ int recId /* recId to be inserted */
 		 return(AME_FD);
                 }
 	
+	/* the page size the splits below work with */
+	AM_PageSize = PF_PageSize(fileDesc);
 	
 	/* Search the leaf for the key */
 	status = AM_Search(fileDesc,attrType,attrLength,value,&pageNum,
@@ -367,7 +390,8 @@ static char *AMerrormsg[] = {
 "Scan Table is full",
 "Invalid Attribute Type",
 "Invalid file Descriptor",
-"Invalid value to Delete or Insert Entry"
+"Invalid value to Delete or Insert Entry",
+"Invalid index page size"
 };
 
 
@@ -199,8 +199,8 @@ int i;
 
 printf("GETTING PAGE = %d\n",pageNum);
 errVal = PF_GetThisPage(fileDesc,pageNum,&pageBuf);
-tempPage = malloc(PF_PAGE_SIZE);
-bcopy(pageBuf,tempPage,PF_PAGE_SIZE);
+tempPage = malloc(PF_PageSize(fileDesc));
+bcopy(pageBuf,tempPage,PF_PageSize(fileDesc));
 errVal = PF_UnfixPage(fileDesc,pageNum,FALSE);
 if (*tempPage == 'l')
   {
@@ -18,9 +18,71 @@ struct {
          int lastpageNum;
          short lastIndex;
          int status;
+         int pinnedpageNum; /* leaf kept fixed between calls, or
+                               AM_NULL_PAGE */
+         char *pinnedBuf; /* buffer of that leaf */
        } AM_scanTable[MAXSCANS];
 
 
+/* Unfixes the leaf held by scan scanDesc, if any. Returns a PF error code */
+static int AM_ScanUnpin(
+int scanDesc /* index scan descriptor */
+)
+
+{
+int errVal;
+
+if (AM_scanTable[scanDesc].pinnedpageNum == AM_NULL_PAGE)
+  return(PFE_OK);
+errVal = PF_UnfixPage(AM_scanTable[scanDesc].fileDesc,
+                      AM_scanTable[scanDesc].pinnedpageNum,FALSE);
+AM_scanTable[scanDesc].pinnedpageNum = AM_NULL_PAGE;
+return(errVal);
+}
+
+
+/* Sets *pageBuf to leaf pageNum, which scan scanDesc keeps fixed until it
+moves on to another leaf or ends, so that successive calls to
+AM_FindNextEntry on one leaf do not fetch it again. Returns a PF error code */
+static int AM_ScanPin(
+int scanDesc, /* index scan descriptor */
+int pageNum, /* leaf to hold */
+char **pageBuf /* buffer of the leaf */
+)
+
+{
+int errVal;
+
+if (AM_scanTable[scanDesc].pinnedpageNum != pageNum)
+ {
+  if ((errVal = AM_ScanUnpin(scanDesc)) != PFE_OK)
+    return(errVal);
+  errVal = PF_GetThisPage(AM_scanTable[scanDesc].fileDesc,pageNum,
+                          &AM_scanTable[scanDesc].pinnedBuf);
+  if (errVal != PFE_OK)
+    return(errVal);
+  AM_scanTable[scanDesc].pinnedpageNum = pageNum;
+ }
+*pageBuf = AM_scanTable[scanDesc].pinnedBuf;
+return(PFE_OK);
+}
+
+
+/* Lets go of the leaf held by scan scanDesc when it has run out of entries.
+Returns AME_EOF, or AME_PF if the leaf cannot be unfixed */
+static int AM_ScanEnd(
+int scanDesc /* index scan descriptor */
+)
+
+{
+int errVal;
+
+errVal = AM_ScanUnpin(scanDesc);
+AM_Check;
+return(AME_EOF);
+}
+
+
 /* Opens an index scan */
 int AM_OpenIndexScan(
 int fileDesc, /* file Descriptor */
@@ -74,6 +136,7 @@ if (scanDesc > MAXSCANS - 1)
 /* there is room */
 AM_scanTable[scanDesc].status = FIRST;
 AM_scanTable[scanDesc].attrType = attrType;
+AM_scanTable[scanDesc].pinnedpageNum = AM_NULL_PAGE;
 
 /* initialise AM_LeftPageNum */
 AM_LeftPageNum = GetLeftPageNum(fileDesc);
@@ -97,6 +160,8 @@ if (value == NULL)
 /* search for the pagenumber and index of value */
 status = AM_Search(fileDesc,attrType,attrLength,value,&pageNum,&pageBuf,&index);
 searchpageNum = pageNum;
+/* a scan does not need the path, so empty the stack for the next amlayer call */
+AM_EmptyStack();
 /* check for errors */
 if (status < 0) 
   { AM_scanTable[scanDesc].status = FREE;
@@ -114,12 +179,13 @@ key */
 if (index > header->numKeys) 
   if (header->nextLeafPage != AM_NULL_PAGE)
   {
-  errVal = PF_GetThisPage(fileDesc,header->nextLeafPage,&pageBuf);
+  /* the header is overwritten by that of the next leaf */
+  pageNum = header->nextLeafPage;
+  errVal = PF_GetThisPage(fileDesc,pageNum,&pageBuf);
   AM_Check;
   bcopy(pageBuf,header,AM_sl);
-  errVal = PF_UnfixPage(fileDesc,header->nextLeafPage,FALSE);
+  errVal = PF_UnfixPage(fileDesc,pageNum,FALSE);
   AM_Check;
-  pageNum = header->nextLeafPage;
   index = 1;
   }
   else
@@ -155,17 +221,12 @@ switch(op)
                 AM_scanTable[scanDesc].nextpageNum = AM_LeftPageNum;
                 AM_scanTable[scanDesc].nextIndex = 1;
                 AM_scanTable[scanDesc].actindex = 1;
-                if (searchpageNum != AM_LeftPageNum)
-		 { errVal = PF_GetThisPage(fileDesc,AM_LeftPageNum,&pageBuf);
-                  AM_Check;
-                 }
+                errVal = PF_GetThisPage(fileDesc,AM_LeftPageNum,&pageBuf);
+                AM_Check;
                 bcopy(pageBuf + AM_sl + attrLength,
                         &AM_scanTable[scanDesc].nextRecIdPtr,AM_ss);
-                if (searchpageNum != AM_LeftPageNum)
-		 {
-		  errVal = PF_UnfixPage(fileDesc,AM_LeftPageNum,FALSE);
-                  AM_Check;
-                 }
+                errVal = PF_UnfixPage(fileDesc,AM_LeftPageNum,FALSE);
+                AM_Check;
                 AM_scanTable[scanDesc].lastpageNum  = pageNum;
                 AM_scanTable[scanDesc].lastIndex  = index - 1 ;
                 break;
@@ -212,17 +273,12 @@ switch(op)
                AM_scanTable[scanDesc].nextpageNum = AM_LeftPageNum;
                AM_scanTable[scanDesc].nextIndex = 1;
                AM_scanTable[scanDesc].actindex = 1;
-                if (searchpageNum != AM_LeftPageNum)
-		 { errVal = PF_GetThisPage(fileDesc,AM_LeftPageNum,&pageBuf);
-                  AM_Check;
-                 }
+               errVal = PF_GetThisPage(fileDesc,AM_LeftPageNum,&pageBuf);
+               AM_Check;
                bcopy(pageBuf + AM_sl + attrLength,
                                  &AM_scanTable[scanDesc].nextRecIdPtr,AM_ss);
-               if (searchpageNum != AM_LeftPageNum)
-		 {
-		  errVal = PF_UnfixPage(fileDesc,AM_LeftPageNum,FALSE);
-                  AM_Check;
-                 }		   
+               errVal = PF_UnfixPage(fileDesc,AM_LeftPageNum,FALSE);
+               AM_Check;
                AM_scanTable[scanDesc].lastpageNum  = pageNum;
                if (status == AM_FOUND)
                 AM_scanTable[scanDesc].lastIndex  = index ;
@@ -247,17 +303,12 @@ switch(op)
                 AM_scanTable[scanDesc].nextpageNum = AM_LeftPageNum;
                 AM_scanTable[scanDesc].nextIndex = 1;
                 AM_scanTable[scanDesc].actindex = 1;
-                if (searchpageNum != AM_LeftPageNum)
-		  {
-		  errVal = PF_GetThisPage(fileDesc,AM_LeftPageNum,&pageBuf);
-                  AM_Check;
-		  }
+                errVal = PF_GetThisPage(fileDesc,AM_LeftPageNum,&pageBuf);
+                AM_Check;
                 bcopy(pageBuf + AM_sl + attrLength,
                               &AM_scanTable[scanDesc].nextRecIdPtr,   AM_ss);
-                if (searchpageNum != AM_LeftPageNum)
-		 { errVal = PF_UnfixPage(fileDesc,AM_LeftPageNum,FALSE);
-                  AM_Check;
-                 }
+                errVal = PF_UnfixPage(fileDesc,AM_LeftPageNum,FALSE);
+                AM_Check;
                 }
                else 
                 AM_scanTable[scanDesc].pageNum = AM_NULL_PAGE;
@@ -300,38 +351,31 @@ if ((scanDesc < 0) || (scanDesc > MAXSCANS - 1))
 
 /* check if scan is over */
 if (AM_scanTable[scanDesc].status == OVER)
-      return(AME_EOF);
+      return(AM_ScanEnd(scanDesc));
 
 if (AM_scanTable[scanDesc].nextpageNum == AM_NULL_PAGE)
  {
   AM_scanTable[scanDesc].status = OVER;
-  return(AME_EOF);
+  return(AM_ScanEnd(scanDesc));
  }
 
 header = &head;
-errVal = PF_GetThisPage(AM_scanTable[scanDesc].fileDesc
-                        ,AM_scanTable[scanDesc].nextpageNum,&pageBuf);
+errVal = AM_ScanPin(scanDesc,AM_scanTable[scanDesc].nextpageNum,&pageBuf);
 AM_Check;
 
 bcopy(pageBuf,header,AM_sl);
 recSize = header->attrLength + AM_ss;
 
-errVal = PF_UnfixPage(AM_scanTable[scanDesc].fileDesc
-           ,AM_scanTable[scanDesc].nextpageNum,FALSE);
-AM_Check;
-
 /* Get next non empty leaf page */
 while(header->numKeys == 0)
   if(header->nextLeafPage == AM_NULL_PAGE)
    {
     AM_scanTable[scanDesc].status = OVER; 
-    return(AME_EOF);
+    return(AM_ScanEnd(scanDesc));
    }
   else
    {
-    errVal = PF_GetThisPage(AM_scanTable[scanDesc].fileDesc,header->nextLeafPage,&pageBuf);
-    AM_Check;
-    errVal = PF_UnfixPage(AM_scanTable[scanDesc].fileDesc,header->nextLeafPage,FALSE);
+    errVal = AM_ScanPin(scanDesc,header->nextLeafPage,&pageBuf);
     AM_Check;
     AM_scanTable[scanDesc].nextpageNum = header->nextLeafPage;
     AM_scanTable[scanDesc].nextIndex = 1;
@@ -350,7 +394,7 @@ if ((AM_scanTable[scanDesc].op == LESS_THAN) ||
  && (AM_scanTable[scanDesc].lastIndex == 0))
  {
   AM_scanTable[scanDesc].status = OVER;
-  return(AME_EOF);
+  return(AM_ScanEnd(scanDesc));
  }
 
 /* if op is not equal then check if we have to skip this value */
@@ -368,21 +412,17 @@ if (AM_scanTable[scanDesc].op == NOT_EQUAL)
          }
        else
           if (header->nextLeafPage == AM_NULL_PAGE)
-            return(AME_EOF); 
+            return(AM_ScanEnd(scanDesc)); 
           else
            {
             AM_scanTable[scanDesc].nextpageNum = header->nextLeafPage;
             AM_scanTable[scanDesc].nextIndex =  1;
             AM_scanTable[scanDesc].actindex = 1;
-            errVal =PF_GetThisPage(AM_scanTable[scanDesc].fileDesc,
-                  header->nextLeafPage,&pageBuf);
+            errVal = AM_ScanPin(scanDesc,header->nextLeafPage,&pageBuf);
             AM_Check;
             bcopy(pageBuf + AM_sl + header->attrLength,
                &AM_scanTable[scanDesc].nextRecIdPtr,AM_ss);
             bcopy(pageBuf,header,AM_sl);
-            errVal = PF_UnfixPage(AM_scanTable[scanDesc].fileDesc
-                ,header->nextLeafPage,FALSE);
-            AM_Check;
            }
 /* if not the first call to findnextentry , check if previous record has 
 been deleted */
@@ -434,14 +474,10 @@ if (AM_scanTable[scanDesc].nextRecIdPtr == (short)0)
       AM_scanTable[scanDesc].nextpageNum = header->nextLeafPage;
       AM_scanTable[scanDesc].nextIndex =  1;
       AM_scanTable[scanDesc].actindex = 1;
-      errVal =PF_GetThisPage(AM_scanTable[scanDesc].fileDesc,
-        header->nextLeafPage,&pageBuf);
+      errVal = AM_ScanPin(scanDesc,header->nextLeafPage,&pageBuf);
       AM_Check;
       bcopy(pageBuf + AM_sl + header->attrLength,
          &AM_scanTable[scanDesc].nextRecIdPtr,AM_ss);
-      errVal = PF_UnfixPage(AM_scanTable[scanDesc].fileDesc
-                ,header->nextLeafPage,FALSE);
-      AM_Check;
       bcopy(pageBuf + AM_sl + (AM_scanTable[scanDesc].nextIndex -1 )*recSize,
       AM_scanTable[scanDesc].nextvalue,header->attrLength); 
       bcopy(pageBuf,header,AM_sl);
@@ -466,6 +502,12 @@ if ((AM_scanTable[scanDesc].op == LESS_THAN) ||
       if (AM_scanTable[scanDesc].status == LAST)
         AM_scanTable[scanDesc].status = OVER;
         
+/* no more calls will need the leaf */
+if (AM_scanTable[scanDesc].status == OVER)
+ {
+  errVal = AM_ScanUnpin(scanDesc);
+  AM_Check;
+ }
 
 return(recId);
 }
@@ -477,12 +519,16 @@ int scanDesc/* scan Descriptor*/
 )
 
 {
+int errVal;
+
 if ((scanDesc < 0) || (scanDesc > MAXSCANS - 1))
   {
    AM_Errno = AME_INVALID_SCANDESC;
    return(AME_INVALID_SCANDESC);
   }
+errVal = AM_ScanUnpin(scanDesc);
 AM_scanTable[scanDesc].status = FREE;
+AM_Check;
 return(AME_OK);
 }
 
@@ -44,6 +44,11 @@ int *indexPtr /* pointer to index in leaf where key is present or
 		bcopy(*pageBuf,iheader,AM_sint);
 		if (iheader->attrLength != attrLength)
 			return(AME_INVALIDATTRLENGTH);
+
+		/* every search passes the internal nodes: keep them in
+		the buffer ahead of leaves and scanned pages */
+		errVal = PF_SetPageHint(fileDesc,*pageNum,PF_HINT_HIGH);
+		AM_Check;
 	}
 	/* find the leaf at which key is present or can be inserted */
 	while ((**pageBuf) != 'l')
@@ -79,6 +84,8 @@ int *indexPtr /* pointer to index in leaf where key is present or
 			bcopy(*pageBuf,iheader,AM_sint);
 			if (iheader->attrLength != attrLength)
 				return(AME_INVALIDATTRLENGTH);
+			errVal = PF_SetPageHint(fileDesc,*pageNum,PF_HINT_HIGH);
+			AM_Check;
 		}
 	}
 	/* find whether key is in leaf or not */
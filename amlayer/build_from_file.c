@@ -10,6 +10,8 @@
  *   roll_field_index = 1  (0-based)
  *
  * Outputs: prints progress and writes 'am_build_from_file.csv' with a CSV line.
+ * With PF_TRACE=tracefile set, its page accesses are traced for
+ * ../pflayer/pf_simulate.
  */
 
 #include "am.h"
@@ -44,6 +46,11 @@ int main(int argc, char **argv) {
     int fieldIndex = (argc > 3) ? atoi(argv[3]) : 1;
 
     printf("=== Build index from file: %s (indexNo=%d) ===\n", spfile, indexNo);
+
+    /* PF_TRACE=file traces the page accesses, for pf_simulate */
+    if (getenv("PF_TRACE") != NULL &&
+        PF_StartTrace(getenv("PF_TRACE"), 0) != PFE_OK)
+        PF_PrintError("PF_StartTrace");
     /* open slotted file */
     int spfd = SP_OpenFile(spfile);
     if (spfd < 0) { perror("SP_OpenFile"); return 1; }
@@ -57,6 +64,7 @@ int main(int argc, char **argv) {
 
     /* measure start */
     clock_t tstart = clock();
+    PF_CollectStats();
     unsigned long beforeLogical = PFbufferPool.logicalPageRequests;
     unsigned long beforePhysReads = PFbufferPool.physicalReads;
     unsigned long beforePhysWrites = PFbufferPool.physicalWrites;
@@ -126,6 +134,7 @@ int main(int argc, char **argv) {
     clock_t tend = clock();
     double seconds = (double)(tend - tstart) / CLOCKS_PER_SEC;
 
+    PF_CollectStats();
     unsigned long afterLogical = PFbufferPool.logicalPageRequests;
     unsigned long afterPhysReads = PFbufferPool.physicalReads;
     unsigned long afterPhysWrites = PFbufferPool.physicalWrites;
@@ -9,6 +9,8 @@
  *   fieldIndex = 1
  *
  * Output: am_build_incremental.csv
+ * With PF_TRACE=tracefile set, its page accesses are traced for
+ * ../pflayer/pf_simulate.
  */
 
 #include "am.h"
@@ -42,6 +44,11 @@ int main(int argc, char **argv) {
 
     printf("=== Build index incremental: %s (indexNo=%d) ===\n", spfile, indexNo);
 
+    /* PF_TRACE=file traces the page accesses, for pf_simulate */
+    if (getenv("PF_TRACE") != NULL &&
+        PF_StartTrace(getenv("PF_TRACE"), 0) != PFE_OK)
+        PF_PrintError("PF_StartTrace");
+
     int spfd = SP_OpenFile(spfile);
     if (spfd < 0) { perror("SP_OpenFile"); return 1; }
 
@@ -52,6 +59,7 @@ int main(int argc, char **argv) {
 
     /* measure */
     clock_t tstart = clock();
+    PF_CollectStats();
     unsigned long beforeLogical = PFbufferPool.logicalPageRequests;
     unsigned long beforePhysReads = PFbufferPool.physicalReads;
     unsigned long beforePhysWrites = PFbufferPool.physicalWrites;
@@ -84,6 +92,7 @@ int main(int argc, char **argv) {
 
     clock_t tend = clock();
     double seconds = (double)(tend - tstart) / CLOCKS_PER_SEC;
+    PF_CollectStats();
     unsigned long logicalDiff = PFbufferPool.logicalPageRequests - beforeLogical;
     unsigned long physReadsDiff = PFbufferPool.physicalReads - beforePhysReads;
     unsigned long physWritesDiff = PFbufferPool.physicalWrites - beforePhysWrites;
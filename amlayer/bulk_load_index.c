@@ -4,13 +4,16 @@
  * This approximates a bottom-up bulk load by inserting sorted keys (minimizes split churn).
  *
  * Usage:
- *   ./bulk_load_index [sp_file] [indexNo] [roll_field_index]
+ *   ./bulk_load_index [sp_file] [indexNo] [roll_field_index] [page_size]
  * Defaults:
  *   sp_file = sp_student.dat
  *   indexNo = 3
  *   roll_field_index = 1
+ *   page_size = PF_PAGE_SIZE (up to AM_MAX_PAGE_SIZE)
  *
  * Output: am_bulk_load.csv
+ * With PF_TRACE=tracefile set, its page accesses are traced for
+ * ../pflayer/pf_simulate.
  */
 
 #include "am.h"
@@ -54,8 +57,18 @@ int main(int argc, char **argv) {
     const char *spfile = (argc > 1) ? argv[1] : DEFAULT_SP;
     int indexNo = (argc > 2) ? atoi(argv[2]) : 3;
     int fieldIndex = (argc > 3) ? atoi(argv[3]) : 1;
+    int pageSize = (argc > 4) ? atoi(argv[4]) : PF_PAGE_SIZE;
+    char indexfname[AM_MAX_FNAME_LENGTH];
 
-    printf("=== Bulk load (sorted insert) from %s -> student.%d ===\n", spfile, indexNo);
+    printf("=== Bulk load (sorted insert) from %s -> student.%d (%d-byte pages) ===\n",
+           spfile, indexNo, pageSize);
+
+    /* PF_TRACE=file traces the page accesses, for pf_simulate */
+    if (getenv("PF_TRACE") != NULL &&
+        PF_StartTrace(getenv("PF_TRACE"), 0) != PFE_OK)
+        PF_PrintError("PF_StartTrace");
+
+    sprintf(indexfname, "student.%d", indexNo);
 
     int spfd = SP_OpenFile(spfile);
     if (spfd < 0) { perror("SP_OpenFile"); return 1; }
@@ -85,10 +98,14 @@ int main(int argc, char **argv) {
     printf("Sort done. Now inserting in sorted order.\n");
 
     /* create index */
-    if (AM_CreateIndex("student", indexNo, 'i', 4) != AME_OK) AM_PrintError("AM_CreateIndex");
+    if (AM_CreateIndexWithPageSize("student", indexNo, 'i', 4, pageSize) != AME_OK) {
+        AM_PrintError("AM_CreateIndex");
+        if (AM_Errno == AME_PAGESIZE) return 1;
+    }
 
     /* measure start */
     clock_t tstart = clock();
+    PF_CollectStats();
     unsigned long beforeLogical = PFbufferPool.logicalPageRequests;
     unsigned long beforePhysReads = PFbufferPool.physicalReads;
     unsigned long beforePhysWrites = PFbufferPool.physicalWrites;
@@ -97,7 +114,7 @@ int main(int argc, char **argv) {
     char valbuf[4];
     for (long i = 0; i < n; i++) {
         memcpy(valbuf, &arr[i].key, 4);
-        int amFd = PF_OpenFile("student.3");
+        int amFd = PF_OpenFile(indexfname);
         if (amFd < 0) {
             if (AM_InsertEntry(0, 'i', 4, valbuf, arr[i].recId) != AME_OK) AM_PrintError("AM_InsertEntry");
         } else {
@@ -110,6 +127,7 @@ int main(int argc, char **argv) {
 
     clock_t tend = clock();
     double seconds = (double)(tend - tstart) / CLOCKS_PER_SEC;
+    PF_CollectStats();
     unsigned long logicalDiff = PFbufferPool.logicalPageRequests - beforeLogical;
     unsigned long physReadsDiff = PFbufferPool.physicalReads - beforePhysReads;
     unsigned long physWritesDiff = PFbufferPool.physicalWrites - beforePhysWrites;
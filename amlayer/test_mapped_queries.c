@@ -0,0 +1,180 @@
+/* test_mapped_queries.c
+ * Run the same queries on a finished index through the buffer pool
+ * (PF_OpenFile) and through a read-only mapping (PF_OpenFileMapped),
+ * and compare their times.
+ *
+ * Usage:
+ *   ./test_mapped_queries [indexNo] [sp_file] [roll_field_index]
+ * Defaults:
+ *   indexNo = 3
+ *   sp_file = sp_student.dat
+ *   roll_field_index = 1  (0-based)
+ *
+ * Keys are taken from the records of sp_file. Each mode runs NPOINT point
+ * queries on keys picked at random, NRANGE range scans from random keys
+ * to the end of the index, and a scan of sp_file. Both modes must find
+ * the same entries and records.
+ *
+ * Outputs am_mapped_results.csv
+ */
+
+#include "am.h"
+#include "../pflayer/splayer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_SP "sp_student.dat"
+#define OUTCSV "am_mapped_results.csv"
+
+#define NPOINT 20000 /* point queries per mode */
+#define NRANGE 20    /* range scans per mode */
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int extract_key_from_record(const char *rec, int len, int field_index) {
+    /* tokenize by ';' and return integer in field_index (0-based).
+       records are not NUL-terminated */
+    char *tmp = strndup(rec, len);
+    char *p = tmp;
+    int idx = 0;
+    char *tok;
+    int key = 0;
+    while ((tok = strsep(&p, ";")) != NULL) {
+        if (idx == field_index) { key = atoi(tok); break; }
+        idx++;
+    }
+    free(tmp);
+    return key;
+}
+
+/* Opens "fname" buffered or mapped */
+static int open_file(const char *fname, int mapped) {
+    int fd = mapped ? PF_OpenFileMapped((char *)fname)
+                    : PF_OpenFile((char *)fname);
+    if (fd < 0) { PF_PrintError((char *)fname); exit(1); }
+    return fd;
+}
+
+/* Runs a scan of the index from key "value" with operator "op";
+   returns the # of entries found */
+static long run_scan(int amFd, int op, int value) {
+    long found = 0;
+    int recId;
+    int scanDesc = AM_OpenIndexScan(amFd, 'i', 4, op, (char *)&value);
+    if (scanDesc < 0) { AM_PrintError("AM_OpenIndexScan"); exit(1); }
+    while ((recId = AM_FindNextEntry(scanDesc)) != AME_EOF) {
+        if (recId < 0) { AM_PrintError("AM_FindNextEntry"); exit(1); }
+        found++;
+    }
+    AM_CloseIndexScan(scanDesc);
+    return found;
+}
+
+int main(int argc, char **argv) {
+    int indexNo = (argc > 1) ? atoi(argv[1]) : 3;
+    const char *spfile = (argc > 2) ? argv[2] : DEFAULT_SP;
+    int fieldIndex = (argc > 3) ? atoi(argv[3]) : 1;
+    const char *modes[] = {"buffered", "mapped"};
+    long pointFound[2], rangeFound[2], spRecords[2];
+    char indexfname[128];
+    int *keys = NULL;
+    int nkeys = 0, maxkeys = 0;
+
+    printf("=== Buffered vs mapped queries on student.%d ===\n", indexNo);
+    sprintf(indexfname, "student.%d", indexNo);
+    PF_Init();
+
+    /* collect the keys */
+    int spfd = SP_OpenFile(spfile);
+    if (spfd < 0) { PF_PrintError("SP_OpenFile"); return 1; }
+    SP_Scan scan;
+    char *rec; int rlen; SP_RecId rid;
+    SP_ScanInit(&scan, spfd);
+    while (SP_ScanNext(&scan, &rec, &rlen, &rid) == 0) {
+        if (nkeys == maxkeys) {
+            maxkeys = maxkeys ? 2 * maxkeys : 1024;
+            keys = realloc(keys, maxkeys * sizeof(int));
+            if (!keys) { perror("realloc"); return 1; }
+        }
+        keys[nkeys++] = extract_key_from_record(rec, rlen, fieldIndex);
+        free(rec);
+    }
+    SP_ScanClose(&scan);
+    SP_CloseFile(spfd);
+    if (nkeys == 0) { printf("no records in %s\n", spfile); return 1; }
+
+    FILE *csv = fopen(OUTCSV, "w");
+    if (!csv) { perror("fopen"); return 1; }
+    fprintf(csv, "index,mode,pointQueries,pointFound,pointSec,rangeScans,"
+                 "rangeFound,rangeSec,spRecords,spSec,logicalReq,physReads,"
+                 "mappedReq\n");
+
+    for (int m = 0; m < 2; m++) {
+        unsigned int seed = 42;
+        double t0, pointSec, rangeSec, spSec;
+
+        PF_Init();
+        PF_ResetStats();
+        int amFd = open_file(indexfname, m);
+
+        /* point queries */
+        pointFound[m] = 0;
+        t0 = now_sec();
+        for (int i = 0; i < NPOINT; i++)
+            pointFound[m] += run_scan(amFd, EQUAL, keys[rand_r(&seed) % nkeys]);
+        pointSec = now_sec() - t0;
+
+        /* range scans to the end of the index */
+        rangeFound[m] = 0;
+        t0 = now_sec();
+        for (int i = 0; i < NRANGE; i++)
+            rangeFound[m] += run_scan(amFd, GREATER_THAN_EQUAL,
+                                      keys[rand_r(&seed) % nkeys]);
+        rangeSec = now_sec() - t0;
+        if (PF_CloseFile(amFd) != PFE_OK) { PF_PrintError("PF_CloseFile"); return 1; }
+
+        /* scan of the records */
+        spRecords[m] = 0;
+        t0 = now_sec();
+        spfd = m ? SP_OpenFileMapped(spfile) : SP_OpenFile(spfile);
+        if (spfd < 0) { PF_PrintError("SP_OpenFile"); return 1; }
+        SP_ScanInit(&scan, spfd);
+        while (SP_ScanNext(&scan, &rec, &rlen, &rid) == 0) {
+            spRecords[m]++;
+            free(rec);
+        }
+        SP_ScanClose(&scan);
+        if (SP_CloseFile(spfd) != PFE_OK) { PF_PrintError("SP_CloseFile"); return 1; }
+        spSec = now_sec() - t0;
+
+        PF_CollectStats();
+        printf("%-8s | %d point queries %.4f s (found %ld) | %d range scans"
+               " %.4f s (found %ld) | sp scan %.4f s (%ld records)"
+               " | L=%lu R=%lu mapped=%lu\n",
+               modes[m], NPOINT, pointSec, pointFound[m], NRANGE, rangeSec,
+               rangeFound[m], spSec, spRecords[m],
+               PFbufferPool.logicalPageRequests, PFbufferPool.physicalReads,
+               PFbufferPool.mappedPageRequests);
+        fprintf(csv, "%d,%s,%d,%ld,%.6f,%d,%ld,%.6f,%ld,%.6f,%lu,%lu,%lu\n",
+                indexNo, modes[m], NPOINT, pointFound[m], pointSec, NRANGE,
+                rangeFound[m], rangeSec, spRecords[m], spSec,
+                PFbufferPool.logicalPageRequests, PFbufferPool.physicalReads,
+                PFbufferPool.mappedPageRequests);
+    }
+    fclose(csv);
+    free(keys);
+
+    if (pointFound[0] != pointFound[1] || rangeFound[0] != rangeFound[1] ||
+        spRecords[0] != spRecords[1]) {
+        printf("buffered and mapped results differ\n");
+        return 1;
+    }
+    printf("Results written to %s\n", OUTCSV);
+    return 0;
+}
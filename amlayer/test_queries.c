@@ -9,6 +9,8 @@
  *   ./test_queries 3 range 900000 960000
  *
  * Outputs am_query_results.csv
+ * With PF_TRACE=tracefile set, its page accesses are traced for
+ * ../pflayer/pf_simulate.
  */
 
 #include "am.h"
@@ -25,6 +27,11 @@ int main(int argc, char **argv) {
 
     printf("=== Query test on student.%d (%s) ===\n", indexNo, qtype);
 
+    /* PF_TRACE=file traces the page accesses, for pf_simulate */
+    if (getenv("PF_TRACE") != NULL &&
+        PF_StartTrace(getenv("PF_TRACE"), 0) != PFE_OK)
+        PF_PrintError("PF_StartTrace");
+
     /* open index PF file */
     char indexfname[128];
     sprintf(indexfname, "student.%d", indexNo);
@@ -37,6 +44,7 @@ int main(int argc, char **argv) {
         int key = (argc > 3) ? atoi(argv[3]) : 95302001;
         memcpy(valbuf, &key, 4);
         clock_t tstart = clock();
+        PF_CollectStats();
         unsigned long beforeLogical = PFbufferPool.logicalPageRequests;
         unsigned long beforePhysReads = PFbufferPool.physicalReads;
         unsigned long beforePhysWrites = PFbufferPool.physicalWrites;
@@ -53,6 +61,7 @@ int main(int argc, char **argv) {
 
         clock_t tend = clock();
         double seconds = (double)(tend - tstart) / CLOCKS_PER_SEC;
+        PF_CollectStats();
         unsigned long logicalDiff = PFbufferPool.logicalPageRequests - beforeLogical;
         unsigned long physReadsDiff = PFbufferPool.physicalReads - beforePhysReads;
         unsigned long physWritesDiff = PFbufferPool.physicalWrites - beforePhysWrites;
@@ -75,6 +84,7 @@ int main(int argc, char **argv) {
         memcpy(valbuf, &low, 4);
 
         clock_t tstart = clock();
+        PF_CollectStats();
         unsigned long beforeLogical = PFbufferPool.logicalPageRequests;
         unsigned long beforePhysReads = PFbufferPool.physicalReads;
         unsigned long beforePhysWrites = PFbufferPool.physicalWrites;
@@ -96,6 +106,7 @@ int main(int argc, char **argv) {
 
         clock_t tend = clock();
         double seconds = (double)(tend - tstart) / CLOCKS_PER_SEC;
+        PF_CollectStats();
         unsigned long logicalDiff = PFbufferPool.logicalPageRequests - beforeLogical;
         unsigned long physReadsDiff = PFbufferPool.physicalReads - beforePhysReads;
         unsigned long physWritesDiff = PFbufferPool.physicalWrites - beforePhysWrites;
@@ -1,81 +1,601 @@
 /* buf.c: buffer management routines. The interface routines are:
-PFbufGet(), PFbufUnfix(), PFbufAlloc(), PFbufReleaseFile(), PFbufUsed() and
-PFbufPrint() */
+PFbufGet(), PFbufPrefetch(), PFbufUnfix(), PFbufAlloc(),
+PFbufReleaseFile(), PFbufUsed(), PFbufDrop(), PFbufStartWriter(),
+PFbufStopWriter() and PFbufPrint(). LRU, MRU and CLOCK replacement
+live here; the policies with queues of their own are in repl.c
+
+The pool is split into partitions (see pftypes.h). The interface
+routines find the partition of a page, take its latch and work inside
+it; the internal routines are given the partition and expect its latch
+to be held.
+
+Under CLOCK a hit needs no latch: PFbufGet() finds the page with
+PFhashPeek(), fixes it by adding one to its fix count atomically and
+then checks that the page is still the one it asked for, and
+PFbufUnfix() sets the reference bit and takes the fix away the same
+way. A page is paged out only after PF_FIX_EVICTING has been put into
+its fix count in place of 0, which tells a latch-free fix that came
+too late to back off and take the latch. Buffer page descriptors are
+never freed while the pool is in use, so a stale pointer from
+PFhashPeek() is always safe to look at. The other policies reorder
+their lists on every use, so they always take the latch.
+
+The background writer, started by PFbufStartWriter(), keeps a share of
+each partition clean. It fixes dirty pages near the cold end under the
+partition latch, writes them without it, and unfixes them. Its fix
+does not count as a use: a page it holds is unfixed, as far as the
+replacement policy is concerned, once its users have let go. The
+writer holds PFwriterlatch while it works, so setting the pool up,
+resizing it and releasing a file, which also take it, never find a
+page the writer has fixed.
+
+No I/O is done under a partition latch. A miss of PFbufGet() puts a
+frame for the page in the page table, marked "reading" and fixed, lets
+the latch go for the read and takes it again to finish; a dirty victim
+is written the same way, closed to fixes, its neighbours in the run
+pinned like the writer's. PFbufPrefetch() gives each page a frame the
+same way, hands the read to io.c and returns. PFbufReadDone() brings
+the pages in when the read is over. A fix of a page still being read
+waits for it on the partition's "iodone". */
+#include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 #include "pf.h"
 #include "pftypes.h"
 
-static int PFnumbpage = 0;	/* # of buffer pages in memory */
-static PFbpage *PFfirstbpage= NULL;	/* ptr to first buffer page, or NULL */
-static PFbpage *PFlastbpage = NULL;	/* ptr to last buffer page, or NULL */
-static PFbpage *PFfreebpage= NULL;	/* list of free buffer pages */
+/* the only partitions, one per size class, until PFbufInitPool() is
+called */
+#define PF_DEFAULT_PART(c) {                                                  \
+    .latch = PTHREAD_MUTEX_INITIALIZER,                                       \
+    .iodone = PTHREAD_COND_INITIALIZER,                                       \
+    .sizeclass = (c),                                                         \
+    .framesize = PF_MIN_PAGE_SIZE << (c),                                     \
+    .poolsize = PF_MAX_BUFS,                                                  \
+}
+static PFpart PFdefaultparts[PF_SIZE_CLASSES] = {
+    PF_DEFAULT_PART(0), PF_DEFAULT_PART(1), PF_DEFAULT_PART(2),
+    PF_DEFAULT_PART(3), PF_DEFAULT_PART(4),
+};
+static PFpart *PFparts = PFdefaultparts; /* partitions of the pool: those
+					of size class 0, then those of
+					class 1, and so on */
+static int PFnumparts = 1;		/* # of partitions per size class */
+static int PFallparts = PF_SIZE_CLASSES; /* # of partitions in all */
+static unsigned char PFfileclass[PF_FTAB_MAX]; /* size class of the
+					pages of each open file */
+static PFbfile *PFbfilechunk[PF_FTAB_CHUNKS]; /* pages and statistics
+					of each open file, in chunks laid
+					out as the open file table */
+
+/* the entry of file "fd" in PFbfilechunk */
+#define PFbfileOf(fd) \
+	(&PFbfilechunk[(fd) / PF_FTAB_CHUNK][(fd) % PF_FTAB_CHUNK])
+
+static pthread_mutex_t PFarenalatch = PTHREAD_MUTEX_INITIALIZER;
+					/* guards the four below */
+static PFbpage *PFretiredbpage[PF_SIZE_CLASSES]; /* pages taken out of
+					the pool by a shrink, kept for the
+					next grow, per size class */
+static PFarena *PFarenalist[PF_SIZE_CLASSES]; /* chunks of the frame
+					arena, per size class */
+static PFarena *PFdeadarenas = NULL;	/* unmapped chunks, whose page
+					descriptors are kept until the pool
+					is set up again */
+static int PFpoolused = 0;		/* # of pages in all partitions, of
+					every size class; never more than
+					PFbufferPool.poolSize once a resize
+					is over */
+
+static pthread_mutex_t PFwriterlatch = PTHREAD_MUTEX_INITIALIZER;
+					/* held by the background writer
+					while it works; guards the below */
+static pthread_cond_t PFwritercond = PTHREAD_COND_INITIALIZER;
+					/* wakes the writer up */
+static pthread_t PFwriterthread;	/* the background writer */
+static int PFwriteron = FALSE;		/* TRUE while the writer runs */
+static int PFwriterlow;			/* % of a partition that must be
+					clean, or the writer cleans it */
+static int PFwriterhigh;		/* % the writer cleans it up to */
+static int (*PFwriterfcn)(int, int, PFfpage **, int); /* writes its pages */
+
+/* count an event in the statistics of partition "part" */
+#define PFpartCount(part, ctr) \
+	__atomic_fetch_add(&(part)->ctr, 1, __ATOMIC_RELAXED)
+
+/* count "n" events in the statistics of file "fd" */
+#define PFfileCount(fd, ctr, n) \
+	__atomic_fetch_add(&PFbfileOf(fd)->ctr, (n), __ATOMIC_RELAXED)
+
+/* The partition of page "page" of file "fd": one of those of the size
+class of the file, picked from the high half of the hash, as the page
+tables index by the low bits. */
+#define PFpartOf(fd, page) \
+	(&PFparts[PFfileclass[fd] * PFnumparts + \
+		  (((PFhash(fd, page) >> 32) * PFnumparts) >> 32)])
+
+/* # of pages partition "i" of "n" may hold when the pool holds "size" */
+#define PFpartShare(size, i, n) ((size) / (n) + ((i) < (size) % (n)))
+
+/* # of pages of partition "part" that make up "pct" percent of it */
+#define PFpartPct(part, pct) (((part)->poolsize * (pct) + 99) / 100)
 
-void PFbufInitPool(int poolSize)
-{
-    /* Reset static vars inside buf.c */
-    PFnumbpage = 0;
-    PFfirstbpage = NULL;
-    PFlastbpage = NULL;
-    PFfreebpage = NULL;
+/****************************************************************************
+SPECIFICATIONS:
+	Wake the background writer up, if it runs, to see whether a
+	partition needs cleaning before its next pass is due.
+*****************************************************************************/
+static void PFwriterWake(void) {
+  if (PFatomicLoad(PFwriteron))
+    pthread_cond_signal(&PFwritercond);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Map "len" bytes of zeroed memory for page frames. Huge pages
+	are tried first: MAP_HUGETLB if the system has reserved any,
+	else a region aligned on a huge page boundary and marked with
+	MADV_HUGEPAGE so transparent huge pages can back it. Falls back
+	silently to ordinary pages.
 
-    /* Create poolSize PFbpage nodes in the free list */
-    for (int i = 0; i < poolSize; i++) {
-        PFbpage *p = (PFbpage *) malloc(sizeof(PFbpage));
+RETURN VALUE:
+	Address of the memory, aligned on at least PF_FRAME_ALIGN, or
+	NULL if no memory. *maplen is set to the # of bytes mapped and
+	*hugetlb to TRUE if MAP_HUGETLB was used.
+*****************************************************************************/
+static char *PFarenaMap(size_t len, size_t *maplen, short *hugetlb) {
+  char *mem;
+  size_t lead;
+
+  *hugetlb = FALSE;
+  if (len < PF_HUGE_PAGE_SIZE) {
+    /* too small to bother with huge pages */
+    mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+    *maplen = len;
+    return ((mem == MAP_FAILED) ? NULL : mem);
+  }
 
-        p->nextpage = PFfreebpage;
-        p->prevpage = NULL;
-        p->dirty = 0;
-        p->fixed = 0;
-        p->fd = -1;
-        p->page = -1;
+  /* round up to whole huge pages */
+  len = (len + PF_HUGE_PAGE_SIZE - 1) & ~((size_t)PF_HUGE_PAGE_SIZE - 1);
+  *maplen = len;
 
-        PFfreebpage = p;
+#ifdef MAP_HUGETLB
+  mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (mem != MAP_FAILED) {
+    *hugetlb = TRUE;
+    return (mem);
+  }
+#endif
+
+  /* over-map by one huge page, then trim to an aligned region */
+  mem = mmap(NULL, len + PF_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return (NULL);
+  lead = (PF_HUGE_PAGE_SIZE - ((uintptr_t)mem & (PF_HUGE_PAGE_SIZE - 1))) &
+         (PF_HUGE_PAGE_SIZE - 1);
+  if (lead > 0)
+    munmap(mem, lead);
+  munmap(mem + lead + len, PF_HUGE_PAGE_SIZE - lead);
+  mem += lead;
+#ifdef MADV_HUGEPAGE
+  madvise(mem, len, MADV_HUGEPAGE);
+#endif
+  return (mem);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Add a chunk of "nframes" page frames of size class "sizeclass"
+	to the head of the arena list of the class. Its pages are not
+	yet in the pool. The caller holds PFarenalatch.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_NOMEM	if no memory.
+
+GLOBAL VARIABLES MODIFIED:
+	PFarenalist
+*****************************************************************************/
+static int PFarenaGrow(int sizeclass, int nframes) {
+  PFarena *arena;
+  PFbpage *bpage;
+  size_t framesize = (size_t)PF_MIN_PAGE_SIZE << sizeclass;
+  int i;
+
+  if ((arena = (PFarena *)malloc(sizeof(PFarena))) == NULL)
+    goto nomem;
+  if ((arena->bpages = (PFbpage *)calloc(nframes, sizeof(PFbpage))) == NULL) {
+    free((char *)arena);
+    goto nomem;
+  }
+  if ((arena->frames = PFarenaMap((size_t)nframes * framesize,
+                                  &arena->maplen, &arena->hugetlb)) == NULL) {
+    free((char *)arena->bpages);
+    free((char *)arena);
+    goto nomem;
+  }
+  arena->nframes = nframes;
+  arena->nretired = 0;
+  arena->next = PFarenalist[sizeclass];
+  PFarenalist[sizeclass] = arena;
+
+  for (i = 0; i < nframes; i++) {
+    bpage = &arena->bpages[i];
+    bpage->arena = arena;
+    bpage->fd = -1;
+    bpage->fpage.pagebuf = arena->frames + (size_t)i * framesize;
+  }
+  return (PFE_OK);
+
+nomem:
+  PFerrno = PFE_NOMEM;
+  return (PFerrno);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Unmap every chunk of the arena whose pages have all been taken
+	out of the pool, dropping those pages from the retired list.
+	The page descriptors of the chunk stay, on PFdeadarenas.
+
+GLOBAL VARIABLES MODIFIED:
+	PFarenalist, PFretiredbpage, PFdeadarenas
+*****************************************************************************/
+static void PFarenaRelease() {
+  PFarena **parena;
+  PFarena *arena;
+  PFbpage **pbpage;
+  int c;
+
+  pthread_mutex_lock(&PFarenalatch);
+  for (c = 0; c < PF_SIZE_CLASSES; c++) {
+    /* forget the retired pages of the chunks about to go */
+    for (pbpage = &PFretiredbpage[c]; *pbpage != NULL;) {
+      if ((*pbpage)->arena->nretired == (*pbpage)->arena->nframes)
+        *pbpage = (*pbpage)->nextpage;
+      else
+        pbpage = &(*pbpage)->nextpage;
+    }
+
+    for (parena = &PFarenalist[c]; (arena = *parena) != NULL;) {
+      if (arena->nretired == arena->nframes) {
+        *parena = arena->next;
+        munmap(arena->frames, arena->maplen);
+        arena->frames = NULL;
+        arena->next = PFdeadarenas;
+        PFdeadarenas = arena;
+      } else
+        parena = &arena->next;
     }
+  }
+  pthread_mutex_unlock(&PFarenalatch);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Make the frame table of partition "part" big enough for "n"
+	pages.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_NOMEM	if no memory.
+*****************************************************************************/
+static int PFframetblReserve(PFpart *part, int n) {
+  PFbpage **tbl;
+  int size;
+
+  if (n <= part->frametblsize)
+    return (PFE_OK);
+  for (size = (part->frametblsize > 0) ? part->frametblsize : PF_MAX_BUFS;
+       size < n; size *= 2)
+    ;
+  if ((tbl = (PFbpage **)realloc((char *)part->frametbl,
+                                 size * sizeof(PFbpage *))) == NULL) {
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  part->frametbl = tbl;
+  part->frametblsize = size;
+  return (PFE_OK);
 }
+
 /****************************************************************************
 SPECIFICATIONS:
-	Insert the buffer page pointed by "bpage" into the free list.
+	Put the unused page "bpage" into partition "part": link it
+	into the free list and give it the next slot of the frame table.
+*****************************************************************************/
+static void PFbufAddFrame(PFpart *part, PFbpage *bpage) {
+  bpage->frameno = part->numbpage;
+  bpage->priority = PF_HINT_NORMAL;
+  bpage->lownext = bpage->lowprev = NULL;
+  part->frametbl[part->numbpage++] = bpage;
+  bpage->nextpage = part->freebpage;
+  part->freebpage = bpage;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Bring up to "n" more pages into partition "part" and put them on
+	its free list, reusing pages of its size class retired by an
+	earlier shrink before mapping a new chunk for the rest. The
+	size classes share the pool, so fewer pages, or none, are
+	brought in if the others hold the rest of it.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_NOMEM	if no memory.
+
+GLOBAL VARIABLES MODIFIED:
+	PFretiredbpage, PFarenalist, PFpoolused
+*****************************************************************************/
+static int PFbufAddPages(PFpart *part, int n) {
+  PFbpage *bpage;
+  int error;
+  int i;
+
+  if ((error = PFframetblReserve(part, part->numbpage + n)) != PFE_OK)
+    return (error);
+
+  pthread_mutex_lock(&PFarenalatch);
+  if (n > PFbufferPool.poolSize - PFpoolused)
+    n = PFbufferPool.poolSize - PFpoolused;
+  if (n <= 0) {
+    pthread_mutex_unlock(&PFarenalatch);
+    return (PFE_OK);
+  }
+  __atomic_fetch_add(&PFpoolused, n, __ATOMIC_RELAXED);
+  for (; n > 0 && (bpage = PFretiredbpage[part->sizeclass]) != NULL; n--) {
+    PFretiredbpage[part->sizeclass] = bpage->nextpage;
+    bpage->arena->nretired--;
+    PFbufAddFrame(part, bpage);
+  }
+  if (n > 0) {
+    if ((error = PFarenaGrow(part->sizeclass, n)) != PFE_OK) {
+      __atomic_fetch_sub(&PFpoolused, n, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&PFarenalatch);
+      return (error);
+    }
+    for (i = 0; i < n; i++)
+      PFbufAddFrame(part, &PFarenalist[part->sizeclass]->bpages[i]);
+  }
+  pthread_mutex_unlock(&PFarenalatch);
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Take the unused buffer page "bpage" out of partition "part".
+	Its memory is given back to the system, and the page is kept on
+	the retired list until a grow reuses it or its whole chunk
+	is unmapped.
+
+GLOBAL VARIABLES MODIFIED:
+	PFretiredbpage, PFpoolused
+*****************************************************************************/
+static void PFbufRetire(PFpart *part, PFbpage *bpage) {
+  /* move the last page of the frame table into the hole */
+  part->frametbl[bpage->frameno] = part->frametbl[--part->numbpage];
+  part->frametbl[bpage->frameno]->frameno = bpage->frameno;
+
+  if (!bpage->arena->hugetlb)
+    madvise(bpage->fpage.pagebuf, part->framesize, MADV_DONTNEED);
+  pthread_mutex_lock(&PFarenalatch);
+  bpage->arena->nretired++;
+  bpage->nextpage = PFretiredbpage[part->sizeclass];
+  PFretiredbpage[part->sizeclass] = bpage;
+  __atomic_fetch_sub(&PFpoolused, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&PFarenalatch);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Count the pages partition "part" may still bring in from the
+	arena: up to its share of the pool, as long as the pages of
+	every size class together stay within the pool size. The caller
+	holds the partition latch.
+
+RETURN VALUE:
+	The count.
+*****************************************************************************/
+static int PFpartRoom(PFpart *part) {
+  int room = part->poolsize - part->numbpage;
+  int left = PFbufferPool.poolSize - PFatomicLoad(PFpoolused);
+
+  return ((left < room) ? ((left > 0) ? left : 0) : room);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Set partition "part" up, empty, to hold "poolSize" pages in
+	frames of size class "sizeclass".
+*****************************************************************************/
+static void PFpartInit(PFpart *part, int sizeclass, int poolSize) {
+  pthread_mutex_init(&part->latch, NULL);
+  pthread_cond_init(&part->iodone, NULL);
+  part->sizeclass = sizeclass;
+  part->framesize = PF_MIN_PAGE_SIZE << sizeclass;
+  part->poolsize = poolSize;
+  part->numbpage = 0;
+  part->firstbpage = NULL;
+  part->lastbpage = NULL;
+  part->freebpage = NULL;
+  part->frametbl = NULL;
+  part->frametblsize = 0;
+  part->clockhand = 0;
+  memset(&part->hash, 0, sizeof(part->hash));
+  part->repl = NULL;
+  part->nreading = 0;
+  part->nlow = part->nhigh = 0;
+  part->lowfirst = part->lowlast = NULL;
+  part->logicalPageRequests = 0;
+  part->logicalPageMisses = 0;
+  part->physicalReads = 0;
+  part->physicalWrites = 0;
+  part->pageAllocations = 0;
+  part->evictions = 0;
+  part->dirtyEvictions = 0;
+  part->writerWrites = 0;
+  part->writeCalls = 0;
+  part->readCalls = 0;
+  part->readAheadPages = 0;
+  part->ioWaits = 0;
+
+  /* size the page table and policy state for the partition */
+  PFhashInit(&part->hash, poolSize);
+  PFreplInit(part, poolSize);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Give back everything partition "part" has allocated, except
+	its pages, which belong to the arena.
+*****************************************************************************/
+static void PFpartFree(PFpart *part) {
+  free((char *)part->frametbl);
+  part->frametbl = NULL;
+  PFhashFree(&part->hash);
+  PFreplFree(part);
+  pthread_cond_destroy(&part->iodone);
+  pthread_mutex_destroy(&part->latch);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Drop every buffer page and set the pool up to hold exactly
+	"poolSize" pages, of every size class together, split into
+	"numParts" partitions per class (no more than one per page).
+	A partition may take up to its share of "poolSize" while the
+	pool has room, and pages move from one class to another as they
+	are needed (see PFpoolSteal()). The frame arena is mapped when
+	the first page is needed, so a class no file uses takes no
+	memory. Must be called before any file is opened, and
+	while no other thread uses the PF layer: the contents of pages
+	still in the buffer are discarded. The background writer, if
+	running, keeps running over the new pool.
+
+RETURN VALUE: none
+
+GLOBAL VARIABLES MODIFIED:
+	PFparts, PFnumparts, PFallparts, PFretiredbpage, PFarenalist,
+	PFdeadarenas, PFpoolused, PFbufferPool, PFbfilechunk
+*****************************************************************************/
+void PFbufInitPool(int poolSize, int numParts)
+{
+    PFbpage *bpage;
+    PFarena *arena;
+    void *mem;
+    int c, i;
+
+    /* no read may be filling a frame, and the writer must not be
+    in the middle of a pass */
+    PFioDrain();
+    pthread_mutex_lock(&PFwriterlatch);
+
+    /* Release whatever a previous pool left behind; the files
+    still open have no pages in the buffer any more */
+    for (i = 0; i < PFallparts; i++) {
+        for (bpage = PFparts[i].firstbpage; bpage != NULL;
+             bpage = bpage->nextpage)
+            if (bpage->fd >= 0) {
+                PFbfileOf(bpage->fd)->first = NULL;
+                PFbfileOf(bpage->fd)->npages = 0;
+            }
+        PFpartFree(&PFparts[i]);
+    }
+    if (PFparts != PFdefaultparts)
+        free((char *)PFparts);
+    for (c = 0; c < PF_SIZE_CLASSES; c++) {
+        while ((arena = PFarenalist[c]) != NULL) {
+            PFarenalist[c] = arena->next;
+            munmap(arena->frames, arena->maplen);
+            free((char *)arena->bpages);
+            free((char *)arena);
+        }
+        PFretiredbpage[c] = NULL;
+    }
+    while ((arena = PFdeadarenas) != NULL) {
+        PFdeadarenas = arena->next;
+        free((char *)arena->bpages);
+        free((char *)arena);
+    }
+    PFpoolused = 0;
+
+    /* every partition must be able to hold a page */
+    if (numParts > poolSize)
+        numParts = poolSize;
+    if (numParts < 1)
+        numParts = 1;
+
+    /* one partition per class needs no allocation */
+    if (numParts == 1)
+        PFparts = PFdefaultparts;
+    else if (posix_memalign(&mem, PF_CACHE_LINE,
+                            PF_SIZE_CLASSES * numParts * sizeof(PFpart)) == 0)
+        PFparts = (PFpart *)mem;
+    else {
+        printf("Internal error:PFbufInitPool()\n");
+        exit(1);
+    }
+    PFnumparts = numParts;
+    PFallparts = PF_SIZE_CLASSES * numParts;
+    for (c = 0; c < PF_SIZE_CLASSES; c++)
+        for (i = 0; i < numParts; i++)
+            PFpartInit(&PFparts[c * numParts + i], c,
+                       PFpartShare(poolSize, i, numParts));
+
+    PFbufferPool.poolSize = poolSize;
+    PFbufferPool.numPartitions = numParts;
+    pthread_mutex_unlock(&PFwriterlatch);
+}
+/****************************************************************************
+SPECIFICATIONS:
+	Insert the buffer page pointed by "bpage" into the free list
+	of partition "part".
 
 AUTHOR: clc
 *****************************************************************************/
-static void PFbufInsertFree(PFbpage *bpage) {
-  bpage->nextpage = PFfreebpage;
-  PFfreebpage = bpage;
+static void PFbufInsertFree(PFpart *part, PFbpage *bpage) {
+  bpage->nextpage = part->freebpage;
+  part->freebpage = bpage;
 }
 
 /****************************************************************************
 SPECIFICATIONS:
 
 	Link the buffer page pointed by "bpage" as the head
-	of the used buffer list. No other field of bpage is modified.
+	of the used buffer list of partition "part". No other field
+	of bpage is modified.
 
 AUTHOR: clc
 
 RETURN VALUE:
 	none.
-
-GLOBAL VARIABLES MODIFIED:
-	PFfirstbpage, PFlastbpage.
-
 *****************************************************************************/
 static void
-PFbufLinkHead(PFbpage *bpage /* pointer to buffer page to be linked */
+PFbufLinkHead(PFpart *part,  /* partition of the page */
+              PFbpage *bpage /* pointer to buffer page to be linked */
 ) {
 
-  bpage->nextpage = PFfirstbpage;
+  bpage->nextpage = part->firstbpage;
   bpage->prevpage = NULL;
-  if (PFfirstbpage != NULL)
-    PFfirstbpage->prevpage = bpage;
-  PFfirstbpage = bpage;
-  if (PFlastbpage == NULL)
-    PFlastbpage = bpage;
+  if (part->firstbpage != NULL)
+    part->firstbpage->prevpage = bpage;
+  part->firstbpage = bpage;
+  if (part->lastbpage == NULL)
+    part->lastbpage = bpage;
 }
 
 /****************************************************************************
 SPECIFICATIONS:
-	Unlink the page pointed by bpage from the buffer list. Assume
+	Unlink the page pointed by bpage from the buffer list of
+	partition "part". Assume
 	that bpage is a valid pointer.  Set the "prevpage" and "nextpage"
 	fields to NULL. The caller is responsible to either place
 	the unlinked page into the free list, or insert it back
@@ -85,19 +605,17 @@ AUTHOR: clc
 
 RETURN VALUE:
 	none
-
-GLOBAL VARIABLES MODIFIED:
-	PFfirstbpage,PFlastbpage.
 *****************************************************************************/
-void PFbufUnlink(
+static void PFbufUnlink(
+    PFpart *part,  /* partition of the page */
     PFbpage *bpage /* buffer page to be unlinked from the used list */
 ) {
 
-  if (PFfirstbpage == bpage)
-    PFfirstbpage = bpage->nextpage;
+  if (part->firstbpage == bpage)
+    part->firstbpage = bpage->nextpage;
 
-  if (PFlastbpage == bpage)
-    PFlastbpage = bpage->prevpage;
+  if (part->lastbpage == bpage)
+    part->lastbpage = bpage->prevpage;
 
   if (bpage->nextpage != NULL)
     bpage->nextpage->prevpage = bpage->prevpage;
@@ -110,16 +628,595 @@ void PFbufUnlink(
 
 /****************************************************************************
 SPECIFICATIONS:
-	Allocate a buffer page and set *bpage to point to it. *bpage
-	is set to NULL if one can not be allocated.
+	Put the buffer page "bpage", just entered in the page table of
+	its partition for file "fd", on the list of the file's pages.
+	The partition latch is held.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFbufFileLink(int fd, PFbpage *bpage) {
+  PFbfile *file = PFbfileOf(fd);
+
+  pthread_spin_lock(&file->latch);
+  bpage->fprev = NULL;
+  bpage->fnext = file->first;
+  if (file->first != NULL)
+    file->first->fprev = bpage;
+  file->first = bpage;
+  file->npages++;
+  pthread_spin_unlock(&file->latch);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Take the buffer page "bpage", just taken out of the page table
+	of its partition, off the list of the pages of file "fd". The
+	partition latch is held.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFbufFileUnlink(int fd, PFbpage *bpage) {
+  PFbfile *file = PFbfileOf(fd);
+
+  pthread_spin_lock(&file->latch);
+  if (bpage->fprev != NULL)
+    bpage->fprev->fnext = bpage->fnext;
+  else
+    file->first = bpage->fnext;
+  if (bpage->fnext != NULL)
+    bpage->fnext->fprev = bpage->fprev;
+  bpage->fprev = bpage->fnext = NULL;
+  file->npages--;
+  pthread_spin_unlock(&file->latch);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Note that the buffer page "bpage" of partition "part" has just
+	been used. Under CLOCK this only sets its reference bit; under
+	LRU and MRU the page is moved to the head of the used list. The
+	policies in repl.c have seen the use already when the page was
+	fixed.
+*****************************************************************************/
+static void PFbufTouch(PFpart *part, PFbpage *bpage) {
+  switch (PFbufferPool.replacement) {
+  case PF_REPLACEMENT_CLOCK:
+    PFatomicStore(bpage->refbit, TRUE);
+    break;
+  case PF_REPLACEMENT_LRU:
+  case PF_REPLACEMENT_MRU:
+    PFbufUnlink(part, bpage);
+    PFbufLinkHead(part, bpage);
+    break;
+  }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Sweep the CLOCK hand over the frame table of partition "part"
+	to find a victim.
+	A page whose reference bit is set gets a second chance: the
+	bit is cleared and the hand moves on. Fixed pages, and pages
+	closed by PFbufFlushFile() while it writes them, are passed
+	over. Only called when the free list is empty, so every page
+	in the table is in use.
+
+RETURN VALUE:
+	The victim, or NULL if every page in the partition is fixed.
+*****************************************************************************/
+static PFbpage *PFbufClockVictim(PFpart *part) {
+  PFbpage *bpage;
+  int n;
+
+  /* two turns clear every reference bit, so a page must turn up
+  unless they are all fixed */
+  for (n = 2 * part->numbpage; n > 0; n--) {
+    if (part->clockhand >= part->numbpage)
+      part->clockhand = 0;
+    bpage = part->frametbl[part->clockhand++];
+    if (PFatomicLoad(bpage->fixcount) != 0)
+      continue;
+    if (!PFatomicLoad(bpage->refbit))
+      return (bpage);
+    PFatomicStore(bpage->refbit, FALSE);
+  }
+  return (NULL);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Choose the unfixed buffer page of partition "part" that the
+	replacement policy would page out next.
+
+RETURN VALUE:
+	The victim, or NULL if every page in the partition is fixed.
+*****************************************************************************/
+static PFbpage *PFbufPolicyVictim(PFpart *part) {
+  PFbpage *tbpage;
+
+  switch (PFbufferPool.replacement) {
+  case PF_REPLACEMENT_CLOCK:
+    return (PFbufClockVictim(part));
+  case PF_REPLACEMENT_2Q:
+  case PF_REPLACEMENT_LRU2:
+  case PF_REPLACEMENT_ARC:
+    return (PFreplVictim(part));
+  }
+
+  /* LRU = choose from tail (least-recently-used) */
+  if (PFbufferPool.replacement == PF_REPLACEMENT_LRU) {
+    for (tbpage = part->lastbpage; tbpage != NULL;
+         tbpage = tbpage->prevpage) {
+      if (tbpage->fixcount == 0)
+        break;
+    }
+  }
+
+  /* MRU = choose from head (most-recently-used) */
+  else {
+    for (tbpage = part->firstbpage; tbpage != NULL;
+         tbpage = tbpage->nextpage) {
+      if (tbpage->fixcount == 0)
+        break;
+    }
+  }
+  return (tbpage);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Walk the used pages of partition "part" in about the order the
+	replacement policy would page them out: give the page after
+	"bpage", or the first if "bpage" is NULL. CLOCK gives one turn
+	of the frame table from the hand. Fixed pages may be given.
+
+RETURN VALUE:
+	The page, or NULL if there are no more.
+*****************************************************************************/
+static PFbpage *PFbufNextCold(PFpart *part, PFbpage *bpage) {
+  int start, i;
+
+  switch (PFbufferPool.replacement) {
+  case PF_REPLACEMENT_LRU:
+    return ((bpage == NULL) ? part->lastbpage : bpage->prevpage);
+  case PF_REPLACEMENT_MRU:
+    return ((bpage == NULL) ? part->firstbpage : bpage->nextpage);
+  case PF_REPLACEMENT_CLOCK:
+    if (part->numbpage == 0)
+      return (NULL);
+    start = (part->clockhand < part->numbpage) ? part->clockhand : 0;
+    i = (bpage == NULL) ? start : (bpage->frameno + 1) % part->numbpage;
+    if (bpage != NULL && i == start)
+      return (NULL);
+    /* skip free pages */
+    while (part->frametbl[i]->fd == -1)
+      if ((i = (i + 1) % part->numbpage) == start)
+        return (NULL);
+    return (part->frametbl[i]);
+  }
+  return (PFreplNextCold(part, bpage));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Give the buffer page "bpage" of partition "part" the priority
+	"priority" (PF_HINT_...), count it, and keep it on the list of
+	low pages of the partition while it is PF_HINT_LOW, last when
+	it gets there. The caller holds the partition latch; the
+	counts are read without it by PFbufHint().
+*****************************************************************************/
+static void PFbufSetHint(PFpart *part, PFbpage *bpage, int priority) {
+  if (bpage->priority == priority)
+    return;
+  if (bpage->priority == PF_HINT_LOW) {
+    PFatomicStore(part->nlow, part->nlow - 1);
+    if (bpage->lowprev != NULL)
+      bpage->lowprev->lownext = bpage->lownext;
+    else
+      part->lowfirst = bpage->lownext;
+    if (bpage->lownext != NULL)
+      bpage->lownext->lowprev = bpage->lowprev;
+    else
+      part->lowlast = bpage->lowprev;
+    bpage->lownext = bpage->lowprev = NULL;
+  } else if (bpage->priority == PF_HINT_HIGH)
+    PFatomicStore(part->nhigh, part->nhigh - 1);
+  if (priority == PF_HINT_LOW) {
+    PFatomicStore(part->nlow, part->nlow + 1);
+    bpage->lowprev = part->lowlast;
+    if (part->lowlast != NULL)
+      part->lowlast->lownext = bpage;
+    else
+      part->lowfirst = bpage;
+    part->lowlast = bpage;
+  } else if (priority == PF_HINT_HIGH)
+    PFatomicStore(part->nhigh, part->nhigh + 1);
+  PFatomicStore(bpage->priority, (char)priority);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Choose the unfixed buffer page of partition "part" to page out
+	next: the policy's choice, unless pages of the partition are
+	hinted (see PFbufHint()) and it is not low. Then the unfixed
+	page hinted low longest ago is taken instead, or, in place of
+	a high page, the first unfixed normal page in the order the
+	policy would page them out (see PFbufNextCold()). Either search
+	looks at no more than PF_HINT_SCAN pages, so a miss costs no
+	more with hints than without; if it finds none, the policy's
+	choice goes.
+
+RETURN VALUE:
+	The victim, or NULL if every page in the partition is fixed.
+*****************************************************************************/
+static PFbpage *PFbufVictim(PFpart *part) {
+  PFbpage *victim, *bpage;
+  int n;
+
+  if ((victim = PFbufPolicyVictim(part)) == NULL ||
+      victim->priority == PF_HINT_LOW ||
+      (part->nlow == 0 && victim->priority == PF_HINT_NORMAL))
+    return (victim);
+
+  for (bpage = part->lowfirst, n = 0; bpage != NULL && n < PF_HINT_SCAN;
+       bpage = bpage->lownext, n++)
+    if (PFatomicLoad(bpage->fixcount) == 0 && bpage->fd >= 0)
+      return (bpage);
+
+  if (victim->priority == PF_HINT_HIGH)
+    for (bpage = PFbufNextCold(part, NULL), n = 0;
+         bpage != NULL && n < PF_HINT_SCAN;
+         bpage = PFbufNextCold(part, bpage), n++)
+      if (PFatomicLoad(bpage->fixcount) == 0 && bpage->fd >= 0 &&
+          bpage->priority == PF_HINT_NORMAL)
+        return (bpage);
+  return (victim);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Close the unfixed buffer page "bpage" to latch-free fixes, so
+	that it can be paged out. A fix that got in first keeps the
+	page.
+
+RETURN VALUE:
+	TRUE	if the page is closed.
+	FALSE	if somebody has fixed it.
+*****************************************************************************/
+static int PFbufClose(PFbpage *bpage) {
+  int unfixed = 0;
+
+  return (__atomic_compare_exchange_n(&bpage->fixcount, &unfixed,
+                                      PF_FIX_EVICTING, FALSE,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Mark the buffer page "bpage", closed by PFbufClose(), free, and
+	open it again. A latch-free fix that finds it from now on sees
+	that it does not hold its page.
+*****************************************************************************/
+static void PFbufReopen(PFbpage *bpage) {
+  PFatomicStore(bpage->fd, -1);
+  __atomic_fetch_sub(&bpage->fixcount, PF_FIX_EVICTING, __ATOMIC_RELEASE);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Order buffer pages by file, then by page number (for qsort()).
+*****************************************************************************/
+static int PFbufCmpPage(const void *a, const void *b) {
+  const PFbpage *x = *(PFbpage *const *)a;
+  const PFbpage *y = *(PFbpage *const *)b;
+
+  if (x->fd != y->fd)
+    return ((x->fd < y->fd) ? -1 : 1);
+  return ((x->page < y->page) ? -1 : (x->page > y->page));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write the "n" buffer pages pages[], sorted by PFbufCmpPage(),
+	with writefcn(): each run of consecutive pages of a file, up to
+	PF_WRITE_RUN long, goes out in one call. The writes are counted
+	in partition "part", or if it is NULL in the partition of each
+	page, a call in that of its first page. The dirty flags are
+	left alone; the pages written are no longer fresh.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PF error code if a write fails. The runs after it are not
+	written.
+*****************************************************************************/
+static int PFbufWriteRuns(PFpart *part, PFbpage **pages, int n,
+                          int (*writefcn)(int, int, PFfpage **, int)) {
+  PFfpage *fpages[PF_WRITE_RUN];
+  int start, len, i;
+  int error;
+
+  for (start = 0; start < n; start += len) {
+    fpages[0] = &pages[start]->fpage;
+    for (len = 1; start + len < n && len < PF_WRITE_RUN &&
+                  pages[start + len]->fd == pages[start]->fd &&
+                  pages[start + len]->page == pages[start]->page + len;
+         len++)
+      fpages[len] = &pages[start + len]->fpage;
+
+    if (part != NULL) {
+      PFpartCount(part, writeCalls);
+      __atomic_fetch_add(&part->physicalWrites, len, __ATOMIC_RELAXED);
+    } else {
+      PFpartCount(PFpartOf(pages[start]->fd, pages[start]->page),
+                  writeCalls);
+      for (i = start; i < start + len; i++)
+        PFpartCount(PFpartOf(pages[i]->fd, pages[i]->page), physicalWrites);
+    }
+    PFfileCount(pages[start]->fd, writes, len);
+    if ((error = (*writefcn)(pages[start]->fd, pages[start]->page, fpages,
+                             len)) != PFE_OK)
+      return (error);
+    for (i = start; i < start + len; i++)
+      PFatomicStore(pages[i]->fresh, FALSE);
+  }
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Find page "page" of file "fd" for writing it out along with a
+	victim of partition "part", whose latch the caller holds. Its
+	partition is latched if it is another one and the latch can be
+	had without waiting; latched[] and *nlatched list the latches
+	taken so far, to be let go by the caller.
+
+RETURN VALUE:
+	The page, or NULL if it is not in the buffer, is fixed, is not
+	dirty or its partition is busy.
+*****************************************************************************/
+static PFbpage *PFbufNeighbour(PFpart *part, int fd, int page,
+                               PFpart **latched, int *nlatched) {
+  PFpart *npart;
+  PFbpage *bpage;
+  int i;
+
+  if (page < 0)
+    return (NULL);
+  if ((npart = PFpartOf(fd, page)) != part) {
+    for (i = 0; i < *nlatched && latched[i] != npart; i++)
+      ;
+    if (i == *nlatched) {
+      if (pthread_mutex_trylock(&npart->latch) != 0)
+        return (NULL);
+      latched[(*nlatched)++] = npart;
+    }
+  }
+  if ((bpage = PFhashFind(&npart->hash, fd, page)) == NULL ||
+      PFatomicLoad(bpage->fixcount) != 0 || !PFatomicLoad(bpage->dirty))
+    return (NULL);
+  return (bpage);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write out the dirty victim "bpage" of partition "part", closed
+	by PFbufClose(), together with the dirty, unfixed pages of its
+	file right before and after it, up to PF_EVICT_RUN pages in
+	one call. The neighbours stay in the buffer, clean.
+	If "unlatch" is TRUE the pages are written without the latch
+	of "part", which is taken again before returning: the
+	neighbours are held meanwhile as the background writer holds
+	a page (see PFpartClean()), and let go under their own latches,
+	which wakes up whoever waits on "iodone" for one of them.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PF error code if the write fails. Every page is left dirty.
+*****************************************************************************/
+static int PFbufEvictWrite(PFpart *part, PFbpage *bpage,
+                           int (*writefcn)(int, int, PFfpage **, int),
+                           int unlatch) {
+  PFbpage *run[PF_EVICT_RUN];
+  PFpart *latched[PF_EVICT_RUN];
+  PFbpage *nbpage;
+  PFpart *npart;
+  int nlatched = 0;
+  int first, n, i;
+  int error;
+
+  /* the victim goes in the middle; pages before it fill in
+  backwards, pages after it forwards */
+  first = PF_EVICT_RUN / 2;
+  run[first] = bpage;
+  n = 1;
+  while (first > 0 && n < PF_EVICT_RUN &&
+         (nbpage = PFbufNeighbour(part, bpage->fd, run[first]->page - 1,
+                                  latched, &nlatched)) != NULL) {
+    run[--first] = nbpage;
+    n++;
+  }
+  while (first + n < PF_EVICT_RUN &&
+         (nbpage = PFbufNeighbour(part, bpage->fd,
+                                  run[first + n - 1]->page + 1, latched,
+                                  &nlatched)) != NULL)
+    run[first + n++] = nbpage;
+
+  for (i = first; i < first + n; i++)
+    if (run[i] != bpage) {
+      PFatomicStore(run[i]->dirty, FALSE);
+      if (unlatch) {
+        PFatomicStore(run[i]->cleaning, TRUE);
+        __atomic_fetch_add(&run[i]->fixcount, 1, __ATOMIC_ACQUIRE);
+      }
+    }
+  if (unlatch) {
+    for (i = 0; i < nlatched; i++)
+      pthread_mutex_unlock(&latched[i]->latch);
+    nlatched = 0;
+    pthread_mutex_unlock(&part->latch);
+  }
+
+  if ((error = PFbufWriteRuns(part, &run[first], n, writefcn)) != PFE_OK)
+    for (i = first; i < first + n; i++)
+      PFatomicStore(run[i]->dirty, TRUE);
+
+  if (unlatch) {
+    /* let the neighbours in other partitions go one latch at a
+    time, then those in "part" */
+    for (i = first; i < first + n; i++)
+      if (run[i] != bpage &&
+          (npart = PFpartOf(run[i]->fd, run[i]->page)) != part) {
+        pthread_mutex_lock(&npart->latch);
+        __atomic_fetch_sub(&run[i]->fixcount, 1, __ATOMIC_RELEASE);
+        PFatomicStore(run[i]->cleaning, FALSE);
+        pthread_cond_broadcast(&npart->iodone);
+        pthread_mutex_unlock(&npart->latch);
+      }
+    pthread_mutex_lock(&part->latch);
+    for (i = first; i < first + n; i++)
+      if (run[i] != bpage && PFpartOf(run[i]->fd, run[i]->page) == part) {
+        __atomic_fetch_sub(&run[i]->fixcount, 1, __ATOMIC_RELEASE);
+        PFatomicStore(run[i]->cleaning, FALSE);
+      }
+  }
+  for (i = 0; i < nlatched; i++)
+    pthread_mutex_unlock(&latched[i]->latch);
+  return (error);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Page out the unfixed buffer page "bpage" of partition "part":
+	write it to the file if it is dirty, with its dirty neighbours
+	(see PFbufEvictWrite()), and wake the background writer up, if
+	it runs; remove it from the hash
+	table and unlink it from the used list. The caller either
+	reuses it or frees it. If "unlatch" is TRUE the latch of
+	"part" is let go while the pages are written; a fix of the
+	page waits for it meanwhile (see PFbufGet()), and is woken
+	up on "iodone" once it is gone.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_PAGEFIXED	if the page was fixed by a latch-free hit before
+		it could be closed. PFerrno is not set: the caller
+		just looks for another victim.
+	PFE_NOBUF	if the page is dirty and "writefcn" is NULL. The
+		page is left in the buffer; PFerrno is not set.
+	PF error code if the write fails, or the page is not in the
+	hash table. The page is then left in the buffer, open to fixes
+	again, and dirty if it was.
+*****************************************************************************/
+static int PFbufEvict(PFpart *part, PFbpage *bpage,
+                      int (*writefcn)(int, int, PFfpage **, int),
+                      int unlatch) {
+  int error;
+
+  if (!PFbufClose(bpage))
+    return (PFE_PAGEFIXED);
+
+  /* write out the dirty page; the writer fell behind */
+  if (bpage->dirty && writefcn == NULL) {
+    __atomic_fetch_sub(&bpage->fixcount, PF_FIX_EVICTING, __ATOMIC_RELEASE);
+    return (PFE_NOBUF);
+  }
+  if (bpage->dirty) {
+    PFpartCount(part, dirtyEvictions);
+    PFfileCount(bpage->fd, dirtyEvictions, 1);
+    PFwriterWake();
+    error = PFbufEvictWrite(part, bpage, writefcn, unlatch);
+    if (unlatch)
+      pthread_cond_broadcast(&part->iodone);
+    if (error != PFE_OK) {
+      __atomic_fetch_sub(&bpage->fixcount, PF_FIX_EVICTING, __ATOMIC_RELEASE);
+      return (error);
+    }
+  }
+  bpage->dirty = FALSE;
+
+  /* unlink from hash table */
+  if ((error = PFhashDelete(&part->hash, bpage->fd, bpage->page)) != PFE_OK) {
+    __atomic_fetch_sub(&bpage->fixcount, PF_FIX_EVICTING, __ATOMIC_RELEASE);
+    return (error);
+  }
+  PFbufFileUnlink(bpage->fd, bpage);
+  PFpartCount(part, evictions);
+  PFfileCount(bpage->fd, evictions, 1);
+
+  /* unlink from buffer list and policy queues */
+  PFbufUnlink(part, bpage);
+  PFbufSetHint(part, bpage, PF_HINT_NORMAL);
+  PFreplRemove(part, bpage, TRUE);
+  PFbufReopen(bpage);
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Make room in the pool for a page of partition "part", whose
+	share is not full but whose size class finds the rest of the
+	pool held by the others: retire a free page of another
+	partition or, failing that, an unfixed victim of one holding
+	more pages than "part". A dirty victim is only written, with
+	writefcn(), if "writefcn" is not NULL; otherwise only a clean
+	one is taken. A partition whose latch is taken is passed over
+	(it is tried, never waited for, so no latch order is needed).
+	The caller holds the latch of "part".
+
+RETURN VALUE:
+	TRUE	if a page was retired.
+	FALSE	if none could be.
+*****************************************************************************/
+static int PFpoolSteal(PFpart *part,
+                       int (*writefcn)(int, int, PFfpage **, int)) {
+  PFpart *other;
+  PFbpage *bpage;
+  int pass; /* 0 looks for free pages, 1 for victims */
+  int i;
+
+  for (pass = 0; pass < 2; pass++)
+    for (i = 0; i < PFallparts; i++) {
+      other = &PFparts[i];
+      if (other == part ||
+          (pass == 0 ? PFatomicLoad(other->freebpage) == NULL
+                     : PFatomicLoad(other->numbpage) <= part->numbpage + 1) ||
+          pthread_mutex_trylock(&other->latch) != 0)
+        continue;
+      bpage = NULL;
+      if (pass == 0 && (bpage = other->freebpage) != NULL)
+        other->freebpage = bpage->nextpage;
+      else if (pass == 1 && other->numbpage > part->numbpage + 1 &&
+               (bpage = PFbufVictim(other)) != NULL &&
+               PFbufEvict(other, bpage, writefcn, FALSE) != PFE_OK)
+        bpage = NULL;
+      if (bpage != NULL)
+        PFbufRetire(other, bpage);
+      pthread_mutex_unlock(&other->latch);
+      if (bpage != NULL)
+        return (TRUE);
+    }
+  return (FALSE);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Allocate a buffer page of partition "part" and set *bpage to
+	point to it. *bpage is set to NULL if one can not be allocated.
 	The "nextpage" and "prevpage" fields of *bpage are linked as
 	the head of the list of used buffers.All the other fields are undefined.
-	writefcn() is used to write pages. (See PFbufGet()).
+	writefcn() is used to write pages. (See PFbufGet()). If it is
+	NULL, only a free page or a clean victim is taken. Otherwise
+	the partition latch is let go while a dirty victim is written
+	(see PFbufEvict()), so the caller must look for its page in the
+	page table again: another thread may have brought it in.
 
 ALGORITHM:
+	If the free list is empty, and there are less than
+	part->poolsize pages in the partition, then bring the
+	missing pages in from the frame arena, as far as the pool
+	size allows; if the other size classes hold the rest of the
+	pool, take a page of theirs first (see PFpoolSteal()).
 	If there is something on the free list, then use it.
-	If free list is empty, and there are less than PF_MAX_BUFS 
-	number of pages allocated, then malloc() one.
 	Otherwise, choose a victim to write out, and then use that
 	page as the page to be used.
 	If a victim cannot be chosen (because all the pages are fixed),
@@ -131,97 +1228,477 @@ RETURN VALUE:
 
 	PFE_OK	if no error.
 	PF_NOMEM	if no memory.
-	PF_NOBUF	if no buffer space left because all pages are fixed.
-
-GLOBAL VARIABLES MODIFIED:
-	PFnumbpage, PFfirstbpage, PFlastbpage, PFfreebpage
+	PF_NOBUF	if no buffer space left because all pages of the
+		partition are fixed, or PF_EVICT_TRIES victims in a row
+		were fixed before they could be paged out, or the victim
+		is dirty and "writefcn" is NULL (PFerrno is not set then).
 *****************************************************************************/
 static int PFbufInternalAlloc(
+    PFpart *part,    /* partition to allocate from */
     PFbpage **bpage, /* pointer to pointer to buffer bpage to be allocated*/
-    int (*writefcn)(int, int, PFfpage *)) {
+    int (*writefcn)(int, int, PFfpage **, int)) {
   PFbpage *tbpage = NULL; /* temporary pointer to buffer page */
   int error;       /* error value returned*/
+  int tries;       /* # of victims fixed before they could go */
+
+  /* We have not reached max buffer limit, so fill the partition up;
+  when the other classes hold the rest of the pool, a partition with
+  no page of its own to give up may have theirs written out */
+  if (part->freebpage == NULL && part->numbpage < part->poolsize) {
+    if (PFpartRoom(part) == 0)
+      PFpoolSteal(part, (part->numbpage == 0) ? writefcn : NULL);
+    if ((error = PFbufAddPages(part, PFpartRoom(part))) != PFE_OK) {
+      *bpage = NULL;
+      return (error);
+    }
+  }
 
   /* Set *bpage to the buffer page to be returned */
-  if (PFfreebpage != NULL) {
+  if (part->freebpage != NULL) {
     /* Free list not empty, use the one from the free list. */
-    *bpage = PFfreebpage;
-    PFfreebpage = (*bpage)->nextpage;
-  } else if (PFnumbpage < PF_MAX_BUFS) {
-    /* We have not reached max buffer limit, so
-    malloc() a new one */
-    if ((*bpage = (PFbpage *)malloc(sizeof(PFbpage))) == NULL) {
-      /* no mem */
-      *bpage = NULL;
-      PFerrno = PFE_NOMEM;
-      return (PFerrno);
-    }
-    /* increment # of pages allocated */
-    PFnumbpage++;
+    *bpage = part->freebpage;
+    part->freebpage = (*bpage)->nextpage;
   } else {
     /* we have reached max buffer limit */
     /* choose a victim from the buffer*/
 
     *bpage = NULL; /* set initial return value */
 
-    /* LRU = choose from tail (least-recently-used) */
-    if (PFbufferPool.replacement == PF_REPLACEMENT_LRU) {
-      for (tbpage = PFlastbpage; tbpage != NULL; tbpage = tbpage->prevpage) {
-        if (!tbpage->fixed)
-          break;
+    /* write it out and take it out of the buffer; look again if
+    it was fixed in the meantime, but not forever */
+    tries = 0;
+    do {
+      if (tries++ == PF_EVICT_TRIES ||
+          (tbpage = PFbufVictim(part)) == NULL) {
+        /* couldn't find a free page */
+        PFerrno = PFE_NOBUF;
+        return (PFerrno);
       }
+    } while ((error = PFbufEvict(part, tbpage, writefcn, TRUE)) ==
+             PFE_PAGEFIXED);
+    if (error != PFE_OK)
+      return (error);
+
+    *bpage = tbpage;
+  }
+
+  /* Link the page as the head of the used list */
+  PFbufLinkHead(part, *bpage);
+  return (PFE_OK);
+}
+/****************************************************************************
+SPECIFICATIONS:
+	Shrink partition "part" until it holds no more than its
+	poolsize pages: retire the pages on the free list first, then
+	page out and retire victims chosen by the replacement policy,
+	writing dirty ones with writefcn().
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PF error code if writing a page fails.
+*****************************************************************************/
+static int PFpartShrink(PFpart *part,
+                        int (*writefcn)(int, int, PFfpage **, int)) {
+  PFbpage *bpage;
+  int error;
+
+  /* give back free pages first */
+  while (part->numbpage > part->poolsize &&
+         (bpage = part->freebpage) != NULL) {
+    part->freebpage = bpage->nextpage;
+    PFbufRetire(part, bpage);
+  }
+
+  /* then page out victims */
+  while (part->numbpage > part->poolsize) {
+    if ((bpage = PFbufVictim(part)) == NULL) {
+      /* can't happen: we checked the fixed pages fit */
+      PFerrno = PFE_NOBUF;
+      return (PFerrno);
     }
+    if ((error = PFbufEvict(part, bpage, writefcn, FALSE)) == PFE_PAGEFIXED)
+      continue;
+    if (error != PFE_OK)
+      return (error);
+    PFbufRetire(part, bpage);
+  }
 
-    /* MRU = choose from head (most-recently-used) */
-    else {
-      for (tbpage = PFfirstbpage; tbpage != NULL; tbpage = tbpage->nextpage) {
-        if (!tbpage->fixed)
-          break;
-      }
+  /* resize the page table and policy state to match */
+  if ((error = PFreplResize(part, part->poolsize)) != PFE_OK)
+    return (error);
+  return (PFhashResize(&part->hash, part->poolsize));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Page out and retire pages until the partitions of every size
+	class together hold no more than "poolSize" pages: free pages
+	first, then victims chosen by the replacement policy of each
+	partition in turn, writing dirty ones with writefcn(). The
+	caller holds every partition latch.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_NOBUF	if every page left is fixed.
+	PF error code if writing a page fails.
+*****************************************************************************/
+static int PFpoolTrim(int poolSize,
+                      int (*writefcn)(int, int, PFfpage **, int)) {
+  PFpart *part;
+  PFbpage *bpage;
+  int paged;  /* TRUE if a round paged something out */
+  int error;
+  int i;
+
+  for (i = 0; i < PFallparts; i++)
+    while (PFpoolused > poolSize &&
+           (bpage = PFparts[i].freebpage) != NULL) {
+      PFparts[i].freebpage = bpage->nextpage;
+      PFbufRetire(&PFparts[i], bpage);
     }
 
-    if (tbpage == NULL) {
+  /* take a page from each partition in turn, so that the classes
+  keep their part of the pool */
+  while (PFpoolused > poolSize) {
+    paged = FALSE;
+    for (i = 0; i < PFallparts && PFpoolused > poolSize; i++) {
+      part = &PFparts[i];
+      if ((bpage = PFbufVictim(part)) == NULL)
+        continue;
+      paged = TRUE;
+      if ((error = PFbufEvict(part, bpage, writefcn, FALSE)) ==
+          PFE_PAGEFIXED)
+        continue;
+      if (error != PFE_OK)
+        return (error);
+      PFbufRetire(part, bpage);
+    }
+    if (!paged) {
+      /* can't happen: we checked the fixed pages fit */
       PFerrno = PFE_NOBUF;
-      return PFerrno;
+      return (PFerrno);
     }
+  }
+  return (PFE_OK);
+}
 
-    if (tbpage == NULL) {
-      /* couldn't find a free page */
-      PFerrno = PFE_NOBUF;
+/****************************************************************************
+SPECIFICATIONS:
+	Zero the statistics of the file whose entry is "file".
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFbufFileResetStats(PFbfile *file) {
+  PFatomicStore(file->hits, 0);
+  PFatomicStore(file->misses, 0);
+  PFatomicStore(file->reads, 0);
+  PFatomicStore(file->writes, 0);
+  PFatomicStore(file->evictions, 0);
+  PFatomicStore(file->dirtyEvictions, 0);
+  PFatomicStore(file->pinWaits, 0);
+  PFatomicStore(file->allocations, 0);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Record that the pages of file "fd" are "pagesize" bytes, a
+	power of two from PF_MIN_PAGE_SIZE to PF_MAX_PAGE_SIZE, so they
+	go to the partitions of that size class, and start its list of
+	pages and zero its statistics. Called when the file is opened,
+	before any of its pages is in the buffer.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_NOMEM	if the chunk of PFbfilechunk holding the file can
+		not be allocated.
+
+GLOBAL VARIABLES MODIFIED:
+	PFfileclass, PFbfilechunk
+*****************************************************************************/
+int PFbufSetPageSize(int fd, int pagesize) {
+  PFbfile *file;
+  void *chunk;
+
+  if (PFbfilechunk[fd / PF_FTAB_CHUNK] == NULL) {
+    if (posix_memalign(&chunk, PF_CACHE_LINE,
+                       PF_FTAB_CHUNK * sizeof(PFbfile)) != 0) {
+      PFerrno = PFE_NOMEM;
       return (PFerrno);
     }
+    memset(chunk, 0, PF_FTAB_CHUNK * sizeof(PFbfile));
+    PFatomicStore(PFbfilechunk[fd / PF_FTAB_CHUNK], (PFbfile *)chunk);
+  }
+  file = PFbfileOf(fd);
+  PFfileclass[fd] = PFsizeClass(pagesize);
+  file->first = NULL;
+  file->npages = 0;
+  pthread_spin_init(&file->latch, PTHREAD_PROCESS_PRIVATE);
+  PFbufFileResetStats(file);
+  return (PFE_OK);
+}
 
-    /* write out the dirty page */
-    if (tbpage->dirty) {
-      PFbufferPool.physicalWrites++;
-      if ((error = (*writefcn)(tbpage->fd, tbpage->page, &tbpage->fpage)) !=
-          PFE_OK)
-        return (error);
+/****************************************************************************
+SPECIFICATIONS:
+	Change the number of pages the buffer pool may hold to
+	"poolSize", spread over the partitions as by PFbufInitPool().
+	Growing only raises the limits; the new pages are brought in
+	from the frame arena when they are needed. Shrinking pages out
+	and retires pages, writing dirty ones with writefcn(), until no
+	partition holds more than its share and the size classes
+	together hold no more than "poolSize" (see PFpoolTrim()). Arena
+	chunks left with no page in the pool are unmapped. Every
+	partition latch is held meanwhile.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_POOLSIZE	if "poolSize" is smaller than the number of
+		partitions. Nothing is changed in this case.
+	PFE_NOBUF	if a partition has more pages fixed than its share
+		of "poolSize", or the pool more than "poolSize". Nothing is
+		changed in this case.
+	PF error code if writing a page fails. The limit is then
+	already "poolSize" but more pages may still be allocated;
+	calling PFbufResizePool() again retries the shrink.
+
+GLOBAL VARIABLES MODIFIED:
+	PFbufferPool
+*****************************************************************************/
+int PFbufResizePool(int poolSize,
+                    int (*writefcn)(int, int, PFfpage **, int)) {
+  PFbpage *bpage;
+  int nfixed; /* # of fixed pages */
+  int allfixed = 0; /* # of fixed pages of every class */
+  int error = PFE_OK;
+  int i;
+
+  if (poolSize < PFnumparts) {
+    PFerrno = PFE_POOLSIZE;
+    return (PFerrno);
+  }
+
+  /* latches are always taken in partition order, after the writer's;
+  reads in flight hold frames, so they must end first */
+  PFioDrain();
+  pthread_mutex_lock(&PFwriterlatch);
+  for (i = 0; i < PFallparts; i++)
+    pthread_mutex_lock(&PFparts[i].latch);
+
+  /* make sure the fixed pages fit in the new pool; a page being
+  read or written without the latch can not be paged out either */
+  for (i = 0; i < PFallparts; i++) {
+    nfixed = 0;
+    for (bpage = PFparts[i].firstbpage; bpage != NULL;
+         bpage = bpage->nextpage)
+      if (PFatomicLoad(bpage->fixcount) != 0)
+        nfixed++;
+    if (nfixed > PFpartShare(poolSize, i % PFnumparts, PFnumparts)) {
+      PFerrno = error = PFE_NOBUF;
+      goto unlock;
     }
-    tbpage->dirty = FALSE;
+    allfixed += nfixed;
+  }
+  if (allfixed > poolSize) {
+    PFerrno = error = PFE_NOBUF;
+    goto unlock;
+  }
 
-    /* unlink from hash table */
-    if ((error = PFhashDelete(tbpage->fd, tbpage->page)) != PFE_OK)
-      return (error);
+  PFbufferPool.poolSize = poolSize;
+  for (i = 0; i < PFallparts; i++) {
+    PFparts[i].poolsize = PFpartShare(poolSize, i % PFnumparts, PFnumparts);
+    if ((error = PFpartShrink(&PFparts[i], writefcn)) != PFE_OK)
+      break;
+  }
+  if (error == PFE_OK)
+    error = PFpoolTrim(poolSize, writefcn);
+  PFarenaRelease();
+
+unlock:
+  for (i = PFallparts - 1; i >= 0; i--)
+    pthread_mutex_unlock(&PFparts[i].latch);
+  pthread_mutex_unlock(&PFwriterlatch);
+  return (error);
+}
 
-    /* unlink from buffer list */
-    PFbufUnlink(tbpage);
+/****************************************************************************
+SPECIFICATIONS:
+	Fix page "pagenum" of file "fd" without the latch of its
+	partition "part", if it is in the buffer.
 
-    *bpage = tbpage;
+RETURN VALUE:
+	The buffer page, fixed, or NULL if the page could not be found
+	or is being paged out. The caller then takes the latch.
+*****************************************************************************/
+static PFbpage *PFbufFastFix(PFpart *part, int fd, int pagenum) {
+  PFbpage *bpage;
+
+  if ((bpage = PFhashPeek(&part->hash, fd, pagenum)) == NULL)
+    return (NULL);
+
+  /* fix it, then make sure it is still the page and not closed */
+  if (__atomic_add_fetch(&bpage->fixcount, 1, __ATOMIC_SEQ_CST) <= 0 ||
+      __atomic_load_n(&bpage->fd, __ATOMIC_SEQ_CST) != fd ||
+      PFatomicLoad(bpage->page) != pagenum) {
+    __atomic_fetch_sub(&bpage->fixcount, 1, __ATOMIC_RELEASE);
+    return (NULL);
   }
+  return (bpage);
+}
 
-  /* Link the page as the head of the used list */
-  PFbufLinkHead(*bpage);
-  return (PFE_OK);
+/****************************************************************************
+SPECIFICATIONS:
+	Take one fix away from page "pagenum" of file "fd", which the
+	caller has fixed, without the latch of its partition "part".
+	Mark it dirty if "dirty" is TRUE, and set its reference bit
+	when the last fix goes.
+
+RETURN VALUE:
+	TRUE	if done.
+	FALSE	if the page is not in the buffer or not fixed. The
+		caller then takes the latch to report the error.
+*****************************************************************************/
+static int PFbufFastUnfix(PFpart *part, int fd, int pagenum, int dirty) {
+  PFbpage *bpage;
+  int count;
+
+  if ((bpage = PFhashPeek(&part->hash, fd, pagenum)) == NULL ||
+      PFatomicLoad(bpage->fd) != fd || PFatomicLoad(bpage->page) != pagenum)
+    return (FALSE);
+
+  /* the marks must be in place before the fix goes; a fix held by
+  the background writer is not the caller's */
+  count = PFatomicLoad(bpage->fixcount);
+  do {
+    if (count <= PFatomicLoad(bpage->cleaning))
+      return (FALSE);
+    if (dirty)
+      PFatomicStore(bpage->dirty, TRUE);
+    if (count == 1 + PFatomicLoad(bpage->cleaning))
+      PFatomicStore(bpage->refbit, TRUE);
+  } while (!__atomic_compare_exchange_n(&bpage->fixcount, &count, count - 1,
+                                        FALSE, __ATOMIC_RELEASE,
+                                        __ATOMIC_ACQUIRE));
+  return (TRUE);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Count the clean pages of partition "part": pages it may still
+	bring in, free pages, and unfixed pages that are not dirty.
+	The caller holds the partition latch.
+
+RETURN VALUE:
+	The count.
+*****************************************************************************/
+static int PFpartCleanPages(PFpart *part) {
+  PFbpage *bpage;
+  int clean = PFpartRoom(part);
+  int i;
+
+  for (i = 0; i < part->numbpage; i++) {
+    bpage = part->frametbl[i];
+    if (bpage->fd == -1 ||
+        (PFatomicLoad(bpage->fixcount) == 0 && !PFatomicLoad(bpage->dirty)))
+      clean++;
+  }
+  return (clean);
 }
 
-void PFbufLinkTail(PFbpage *p) {
-    p->nextpage = NULL;
-    p->prevpage = PFlastbpage;
-    if (PFlastbpage) PFlastbpage->nextpage = p;
-    PFlastbpage = p;
-    if (PFfirstbpage == NULL)
-        PFfirstbpage = p;
+/****************************************************************************
+SPECIFICATIONS:
+	If fewer than PFwriterlow percent of the pages of partition
+	"part" are clean, write dirty, unfixed pages from its cold end
+	until PFwriterhigh percent are, or no dirty page is left. Up
+	to PF_WRITER_BATCH pages at a time are fixed and marked clean
+	under the latch, then written without it, in runs of
+	consecutive pages (see PFbufWriteRuns()). A user may fix the
+	page and change it while it is written; it is then dirty
+	again, and written again later. The caller holds
+	PFwriterlatch.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PF error code if writing a page fails. The pages of the batch
+	are marked dirty again, and left for a later pass or for the
+	misses that page them out.
+*****************************************************************************/
+static int PFpartClean(PFpart *part) {
+  PFbpage *batch[PF_WRITER_BATCH];
+  PFbpage *bpage;
+  int need; /* # of pages to clean */
+  int want; /* # of pages to fix in this batch */
+  int error = PFE_OK;
+  int n, i;
+
+  pthread_mutex_lock(&part->latch);
+  need = PFpartPct(part, PFwriterhigh) - PFpartCleanPages(part);
+  if (PFpartPct(part, PFwriterhigh) - need >= PFpartPct(part, PFwriterlow))
+    need = 0;
+
+  while (need > 0 && error == PFE_OK) {
+    /* fix the coldest dirty pages */
+    want = (need < PF_WRITER_BATCH) ? need : PF_WRITER_BATCH;
+    n = 0;
+    for (bpage = PFbufNextCold(part, NULL); bpage != NULL && n < want;
+         bpage = PFbufNextCold(part, bpage)) {
+      if (PFatomicLoad(bpage->fixcount) == 0 && PFatomicLoad(bpage->dirty))
+        batch[n++] = bpage;
+    }
+    for (i = 0; i < n; i++) {
+      PFatomicStore(batch[i]->cleaning, TRUE);
+      __atomic_fetch_add(&batch[i]->fixcount, 1, __ATOMIC_ACQUIRE);
+      PFatomicStore(batch[i]->dirty, FALSE);
+    }
+    pthread_mutex_unlock(&part->latch);
+
+    /* write them in file order while others use the partition */
+    qsort(batch, n, sizeof(PFbpage *), PFbufCmpPage);
+    if ((error = PFbufWriteRuns(part, batch, n, PFwriterfcn)) == PFE_OK)
+      __atomic_fetch_add(&part->writerWrites, n, __ATOMIC_RELAXED);
+    else
+      for (i = 0; i < n; i++)
+        PFatomicStore(batch[i]->dirty, TRUE);
+
+    pthread_mutex_lock(&part->latch);
+    for (i = 0; i < n; i++) {
+      __atomic_fetch_sub(&batch[i]->fixcount, 1, __ATOMIC_RELEASE);
+      PFatomicStore(batch[i]->cleaning, FALSE);
+    }
+    pthread_cond_broadcast(&part->iodone);
+
+    /* a short batch means there is nothing more to write */
+    need = (n == want) ? need - n : 0;
+  }
+  pthread_mutex_unlock(&part->latch);
+  return (error);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Body of the background writer thread: clean every partition,
+	then sleep PF_WRITER_INTERVAL ms or until woken up, until
+	PFbufStopWriter() is called. Write errors are not reported
+	here; the page stays dirty.
+*****************************************************************************/
+static void *PFwriterMain(void *arg) {
+  struct timespec ts;
+  int i;
+
+  (void)arg;
+  pthread_mutex_lock(&PFwriterlatch);
+  while (PFwriteron) {
+    for (i = 0; i < PFallparts; i++)
+      PFpartClean(&PFparts[i]);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += PF_WRITER_INTERVAL * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&PFwritercond, &PFwriterlatch, &ts);
+  }
+  pthread_mutex_unlock(&PFwriterlatch);
+  return (NULL);
 }
 
 /************************* Interface to the Outside World ****************/
@@ -231,98 +1708,383 @@ SPECIFICATIONS:
 	Get a page whose number is "pagenum" from the file pointed
 	by "fd". Set *fpage to point to the data for that page.
 	This function requires two functions:
-		readfcn(fd,pagenum,fpage) 
+		readfcn(fd,pagenum,fpages,n)
 		int fd;
 		int pagenum;
-		PFfpage *fpage;
-	which will read one page whose number is "pagenum" from the file "fd"
-	into the buffer area pointed by "fpage".
-		writefcn(fd,pagenum,fpage)
+		PFfpage **fpages;
+		int n;
+	which will read the "n" pages from "pagenum" on from the file
+	"fd" into the buffers fpages[0] to fpages[n-1] (here n is 1).
+		writefcn(fd,pagenum,fpages,n)
 		int fd;
-		in pagenum;
-		PFpage *fpage;
-	which will write one page into the file.
-	It is an error to read a page already fixed in the buffer.
+		int pagenum;
+		PFfpage **fpages;
+		int n;
+	which will write the "n" pages from "pagenum" on, whose
+	buffers are fpages[0] to fpages[n-1], into the file.
+	A page already fixed in the buffer may be fixed again: each
+	call adds one to its fix count, and each PFbufUnfix() takes one
+	away. The page can be paged out only when the count is back to 0.
+	Under CLOCK a page found in the buffer is fixed without a latch
+	(see PFbufFastFix()). Otherwise the latch of the page's
+	partition is held, except while a missing page is read in, or
+	a dirty victim written out (see PFbufInternalAlloc()): the
+	frame is then in the page table, fixed and marked "reading",
+	so that other fixes of the page wait for it, as they wait for
+	a page that PFbufPrefetch() is still reading.
 
 RETURN VALUE:
 	PFE_OK	if no error.
 	PF error code if error.
-	If error code is PFE_PAGEFIXED, *fpage is still set to point to the buffer
-	page of the page in memory.
 
 GLOBAL VARIABLES MODIFIED:
 *****************************************************************************/
 int PFbufGet(int fd,          /* file descriptor */
              int pagenum,     /* page number */
              PFfpage **fpage, /* pointer to pointer to file page */
-             int (*readfcn)(int, int, PFfpage *), /* function to read a page */
-             int (*writefcn)(int, int, PFfpage *) /* function to write a page */
+             int (*readfcn)(int, int, PFfpage **, int), /* reads pages */
+             int (*writefcn)(int, int, PFfpage **, int) /* writes pages */
 ) {
-  PFbufferPool.logicalPageRequests++;
+  PFpart *part = PFpartOf(fd, pagenum);
   PFbpage *bpage; /* pointer to buffer */
-  int error;
+  PFfpage *rpage; /* page to read */
+  int waited = FALSE; /* TRUE if the fix was counted as a miss */
+  int missed;         /* what PFreplMiss() said */
+  int error = PFE_OK;
+
+  PFpartCount(part, logicalPageRequests);
+  if (PFbufferPool.replacement == PF_REPLACEMENT_CLOCK &&
+      (bpage = PFbufFastFix(part, fd, pagenum)) != NULL) {
+    /* hit, with no latch taken */
+    PFfileCount(fd, hits, 1);
+    PFtrace(fd, pagenum, PF_TRACE_GET, FALSE);
+    *fpage = &bpage->fpage;
+    return (PFE_OK);
+  }
+
+  pthread_mutex_lock(&part->latch);
+  *fpage = NULL;
+
+again:
+  /* wait for the page if PFbufFlushFile() or a miss is writing it,
+  the only times a page is closed to fixes with its latch free */
+  while ((bpage = PFhashFind(&part->hash, fd, pagenum)) != NULL &&
+         PFatomicLoad(bpage->fixcount) < 0)
+    pthread_cond_wait(&part->iodone, &part->latch);
+
+  /* wait for the page if it is being read, ahead or by another
+  miss; it is not there after all if the read fails. Either way
+  the fix is a miss: it waited for the disk */
+  if ((bpage = PFhashFind(&part->hash, fd, pagenum)) != NULL &&
+      bpage->reading) {
+    if (!waited) {
+      PFpartCount(part, ioWaits);
+      PFpartCount(part, logicalPageMisses);
+      PFfileCount(fd, pinWaits, 1);
+      PFfileCount(fd, misses, 1);
+    }
+    waited = TRUE;
+    do
+      pthread_cond_wait(&part->iodone, &part->latch);
+    while ((bpage = PFhashFind(&part->hash, fd, pagenum)) != NULL &&
+           bpage->reading);
+    goto again;
+  }
 
-  if ((bpage = PFhashFind(fd, pagenum)) == NULL) {
+  if (bpage == NULL) {
     /* page not in buffer. */
-    PFbufferPool.logicalPageHits++;
     /* allocate an empty page */
-    if ((error = PFbufInternalAlloc(&bpage, writefcn)) != PFE_OK) {
-      /* error */
-      *fpage = NULL;
-      return (error);
+    if (!waited) {
+      PFpartCount(part, logicalPageMisses);
+      PFfileCount(fd, misses, 1);
+      waited = TRUE;
     }
-
-    /* read the page */
-    if ((error = (*readfcn)(fd, pagenum, &bpage->fpage)) != PFE_OK) {
-      PFbufferPool.physicalReads++;
-      /* error reading the page. put buffer back into
-      the free list, and return gracefully */
-      /* If MRU policy: move to head as usual */
-      if (PFbufferPool.replacement == PF_REPLACEMENT_MRU) {
-        PFbufUnlink(bpage);
-        PFbufLinkHead(bpage);
-      }
-      /* If LRU: move to tail */
-      else {
-        PFbufUnlink(bpage);
-        PFbufLinkTail(bpage); // You must implement PFbufLinkTail()
-      }
-      *fpage = NULL;
-      return (error);
+    missed = PFreplMiss(part, fd, pagenum);
+    if ((error = PFbufInternalAlloc(part, &bpage, writefcn)) != PFE_OK)
+      /* error */
+      goto unlock;
+    if (PFhashFind(&part->hash, fd, pagenum) != NULL) {
+      /* brought in while a victim was written: use that one */
+      PFbufUnlink(part, bpage);
+      PFbufInsertFree(part, bpage);
+      goto again;
     }
 
     /* insert new page into hash table */
-    if ((error = PFhashInsert(fd, pagenum, bpage)) != PFE_OK) {
+    if ((error = PFhashInsert(&part->hash, fd, pagenum, bpage)) != PFE_OK) {
       /* failed to insert into hash table */
       /* put page into free list */
-      PFbufUnlink(bpage);
-      PFbufInsertFree(bpage);
-      return (error);
+      PFbufUnlink(part, bpage);
+      PFbufInsertFree(part, bpage);
+      goto unlock;
     }
+    PFbufFileLink(fd, bpage);
 
-    /* set the fields for this page*/
-    bpage->fd = fd;
-    bpage->page = pagenum;
+    /* read the page without the latch, the frame fixed and marked
+    "reading" as PFbufPrefetch() does, so that other fixes of the
+    page wait for it and other pages of the partition can be used
+    meanwhile; "fd" stays -1 for latch-free fixes until it is in */
     bpage->dirty = FALSE;
-  } else if (bpage->fixed) {
-    /* page already in memory, and is fixed, so we can't
-    get it again. */
+    bpage->refbit = FALSE;
+    bpage->prefetched = FALSE;
+    bpage->reading = TRUE;
+    bpage->fresh = FALSE;
+    __atomic_fetch_add(&bpage->fixcount, 1, __ATOMIC_ACQUIRE);
+    PFatomicStore(bpage->page, pagenum);
+    PFpartCount(part, readCalls);
+    PFpartCount(part, physicalReads);
+    PFfileCount(fd, reads, 1);
+    pthread_mutex_unlock(&part->latch);
+    rpage = &bpage->fpage;
+    error = (*readfcn)(fd, pagenum, &rpage, 1);
+    pthread_mutex_lock(&part->latch);
+    bpage->reading = FALSE;
+    pthread_cond_broadcast(&part->iodone);
+    if (error != PFE_OK) {
+      /* error reading the page. put buffer back into
+      the free list, and return gracefully */
+      PFhashDelete(&part->hash, fd, pagenum);
+      PFbufFileUnlink(fd, bpage);
+      PFbufUnlink(part, bpage);
+      PFbufInsertFree(part, bpage);
+      __atomic_fetch_sub(&bpage->fixcount, 1, __ATOMIC_RELEASE);
+      goto unlock;
+    }
+
+    /* the page is in, fixed for the caller; "fd" last, as it tells
+    latch-free fixes that the page is ready */
+    PFatomicStore(bpage->fd, fd);
+    PFreplAdmit(part, bpage, missed);
+    PFtrace(fd, pagenum, PF_TRACE_GET, FALSE);
     *fpage = &bpage->fpage;
-    PFerrno = PFE_PAGEFIXED;
-    return (PFerrno);
+    goto unlock;
+  } else {
+    /* page found in the buffer */
+    if (!waited)
+      PFfileCount(fd, hits, 1);
+    if (bpage->prefetched) {
+      /* first use of a page read ahead: admitting it counted */
+      bpage->prefetched = FALSE;
+      PFreplFirstUse(part, bpage);
+    } else
+      PFreplRef(part, bpage);
   }
 
   /* Fix the page in the buffer then return*/
-  bpage->fixed = TRUE;
+  __atomic_fetch_add(&bpage->fixcount, 1, __ATOMIC_ACQUIRE);
+  PFtrace(fd, pagenum, PF_TRACE_GET, FALSE);
   *fpage = &bpage->fpage;
+
+unlock:
+  pthread_mutex_unlock(&part->latch);
+  return (error);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	The read of page "pagenum" of file "fd" into the buffer page
+	"bpage", started by PFbufPrefetch(), is over, with "error".
+	If it went well, bring the page in unfixed, admitted to the
+	replacement policy as if it had been missed; its first fix is
+	not taken for a re-use (see PFreplFirstUse()). Otherwise drop
+	it, so that a fix of it reads it again. Either way, wake up
+	whoever waits for it.
+*****************************************************************************/
+static void PFbufReadEnd(int fd, int pagenum, PFbpage *bpage, int error) {
+  PFpart *part = PFpartOf(fd, pagenum);
+
+  pthread_mutex_lock(&part->latch);
+  bpage->reading = FALSE;
+  part->nreading--;
+  if (error != PFE_OK) {
+    PFhashDelete(&part->hash, fd, pagenum);
+    PFbufFileUnlink(fd, bpage);
+    PFbufUnlink(part, bpage);
+    PFbufInsertFree(part, bpage);
+    __atomic_fetch_sub(&bpage->fixcount, 1, __ATOMIC_RELEASE);
+  } else {
+    /* the CLOCK hand is to pass it once, as a page just used, or
+    it would be taken before the scan gets to it; "fd" last, as it
+    tells latch-free fixes that the page is ready */
+    bpage->refbit = TRUE;
+    bpage->prefetched = TRUE;
+    PFreplAdmit(part, bpage, PFreplMiss(part, fd, pagenum));
+    __atomic_fetch_sub(&bpage->fixcount, 1, __ATOMIC_RELEASE);
+    PFreplUnfix(part, bpage);
+    PFatomicStore(bpage->fd, fd);
+  }
+  pthread_cond_broadcast(&part->iodone);
+  pthread_mutex_unlock(&part->latch);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	"done" function of the requests of PFbufPrefetch(): the read
+	of request "req" is over, with "error". Call its "finish" first,
+	as the file may be closed once its pages are in, then end the
+	read for each of its pages (see PFbufReadEnd()), a page that
+	fails the "check" of the request with the error of the check,
+	and free the request and its "zbuf".
+*****************************************************************************/
+static void PFbufReadDone(PFioreq *req, int error) {
+  int i, pageerror;
+
+  if (req->finish != NULL)
+    (*req->finish)(req);
+  for (i = 0; i < req->n; i++) {
+    pageerror = error;
+    if (error == PFE_OK && req->check != NULL)
+      pageerror = (*req->check)(req, i);
+    PFbufReadEnd(req->fd, req->pagenum + i, req->bpages[i], pageerror);
+  }
+  free(req->zbuf);
+  free((char *)req);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Start reading the "n" pages from "pagenum" on of file "fd"
+	into the buffer pages run[0] to run[n-1], reserved by
+	PFbufPrefetch(). prepfcn() sets the request up (see
+	PFbufPrefetch()). No latch may be held.
+
+RETURN VALUE:
+	PFE_OK	if the read is started.
+	PFE_NOMEM	if no memory. The pages are dropped.
+*****************************************************************************/
+static int PFbufStartRead(int fd, int pagenum, PFbpage **run, int n,
+                          void (*prepfcn)(int, int, PFfpage **, int,
+                                          PFioreq *)) {
+  PFfpage *fpages[PF_READ_AHEAD_MAX];
+  PFioreq *req;
+  int i;
+
+  if ((req = (PFioreq *)malloc(sizeof(PFioreq))) == NULL) {
+    for (i = 0; i < n; i++)
+      PFbufReadEnd(fd, pagenum + i, run[i], PFE_NOMEM);
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  for (i = 0; i < n; i++) {
+    req->bpages[i] = run[i];
+    fpages[i] = &run[i]->fpage;
+  }
+  req->fd = fd;
+  req->pagenum = pagenum;
+  req->n = n;
+  req->done = PFbufReadDone;
+  req->finish = NULL;
+  (*prepfcn)(fd, pagenum, fpages, n, req);
+
+  PFpartCount(PFpartOf(fd, pagenum), readCalls);
+  PFioSubmit(req);
   return (PFE_OK);
 }
 
+/****************************************************************************
+SPECIFICATIONS:
+	Start reading in the "n" pages of file "fd" listed in pages[],
+	which a caller is about to ask for, and return without waiting
+	for them. Pages already in the buffer are skipped. Each run of
+	consecutive pages in pages[], up to PF_READ_AHEAD_MAX, is read
+	with one request, set up by
+		prepfcn(fd,pagenum,fpages,n,req)
+		int fd;
+		int pagenum;
+		PFfpage **fpages;
+		int n;
+		PFioreq *req;
+	which fills in where "req" is to read the "n" pages from
+	"pagenum" on, into the buffers fpages[0] to fpages[n-1], from,
+	and handed to PFioSubmit(). A page only gets a free page or a
+	clean victim, and no more than half of a partition is read
+	into at a time; pages that find no frame are left out. No more
+	than a quarter of the pool is asked for by one call, so a scan
+	does not page out what it has read ahead before it gets there.
+	Nothing is read under MRU, which would page those out first.
+	Until its read is over a page holds a fix and is marked
+	"reading"; PFbufReadEnd() then brings it in unfixed. A page
+	whose read fails is dropped, and the error is reported by the
+	fix that reads it again. The latch of a page's partition is
+	taken only while its frame is reserved.
+
+RETURN VALUE:
+	The # of pages whose read was started, which may be 0.
+	PFE_NOMEM	if no memory.
+*****************************************************************************/
+int PFbufPrefetch(int fd,     /* file descriptor */
+                  int *pages, /* pages to read in */
+                  int n,      /* # of pages */
+                  void (*prepfcn)(int, int, PFfpage **, int, PFioreq *)) {
+  PFbpage *run[PF_READ_AHEAD_MAX]; /* frames of the run being built */
+  PFpart *part;
+  PFbpage *bpage;
+  int first = 0, len = 0; /* first page and length of the run */
+  int started = 0;
+  int i, error;
+
+  if (PFbufferPool.replacement == PF_REPLACEMENT_MRU)
+    return (0);
+  if (n > PFbufferPool.poolSize / 4)
+    n = PFbufferPool.poolSize / 4;
+
+  for (i = 0; i <= n; i++) {
+    /* start the run if page i can not go on with it */
+    if (len > 0 &&
+        (i == n || len == PF_READ_AHEAD_MAX || pages[i] != first + len)) {
+      if ((error = PFbufStartRead(fd, first, run, len, prepfcn)) != PFE_OK)
+        return (error);
+      started += len;
+      len = 0;
+    }
+    if (i == n)
+      break;
+
+    /* reserve a frame for the page, fixed so that it is not taken
+    as a victim; "fd" stays -1 until the page is there */
+    part = PFpartOf(fd, pages[i]);
+    pthread_mutex_lock(&part->latch);
+    if (part->nreading >= part->poolsize / 2 ||
+        PFhashFind(&part->hash, fd, pages[i]) != NULL ||
+        PFbufInternalAlloc(part, &bpage, NULL) != PFE_OK) {
+      pthread_mutex_unlock(&part->latch);
+      continue;
+    }
+    if (PFhashInsert(&part->hash, fd, pages[i], bpage) != PFE_OK) {
+      /* can't happen: the page was not in the buffer */
+      PFbufUnlink(part, bpage);
+      PFbufInsertFree(part, bpage);
+      pthread_mutex_unlock(&part->latch);
+      continue;
+    }
+    PFbufFileLink(fd, bpage);
+    bpage->dirty = FALSE;
+    bpage->fresh = FALSE;
+    bpage->reading = TRUE;
+    part->nreading++;
+    __atomic_fetch_add(&bpage->fixcount, 1, __ATOMIC_ACQUIRE);
+    PFatomicStore(bpage->page, pages[i]);
+    PFpartCount(part, physicalReads);
+    PFpartCount(part, readAheadPages);
+    PFfileCount(fd, reads, 1);
+    pthread_mutex_unlock(&part->latch);
+
+    if (len == 0)
+      first = pages[i];
+    run[len++] = bpage;
+  }
+  return (started);
+}
+
 /****************************************************************************
 SPECIFICATIONS:
 	Unfix the file page whose number is "pagenum" from the buffer.
 	If dirty is TRUE, then mark the buffer as having been modified.
 	Otherwise, the dirty flag is left unchanged.
+	This takes away one fix; if the page was fixed more than once it
+	stays fixed, and the replacement policy only hears about it when
+	the last fix goes. Under CLOCK no latch is taken (see
+	PFbufFastUnfix()).
 
 AUTHOR: clc
 
@@ -335,34 +2097,46 @@ int PFbufUnfix(int fd,      /* file descriptor */
                int pagenum, /* page number */
                int dirty    /* TRUE if page is dirty */
 ) {
+  PFpart *part = PFpartOf(fd, pagenum);
   PFbpage *bpage;
+  int error = PFE_OK;
+
+  if (PFbufferPool.replacement == PF_REPLACEMENT_CLOCK &&
+      PFbufFastUnfix(part, fd, pagenum, dirty)) {
+    PFtrace(fd, pagenum, PF_TRACE_UNFIX, dirty);
+    return (PFE_OK);
+  }
 
-  if ((bpage = PFhashFind(fd, pagenum)) == NULL) {
+  pthread_mutex_lock(&part->latch);
+  if ((bpage = PFhashFind(&part->hash, fd, pagenum)) == NULL) {
     /* page not in buffer */
-    PFerrno = PFE_PAGENOTINBUF;
-    return (PFerrno);
+    PFerrno = error = PFE_PAGENOTINBUF;
+    goto unlock;
   }
 
-  if (!bpage->fixed) {
-    /* page already unfixed */
-    PFerrno = PFE_PAGEUNFIXED;
-    return (PFerrno);
+  if (PFatomicLoad(bpage->fixcount) <= bpage->cleaning + bpage->reading) {
+    /* page already unfixed, or still being read in */
+    PFerrno = error = PFE_PAGEUNFIXED;
+    goto unlock;
   }
 
   if (dirty)
     /* mark this page dirty */
-    bpage->dirty = TRUE;
-
-  /* unfix the page */
-  bpage->fixed = FALSE;
-
-  /* unlink this page */
-  PFbufUnlink(bpage);
-
-  /* insert it as head of linked list to make it most recently used*/
-  PFbufLinkHead(bpage);
+    PFatomicStore(bpage->dirty, TRUE);
+
+  /* drop one fix; the page stays fixed until the last one goes,
+  not counting one held by the background writer */
+  if (__atomic_sub_fetch(&bpage->fixcount, 1, __ATOMIC_RELEASE) ==
+      bpage->cleaning) {
+    /* make it most recently used */
+    PFbufTouch(part, bpage);
+    PFreplUnfix(part, bpage);
+  }
+  PFtrace(fd, pagenum, PF_TRACE_UNFIX, dirty);
 
-  return (PFE_OK);
+unlock:
+  pthread_mutex_unlock(&part->latch);
+  return (error);
 }
 
 /****************************************************************************
@@ -380,90 +2154,393 @@ RETURN VALUE:
 int PFbufAlloc(int fd,          /* file descriptor */
                int pagenum,     /* page number */
                PFfpage **fpage, /* pointer to file page */
-               int (*writefcn)(int, int, PFfpage*)) {
+               int (*writefcn)(int, int, PFfpage **, int)) {
+  PFpart *part = PFpartOf(fd, pagenum);
   PFbpage *bpage;
-  int error;
+  int missed; /* what PFreplMiss() said */
+  int error = PFE_OK;
 
   *fpage = NULL; /* initial value of fpage */
 
-  if ((bpage = PFhashFind(fd, pagenum)) != NULL) {
+  pthread_mutex_lock(&part->latch);
+  if ((bpage = PFhashFind(&part->hash, fd, pagenum)) != NULL) {
     /* page already in buffer*/
-    PFerrno = PFE_PAGEINBUF;
-    return (PFerrno);
+    PFerrno = error = PFE_PAGEINBUF;
+    goto unlock;
   }
 
-  if ((error = PFbufInternalAlloc(&bpage, writefcn)) != PFE_OK)
+  missed = PFreplMiss(part, fd, pagenum);
+  if ((error = PFbufInternalAlloc(part, &bpage, writefcn)) != PFE_OK)
     /* can't get any buffer */
-    return (error);
-  PFbufferPool.pageAllocations++;
+    goto unlock;
+  if (PFhashFind(&part->hash, fd, pagenum) != NULL) {
+    /* allocated while a victim was written */
+    PFbufUnlink(part, bpage);
+    PFbufInsertFree(part, bpage);
+    PFerrno = error = PFE_PAGEINBUF;
+    goto unlock;
+  }
+  PFpartCount(part, pageAllocations);
+  PFfileCount(fd, allocations, 1);
 
   /* put ourselves into the hash table */
-  if ((error = PFhashInsert(fd, pagenum, bpage)) != PFE_OK) {
+  if ((error = PFhashInsert(&part->hash, fd, pagenum, bpage)) != PFE_OK) {
     /* can't insert into the hash table */
     /* unlink bpage, and put it into the free list */
-    PFbufUnlink(bpage);
-    PFbufInsertFree(bpage);
-    return (error);
+    PFbufUnlink(part, bpage);
+    PFbufInsertFree(part, bpage);
+    goto unlock;
   }
+  PFbufFileLink(fd, bpage);
 
   /* init the fields of bpage and return */
-  bpage->fd = fd;
-  bpage->page = pagenum;
-  bpage->fixed = TRUE;
   bpage->dirty = FALSE;
+  bpage->refbit = FALSE;
+  bpage->prefetched = FALSE;
+  bpage->reading = FALSE;
+  bpage->fresh = TRUE;
+  __atomic_fetch_add(&bpage->fixcount, 1, __ATOMIC_ACQUIRE);
+  PFatomicStore(bpage->page, pagenum);
+  PFatomicStore(bpage->fd, fd);
+  PFreplAdmit(part, bpage, missed);
+  PFtrace(fd, pagenum, PF_TRACE_ALLOC, FALSE);
 
   *fpage = &bpage->fpage;
-  return (PFE_OK);
+
+unlock:
+  pthread_mutex_unlock(&part->latch);
+  return (error);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Tell whether a read or a write of the buffer page "bpage" is in
+	flight without its partition latch: it is being read ("reading",
+	see PFbufGet() and PFbufPrefetch()), written along with a victim
+	or by the background writer ("cleaning"), or written as a victim
+	or by PFbufFlushFile() (closed, see PFbufClose()). Each of these
+	ends under the partition latch with a broadcast of "iodone".
+
+RETURN VALUE:
+	TRUE if so, FALSE if not.
+*****************************************************************************/
+static int PFbufBusy(PFbpage *bpage) {
+  return (PFatomicLoad(bpage->reading) || PFatomicLoad(bpage->cleaning) ||
+          PFatomicLoad(bpage->fixcount) < 0);
 }
 
+/****************************************************************************
+SPECIFICATIONS:
+	Wait until no page of file "fd" is busy (see PFbufBusy()). Each
+	busy page found on the file's list is waited for under the
+	latch of its own partition, so I/O of other files is not
+	waited for.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFbufWaitBusy(int fd) {
+  PFbfile *file = PFbfileOf(fd);
+  PFbpage *bpage;
+  PFpart *part;
+
+  for (;;) {
+    pthread_spin_lock(&file->latch);
+    for (bpage = file->first; bpage != NULL; bpage = bpage->fnext)
+      if (PFbufBusy(bpage))
+        break;
+    part = (bpage != NULL) ? PFpartOf(fd, PFatomicLoad(bpage->page)) : NULL;
+    pthread_spin_unlock(&file->latch);
+    if (bpage == NULL)
+      return;
+
+    /* the frame stays in its partition, even if it is reused */
+    pthread_mutex_lock(&part->latch);
+    while (PFbufBusy(bpage))
+      pthread_cond_wait(&part->iodone, &part->latch);
+    pthread_mutex_unlock(&part->latch);
+  }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write out the dirty pages of file "fd" and drop all its pages
+	from the buffer. The dirty pages are written in page order, a
+	run of consecutive pages in one call (see PFbufWriteRuns()).
+	Only the file's own pages are looked at (see PFbfile): its
+	reads and writes in flight are waited for (see PFbufBusy()),
+	then its pages are closed to fixes (see PFbufClose()) with
+	every partition latch of the file's size class held, written
+	without the latches, a fix of one of them waiting meanwhile
+	(see PFbufGet()), and dropped under the latch of each.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_PAGEFIXED	if a page of the file is fixed. No page is
+		dropped in this case.
+	PFE_NOMEM	if no memory.
+	PF error code if writing a page fails. No page is dropped;
+	pages already written may still be marked dirty.
+*****************************************************************************/
 int PFbufReleaseFile(
     int fd,                              /* file descriptor */
-    int (*writefcn)(int, int, PFfpage *) /* function to write a page of file */
+    int (*writefcn)(int, int, PFfpage **, int) /* writes pages */
 ) {
-  PFbpage *bpage; /* ptr to buffer pages to search */
-  PFbpage *temppage;
-  int error; /* error code */
-
-  /* Do linear scan of the buffer to find pages belonging to the file */
-  bpage = PFfirstbpage;
-  while (bpage != NULL) {
-    if (bpage->fd == fd) {
-      /* The file descriptor matches*/
-      if (bpage->fixed) {
-        PFerrno = PFE_PAGEFIXED;
-        return (PFerrno);
+  PFbpage **pages = NULL; /* pages of the file */
+  PFbpage **dirty;        /* the dirty ones, in the same array */
+  PFbpage *bpage;
+  PFpart *part;
+  int npages, ndirty;
+  int total; /* # of pages of the file in the buffer */
+  int first = PFfileclass[fd] * PFnumparts; /* partitions of its class */
+  int busy;  /* TRUE if a page got busy before the latches were had */
+  int error = PFE_OK;
+  int i;
+
+  do {
+    /* a page being read or written could not be dropped */
+    PFbufWaitBusy(fd);
+
+    /* keep the writer out, so that it holds none of the pages, and
+    close the pages of the file to fixes */
+    pthread_mutex_lock(&PFwriterlatch);
+    for (i = first; i < first + PFnumparts; i++)
+      pthread_mutex_lock(&PFparts[i].latch);
+    npages = ndirty = 0;
+    busy = FALSE;
+    total = PFbfileOf(fd)->npages;
+    if (total > 0 &&
+        (pages = (PFbpage **)malloc(2 * total * sizeof(PFbpage *))) == NULL)
+      PFerrno = error = PFE_NOMEM;
+    dirty = pages + total;
+    for (bpage = PFbfileOf(fd)->first; error == PFE_OK && bpage != NULL;
+         bpage = bpage->fnext) {
+      if (PFbufBusy(bpage)) {
+        busy = TRUE;
+        break;
       }
-
-      /* write out dirty page */
-      if (bpage->dirty)
-      {
-        PFbufferPool.physicalWrites++;
-        if((error = (*writefcn)(fd, bpage->page, &bpage->fpage)) != PFE_OK)
-        {
-          /* error writing file */
-          return (error);
-        }
+      if (!PFbufClose(bpage)) {
+        PFerrno = error = PFE_PAGEFIXED;
+        break;
       }
+      pages[npages++] = bpage;
+      if (bpage->dirty)
+        dirty[ndirty++] = bpage;
+    }
+    if (error != PFE_OK || busy) {
+      /* nobody has seen them closed: the latches were held */
+      for (i = 0; i < npages; i++)
+        __atomic_fetch_sub(&pages[i]->fixcount, PF_FIX_EVICTING,
+                           __ATOMIC_RELEASE);
+      npages = ndirty = 0;
+    }
+    for (i = first + PFnumparts - 1; i >= first; i--)
+      pthread_mutex_unlock(&PFparts[i].latch);
+    pthread_mutex_unlock(&PFwriterlatch);
+    if (busy) {
+      free((char *)pages);
+      pages = NULL;
+    }
+  } while (busy);
+
+  /* write out the dirty pages in file order */
+  qsort(dirty, ndirty, sizeof(PFbpage *), PFbufCmpPage);
+  if (error == PFE_OK)
+    error = PFbufWriteRuns(NULL, dirty, ndirty, writefcn);
+
+  /* put the pages into the free lists, or leave them in the buffer
+  if the write failed */
+  for (i = 0; i < npages; i++) {
+    bpage = pages[i];
+    part = PFpartOf(fd, bpage->page);
+    pthread_mutex_lock(&part->latch);
+    if (error != PFE_OK)
+      __atomic_fetch_sub(&bpage->fixcount, PF_FIX_EVICTING, __ATOMIC_RELEASE);
+    else {
       bpage->dirty = FALSE;
-      
-
-      /* get rid of it from the hash table */
-      if ((error = PFhashDelete(fd, bpage->page)) != PFE_OK) {
+      if (PFhashDelete(&part->hash, fd, bpage->page) != PFE_OK) {
         /* internal error */
         printf("Internal error:PFbufReleaseFile()\n");
         exit(1);
       }
+      PFbufFileUnlink(fd, bpage);
+      PFbufUnlink(part, bpage);
+      PFbufSetHint(part, bpage, PF_HINT_NORMAL);
+      PFreplRemove(part, bpage, FALSE);
+      PFbufReopen(bpage);
+      PFbufInsertFree(part, bpage);
+    }
+    pthread_cond_broadcast(&part->iodone);
+    pthread_mutex_unlock(&part->latch);
+  }
+  free((char *)pages);
+  return (error);
+}
 
-      /* put the page into free list */
-      temppage = bpage;
-      bpage = bpage->nextpage;
-      PFbufUnlink(temppage);
-      PFbufInsertFree(temppage);
+/****************************************************************************
+SPECIFICATIONS:
+	Write out the dirty pages of file "fd" that are not fixed, as
+	PFbufReleaseFile() does, but leave them in the buffer, clean.
+	A fixed page, which may yet change, is left as it is. The
+	file's writes in flight are waited for (see PFbufBusy()), so
+	that every page is on disk on return; then the pages are found
+	and closed to fixes (see PFbufClose()) with every partition
+	latch of the file's size class held, and only the file's own
+	pages are looked at; they are written without the latches, a
+	fix of one of them waiting meanwhile (see PFbufGet()), then
+	opened again under the latch of each.
 
-    } else
-      bpage = bpage->nextpage;
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_NOMEM	if no memory.
+	PF error code if writing a page fails. The pages are left
+	dirty.
+*****************************************************************************/
+int PFbufFlushFile(
+    int fd,                              /* file descriptor */
+    int (*writefcn)(int, int, PFfpage **, int) /* writes pages */
+) {
+  PFbpage **dirty = NULL; /* dirty pages of the file */
+  PFbpage *bpage;
+  PFpart *part;
+  int ndirty;
+  int first = PFfileclass[fd] * PFnumparts; /* partitions of its class */
+  int busy;  /* TRUE if a page got busy before the latches were had */
+  int error = PFE_OK;
+  int i;
+
+  do {
+    /* a page an eviction is writing is not on disk yet */
+    PFbufWaitBusy(fd);
+
+    /* keep the writer out, so that it holds none of the pages */
+    pthread_mutex_lock(&PFwriterlatch);
+    for (i = first; i < first + PFnumparts; i++)
+      pthread_mutex_lock(&PFparts[i].latch);
+    ndirty = 0;
+    busy = FALSE;
+    if (PFbfileOf(fd)->npages > 0 &&
+        (dirty = (PFbpage **)malloc(PFbfileOf(fd)->npages *
+                                    sizeof(PFbpage *))) == NULL)
+      PFerrno = error = PFE_NOMEM;
+    else
+      /* close the dirty pages to fixes while they are written, so
+      that they do not change meanwhile */
+      for (bpage = PFbfileOf(fd)->first; bpage != NULL;
+           bpage = bpage->fnext) {
+        if (PFbufBusy(bpage)) {
+          busy = TRUE;
+          break;
+        }
+        if (PFatomicLoad(bpage->dirty) && PFbufClose(bpage))
+          dirty[ndirty++] = bpage;
+      }
+    if (busy) {
+      /* nobody has seen them closed: the latches were held */
+      for (i = 0; i < ndirty; i++)
+        __atomic_fetch_sub(&dirty[i]->fixcount, PF_FIX_EVICTING,
+                           __ATOMIC_RELEASE);
+      ndirty = 0;
+      free((char *)dirty);
+      dirty = NULL;
+    }
+    for (i = first + PFnumparts - 1; i >= first; i--)
+      pthread_mutex_unlock(&PFparts[i].latch);
+    pthread_mutex_unlock(&PFwriterlatch);
+  } while (busy);
+
+  qsort(dirty, ndirty, sizeof(PFbpage *), PFbufCmpPage);
+  if (error == PFE_OK)
+    error = PFbufWriteRuns(NULL, dirty, ndirty, writefcn);
+  for (i = 0; i < ndirty; i++) {
+    part = PFpartOf(fd, dirty[i]->page);
+    pthread_mutex_lock(&part->latch);
+    if (error == PFE_OK)
+      dirty[i]->dirty = FALSE;
+    __atomic_fetch_sub(&dirty[i]->fixcount, PF_FIX_EVICTING, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&part->iodone);
+    pthread_mutex_unlock(&part->latch);
   }
-  return (PFE_OK);
+  free((char *)dirty);
+  return (error);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write a page of zeroes with writefcn() in place of each page of
+	file "fd" that is fixed and fresh: allocated, and not written
+	since, so that PFbufFlushFile() left it out. A file with
+	checksums does this before its header and bitmap count such a
+	page used, so that every used page of it on disk has been
+	written, with its checksum. Meanwhile each page is held as the
+	background writer holds one (see PFpartClean()), so that it is
+	not written with what it holds at the same time; it stays dirty,
+	and is written as usual once unfixed.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_NOMEM	if no memory.
+	PF error code if a write fails. The pages not written are
+	still fresh.
+*****************************************************************************/
+int PFbufStampFresh(
+    int fd,                              /* file descriptor */
+    int (*writefcn)(int, int, PFfpage **, int) /* writes pages */
+) {
+  PFbpage **fresh = NULL; /* fixed, fresh pages of the file */
+  PFbpage *bpage;
+  PFpart *part;
+  PFfpage zero, *zerop = &zero;
+  int size = PF_MIN_PAGE_SIZE << PFfileclass[fd]; /* its page size */
+  int nfresh = 0;
+  int first = PFfileclass[fd] * PFnumparts; /* partitions of its class */
+  int error = PFE_OK;
+  int i;
+
+  for (i = first; i < first + PFnumparts; i++)
+    pthread_mutex_lock(&PFparts[i].latch);
+  if (PFbfileOf(fd)->npages > 0 &&
+      (fresh = (PFbpage **)malloc(PFbfileOf(fd)->npages *
+                                  sizeof(PFbpage *))) == NULL)
+    PFerrno = error = PFE_NOMEM;
+  for (bpage = PFbfileOf(fd)->first; error == PFE_OK && bpage != NULL;
+       bpage = bpage->fnext)
+    if (bpage->fresh && !bpage->cleaning &&
+        PFatomicLoad(bpage->fixcount) > 0) {
+      PFatomicStore(bpage->cleaning, TRUE);
+      __atomic_fetch_add(&bpage->fixcount, 1, __ATOMIC_ACQUIRE);
+      fresh[nfresh++] = bpage;
+    }
+  for (i = first + PFnumparts - 1; i >= first; i--)
+    pthread_mutex_unlock(&PFparts[i].latch);
+  if (nfresh == 0) {
+    free((char *)fresh);
+    return (error);
+  }
+
+  zero.nextfree = PF_PAGE_USED;
+  if ((zero.pagebuf = malloc(size)) == NULL)
+    PFerrno = error = PFE_NOMEM;
+  for (i = 0; i < nfresh; i++) {
+    bpage = fresh[i];
+    part = PFpartOf(fd, bpage->page);
+    if (error == PFE_OK) {
+      memset(zero.pagebuf, 0, size);
+      PFpartCount(part, writeCalls);
+      PFpartCount(part, physicalWrites);
+      PFfileCount(fd, writes, 1);
+      if ((error = (*writefcn)(fd, bpage->page, &zerop, 1)) ==
+          PFE_OK)
+        PFatomicStore(bpage->fresh, FALSE);
+    }
+    pthread_mutex_lock(&part->latch);
+    __atomic_fetch_sub(&bpage->fixcount, 1, __ATOMIC_RELEASE);
+    PFatomicStore(bpage->cleaning, FALSE);
+    pthread_cond_broadcast(&part->iodone);
+    pthread_mutex_unlock(&part->latch);
+  }
+  free(zero.pagebuf);
+  free((char *)fresh);
+  return (error);
 }
 
 /****************************************************************************
@@ -480,29 +2557,442 @@ RETURN VALUE: PF error codes.
 int PFbufUsed(int fd,     /* file descriptor */
               int pagenum /* page number */
 ) {
+  PFpart *part = PFpartOf(fd, pagenum);
   PFbpage *bpage; /* pointer to the bpage we are looking for */
+  int error = PFE_OK;
 
   /* Find page in the buffer */
-  if ((bpage = PFhashFind(fd, pagenum)) == NULL) {
+  pthread_mutex_lock(&part->latch);
+  if ((bpage = PFhashFind(&part->hash, fd, pagenum)) == NULL) {
     /* page not in the buffer */
-    PFerrno = PFE_PAGENOTINBUF;
-    return (PFerrno);
+    PFerrno = error = PFE_PAGENOTINBUF;
+    goto unlock;
   }
 
-  if (!(bpage->fixed)) {
+  if (PFatomicLoad(bpage->fixcount) <= bpage->cleaning + bpage->reading) {
     /* page not fixed */
-    PFerrno = PFE_PAGEUNFIXED;
-    return (PFerrno);
+    PFerrno = error = PFE_PAGEUNFIXED;
+    goto unlock;
   }
 
   /* mark this page dirty */
-  bpage->dirty = TRUE;
+  PFatomicStore(bpage->dirty, TRUE);
 
-  /* make this page head of the list of buffers*/
-  PFbufUnlink(bpage);
-  PFbufLinkHead(bpage);
+  /* make this page most recently used */
+  PFbufTouch(part, bpage);
 
-  return (PFE_OK);
+unlock:
+  pthread_mutex_unlock(&part->latch);
+  return (error);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Find out how many times page "pagenum" of file "fd" is fixed
+	in the buffer.
+
+RETURN VALUE:
+	The fix count, 0 if the page is unfixed or not in the buffer.
+	A fix held by the background writer, or by a read in flight,
+	is not counted.
+*****************************************************************************/
+int PFbufFixCount(int fd,     /* file descriptor */
+                  int pagenum /* page number */
+) {
+  PFpart *part = PFpartOf(fd, pagenum);
+  PFbpage *bpage;
+  int count = 0;
+
+  pthread_mutex_lock(&part->latch);
+  if ((bpage = PFhashFind(&part->hash, fd, pagenum)) != NULL)
+    count = PFatomicLoad(bpage->fixcount) - bpage->cleaning - bpage->reading;
+  pthread_mutex_unlock(&part->latch);
+  return (count);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Give page "pagenum" of file "fd", if it is in the buffer, the
+	priority "priority" (PF_HINT_...) for PFbufVictim(). The page
+	keeps it until it leaves the buffer, and comes back in at
+	PF_HINT_NORMAL. A page being read in is left as it is, and so
+	is one to be made PF_HINT_HIGH when half of the pages its
+	partition may hold are high already, so that some room is
+	always left to the policy. Both cases that change nothing, a
+	page that has the priority already and a full share of high
+	pages, are found without the latch, as an index scan hints
+	every page it fixes.
+
+RETURN VALUE: none
+*****************************************************************************/
+void PFbufHint(int fd,      /* file descriptor */
+               int pagenum, /* page number */
+               int priority /* PF_HINT_LOW, _NORMAL or _HIGH */
+) {
+  PFpart *part = PFpartOf(fd, pagenum);
+  PFbpage *bpage;
+
+  if (priority == PF_HINT_HIGH &&
+      PFatomicLoad(part->nhigh) >= PFatomicLoad(part->poolsize) / 2)
+    return;
+  if ((bpage = PFhashPeek(&part->hash, fd, pagenum)) != NULL &&
+      PFatomicLoad(bpage->fd) == fd && PFatomicLoad(bpage->page) == pagenum &&
+      PFatomicLoad(bpage->priority) == priority)
+    return;
+
+  pthread_mutex_lock(&part->latch);
+  if ((bpage = PFhashFind(&part->hash, fd, pagenum)) != NULL &&
+      !bpage->reading && bpage->priority != priority &&
+      (priority != PF_HINT_HIGH || part->nhigh < part->poolsize / 2))
+    PFbufSetHint(part, bpage, priority);
+  pthread_mutex_unlock(&part->latch);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Drop page "pagenum" of file "fd" from the buffer, if it is
+	there, without writing it: the page has been freed, and what
+	it holds is of no use. A read or a write of it in flight (see
+	PFbufBusy()) is waited for, and the background writer is kept
+	out meanwhile, so that no write of the page can land after this
+	returns.
+
+RETURN VALUE:
+	PFE_OK	if the page is not in the buffer any more.
+	PFE_PAGEFIXED	if it is fixed.
+	PF error code if other error.
+*****************************************************************************/
+int PFbufDrop(int fd,     /* file descriptor */
+              int pagenum /* page number */
+) {
+  PFpart *part = PFpartOf(fd, pagenum);
+  PFbpage *bpage;
+  int error = PFE_OK;
+
+  pthread_mutex_lock(&PFwriterlatch);
+  pthread_mutex_lock(&part->latch);
+  while ((bpage = PFhashFind(&part->hash, fd, pagenum)) != NULL &&
+         PFbufBusy(bpage))
+    pthread_cond_wait(&part->iodone, &part->latch);
+  if (bpage == NULL)
+    goto unlock;
+  if (!PFbufClose(bpage)) {
+    PFerrno = error = PFE_PAGEFIXED;
+    goto unlock;
+  }
+  bpage->dirty = FALSE;
+  if ((error = PFhashDelete(&part->hash, fd, pagenum)) != PFE_OK) {
+    /* internal error */
+    printf("Internal error:PFbufDrop()\n");
+    exit(1);
+  }
+  PFbufFileUnlink(fd, bpage);
+  PFbufUnlink(part, bpage);
+  PFbufSetHint(part, bpage, PF_HINT_NORMAL);
+  PFreplRemove(part, bpage, FALSE);
+  PFbufReopen(bpage);
+  PFbufInsertFree(part, bpage);
+
+unlock:
+  pthread_mutex_unlock(&part->latch);
+  pthread_mutex_unlock(&PFwriterlatch);
+  return (error);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Start the background writer, which writes pages with
+	writefcn() to keep at least "lowPct" percent of each partition
+	clean: whenever fewer are, it cleans the partition up to
+	"highPct" percent. If the writer runs already, it only takes
+	the new watermarks. Must not be called at the same time as
+	PFbufStopWriter().
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_WATERMARK	unless 0 < lowPct <= highPct <= 100.
+	PFE_UNIX	if the thread can not be created.
+*****************************************************************************/
+int PFbufStartWriter(int lowPct, int highPct,
+                     int (*writefcn)(int, int, PFfpage **, int)) {
+  int error = PFE_OK;
+
+  if (lowPct < 1 || lowPct > highPct || highPct > 100) {
+    PFerrno = PFE_WATERMARK;
+    return (PFerrno);
+  }
+
+  pthread_mutex_lock(&PFwriterlatch);
+  PFwriterlow = lowPct;
+  PFwriterhigh = highPct;
+  PFwriterfcn = writefcn;
+  if (!PFwriteron) {
+    PFatomicStore(PFwriteron, TRUE);
+    if ((errno = pthread_create(&PFwriterthread, NULL, PFwriterMain, NULL)) !=
+        0) {
+      PFatomicStore(PFwriteron, FALSE);
+      PFerrno = error = PFE_UNIX;
+    }
+  }
+  pthread_mutex_unlock(&PFwriterlatch);
+  return (error);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Stop the background writer, if it runs, and wait until it is
+	done with the pass it may be in.
+*****************************************************************************/
+void PFbufStopWriter(void) {
+  pthread_mutex_lock(&PFwriterlatch);
+  if (!PFwriteron) {
+    pthread_mutex_unlock(&PFwriterlatch);
+    return;
+  }
+  PFatomicStore(PFwriteron, FALSE);
+  pthread_cond_signal(&PFwritercond);
+  pthread_mutex_unlock(&PFwriterlatch);
+  pthread_join(PFwriterthread, NULL);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Add up the counters of the partitions into PFbufferPool, so
+	that it shows the whole pool. Under ARC the target sizes of
+	the partitions are added up too.
+
+GLOBAL VARIABLES MODIFIED:
+	PFbufferPool
+*****************************************************************************/
+void PFbufCollectStats(void) {
+  PFpart *part;
+  int i;
+
+  PFbufferPool.logicalPageRequests = 0;
+  PFbufferPool.logicalPageMisses = 0;
+  PFbufferPool.physicalReads = 0;
+  PFbufferPool.physicalWrites = 0;
+  PFbufferPool.pageAllocations = 0;
+  PFbufferPool.evictions = 0;
+  PFbufferPool.dirtyEvictions = 0;
+  PFbufferPool.writerWrites = 0;
+  PFbufferPool.writeCalls = 0;
+  PFbufferPool.readCalls = 0;
+  PFbufferPool.readAheadPages = 0;
+  PFbufferPool.ioWaits = 0;
+  PFbufferPool.arcTarget = 0;
+  for (i = 0; i < PFallparts; i++) {
+    part = &PFparts[i];
+    pthread_mutex_lock(&part->latch);
+    PFbufferPool.logicalPageRequests += PFatomicLoad(part->logicalPageRequests);
+    PFbufferPool.logicalPageMisses += PFatomicLoad(part->logicalPageMisses);
+    PFbufferPool.physicalReads += PFatomicLoad(part->physicalReads);
+    PFbufferPool.physicalWrites += PFatomicLoad(part->physicalWrites);
+    PFbufferPool.pageAllocations += PFatomicLoad(part->pageAllocations);
+    PFbufferPool.evictions += PFatomicLoad(part->evictions);
+    PFbufferPool.dirtyEvictions += PFatomicLoad(part->dirtyEvictions);
+    PFbufferPool.writerWrites += PFatomicLoad(part->writerWrites);
+    PFbufferPool.writeCalls += PFatomicLoad(part->writeCalls);
+    PFbufferPool.readCalls += PFatomicLoad(part->readCalls);
+    PFbufferPool.readAheadPages += PFatomicLoad(part->readAheadPages);
+    PFbufferPool.ioWaits += PFatomicLoad(part->ioWaits);
+    PFbufferPool.arcTarget += PFreplArcTarget(part);
+    pthread_mutex_unlock(&part->latch);
+  }
+  /* a request is counted before it is known to be a miss, so while
+  fixes run the two may be a little apart */
+  PFbufferPool.logicalPageHits =
+      PFbufferPool.logicalPageRequests > PFbufferPool.logicalPageMisses
+          ? PFbufferPool.logicalPageRequests - PFbufferPool.logicalPageMisses
+          : 0;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Zero the counters of every partition, of every file and of
+	PFbufferPool.
+
+GLOBAL VARIABLES MODIFIED:
+	PFbufferPool
+*****************************************************************************/
+void PFbufResetStats(void) {
+  PFbfile *chunk;
+  PFpart *part;
+  int i, c;
+
+  for (c = 0; c < PF_FTAB_CHUNKS; c++)
+    if ((chunk = PFatomicLoad(PFbfilechunk[c])) != NULL)
+      for (i = 0; i < PF_FTAB_CHUNK; i++)
+        PFbufFileResetStats(&chunk[i]);
+
+  for (i = 0; i < PFallparts; i++) {
+    part = &PFparts[i];
+    pthread_mutex_lock(&part->latch);
+    PFatomicStore(part->logicalPageRequests, 0);
+    PFatomicStore(part->logicalPageMisses, 0);
+    PFatomicStore(part->physicalReads, 0);
+    PFatomicStore(part->physicalWrites, 0);
+    PFatomicStore(part->pageAllocations, 0);
+    PFatomicStore(part->evictions, 0);
+    PFatomicStore(part->dirtyEvictions, 0);
+    PFatomicStore(part->writerWrites, 0);
+    PFatomicStore(part->writeCalls, 0);
+    PFatomicStore(part->readCalls, 0);
+    PFatomicStore(part->readAheadPages, 0);
+    PFatomicStore(part->ioWaits, 0);
+    pthread_mutex_unlock(&part->latch);
+  }
+  PFbufferPool.logicalPageRequests = 0;
+  PFbufferPool.logicalPageHits = 0;
+  PFbufferPool.logicalPageMisses = 0;
+  PFbufferPool.physicalReads = 0;
+  PFbufferPool.physicalWrites = 0;
+  PFbufferPool.pageAllocations = 0;
+  PFbufferPool.evictions = 0;
+  PFbufferPool.dirtyEvictions = 0;
+  PFbufferPool.writerWrites = 0;
+  PFbufferPool.writeCalls = 0;
+  PFbufferPool.readCalls = 0;
+  PFbufferPool.readAheadPages = 0;
+  PFbufferPool.ioWaits = 0;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Fill in *stats with the counters of the open file "fd" and the
+	# of its pages in the buffer, and of those dirty, which are
+	counted on the file's list of pages.
+
+RETURN VALUE: none
+*****************************************************************************/
+void PFbufFileStats(int fd, PF_FileStats *stats) {
+  PFbfile *file = PFbfileOf(fd);
+  PFbpage *bpage;
+
+  stats->hits = PFatomicLoad(file->hits);
+  stats->misses = PFatomicLoad(file->misses);
+  stats->reads = PFatomicLoad(file->reads);
+  stats->writes = PFatomicLoad(file->writes);
+  stats->evictions = PFatomicLoad(file->evictions);
+  stats->dirtyEvictions = PFatomicLoad(file->dirtyEvictions);
+  stats->pinWaits = PFatomicLoad(file->pinWaits);
+  stats->allocations = PFatomicLoad(file->allocations);
+  stats->dirtyPages = 0;
+  pthread_spin_lock(&file->latch);
+  stats->residentPages = file->npages;
+  for (bpage = file->first; bpage != NULL; bpage = bpage->fnext)
+    if (PFatomicLoad(bpage->dirty))
+      stats->dirtyPages++;
+  pthread_spin_unlock(&file->latch);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Set *resident to the # of pages in the buffer, of all page
+	sizes, and *dirty to the # of those that are dirty. Pages still
+	being read ahead are not counted.
+
+RETURN VALUE: none
+*****************************************************************************/
+void PFbufOccupancy(int *resident, int *dirty) {
+  PFpart *part;
+  PFbpage *bpage;
+  int i;
+
+  *resident = *dirty = 0;
+  for (i = 0; i < PFallparts; i++) {
+    part = &PFparts[i];
+    pthread_mutex_lock(&part->latch);
+    for (bpage = part->firstbpage; bpage != NULL; bpage = bpage->nextpage)
+      if (PFatomicLoad(bpage->fd) >= 0) {
+        (*resident)++;
+        if (PFatomicLoad(bpage->dirty))
+          (*dirty)++;
+      }
+    pthread_mutex_unlock(&part->latch);
+  }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Order warm pages hottest first (for qsort()).
+*****************************************************************************/
+static int PFbufCmpHeat(const void *a, const void *b) {
+  const PFwarmpage *x = (const PFwarmpage *)a;
+  const PFwarmpage *y = (const PFwarmpage *)b;
+
+  return ((x->heat > y->heat) ? -1 : (x->heat < y->heat));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	List the pages in the buffer, hottest first, in a new array
+	*pages that the caller frees. A page's heat is 1 if the policy
+	would keep it longer than the pages used once: its reference
+	bit is set under CLOCK, or it is on the frequency side of 2Q,
+	ARC or LRU-2 (see PFreplHot()). To that is added where it is
+	on its partition's used list, from 1 at the head, the most
+	recently used page under LRU and MRU and the most recently
+	brought in under the others, down to 0 at the tail, so the
+	partitions interleave. Pages being read ahead are left out.
+
+RETURN VALUE:
+	The # of pages listed.
+	PFE_NOMEM	if no memory.
+*****************************************************************************/
+int PFbufWarmPages(PFwarmpage **pages) {
+  PFpart *part;
+  PFbpage *bpage;
+  int i, n = 0, max = 0, pos;
+
+  for (i = 0; i < PFallparts; i++)
+    max += PFatomicLoad(PFparts[i].numbpage);
+  if ((*pages = (PFwarmpage *)malloc((max + 1) * sizeof(PFwarmpage))) ==
+      NULL) {
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+
+  for (i = 0; i < PFallparts; i++) {
+    part = &PFparts[i];
+    pthread_mutex_lock(&part->latch);
+    pos = 0;
+    for (bpage = part->firstbpage; bpage != NULL && n < max;
+         bpage = bpage->nextpage, pos++) {
+      if (PFatomicLoad(bpage->fd) < 0)
+        continue;
+      (*pages)[n].fd = bpage->fd;
+      (*pages)[n].page = bpage->page;
+      (*pages)[n].heat = 1.0 - (double)pos / part->numbpage;
+      if (PFbufferPool.replacement == PF_REPLACEMENT_CLOCK
+              ? PFatomicLoad(bpage->refbit)
+              : PFreplHot(bpage))
+        (*pages)[n].heat += 1.0;
+      n++;
+    }
+    pthread_mutex_unlock(&part->latch);
+  }
+  qsort(*pages, n, sizeof(PFwarmpage), PFbufCmpHeat);
+  return (n);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Print the page tables of the partitions.
+*****************************************************************************/
+void PFbufHashPrint(void) {
+  int i;
+
+  for (i = 0; i < PFallparts; i++) {
+    pthread_mutex_lock(&PFparts[i].latch);
+    /* the larger classes only once a file has used them */
+    if (PFparts[i].sizeclass == 0 || PFparts[i].numbpage > 0) {
+      if (PFnumparts > 1)
+        printf("partition %d: ", i);
+      PFhashPrint(&PFparts[i].hash);
+    }
+    pthread_mutex_unlock(&PFparts[i].latch);
+  }
 }
 
 /****************************************************************************
@@ -515,15 +3005,25 @@ AUTHOR: clc
 void PFbufPrint()
 {
 PFbpage *bpage;
+int empty;
+int i;
 
 	printf("buffer content:\n");
-	if (PFfirstbpage == NULL)
-		printf("empty\n");
-	else {
-		printf("fd\tpage\tfixed\tdirty\tfpage\n");
-		for(bpage = PFfirstbpage; bpage != NULL; bpage= bpage->nextpage)
+	empty = TRUE;
+	for (i = 0; i < PFallparts; i++) {
+		pthread_mutex_lock(&PFparts[i].latch);
+		for(bpage = PFparts[i].firstbpage; bpage != NULL;
+		    bpage= bpage->nextpage) {
+			if (empty) {
+				printf("fd\tpage\tfixed\tdirty\tfpage\n");
+				empty = FALSE;
+			}
 			printf("%d\t%d\t%d\t%d\t%lu\n",
-				bpage->fd,bpage->page,(int)bpage->fixed,
-				(int)bpage->dirty,(uintptr_t)&bpage->fpage);
+				bpage->fd,bpage->page,bpage->fixcount,
+				(int)bpage->dirty,(uintptr_t)bpage->fpage.pagebuf);
+		}
+		pthread_mutex_unlock(&PFparts[i].latch);
 	}
+	if (empty)
+		printf("empty\n");
 }
@@ -0,0 +1,388 @@
+/* crc.c: CRC-32C (Castagnoli) of page data, for the page checksums of
+files made with PF_FILE_CHECKSUM. The fastest way the processor has is
+picked when first needed:
+	- with AVX-512 and VPCLMULQDQ, the data is folded 256 bytes at a
+	time by carry-less multiplies, as in Intel's "Fast CRC Computation
+	Using PCLMULQDQ", down to 16 bytes that the crc32 instruction
+	finishes;
+	- with SSE4.2, the crc32 instruction does it all, on three streams
+	at once so that its latency is hidden; the three CRCs are then
+	joined with tables that shift a CRC over a run of zero bytes;
+	- elsewhere an eight-table ("slicing by 8") software version is
+	used.
+All give the same result. */
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "pf.h"
+#include "pftypes.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define PF_CRC_POLY	0x82f63b78	/* CRC-32C polynomial, reflected */
+#define PF_CRC_LONG	4096		/* bytes per stream in the long loop */
+#define PF_CRC_SHORT	256		/* bytes per stream in the short loop */
+#define PF_CRC_FOLD	256		/* bytes folded at a time */
+
+static uint32_t PFcrctable[8][256];	/* slicing-by-8 tables */
+static uint32_t PFcrclong[4][256];	/* shift by PF_CRC_LONG zero bytes */
+static uint32_t PFcrcshort[4][256];	/* shift by PF_CRC_SHORT zero bytes */
+static uint64_t PFcrcfold[3][2];	/* folding constants: to move 16 bytes
+					forward by PF_CRC_FOLD, 64 and 16
+					bytes */
+static int PFcrcbest = PF_CRC_SOFT;	/* fastest way the processor has */
+static int PFcrcmethod;			/* way PFcrc32c() computes */
+static pthread_once_t PFcrconce = PTHREAD_ONCE_INIT;
+
+/****************************************************************************
+SPECIFICATIONS:
+	Multiply the vector "vec" by the 32x32 GF(2) matrix "mat", whose
+	columns are mat[0] to mat[31].
+
+RETURN VALUE:
+	The product.
+*****************************************************************************/
+static uint32_t PFgf2Times(const uint32_t *mat, uint32_t vec) {
+  uint32_t sum = 0;
+
+  for (; vec != 0; vec >>= 1, mat++)
+    if (vec & 1)
+      sum ^= *mat;
+  return (sum);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Set "square" to the square of the GF(2) matrix "mat".
+*****************************************************************************/
+static void PFgf2Square(uint32_t *square, const uint32_t *mat) {
+  int n;
+
+  for (n = 0; n < 32; n++)
+    square[n] = PFgf2Times(mat, mat[n]);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Fill "zeros" with the tables that move a CRC over "len" zero
+	bytes, one table per byte of the CRC. "len" must be a power of
+	two.
+*****************************************************************************/
+static void PFcrcZeros(uint32_t zeros[4][256], size_t len) {
+  uint32_t even[32], odd[32];
+  uint32_t row = 1;
+  int n;
+
+  /* the operator for one zero bit, then for two and four */
+  odd[0] = PF_CRC_POLY;
+  for (n = 1; n < 32; n++) {
+    odd[n] = row;
+    row <<= 1;
+  }
+  PFgf2Square(even, odd);
+  PFgf2Square(odd, even);
+
+  /* square it up to one zero byte, two, four, ... "len" */
+  for (;;) {
+    PFgf2Square(even, odd);
+    len >>= 1;
+    if (len == 0) {
+      memcpy(odd, even, sizeof(odd));
+      break;
+    }
+    PFgf2Square(odd, even);
+    len >>= 1;
+    if (len == 0)
+      break;
+  }
+
+  for (n = 0; n < 256; n++) {
+    zeros[0][n] = PFgf2Times(odd, n);
+    zeros[1][n] = PFgf2Times(odd, n << 8);
+    zeros[2][n] = PFgf2Times(odd, n << 16);
+    zeros[3][n] = PFgf2Times(odd, (uint32_t)n << 24);
+  }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Compute x^n modulo the CRC-32C polynomial, bit-reflected as the
+	CRC is (the top bit is x^0), and shifted left one bit, as the
+	carry-less multiplies of the folding want it.
+
+RETURN VALUE:
+	The folding constant.
+*****************************************************************************/
+static uint64_t PFcrcXn(int n) {
+  uint32_t r = 0x80000000;	/* x^0 */
+
+  while (n-- > 0)
+    r = (r & 1) ? (r >> 1) ^ PF_CRC_POLY : r >> 1;
+  return ((uint64_t)r << 1);
+}
+
+/* move "crc" over the zero bytes of the tables "zeros" */
+#define PFcrcShift(zeros, crc) \
+	((zeros)[0][(crc) & 0xff] ^ (zeros)[1][((crc) >> 8) & 0xff] ^ \
+	 (zeros)[2][((crc) >> 16) & 0xff] ^ (zeros)[3][(crc) >> 24])
+
+/****************************************************************************
+SPECIFICATIONS:
+	Build the tables and find out the fastest way the processor
+	has. Run once, by the first call here.
+*****************************************************************************/
+static void PFcrcInit(void) {
+  uint32_t crc;
+  int n, k;
+
+  for (n = 0; n < 256; n++) {
+    crc = n;
+    for (k = 0; k < 8; k++)
+      crc = (crc & 1) ? (crc >> 1) ^ PF_CRC_POLY : crc >> 1;
+    PFcrctable[0][n] = crc;
+  }
+  for (n = 0; n < 256; n++) {
+    crc = PFcrctable[0][n];
+    for (k = 1; k < 8; k++) {
+      crc = PFcrctable[0][crc & 0xff] ^ (crc >> 8);
+      PFcrctable[k][n] = crc;
+    }
+  }
+  PFcrcZeros(PFcrclong, PF_CRC_LONG);
+  PFcrcZeros(PFcrcshort, PF_CRC_SHORT);
+
+  /* the low half of 16 bytes moved d bytes forward is multiplied by
+  x^(8d+32), the high half by x^(8d-32) */
+  for (n = 0; n < 3; n++) {
+    k = n == 0 ? PF_CRC_FOLD : n == 1 ? 64 : 16;
+    PFcrcfold[n][0] = PFcrcXn(8 * k + 32);
+    PFcrcfold[n][1] = PFcrcXn(8 * k - 32);
+  }
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2"))
+    PFcrcbest = PF_CRC_SSE42;
+  if (PFcrcbest == PF_CRC_SSE42 && __builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("vpclmulqdq") &&
+      __builtin_cpu_supports("pclmul"))
+    PFcrcbest = PF_CRC_VPCLMUL;
+#endif
+  PFcrcmethod = PFcrcbest;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Continue the CRC-32C "crc" over the "len" bytes at "buf", in
+	software.
+
+RETURN VALUE:
+	The new CRC.
+*****************************************************************************/
+unsigned int PFcrc32cSoft(unsigned int crc, const void *buf, size_t len) {
+  const unsigned char *next = (const unsigned char *)buf;
+  uint64_t word;
+
+  pthread_once(&PFcrconce, PFcrcInit);
+  crc = ~crc;
+  while (len > 0 && ((uintptr_t)next & 7) != 0) {
+    crc = PFcrctable[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+    len--;
+  }
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  for (; len >= 8; len -= 8, next += 8) {
+    memcpy(&word, next, 8);
+    word ^= crc;
+    crc = PFcrctable[7][word & 0xff] ^ PFcrctable[6][(word >> 8) & 0xff] ^
+          PFcrctable[5][(word >> 16) & 0xff] ^
+          PFcrctable[4][(word >> 24) & 0xff] ^
+          PFcrctable[3][(word >> 32) & 0xff] ^
+          PFcrctable[2][(word >> 40) & 0xff] ^
+          PFcrctable[1][(word >> 48) & 0xff] ^ PFcrctable[0][word >> 56];
+  }
+#endif
+  while (len > 0) {
+    crc = PFcrctable[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+    len--;
+  }
+  return (~crc);
+}
+
+#if defined(__x86_64__)
+/****************************************************************************
+SPECIFICATIONS:
+	Run the crc32 instruction from "crc" over the "len" bytes at
+	"buf", reading three streams at a time. Unlike PFcrc32c(), it
+	does not invert the CRC before and after.
+
+RETURN VALUE:
+	The new CRC.
+*****************************************************************************/
+__attribute__((target("sse4.2"))) static uint32_t
+PFcrcSse42(uint32_t crc, const void *buf, size_t len) {
+  const unsigned char *next = (const unsigned char *)buf;
+  const unsigned char *end;
+  uint64_t crc0, crc1, crc2;
+  uint64_t w0, w1, w2;
+
+  crc0 = crc;
+  while (len > 0 && ((uintptr_t)next & 7) != 0) {
+    crc0 = _mm_crc32_u8((uint32_t)crc0, *next++);
+    len--;
+  }
+
+  /* three streams of PF_CRC_LONG bytes, then of PF_CRC_SHORT bytes;
+  the CRC of each stream is shifted over the next and joined to it */
+  while (len >= 3 * PF_CRC_LONG) {
+    crc1 = crc2 = 0;
+    end = next + PF_CRC_LONG;
+    do {
+      memcpy(&w0, next, 8);
+      memcpy(&w1, next + PF_CRC_LONG, 8);
+      memcpy(&w2, next + 2 * PF_CRC_LONG, 8);
+      crc0 = _mm_crc32_u64(crc0, w0);
+      crc1 = _mm_crc32_u64(crc1, w1);
+      crc2 = _mm_crc32_u64(crc2, w2);
+      next += 8;
+    } while (next < end);
+    crc0 = PFcrcShift(PFcrclong, (uint32_t)crc0) ^ crc1;
+    crc0 = PFcrcShift(PFcrclong, (uint32_t)crc0) ^ crc2;
+    next += 2 * PF_CRC_LONG;
+    len -= 3 * PF_CRC_LONG;
+  }
+  while (len >= 3 * PF_CRC_SHORT) {
+    crc1 = crc2 = 0;
+    end = next + PF_CRC_SHORT;
+    do {
+      memcpy(&w0, next, 8);
+      memcpy(&w1, next + PF_CRC_SHORT, 8);
+      memcpy(&w2, next + 2 * PF_CRC_SHORT, 8);
+      crc0 = _mm_crc32_u64(crc0, w0);
+      crc1 = _mm_crc32_u64(crc1, w1);
+      crc2 = _mm_crc32_u64(crc2, w2);
+      next += 8;
+    } while (next < end);
+    crc0 = PFcrcShift(PFcrcshort, (uint32_t)crc0) ^ crc1;
+    crc0 = PFcrcShift(PFcrcshort, (uint32_t)crc0) ^ crc2;
+    next += 2 * PF_CRC_SHORT;
+    len -= 3 * PF_CRC_SHORT;
+  }
+
+  /* what is left, one stream */
+  for (; len >= 8; len -= 8, next += 8) {
+    memcpy(&w0, next, 8);
+    crc0 = _mm_crc32_u64(crc0, w0);
+  }
+  while (len > 0) {
+    crc0 = _mm_crc32_u8((uint32_t)crc0, *next++);
+    len--;
+  }
+  return ((uint32_t)crc0);
+}
+
+/* move the 16-byte lanes of "x" forward by the distance of the constants
+"k" and add them to "y" */
+#define PFcrcFold512(x, k, y) _mm512_ternarylogic_epi64( \
+		_mm512_clmulepi64_epi128((x), (k), 0x00), \
+		_mm512_clmulepi64_epi128((x), (k), 0x11), (y), 0x96)
+#define PFcrcFold128(x, k, y) _mm_xor_si128(_mm_xor_si128( \
+		_mm_clmulepi64_si128((x), (k), 0x00), \
+		_mm_clmulepi64_si128((x), (k), 0x11)), (y))
+
+/****************************************************************************
+SPECIFICATIONS:
+	Run the CRC from "crc" over the "len" bytes at "buf", at least
+	PF_CRC_FOLD, folding the data into four 64-byte registers with
+	VPCLMULQDQ, those into one, then into 16 bytes, taking in what
+	is left 64 and then 16 bytes at a time. The crc32 instruction
+	does the last 16 bytes and the few after them. Like
+	PFcrcSse42(), it does not invert the CRC before and after.
+
+RETURN VALUE:
+	The new CRC.
+*****************************************************************************/
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.2"))) static uint32_t
+PFcrcVpclmul(uint32_t crc, const void *buf, size_t len) {
+  const char *next = (const char *)buf;
+  __m512i x0, x1, x2, x3, k;
+  __m128i a, k16;
+
+  /* the CRC so far is added to the first four bytes */
+  x0 = _mm512_xor_si512(_mm512_loadu_si512(next),
+                        _mm512_castsi128_si512(_mm_cvtsi32_si128(crc)));
+  x1 = _mm512_loadu_si512(next + 64);
+  x2 = _mm512_loadu_si512(next + 128);
+  x3 = _mm512_loadu_si512(next + 192);
+  next += PF_CRC_FOLD;
+  len -= PF_CRC_FOLD;
+
+  k = _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i *)PFcrcfold[0]));
+  for (; len >= PF_CRC_FOLD; len -= PF_CRC_FOLD, next += PF_CRC_FOLD) {
+    x0 = PFcrcFold512(x0, k, _mm512_loadu_si512(next));
+    x1 = PFcrcFold512(x1, k, _mm512_loadu_si512(next + 64));
+    x2 = PFcrcFold512(x2, k, _mm512_loadu_si512(next + 128));
+    x3 = PFcrcFold512(x3, k, _mm512_loadu_si512(next + 192));
+  }
+
+  /* four registers into one, which takes in the rest 64 bytes at a
+  time, then its four lanes into one, which takes in the rest 16 bytes
+  at a time */
+  k = _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i *)PFcrcfold[1]));
+  x1 = PFcrcFold512(x0, k, x1);
+  x2 = PFcrcFold512(x1, k, x2);
+  x3 = PFcrcFold512(x2, k, x3);
+  for (; len >= 64; len -= 64, next += 64)
+    x3 = PFcrcFold512(x3, k, _mm512_loadu_si512(next));
+  k16 = _mm_loadu_si128((__m128i *)PFcrcfold[2]);
+  a = _mm512_extracti32x4_epi32(x3, 0);
+  a = PFcrcFold128(a, k16, _mm512_extracti32x4_epi32(x3, 1));
+  a = PFcrcFold128(a, k16, _mm512_extracti32x4_epi32(x3, 2));
+  a = PFcrcFold128(a, k16, _mm512_extracti32x4_epi32(x3, 3));
+  for (; len >= 16; len -= 16, next += 16)
+    a = PFcrcFold128(a, k16, _mm_loadu_si128((__m128i *)next));
+
+  crc = _mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(a));
+  crc = _mm_crc32_u64(crc, (uint64_t)_mm_extract_epi64(a, 1));
+  return (PFcrcSse42(crc, next, len));
+}
+#endif
+
+/****************************************************************************
+SPECIFICATIONS:
+	Continue the CRC-32C "crc" (0 to start one) over the "len"
+	bytes at "buf", the fastest way the processor has unless
+	PFcrc32cSetMethod() says otherwise.
+
+RETURN VALUE:
+	The new CRC.
+*****************************************************************************/
+unsigned int PFcrc32c(unsigned int crc, const void *buf, size_t len) {
+  pthread_once(&PFcrconce, PFcrcInit);
+#if defined(__x86_64__)
+  if (PFcrcmethod == PF_CRC_VPCLMUL && len >= PF_CRC_FOLD)
+    return (~PFcrcVpclmul(~crc, buf, len));
+  if (PFcrcmethod != PF_CRC_SOFT)
+    return (~PFcrcSse42(~crc, buf, len));
+#endif
+  return (PFcrc32cSoft(crc, buf, len));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Make PFcrc32c() compute by "method": PF_CRC_SOFT, PF_CRC_SSE42
+	or PF_CRC_VPCLMUL, if the processor can, or by the fastest way
+	it has if "method" is -1. For tests and benchmarks; no thread
+	may be computing a CRC meanwhile.
+
+RETURN VALUE:
+	The method now used, which is not "method" if the processor
+	can not do it.
+*****************************************************************************/
+int PFcrc32cSetMethod(int method /* PF_CRC_..., or -1 */
+) {
+  pthread_once(&PFcrconce, PFcrcInit);
+  if (method >= PF_CRC_SOFT && method <= PFcrcbest)
+    PFcrcmethod = method;
+  else if (method == -1)
+    PFcrcmethod = PFcrcbest;
+  return (PFcrcmethod);
+}
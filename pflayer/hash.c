@@ -1,37 +1,221 @@
 /* hash.c: Functions to facilitate finding the buffer page given
-a file descriptor and a page number */
+a file descriptor and a page number. Each partition of the buffer
+pool has a table of its own, passed in as "tab"; the caller holds
+the partition latch, except for PFhashPeek(). Entries are stored
+with atomic writes, and moved only between PFhashWriteBegin() and
+PFhashWriteEnd(), so that PFhashPeek() can read the table at the same
+time. */
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "pf.h"
 #include "pftypes.h"
 
-/* hash table */
-static PFhash_entry *PFhashtbl[PF_HASH_TBL_SIZE];
+/****************************************************************************
+SPECIFICATIONS:
+	Allocate an empty table of "size" slots. "size" must be a
+	power of two.
+
+RETURN VALUE:
+	Pointer to the slots, or NULL if no memory.
+*****************************************************************************/
+static PFhash_entry *PFhashAllocSlots(unsigned int size) {
+  PFhash_entry *slots;
+  unsigned int i;
+
+  if ((slots = (PFhash_entry *)malloc(size * sizeof(PFhash_entry))) == NULL)
+    return (NULL);
+  for (i = 0; i < size; i++) {
+    slots[i].fd = PF_HASH_EMPTY;
+    slots[i].bpage = NULL;
+  }
+  return (slots);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Start and end a change to "tab" that may move or tear entries.
+	PFhashPeek() calls that overlap the change fail.
+*****************************************************************************/
+static void PFhashWriteBegin(PFhashtab *tab) {
+  __atomic_store_n(&tab->seq, tab->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void PFhashWriteEnd(PFhashtab *tab) {
+  __atomic_store_n(&tab->seq, tab->seq + 1, __ATOMIC_RELEASE);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Store (fd,page,bpage) in slot "i" of "tab". "fd" goes last, so
+	a reader that sees it sees the rest.
+*****************************************************************************/
+static void PFhashSetSlot(PFhashtab *tab, unsigned int i, int fd, int page,
+                          PFbpage *bpage) {
+  __atomic_store_n(&tab->slots[i].bpage, bpage, __ATOMIC_RELAXED);
+  __atomic_store_n(&tab->slots[i].page, page, __ATOMIC_RELAXED);
+  __atomic_store_n(&tab->slots[i].fd, fd, __ATOMIC_RELEASE);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Return the number of slots to use for a table holding at most
+	"numbuf" pages: the smallest power of two that keeps the load
+	factor at or below 1/2.
+*****************************************************************************/
+static unsigned int PFhashSizeFor(int numbuf) {
+  unsigned int size;
+
+  for (size = PF_HASH_MIN_SIZE; size < 2 * (unsigned int)numbuf; size <<= 1)
+    ;
+  return (size);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Find the slot holding (fd,page), or the empty slot that ends
+	its probe sequence.
+
+RETURN VALUE:
+	Index of the slot.
+*****************************************************************************/
+static unsigned int PFhashProbe(PFhashtab *tab, int fd, int page) {
+  unsigned int i;
+
+  for (i = PFhash(fd, page) & tab->mask; tab->slots[i].fd != PF_HASH_EMPTY;
+       i = (i + 1) & tab->mask) {
+    if (tab->slots[i].fd == fd && tab->slots[i].page == page)
+      break;
+  }
+  return (i);
+}
 
 /****************************************************************************
 SPECIFICATIONS:
-	Init the hash table entries. Must be called before any of the other
-	hash functions are used.
+	Move the table to "size" slots, rehashing every entry.
+	Only called when the buffer pool is resized, or if the table
+	grows past the size it was initialised for, so never in the
+	normal buffer paths. The old slots are kept until PFhashFree().
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_NOMEM	if no memory. The old table is left intact.
+*****************************************************************************/
+static int PFhashRehash(PFhashtab *tab, unsigned int size) {
+  PFhash_entry *old;
+  PFhash_entry *slots;
+  PFhash_entry **oldslots;
+  unsigned int oldsize;
+  unsigned int mask;
+  unsigned int i;
+  unsigned int j;
+
+  if ((slots = PFhashAllocSlots(size)) == NULL ||
+      (oldslots = (PFhash_entry **)realloc(
+           (char *)tab->oldslots,
+           (tab->noldslots + 1) * sizeof(PFhash_entry *))) == NULL) {
+    free((char *)slots);
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  tab->oldslots = oldslots;
+
+  /* fill the new slots before anybody can see them */
+  old = tab->slots;
+  oldsize = (old == NULL) ? 0 : tab->mask + 1;
+  mask = size - 1;
+  for (i = 0; i < oldsize; i++) {
+    if (old[i].fd == PF_HASH_EMPTY)
+      continue;
+    for (j = PFhash(old[i].fd, old[i].page) & mask;
+         slots[j].fd != PF_HASH_EMPTY; j = (j + 1) & mask)
+      ;
+    slots[j] = old[i];
+  }
+
+  PFhashWriteBegin(tab);
+  __atomic_store_n(&tab->slots, slots, __ATOMIC_RELAXED);
+  __atomic_store_n(&tab->mask, mask, __ATOMIC_RELAXED);
+  PFhashWriteEnd(tab);
+  if (old != NULL)
+    tab->oldslots[tab->noldslots++] = old;
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Init the hash table entries of "tab", sized to hold "numbuf"
+	pages. A table that is all zeroes needs no init: the first
+	insertion sizes it for PF_MAX_BUFS pages. Nobody may be reading
+	the table meanwhile.
 
 AUTHOR: clc
 
 RETURN VALUE: none
+*****************************************************************************/
+void PFhashInit(PFhashtab *tab, int numbuf) {
+  unsigned int size;
+  unsigned int i;
+
+  size = PFhashSizeFor(numbuf);
+  if (tab->slots == NULL || tab->mask + 1 != size) {
+    free((char *)tab->slots);
+    tab->slots = NULL;
+    if ((tab->slots = PFhashAllocSlots(size)) == NULL) {
+      printf("Internal error:PFhashInit()\n");
+      exit(1);
+    }
+    tab->mask = size - 1;
+  } else
+    for (i = 0; i < size; i++)
+      tab->slots[i].fd = PF_HASH_EMPTY;
+  tab->count = 0;
+}
 
-GLOBAL VARIABLES MODIFIED:
-	PFhashtbl
+/****************************************************************************
+SPECIFICATIONS:
+	Give back the slots of "tab", leaving it all zeroes.
 *****************************************************************************/
-void PFhashInit() {
+void PFhashFree(PFhashtab *tab) {
   int i;
 
-  for (i = 0; i < PF_HASH_TBL_SIZE; i++)
-    PFhashtbl[i] = NULL;
+  free((char *)tab->slots);
+  for (i = 0; i < tab->noldslots; i++)
+    free((char *)tab->oldslots[i]);
+  free((char *)tab->oldslots);
+  tab->slots = NULL;
+  tab->mask = 0;
+  tab->count = 0;
+  tab->seq = 0;
+  tab->oldslots = NULL;
+  tab->noldslots = 0;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Resize the hash table "tab" to hold "numbuf" pages, keeping its
+	entries. Used when the buffer pool is resized.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_NOMEM	if no memory. The old table is left intact.
+*****************************************************************************/
+int PFhashResize(PFhashtab *tab, int numbuf) {
+  unsigned int size;
+
+  if (numbuf < tab->count)
+    numbuf = tab->count;
+  size = PFhashSizeFor(numbuf);
+  if (tab->slots != NULL && tab->mask + 1 == size)
+    return (PFE_OK);
+  return (PFhashRehash(tab, size));
 }
 
 /****************************************************************************
 SPECIFICATIONS:
 	Given the file descriptor "fd", and page number "page",
-	find the buffer address of this particular page.
+	find the buffer address of this particular page in table "tab".
 
 AUTHOR: clc
 
@@ -40,30 +224,79 @@ RETURN VALUE:
 	Buffer address, if found.
 
 *****************************************************************************/
-PFbpage *PFhashFind(int fd,  /* file descriptor */
-                    int page /* page number */
+PFbpage *PFhashFind(PFhashtab *tab, /* table to look in */
+                    int fd,         /* file descriptor */
+                    int page        /* page number */
 ) {
-  int bucket;          /* bucket to look for the page*/
-  PFhash_entry *entry; /* ptr to entries to search */
+  unsigned int i; /* slot to look for the page*/
 
-  /* See which bucket it is in */
-  bucket = PFhash(fd, page);
+  if (tab->slots == NULL)
+    return (NULL);
 
-  /* go through the linked list of this bucket */
-  for (entry = PFhashtbl[bucket]; entry != NULL; entry = entry->nextentry) {
-    if (entry->fd == fd && entry->page == page)
-      /* found it */
-      return (entry->bpage);
+  /* follow the probe sequence until the page or an empty slot */
+  i = PFhashProbe(tab, fd, page);
+  if (tab->slots[i].fd == PF_HASH_EMPTY)
+    /* not found */
+    return (NULL);
+  return (tab->slots[i].bpage);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Like PFhashFind(), but without the partition latch: the table
+	is read with atomic loads and the read is checked against the
+	sequence number of the table. The buffer page found may be
+	paged out by the time it is returned, so the caller must check
+	that it still holds the page once it has it fixed.
+
+RETURN VALUE:
+	Buffer address, if found.
+	NULL	if not found, or if the table changed during the read.
+*****************************************************************************/
+PFbpage *PFhashPeek(PFhashtab *tab, /* table to look in */
+                    int fd,         /* file descriptor */
+                    int page        /* page number */
+) {
+  PFhash_entry *slots;
+  PFbpage *bpage = NULL;
+  unsigned long seq;
+  unsigned int mask;
+  unsigned int i;
+  int slotfd;
+
+  /* get slots and mask that belong together */
+  seq = __atomic_load_n(&tab->seq, __ATOMIC_ACQUIRE);
+  if (seq & 1)
+    return (NULL);
+  slots = __atomic_load_n(&tab->slots, __ATOMIC_RELAXED);
+  mask = __atomic_load_n(&tab->mask, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (slots == NULL || __atomic_load_n(&tab->seq, __ATOMIC_RELAXED) != seq)
+    return (NULL);
+
+  /* follow the probe sequence until the page or an empty slot */
+  for (i = PFhash(fd, page) & mask;
+       (slotfd = __atomic_load_n(&slots[i].fd, __ATOMIC_ACQUIRE)) !=
+       PF_HASH_EMPTY;
+       i = (i + 1) & mask) {
+    if (slotfd == fd &&
+        __atomic_load_n(&slots[i].page, __ATOMIC_RELAXED) == page) {
+      bpage = __atomic_load_n(&slots[i].bpage, __ATOMIC_RELAXED);
+      break;
+    }
   }
 
-  /* not found */
-  return (NULL);
+  /* an entry moved meanwhile may have been missed or torn */
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&tab->seq, __ATOMIC_RELAXED) != seq)
+    return (NULL);
+  return (bpage);
 }
 
 /*****************************************************************************
 SPECIFICATIONS:
 	Insert the file descriptor "fd", page number "page", and the
-	buffer address "bpage" into the hash table.
+	buffer address "bpage" into the hash table "tab".
 
 AUTHOR: clc
 
@@ -71,42 +304,33 @@ RETURN VALUE:
 	PFE_OK	if OK
 	PFE_NOMEM	if nomem
 	PFE_HASHPAGEEXIST if the page already exists.
-
-GLOBAL VARIABLES MODIFIED:
-	PFhashtbl
 *****************************************************************************/
-int PFhashInsert(int fd,        /* file descriptor */
-                 int page,      /* page number */
-                 PFbpage *bpage /* buffer address for this page */
+int PFhashInsert(PFhashtab *tab,   /* table to insert into */
+                 int fd,           /* file descriptor */
+                 int page,         /* page number */
+                 PFbpage *bpage    /* buffer address for this page */
 ) {
-  int bucket;          /* bucket to insert the page */
-  PFhash_entry *entry; /* pointer to new entry */
+  unsigned int i; /* slot to insert the page */
+  int error;
 
-  if (PFhashFind(fd, page) != NULL) {
-    /* page already inserted */
-    PFerrno = PFE_HASHPAGEEXIST;
-    return (PFerrno);
-  }
+  if (tab->slots == NULL)
+    PFhashInit(tab, PF_MAX_BUFS);
 
-  /* find the bucket for this page */
-  bucket = PFhash(fd, page);
+  /* keep the load factor at or below 1/2 */
+  if (2 * (unsigned)(tab->count + 1) > tab->mask + 1 &&
+      (error = PFhashRehash(tab, 2 * (tab->mask + 1))) != PFE_OK)
+    return (error);
 
-  /* allocate mem for new entry */
-  if ((entry = (PFhash_entry *)malloc(sizeof(PFhash_entry))) == NULL) {
-    /* no mem */
-    PFerrno = PFE_NOMEM;
+  i = PFhashProbe(tab, fd, page);
+  if (tab->slots[i].fd != PF_HASH_EMPTY) {
+    /* page already inserted */
+    PFerrno = PFE_HASHPAGEEXIST;
     return (PFerrno);
   }
 
-  /* Insert entry as head of list for this bucket */
-  entry->fd = fd;
-  entry->page = page;
-  entry->bpage = bpage;
-  entry->nextentry = PFhashtbl[bucket];
-  entry->preventry = NULL;
-  if (PFhashtbl[bucket] != NULL)
-    PFhashtbl[bucket]->preventry = entry;
-  PFhashtbl[bucket] = entry;
+  /* fill the empty slot that ended the probe */
+  PFhashSetSlot(tab, i, fd, page, bpage);
+  tab->count++;
 
   return (PFE_OK);
 }
@@ -114,68 +338,71 @@ int PFhashInsert(int fd,        /* file descriptor */
 /****************************************************************************
 SPECIFICATIONS:
 	Delete the entry whose file descriptor is "fd", and whose page number
-	is "page" from the hash table.
+	is "page" from the hash table "tab".
+
+ALGORITHM:
+	Backward-shift deletion: after emptying the slot, entries
+	further along the same probe run are moved back into the hole
+	whenever their home slot does not lie between the hole and
+	their current slot. No tombstones are left behind, so lookups
+	never get slower as pages come and go.
 
 AUTHOR: clc
 
 RETURN VALUE:
 	PFE_OK	if OK
 	PFE_HASHNOTFOUND if can't find the entry
-
-GLOBAL VARIABLES MODIFIED:
-	PFhashtbl
 *****************************************************************************/
-int PFhashDelete(int fd,  /* file descriptor */
-                 int page /* page number */
+int PFhashDelete(PFhashtab *tab, /* table to delete from */
+                 int fd,         /* file descriptor */
+                 int page        /* page number */
 ) {
-  int bucket;          /* bucket for this page */
-  PFhash_entry *entry; /* entry to look for */
-
-  /* find the bucket */
-  bucket = PFhash(fd, page);
+  unsigned int hole; /* slot being emptied */
+  unsigned int i;    /* slot being examined */
+  unsigned int home; /* home slot of the entry in slot i */
 
-  /* See if the entry is in this bucket */
-  for (entry = PFhashtbl[bucket]; entry != NULL; entry = entry->nextentry)
-    if (entry->fd == fd && entry->page == page)
-      break;
-
-  if (entry == NULL) {
+  if (tab->slots == NULL ||
+      tab->slots[hole = PFhashProbe(tab, fd, page)].fd == PF_HASH_EMPTY) {
     /* not found */
     PFerrno = PFE_HASHNOTFOUND;
     return (PFerrno);
   }
 
-  /* get rid of this entry */
-  if (entry == PFhashtbl[bucket])
-    PFhashtbl[bucket] = entry->nextentry;
-  if (entry->preventry != NULL)
-    entry->preventry->nextentry = entry->nextentry;
-  if (entry->nextentry != NULL)
-    entry->nextentry->preventry = entry->preventry;
-  free((char *)entry);
+  /* get rid of this entry, pulling back the rest of its run */
+  PFhashWriteBegin(tab);
+  for (i = (hole + 1) & tab->mask; tab->slots[i].fd != PF_HASH_EMPTY;
+       i = (i + 1) & tab->mask) {
+    home = PFhash(tab->slots[i].fd, tab->slots[i].page) & tab->mask;
+    if (((i - home) & tab->mask) >= ((i - hole) & tab->mask)) {
+      PFhashSetSlot(tab, hole, tab->slots[i].fd, tab->slots[i].page,
+                    tab->slots[i].bpage);
+      hole = i;
+    }
+  }
+  __atomic_store_n(&tab->slots[hole].fd, PF_HASH_EMPTY, __ATOMIC_RELAXED);
+  PFhashWriteEnd(tab);
+  tab->count--;
 
   return (PFE_OK);
 }
 
 /****************************************************************************
 SPECIFICATIONS:
-	Print the hash table entries.
+	Print the entries of hash table "tab".
 
 AUTHOR: clc
 
 RETURN VALUE: None
 *****************************************************************************/
-void PFhashPrint() {
-  int i;
-  PFhash_entry *entry;
-
-  for (i = 0; i < PF_HASH_TBL_SIZE; i++) {
-    printf("bucket %d\n", i);
-    if (PFhashtbl[i] == NULL)
-      printf("\tempty\n");
-    else {
-      for (entry = PFhashtbl[i]; entry != NULL; entry = entry->nextentry)
-        printf("\tfd: %d, page: %d %lu\n", entry->fd, entry->page, (uintptr_t)entry->bpage);
-    }
+void PFhashPrint(PFhashtab *tab) {
+  unsigned int i;
+
+  printf("%d entries\n", tab->count);
+  if (tab->slots == NULL)
+    return;
+  for (i = 0; i <= tab->mask; i++) {
+    if (tab->slots[i].fd != PF_HASH_EMPTY)
+      printf("slot %u\tfd: %d, page: %d %lu\n", i, tab->slots[i].fd,
+             tab->slots[i].page, (uintptr_t)tab->slots[i].bpage);
   }
 }
@@ -0,0 +1,414 @@
+/* io.c: asynchronous reads for the buffer manager. PFioSubmit() starts
+the read of a request and calls the request's "done" function when it
+is over, in whichever thread sees it end. PFioStart() picks how reads
+are done: through an io_uring, if the kernel has one, with a thread
+that reaps the completions, or else by a few threads that take requests
+off a queue and preadv() them. Until PFioStart() is called, and after
+PFioStop(), PFioSubmit() reads in the caller's thread and has called
+"done" by the time it returns.
+
+No more than PF_IO_DEPTH reads are in flight at a time; PFioSubmit()
+waits for one to end before it starts another. The caller must hold no
+partition latch, as "done" takes them. */
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include "pf.h"
+#include "pftypes.h"
+
+static pthread_mutex_t PFiolatch = PTHREAD_MUTEX_INITIALIZER;
+					/* guards everything below */
+static pthread_cond_t PFioqueued = PTHREAD_COND_INITIALIZER;
+					/* a request was queued, or the
+					threads are to stop */
+static pthread_cond_t PFiodone = PTHREAD_COND_INITIALIZER;
+					/* a read is over */
+static int PFiobackend = PF_ASYNC_NONE;	/* how reads are done */
+static int PFiopending = 0;		/* # of reads started, not over */
+static int PFiostopping = FALSE;	/* TRUE while the threads stop */
+static pthread_t PFiothreads[PF_IO_THREADS]; /* pool threads, or the
+					io_uring reaper in [0] */
+static int PFionthreads = 0;		/* # of threads started */
+static PFioreq *PFioqhead = NULL;	/* thread pool: requests not */
+static PFioreq *PFioqtail = NULL;	/* started yet, oldest first */
+
+/* The io_uring: its rings are shared with the kernel. Requests are
+submitted under PFiolatch; only the reaper takes completions. */
+static struct {
+	int	fd;			/* ring file descriptor */
+	void	*sq;			/* submission ring */
+	size_t	sqlen;
+	void	*cq;			/* completion ring */
+	size_t	cqlen;
+	struct io_uring_sqe *sqes;	/* submission entries */
+	size_t	sqeslen;
+	unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+	unsigned *cqhead, *cqtail, *cqmask;
+	struct io_uring_cqe *cqes;	/* completion entries */
+} PFring = {.fd = -1};
+
+/****************************************************************************
+SPECIFICATIONS:
+	The read of request "req" is over, having returned "res" (the
+	# of bytes read, or -errno). Tell its "done" function, then
+	count the read out.
+*****************************************************************************/
+static void PFioFinish(PFioreq *req, ssize_t res) {
+  int error = PFE_OK;
+
+  if (res < 0) {
+    errno = (int)-res;
+    error = PFE_UNIX;
+  } else if (res != req->len)
+    error = PFE_INCOMPLETEREAD;
+  (*req->done)(req, error);
+
+  pthread_mutex_lock(&PFiolatch);
+  PFiopending--;
+  pthread_cond_broadcast(&PFiodone);
+  pthread_mutex_unlock(&PFiolatch);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Read request "req" with preadv().
+
+RETURN VALUE:
+	What preadv() returned, or -errno.
+*****************************************************************************/
+static ssize_t PFioRead(PFioreq *req) {
+  ssize_t res;
+
+  if ((res = preadv(req->unixfd, req->iov, req->niov, req->offset)) < 0)
+    res = -errno;
+  return (res);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Body of a thread of the pool: read queued requests until told
+	to stop with nothing left in the queue.
+*****************************************************************************/
+static void *PFioThreadMain(void *arg) {
+  PFioreq *req;
+
+  (void)arg;
+  pthread_mutex_lock(&PFiolatch);
+  for (;;) {
+    while (PFioqhead == NULL && !PFiostopping)
+      pthread_cond_wait(&PFioqueued, &PFiolatch);
+    if ((req = PFioqhead) == NULL)
+      break;
+    if ((PFioqhead = req->next) == NULL)
+      PFioqtail = NULL;
+    pthread_mutex_unlock(&PFiolatch);
+    PFioFinish(req, PFioRead(req));
+    pthread_mutex_lock(&PFiolatch);
+  }
+  pthread_mutex_unlock(&PFiolatch);
+  return (NULL);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Put a submission entry for opcode "op" on the ring, for request
+	"req" (NULL for none), and hand it to the kernel. The caller
+	holds PFiolatch and has made sure that there is room. The
+	kernel takes entries only in io_uring_enter(), which nobody
+	else calls with entries to submit, so the entry is offered
+	again until the kernel's head passes it; if it never does, the
+	tail is moved back and the entry is gone, as if never put.
+
+RETURN VALUE:
+	0 if the kernel took it, else -errno.
+*****************************************************************************/
+static int PFringSubmit(int op, PFioreq *req) {
+  struct io_uring_sqe *sqe;
+  unsigned tail, idx;
+  int tries, error;
+
+  tail = *PFring.sqtail;
+  idx = tail & *PFring.sqmask;
+  sqe = &PFring.sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = op;
+  sqe->fd = -1;
+  if (req != NULL) {
+    sqe->fd = req->unixfd;
+    sqe->off = req->offset;
+    sqe->addr = (unsigned long)req->iov;
+    sqe->len = req->niov;
+  }
+  sqe->user_data = (unsigned long)req;
+  PFring.sqarray[idx] = idx;
+  __atomic_store_n(PFring.sqtail, tail + 1, __ATOMIC_RELEASE);
+
+  for (tries = 0;; tries++) {
+    error = 0;
+    if (syscall(__NR_io_uring_enter, PFring.fd, 1, 0, 0, NULL, 0) < 0)
+      error = -errno;
+    if (__atomic_load_n(PFring.sqhead, __ATOMIC_ACQUIRE) != tail)
+      return (0);				/* taken */
+    if (error != 0 && error != -EINTR && error != -EAGAIN &&
+        error != -EBUSY)
+      break;
+    if (tries + 1 >= PF_IO_TRIES) {
+      error = -EAGAIN;
+      break;
+    }
+  }
+  __atomic_store_n(PFring.sqtail, tail, __ATOMIC_RELEASE);
+  return (error);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Body of the io_uring reaper: wait for completions and finish
+	their requests, until the no-op PFioStop() submits comes back.
+	If the kernel will not let it wait, it looks at the completion
+	ring every PF_IO_NAP ns instead, so that reads in flight are
+	still finished. PFioStop() cancels it if it cannot submit the
+	no-op; it can be cancelled while waiting, when it holds nothing.
+*****************************************************************************/
+static void *PFringReaper(void *arg) {
+  struct io_uring_cqe *cqe;
+  struct timespec nap = {0, PF_IO_NAP};
+  unsigned head;
+  int stop = FALSE, poll = FALSE, type;
+  long res;
+
+  (void)arg;
+  while (!stop) {
+    if (poll)
+      nanosleep(&nap, NULL);
+    else {
+      pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, &type);
+      res = syscall(__NR_io_uring_enter, PFring.fd, 0, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0);
+      pthread_setcanceltype(type, NULL);
+      if (res < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        poll = TRUE;
+    }
+    head = *PFring.cqhead;
+    while (head != __atomic_load_n(PFring.cqtail, __ATOMIC_ACQUIRE)) {
+      cqe = &PFring.cqes[head & *PFring.cqmask];
+      if (cqe->user_data == 0)
+        stop = TRUE;
+      else
+        PFioFinish((PFioreq *)(unsigned long)cqe->user_data, cqe->res);
+      __atomic_store_n(PFring.cqhead, ++head, __ATOMIC_RELEASE);
+    }
+  }
+  return (NULL);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Give the io_uring and its rings back, if there are any.
+*****************************************************************************/
+static void PFringFree(void) {
+  if (PFring.sqes != NULL && PFring.sqes != MAP_FAILED)
+    munmap(PFring.sqes, PFring.sqeslen);
+  if (PFring.cq != NULL && PFring.cq != MAP_FAILED && PFring.cq != PFring.sq)
+    munmap(PFring.cq, PFring.cqlen);
+  if (PFring.sq != NULL && PFring.sq != MAP_FAILED)
+    munmap(PFring.sq, PFring.sqlen);
+  if (PFring.fd >= 0)
+    close(PFring.fd);
+  memset(&PFring, 0, sizeof(PFring));
+  PFring.fd = -1;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Set up an io_uring of PF_IO_DEPTH entries and map its rings.
+
+RETURN VALUE:
+	TRUE	if done.
+	FALSE	if the kernel has no io_uring, or will not let us have
+		one. Nothing is left set up.
+*****************************************************************************/
+static int PFringInit(void) {
+  struct io_uring_params p;
+  char *sq, *cq;
+
+  memset(&p, 0, sizeof(p));
+  if ((PFring.fd = syscall(__NR_io_uring_setup, PF_IO_DEPTH, &p)) < 0) {
+    PFring.fd = -1;
+    return (FALSE);
+  }
+
+  PFring.sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  PFring.cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if ((p.features & IORING_FEAT_SINGLE_MMAP) && PFring.cqlen > PFring.sqlen)
+    PFring.sqlen = PFring.cqlen;
+  PFring.sq = mmap(NULL, PFring.sqlen, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, PFring.fd, IORING_OFF_SQ_RING);
+  if (PFring.sq == MAP_FAILED) {
+    PFringFree();
+    return (FALSE);
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    PFring.cq = PFring.sq;
+  else if ((PFring.cq = mmap(NULL, PFring.cqlen, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, PFring.fd,
+                             IORING_OFF_CQ_RING)) == MAP_FAILED) {
+    PFringFree();
+    return (FALSE);
+  }
+  PFring.sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+  if ((PFring.sqes = mmap(NULL, PFring.sqeslen, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, PFring.fd,
+                          IORING_OFF_SQES)) == MAP_FAILED) {
+    PFringFree();
+    return (FALSE);
+  }
+
+  sq = PFring.sq;
+  cq = PFring.cq;
+  PFring.sqhead = (unsigned *)(sq + p.sq_off.head);
+  PFring.sqtail = (unsigned *)(sq + p.sq_off.tail);
+  PFring.sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+  PFring.sqarray = (unsigned *)(sq + p.sq_off.array);
+  PFring.cqhead = (unsigned *)(cq + p.cq_off.head);
+  PFring.cqtail = (unsigned *)(cq + p.cq_off.tail);
+  PFring.cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+  PFring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return (TRUE);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Start doing reads asynchronously. With "backend" PF_ASYNC_URING
+	an io_uring is tried first; if the kernel will not have it, or
+	with PF_ASYNC_THREADS, PF_IO_THREADS threads read instead.
+	Reads already started by another backend are waited for first.
+
+RETURN VALUE:
+	The backend started: PF_ASYNC_URING or PF_ASYNC_THREADS.
+	PFE_UNIX	if no thread can be created. Reads are then
+		done by their callers.
+*****************************************************************************/
+int PFioStart(int backend) {
+  int error;
+
+  PFioStop();
+  pthread_mutex_lock(&PFiolatch);
+  if (backend == PF_ASYNC_URING && PFringInit()) {
+    if ((error = pthread_create(&PFiothreads[0], NULL, PFringReaper,
+                                NULL)) == 0) {
+      PFionthreads = 1;
+      PFiobackend = PF_ASYNC_URING;
+      goto unlock;
+    }
+    PFringFree();
+  }
+
+  for (PFionthreads = 0; PFionthreads < PF_IO_THREADS; PFionthreads++)
+    if (pthread_create(&PFiothreads[PFionthreads], NULL, PFioThreadMain,
+                       NULL) != 0)
+      break;
+  PFiobackend = (PFionthreads > 0) ? PF_ASYNC_THREADS : PF_ASYNC_NONE;
+
+unlock:
+  backend = PFiobackend;
+  pthread_mutex_unlock(&PFiolatch);
+  if (backend == PF_ASYNC_NONE) {
+    PFerrno = PFE_UNIX;
+    return (PFerrno);
+  }
+  return (backend);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Wait for the reads in flight to end, then stop the threads
+	PFioStart() started, if any. Reads are done by their callers
+	from then on. An io_uring reaper that cannot be sent the no-op
+	it stops on is cancelled.
+*****************************************************************************/
+void PFioStop(void) {
+  int i;
+
+  pthread_mutex_lock(&PFiolatch);
+  while (PFiopending > 0)
+    pthread_cond_wait(&PFiodone, &PFiolatch);
+  if (PFiobackend == PF_ASYNC_URING &&
+      PFringSubmit(IORING_OP_NOP, NULL) < 0)
+    /* the reaper stops when the no-op comes back, and it won't */
+    pthread_cancel(PFiothreads[0]);
+  PFiostopping = TRUE;
+  pthread_cond_broadcast(&PFioqueued);
+  pthread_mutex_unlock(&PFiolatch);
+
+  for (i = 0; i < PFionthreads; i++)
+    pthread_join(PFiothreads[i], NULL);
+
+  pthread_mutex_lock(&PFiolatch);
+  if (PFiobackend == PF_ASYNC_URING)
+    PFringFree();
+  PFionthreads = 0;
+  PFiostopping = FALSE;
+  PFiobackend = PF_ASYNC_NONE;
+  pthread_mutex_unlock(&PFiolatch);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Wait until no read started by PFioSubmit() is in flight.
+*****************************************************************************/
+void PFioDrain(void) {
+  pthread_mutex_lock(&PFiolatch);
+  while (PFiopending > 0)
+    pthread_cond_wait(&PFiodone, &PFiolatch);
+  pthread_mutex_unlock(&PFiolatch);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Start reading "req->len" bytes from "req->unixfd" at
+	"req->offset" into "req->iov", and call req->done(req, error)
+	when the read is over, "error" being PFE_OK, PFE_UNIX or
+	PFE_INCOMPLETEREAD. If PF_IO_DEPTH reads are in flight, one is
+	waited for first. Without a backend started the read is done
+	here.
+*****************************************************************************/
+void PFioSubmit(PFioreq *req) {
+  int res;
+
+  pthread_mutex_lock(&PFiolatch);
+  if (PFiobackend == PF_ASYNC_NONE) {
+    PFiopending++;
+    pthread_mutex_unlock(&PFiolatch);
+    PFioFinish(req, PFioRead(req));
+    return;
+  }
+
+  while (PFiopending >= PF_IO_DEPTH)
+    pthread_cond_wait(&PFiodone, &PFiolatch);
+  PFiopending++;
+  if (PFiobackend == PF_ASYNC_URING) {
+    if ((res = PFringSubmit(IORING_OP_READV, req)) < 0) {
+      /* the kernel would not take it: read it here */
+      pthread_mutex_unlock(&PFiolatch);
+      PFioFinish(req, PFioRead(req));
+      return;
+    }
+  } else {
+    req->next = NULL;
+    if (PFioqtail != NULL)
+      PFioqtail->next = req;
+    else
+      PFioqhead = req;
+    PFioqtail = req;
+    pthread_cond_signal(&PFioqueued);
+  }
+  pthread_mutex_unlock(&PFiolatch);
+}
@@ -0,0 +1,193 @@
+/* lz.c: the page codec of files made with PF_FILE_COMPRESS. It is an
+LZ77 coder writing the LZ4 block format: a page is a run of sequences,
+each a token byte (# of literals in the high four bits, match length
+less PF_LZ_MINMATCH in the low four, 15 meaning more bytes of 255 follow),
+the literals, and a two-byte little-endian offset back to the match;
+the last sequence has literals only. Matches are found through a hash
+table of the positions of 4-byte strings, greedily, so compressing
+costs about as much as decompressing. Pages are at most
+PF_MAX_PAGE_SIZE bytes, so every offset fits in 16 bits. */
+#include <stdint.h>
+#include <string.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#define PF_LZ_MINMATCH	4	/* shortest match */
+#define PF_LZ_LASTLITS	5	/* the last bytes are always literals */
+#define PF_LZ_MFLIMIT	12	/* no match starts in the last bytes */
+#define PF_LZ_HASHBITS	12	/* log2 of the # of hash table slots */
+
+/* slot of the 4-byte string "v" in the hash table */
+#define PFlzHash(v) (((v) * 2654435761U) >> (32 - PF_LZ_HASHBITS))
+
+static inline uint32_t PFlzRead32(const unsigned char *p) {
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return (v);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write at "op" the length "len", less the 15 the token holds, as
+	bytes of 255 and a last byte below it. "oend" is the end of the
+	output.
+
+RETURN VALUE:
+	The byte after it, or NULL if it does not fit.
+*****************************************************************************/
+static unsigned char *PFlzPutLength(unsigned char *op, unsigned char *oend,
+                                    int len) {
+  for (len -= 15; len >= 255; len -= 255) {
+    if (op >= oend)
+      return (NULL);
+    *op++ = 255;
+  }
+  if (op >= oend)
+    return (NULL);
+  *op++ = (unsigned char)len;
+  return (op);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Compress the "srclen" bytes at "src", at most PF_MAX_PAGE_SIZE,
+	into "dst", which holds "dstcap" bytes.
+
+RETURN VALUE:
+	The # of bytes written at "dst".
+	0	if they do not fit in "dstcap".
+*****************************************************************************/
+int PFlzCompress(const char *src, int srclen, char *dst, int dstcap) {
+  const unsigned char *base = (const unsigned char *)src;
+  const unsigned char *ip = base, *anchor = base, *ref;
+  const unsigned char *iend = base + srclen;
+  const unsigned char *mflimit = iend - PF_LZ_MFLIMIT;
+  const unsigned char *matchlimit = iend - PF_LZ_LASTLITS;
+  unsigned char *op = (unsigned char *)dst;
+  unsigned char *oend = op + dstcap;
+  unsigned char *token;
+  uint16_t table[1 << PF_LZ_HASHBITS];
+  uint32_t h;
+  int lits, mlen, step;
+
+  memset(table, 0, sizeof(table));
+  if (srclen > PF_LZ_MFLIMIT) {
+    table[PFlzHash(PFlzRead32(ip))] = 0;
+    ip++;
+  }
+  while (ip < mflimit) {
+    /* look for a match, stepping faster through data that has none */
+    step = 1 + ((ip - anchor) >> 6);
+    h = PFlzHash(PFlzRead32(ip));
+    ref = base + table[h];
+    table[h] = (uint16_t)(ip - base);
+    if (ref >= ip || PFlzRead32(ref) != PFlzRead32(ip)) {
+      ip += step;
+      continue;
+    }
+    for (mlen = PF_LZ_MINMATCH; ip + mlen < matchlimit && ref[mlen] == ip[mlen];
+         mlen++)
+      ;
+
+    /* the sequence: token, literals, offset, match length */
+    lits = ip - anchor;
+    if (op + 1 + lits / 255 + 1 + lits + 2 > oend)
+      return (0);
+    token = op++;
+    *token = (unsigned char)((lits >= 15 ? 15 : lits) << 4);
+    if (lits >= 15 && (op = PFlzPutLength(op, oend, lits)) == NULL)
+      return (0);
+    memcpy(op, anchor, lits);
+    op += lits;
+    *op++ = (unsigned char)((ip - ref) & 0xff);
+    *op++ = (unsigned char)((ip - ref) >> 8);
+    *token |= (unsigned char)(mlen - PF_LZ_MINMATCH >= 15
+                                  ? 15
+                                  : mlen - PF_LZ_MINMATCH);
+    if (mlen - PF_LZ_MINMATCH >= 15 &&
+        (op = PFlzPutLength(op, oend, mlen - PF_LZ_MINMATCH)) == NULL)
+      return (0);
+
+    ip += mlen;
+    anchor = ip;
+    if (ip < mflimit)
+      table[PFlzHash(PFlzRead32(ip - 2))] = (uint16_t)(ip - 2 - base);
+  }
+
+  /* the last literals */
+  lits = iend - anchor;
+  if (op + 1 + lits / 255 + 1 + lits > oend)
+    return (0);
+  token = op++;
+  *token = (unsigned char)((lits >= 15 ? 15 : lits) << 4);
+  if (lits >= 15 && (op = PFlzPutLength(op, oend, lits)) == NULL)
+    return (0);
+  memcpy(op, anchor, lits);
+  op += lits;
+  return ((int)(op - (unsigned char *)dst));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Decompress the "srclen" bytes at "src", written by
+	PFlzCompress(), into "dst", which holds "dstlen" bytes. Damaged
+	input is caught before it can read or write out of bounds.
+
+RETURN VALUE:
+	The # of bytes written at "dst".
+	-1	if the input is damaged or does not fit in "dstlen".
+*****************************************************************************/
+int PFlzDecompress(const char *src, int srclen, char *dst, int dstlen) {
+  const unsigned char *ip = (const unsigned char *)src;
+  const unsigned char *iend = ip + srclen;
+  unsigned char *op = (unsigned char *)dst;
+  unsigned char *oend = op + dstlen;
+  const unsigned char *ref;
+  unsigned int token, b;
+  size_t lits, mlen, offset;
+
+  while (ip < iend) {
+    token = *ip++;
+
+    /* literals */
+    if ((lits = token >> 4) == 15)
+      do {
+        if (ip >= iend)
+          return (-1);
+        lits += (b = *ip++);
+      } while (b == 255);
+    if (lits > (size_t)(iend - ip) || lits > (size_t)(oend - op))
+      return (-1);
+    memcpy(op, ip, lits);
+    ip += lits;
+    op += lits;
+    if (ip == iend)
+      break; /* the last sequence */
+
+    /* the match */
+    if (iend - ip < 2)
+      return (-1);
+    offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if ((mlen = token & 15) == 15)
+      do {
+        if (ip >= iend)
+          return (-1);
+        mlen += (b = *ip++);
+      } while (b == 255);
+    mlen += PF_LZ_MINMATCH;
+    if (offset == 0 || offset > (size_t)(op - (unsigned char *)dst) ||
+        mlen > (size_t)(oend - op))
+      return (-1);
+    ref = op - offset;
+    if (offset >= mlen) {
+      memcpy(op, ref, mlen);
+      op += mlen;
+    } else
+      /* the match runs into itself: a repeating pattern */
+      while (mlen-- > 0)
+        *op++ = *ref++;
+  }
+  return ((int)(op - (unsigned char *)dst));
+}
@@ -1,10 +1,17 @@
 /* pf.c: Paged File Interface Routines+ support routines */
+#define _GNU_SOURCE /* O_DIRECT */
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include "pf.h"
 #include "pftypes.h"
@@ -14,46 +21,395 @@
 #define L_SET 0
 #endif
 
-int PFerrno = PFE_OK;	/* last error message */
-
-static PFftab_ele PFftab[PF_FTAB_SIZE]; /* table of opened files */
+_Thread_local int PFerrno = PFE_OK;	/* last error message */
+
+static PFftab_ele *PFftabchunk[PF_FTAB_CHUNKS]; /* table of opened
+					files, in chunks of PF_FTAB_CHUNK
+					entries */
+static int PFftabchunks = 0;	/* # of chunks allocated */
+static int PFftabfree = -1;	/* first free entry, or -1 */
+
+/* entry of file descriptor fd in the table of opened files */
+#define PFftab(fd) (PFftabchunk[(fd) / PF_FTAB_CHUNK][(fd) % PF_FTAB_CHUNK])
+
+static int *PFnamebucket = NULL; /* name hash table: first entry of the
+				table of opened files in each bucket,
+				or -1 */
+static unsigned int PFnamebuckets = 0; /* # of buckets, a power of 2 */
+static unsigned int PFnamecount = 0;   /* # of names in it */
+
+/* Descriptor cache: with a limit set by PF_SetMaxOpenFds(), at most
+PFfdmax unix files are kept open; the least recently used of them, if
+no I/O is using it, is closed to make room, and opened again the next
+time its file is read or written. */
+static pthread_mutex_t PFfdlatch = PTHREAD_MUTEX_INITIALIZER;
+					/* guards the below, and "unixfd",
+					"fdpins", "fdprev" and "fdnext"
+					of the entries while there is a
+					limit */
+static int PFfdmax = 0;		/* max # of unix files open, 0 if none */
+static int PFfdopen = 0;	/* # of unix files open */
+static int PFfdhead = -1;	/* file whose unix file was used last */
+static int PFfdtail = -1;	/* file whose unix file was used first */
+
+/* Warm list loader: a thread PF_LoadWarmList() may start to read the
+pages in while the program goes on */
+static pthread_mutex_t PFwarmlatch = PTHREAD_MUTEX_INITIALIZER;
+					/* guards the below */
+static pthread_cond_t PFwarmidle = PTHREAD_COND_INITIALIZER;
+					/* the loader is done with a file */
+static pthread_t PFwarmthread;		/* the loader */
+static int PFwarmon = FALSE;		/* TRUE until the loader is joined */
+static int PFwarmcancel = FALSE;	/* TRUE when the loader is to stop */
+static PFwarment *PFwarmpages = NULL;	/* pages it reads, sorted; the
+					file of those of a closed file is
+					-1 */
+static int PFwarmnpages;		/* # of them */
+static int PFwarmfd = -1;		/* file it is reading pages of */
+static int PFwarmloaded;		/* # of pages it read, set as it ends */
+static int PFwarmJoin(int cancel);
+static void PFwarmForget(int fd);
+
+static int PFreadahead = 0; /* max # of pages read ahead
+					at a time, 0 if read-ahead is off */
 
 /* true if file descriptor fd is invaild */
-#define PFinvalidFd(fd) ((fd) < 0 || (fd) >= PF_FTAB_SIZE \
-				|| PFftab[fd].fname == NULL)
+#define PFinvalidFd(fd) ((fd) < 0 || (fd) >= PFftabchunks * PF_FTAB_CHUNK \
+				|| PFftab(fd).fname == NULL)
+
+/* # of pages a bitmap page of the version 2 file "fd" covers */
+#define PFmapPages(fd) (8 * PFftab(fd).pagesize)
+
+/* offset in the file "fd" of page "pagenum": of its "nextfree" word
+in a version 1 file, of its data in a version 2 file, past the header
+page and the bitmap pages before it */
+#define PFpageOffset(fd,pagenum) (PFftab(fd).version == 1 ? \
+		(off_t)PF_HDR_SIZE + (off_t)(pagenum) * (off_t)PF_FPAGE_SIZE : \
+		((off_t)(pagenum) + (pagenum) / PFmapPages(fd) + 2) * \
+		PFftab(fd).pagesize)
+
+/* offset of bitmap page "i" of the version 2 file "fd"; in a
+compressed file, in the trailer, after the extent map */
+#define PFbitmapOffset(fd,i) (PFftab(fd).compress ? \
+		PFftab(fd).tail + PFtrailerMapSize(fd) + \
+		(off_t)(i) * PFftab(fd).pagesize : \
+		((off_t)(i) * (PFmapPages(fd) + 1) + 1) * PFftab(fd).pagesize)
+
+/* # of bytes the extent map of the compressed file "fd" takes in its
+trailer */
+#define PFtrailerMapSize(fd) \
+		PFextentRound((size_t)PFftab(fd).hdr.numpages * sizeof(PFextent))
+
+/* true if pages "pagenum" and "pagenum"+1 of file "fd" are not next to
+each other in the file, a bitmap page coming between them */
+#define PFmapBetween(fd,pagenum) (PFftab(fd).version != 1 && \
+				((pagenum) + 1) % PFmapPages(fd) == 0)
+
+/* # of bytes a page takes up in the file "fd" */
+#define PFdiskPageSize(fd) (PFftab(fd).version == 1 ? (int)PF_FPAGE_SIZE : \
+				PFftab(fd).pagesize)
+
+/* flags a file may be created with */
+#define PF_FILE_FLAGS	(PF_FILE_CHECKSUM | PF_FILE_COMPRESS)
+
+/* true if "size" is a page size a file may have */
+#define PFvalidPageSize(size) ((size) >= PF_MIN_PAGE_SIZE && \
+				(size) <= PF_MAX_PAGE_SIZE && \
+				((size) & ((size) - 1)) == 0)
+
+/* data of page "pagenum" of the mapped file "fd" */
+#define PFmapPage(fd,pagenum) (PFftab(fd).map + \
+				PFpageOffset(fd, pagenum) + \
+				(PFftab(fd).version == 1 ? sizeof(int) : 0))
+
+/* true if page "pagenum" of the version 2 file "fd" is free; false
+for a version 1 file, whose pages must be read to tell */
+#define PFfreePage(fd,pagenum) (PFftab(fd).bitmap != NULL && \
+		!(PFatomicLoad(PFatomicLoad(PFftab(fd).bitmap)[(pagenum) >> 3]) \
+		& (1 << ((pagenum) & 7))))
+
+static unsigned long PFmappedRequests = 0; /* fixes of pages of mapped
+					files, counted atomically */
 
 /* true if page number "pagenum" of file "fd" is invalid in the
 sense that it's <0 or >= # of pages in the file */
 #define PFinvalidPagenum(fd,pagenum) ((pagenum)<0 || (pagenum) >= \
-				PFftab[fd].hdr.numpages)
+				PFftab(fd).hdr.numpages)
+
+struct PF_BufferPool PFbufferPool = {
+    .poolSize = PF_MAX_BUFS,
+    .numPartitions = 1,
+    .replacement = PF_REPLACEMENT_LRU,
+};
+
+/****************************************************************************
+SPECIFICATIONS:
+	Bring the statistics in PFbufferPool up to date. Each buffer
+	partition keeps counters of its own; this adds them up.
+
+RETURN VALUE: none
+*****************************************************************************/
+void PF_CollectStats() {
+    PFbufCollectStats();
+    PFbufferPool.mappedPageRequests = PFatomicLoad(PFmappedRequests);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Zero the statistics of the buffer pool and of every open file.
+
+RETURN VALUE: none
+*****************************************************************************/
+void PF_ResetStats() {
+    PFbufResetStats();
+    PFatomicStore(PFmappedRequests, 0);
+    PFbufferPool.mappedPageRequests = 0;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Fill in *stats with a snapshot of the statistics of the whole
+	buffer pool, and of how many of its frames are used and dirty.
+	The counters are those since PF_Init() or PF_ResetStats(); hits
+	are the requests less the misses, so while other threads fix
+	pages the two may be a little apart.
+
+RETURN VALUE:
+	PFE_OK	always.
+*****************************************************************************/
+int PF_GetStats(PF_Stats *stats) {
+    int fd;
+
+    PF_CollectStats();
+    stats->total.hits = PFbufferPool.logicalPageHits;
+    stats->total.misses = PFbufferPool.logicalPageMisses;
+    stats->total.reads = PFbufferPool.physicalReads;
+    stats->total.writes = PFbufferPool.physicalWrites;
+    stats->total.evictions = PFbufferPool.evictions;
+    stats->total.dirtyEvictions = PFbufferPool.dirtyEvictions;
+    stats->total.pinWaits = PFbufferPool.ioWaits;
+    stats->total.allocations = PFbufferPool.pageAllocations;
+    PFbufOccupancy(&stats->total.residentPages, &stats->total.dirtyPages);
+    stats->requests = PFbufferPool.logicalPageRequests;
+    stats->readCalls = PFbufferPool.readCalls;
+    stats->writeCalls = PFbufferPool.writeCalls;
+    stats->readAheadPages = PFbufferPool.readAheadPages;
+    stats->writerWrites = PFbufferPool.writerWrites;
+    stats->mappedRequests = PFbufferPool.mappedPageRequests;
+    stats->poolSize = PFbufferPool.poolSize;
+    stats->numPartitions = PFbufferPool.numPartitions;
+    stats->replacement = PFbufferPool.replacement;
+    stats->openFiles = 0;
+    for (fd = 0; fd < PFftabchunks * PF_FTAB_CHUNK; fd++)
+        if (PFftab(fd).fname != NULL)
+            stats->openFiles++;
+    return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Fill in *stats with the statistics of the open file "fd": its
+	counters since it was opened or PF_ResetStats() was called, and
+	how many of its pages are in the buffer and dirty. Fixes of the
+	pages of a mapped file bypass the buffer and are not counted.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_FD	if "fd" is not an open file.
+*****************************************************************************/
+int PF_GetFileStats(int fd, PF_FileStats *stats) {
+    if (PFinvalidFd(fd)) {
+        PFerrno = PFE_FD;
+        return (PFerrno);
+    }
+    PFbufFileStats(fd, stats);
+    return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write "s" to "out" as a JSON string.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFjsonString(FILE *out, const char *s) {
+    putc('"', out);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char)*s);
+        else
+            putc(*s, out);
+    }
+    putc('"', out);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write the counters of *stats to "out" as the members of a JSON
+	object, without the braces.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFjsonFileStats(FILE *out, const PF_FileStats *stats) {
+    fprintf(out,
+            "\"hits\": %lu, \"misses\": %lu, \"reads\": %lu, "
+            "\"writes\": %lu, \"evictions\": %lu, \"dirtyEvictions\": %lu, "
+            "\"pinWaits\": %lu, \"allocations\": %lu, "
+            "\"residentPages\": %d, \"dirtyPages\": %d",
+            stats->hits, stats->misses, stats->reads, stats->writes,
+            stats->evictions, stats->dirtyEvictions, stats->pinWaits,
+            stats->allocations, stats->residentPages, stats->dirtyPages);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write the statistics of the buffer pool and of each open file
+	to "out": as lines for people to read if "format" is
+	PF_STATS_TEXT, or as one JSON object, ended by a newline, if it
+	is PF_STATS_JSON. The JSON object has the members of PF_Stats,
+	with those of "total" at the top level, and a "files" array
+	with the name, descriptor and PF_FileStats of each file.
+
+RETURN VALUE: none
+*****************************************************************************/
+void PF_DumpStatsTo(FILE *out, int format) {
+    static const char *replname[] = {"LRU", "MRU", "CLOCK", "2Q", "LRU-2",
+                                     "ARC"};
+    PF_FileStats fstats;
+    PF_Stats stats;
+    int fd, first = TRUE;
+
+    PF_GetStats(&stats);
+    if (format == PF_STATS_JSON) {
+        fprintf(out, "{\"requests\": %lu, ", stats.requests);
+        PFjsonFileStats(out, &stats.total);
+        fprintf(out,
+                ", \"readCalls\": %lu, \"writeCalls\": %lu, "
+                "\"readAheadPages\": %lu, \"writerWrites\": %lu, "
+                "\"mappedRequests\": %lu, \"poolSize\": %d, "
+                "\"numPartitions\": %d, \"replacement\": \"%s\", "
+                "\"openFiles\": %d, \"files\": [",
+                stats.readCalls, stats.writeCalls, stats.readAheadPages,
+                stats.writerWrites, stats.mappedRequests, stats.poolSize,
+                stats.numPartitions, replname[stats.replacement],
+                stats.openFiles);
+        for (fd = 0; fd < PFftabchunks * PF_FTAB_CHUNK; fd++) {
+            if (PFftab(fd).fname == NULL)
+                continue;
+            PFbufFileStats(fd, &fstats);
+            fprintf(out, "%s{\"fd\": %d, \"name\": ", first ? "" : ", ", fd);
+            PFjsonString(out, PFftab(fd).fname);
+            fprintf(out, ", \"mapped\": %s, ",
+                    PFftab(fd).map != NULL ? "true" : "false");
+            PFjsonFileStats(out, &fstats);
+            putc('}', out);
+            first = FALSE;
+        }
+        fprintf(out, "]}\n");
+        return;
+    }
 
-struct PF_BufferPool PFbufferPool;
+    fprintf(out, "PF Buffer Statistics:\n");
+    fprintf(out, "  Logical requests   : %lu\n", stats.requests);
+    fprintf(out, "  Logical hits       : %lu\n", stats.total.hits);
+    fprintf(out, "  Logical misses     : %lu\n", stats.total.misses);
+    fprintf(out, "  Physical reads     : %lu\n", stats.total.reads);
+    fprintf(out, "  Physical writes    : %lu\n", stats.total.writes);
+    fprintf(out, "  Evictions          : %lu (%lu dirty)\n",
+            stats.total.evictions, stats.total.dirtyEvictions);
+    fprintf(out, "  Frames in use      : %d (%d dirty)\n",
+            stats.total.residentPages, stats.total.dirtyPages);
+    if (stats.writerWrites > 0)
+        fprintf(out, "  Background writes  : %lu\n", stats.writerWrites);
+    if (stats.readCalls > 0)
+        fprintf(out, "  Read calls         : %lu (%.1f pages each)\n",
+                stats.readCalls, (double)stats.total.reads / stats.readCalls);
+    if (stats.readAheadPages > 0)
+        fprintf(out, "  Pages read ahead   : %lu\n", stats.readAheadPages);
+    if (PFbufferPool.asyncIO != PF_ASYNC_NONE)
+        fprintf(out, "  Asynchronous I/O   : %s (%lu fixes waited)\n",
+                PFbufferPool.asyncIO == PF_ASYNC_URING ? "io_uring"
+                                                       : "threads",
+                stats.total.pinWaits);
+    if (stats.writeCalls > 0)
+        fprintf(out, "  Write calls        : %lu (%.1f pages each)\n",
+                stats.writeCalls, (double)stats.total.writes / stats.writeCalls);
+    if (stats.mappedRequests > 0)
+        fprintf(out, "  Mapped requests    : %lu\n", stats.mappedRequests);
+    if (stats.replacement == PF_REPLACEMENT_ARC)
+        fprintf(out, "  ARC target (p)     : %d of %d\n", PFbufferPool.arcTarget,
+                stats.poolSize);
+    if (stats.numPartitions > 1)
+        fprintf(out, "  Partitions         : %d\n", stats.numPartitions);
+    for (fd = 0; fd < PFftabchunks * PF_FTAB_CHUNK; fd++) {
+        if (PFftab(fd).fname == NULL)
+            continue;
+        PFbufFileStats(fd, &fstats);
+        fprintf(out,
+                "  File %d (%s): %lu hits, %lu misses, %lu reads, "
+                "%lu writes, %lu evictions, %d pages (%d dirty)\n",
+                fd, PFftab(fd).fname, fstats.hits, fstats.misses,
+                fstats.reads, fstats.writes, fstats.evictions,
+                fstats.residentPages, fstats.dirtyPages);
+    }
+}
 
 void PF_DumpStats() {
-    printf("PF Buffer Statistics:\n");
-    printf("  Logical requests   : %lu\n", PFbufferPool.logicalPageRequests);
-    printf("  Logical hits       : %lu\n", PFbufferPool.logicalPageHits);
-    printf("  Physical reads     : %lu\n", PFbufferPool.physicalReads);
-    printf("  Physical writes    : %lu\n", PFbufferPool.physicalWrites);
+    PF_DumpStatsTo(stdout, PF_STATS_TEXT);
 }
 /****************** Internal Support Functions *****************************/
 /****************************************************************************
 SPECIFICATIONS:
-	Allocate memory and save string pointed by str.
-	Return a pointer to the saved string, or NULL if no memory.
+	Hash the file name "fname" (FNV-1a).
+
+RETURN VALUE:
+	The hash.
+*****************************************************************************/
+static unsigned int PFnameHash(char *fname /* file name */
+) {
+  unsigned int h = 2166136261u;
+
+  while (*fname != '\0')
+    h = (h ^ (unsigned char)*fname++) * 16777619u;
+  return (h);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Double the buckets of the name hash table, or make the first
+	16, and put the names of the open files in them again.
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PFE_NOMEM	if no memory. The table is left as it was.
 *****************************************************************************/
-static char *savestr(char *str /* string to be saved */) {
-  char *s;
+static int PFnameGrow() {
+  unsigned int n = PFnamebuckets == 0 ? 16 : 2 * PFnamebuckets;
+  int *bucket;
+  int fd;
 
-  if ((s = malloc(strlen(str) + 1)) != NULL)
-    strcpy(s, str);
-  return (s);
+  if ((bucket = (int *)malloc(n * sizeof(int))) == NULL) {
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  memset(bucket, 0xff, n * sizeof(int)); /* all -1 */
+  for (fd = 0; fd < PFftabchunks * PF_FTAB_CHUNK; fd++)
+    if (PFftab(fd).fname != NULL) {
+      PFftab(fd).namenext = bucket[PFftab(fd).namehash & (n - 1)];
+      bucket[PFftab(fd).namehash & (n - 1)] = fd;
+    }
+  free((char *)PFnamebucket);
+  PFnamebucket = bucket;
+  PFnamebuckets = n;
+  return (PFE_OK);
 }
 
 /****************************************************************************
 SPECIFICATIONS:
-	Find the index to PFftab[] entry whose "fname" field is the
-	same as "fname". 
+	Find the index to PFftab() entry whose "fname" field is the
+	same as "fname", through the name hash table.
 
 AUTHOR: clc
 
@@ -64,175 +420,2497 @@ RETURN VALUE:
 *****************************************************************************/
 int static PFtabFindFname(char *fname /* file name to find */
 ) {
+  unsigned int h;
   int i;
 
-  for (i = 0; i < PF_FTAB_SIZE; i++) {
-    if (PFftab[i].fname != NULL && strcmp(PFftab[i].fname, fname) == 0)
+  if (PFnamecount == 0)
+    return (-1);
+  h = PFnameHash(fname);
+  for (i = PFnamebucket[h & (PFnamebuckets - 1)]; i >= 0;
+       i = PFftab(i).namenext)
+    if (PFftab(i).namehash == h && strcmp(PFftab(i).fname, fname) == 0)
       /* found it */
       return (i);
-  }
   return (-1);
 }
 
 /****************************************************************************
 SPECIFICATIONS:
-	Find a free entry in the open file table "PFtab", and return its
-	index.
+	Add a chunk of PF_FTAB_CHUNK entries to the open file table and
+	put them on the free list, lowest first.
 
-AUTHOR: clc
+RETURN VALUE:
+	PFE_OK	if ok.
+	PFE_FTABFULL	if the table has PF_FTAB_CHUNKS chunks already.
+	PFE_NOMEM	if no memory.
+*****************************************************************************/
+static int PFftabGrow() {
+  PFftab_ele *chunk;
+  int i;
+
+  if (PFftabchunks == PF_FTAB_CHUNKS) {
+    PFerrno = PFE_FTABFULL;
+    return (PFerrno);
+  }
+  if ((chunk = (PFftab_ele *)calloc(PF_FTAB_CHUNK, sizeof(PFftab_ele))) ==
+      NULL) {
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  for (i = PF_FTAB_CHUNK - 1; i >= 0; i--) {
+    chunk[i].fname = NULL;
+    chunk[i].unixfd = -1;
+    chunk[i].freenext = PFftabfree;
+    PFftabfree = PFftabchunks * PF_FTAB_CHUNK + i;
+  }
+  /* readers index the chunk only once a descriptor in it is handed out */
+  PFatomicStore(PFftabchunk[PFftabchunks], chunk);
+  PFatomicStore(PFftabchunks, PFftabchunks + 1);
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Take an entry off the free list of the open file table, growing
+	the table if none is free, and give it the name "fname", which
+	is entered in the name hash table. The room for the name is
+	that of the last file to use the entry, if it is enough. The
+	header latch of the entry is set up here and destroyed by
+	PFftabRelease(), so it lives exactly as long as the entry is
+	in use, on error paths too.
+
+RETURN VALUE:
+	If >=0, the index of the entry.
+	PFE_FTABFULL	if the table can't grow.
+	PFE_NOMEM	if no memory.
+*****************************************************************************/
+static int PFftabAlloc(char *fname /* name of the file to open */
+) {
+  size_t len = strlen(fname) + 1;
+  PFftab_ele *f;
+  char *buf;
+  int fd;
+
+  if (PFftabfree < 0 && PFftabGrow() != PFE_OK)
+    return (PFerrno);
+  if (PFnamecount >= PFnamebuckets && PFnameGrow() != PFE_OK)
+    return (PFerrno);
+  f = &PFftab(PFftabfree);
+  if (len > f->namecap) {
+    if ((buf = malloc(len)) == NULL) {
+      PFerrno = PFE_NOMEM;
+      return (PFerrno);
+    }
+    free(f->namebuf);
+    f->namebuf = buf;
+    f->namecap = len;
+  }
+  fd = PFftabfree;
+  PFftabfree = f->freenext;
+  memcpy(f->namebuf, fname, len);
+  f->fname = f->namebuf;
+  f->namehash = PFnameHash(fname);
+  f->namenext = PFnamebucket[f->namehash & (PFnamebuckets - 1)];
+  PFnamebucket[f->namehash & (PFnamebuckets - 1)] = fd;
+  PFnamecount++;
+  f->unixfd = -1;
+  f->fdpins = 0;
+  f->fdprev = f->fdnext = -1;
+  pthread_mutex_init(&f->hdrlatch, NULL);
+  return (fd);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Give entry "fd" of the open file table back to the free list,
+	taking its name out of the name hash table and destroying its
+	header latch.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFftabRelease(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  int *link = &PFnamebucket[f->namehash & (PFnamebuckets - 1)];
+
+  while (*link != fd)
+    link = &PFftab(*link).namenext;
+  *link = f->namenext;
+  PFnamecount--;
+  pthread_mutex_destroy(&f->hdrlatch);
+  f->fname = NULL;
+  f->freenext = PFftabfree;
+  PFftabfree = fd;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Take file "fd" out of the descriptor cache's LRU list. The
+	latch is held, or the cache has no limit and no I/O runs.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFfdUnlink(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+
+  if (f->fdprev >= 0)
+    PFftab(f->fdprev).fdnext = f->fdnext;
+  else
+    PFfdhead = f->fdnext;
+  if (f->fdnext >= 0)
+    PFftab(f->fdnext).fdprev = f->fdprev;
+  else
+    PFfdtail = f->fdprev;
+  f->fdprev = f->fdnext = -1;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Put file "fd" at the head of the descriptor cache's LRU list,
+	as the file whose unix file was used last. The latch is held,
+	or the cache has no limit and no I/O runs.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFfdLink(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+
+  f->fdprev = -1;
+  f->fdnext = PFfdhead;
+  if (PFfdhead >= 0)
+    PFftab(PFfdhead).fdprev = fd;
+  else
+    PFfdtail = fd;
+  PFfdhead = fd;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Close the unix files least recently used, of those no I/O is
+	using, until "room" more can be opened without going over the
+	descriptor cache's limit, or none is left to close. The latch
+	is held.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFfdTrim(int room /* # of unix files to make room for */
+) {
+  int fd, prev;
+
+  for (fd = PFfdtail; fd >= 0 && PFfdopen + room > PFfdmax; fd = prev) {
+    prev = PFftab(fd).fdprev;
+    if (PFftab(fd).fdpins > 0)
+      continue;
+    PFfdUnlink(fd);
+    close(PFftab(fd).unixfd);
+    PFftab(fd).unixfd = -1;
+    PFfdopen--;
+  }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Open the unix file of file "fd", with O_DIRECT if it was opened
+	so, and enter it in the descriptor cache; with a limit, the
+	least recently used unix file is closed first if there is no
+	room (see PFfdTrim()), and the one opened is held for the
+	caller, who lets go of it with PFfdPut(). The latch is held.
+
+RETURN VALUE:
+	The unix file descriptor, if ok.
+	PFE_UNIX	if the file can't be opened.
+*****************************************************************************/
+static int PFfdOpen(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+
+  if (PFfdmax > 0)
+    PFfdTrim(1);
+  if ((f->unixfd = open(f->fname, f->direct ? O_RDWR | O_DIRECT : O_RDWR)) <
+      0) {
+    PFerrno = PFE_UNIX;
+    return (PFerrno);
+  }
+  PFfdLink(fd);
+  PFfdopen++;
+  if (PFfdmax > 0)
+    f->fdpins++;
+  return (f->unixfd);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Get the unix file of file "fd" for I/O, and hold it so that the
+	descriptor cache does not close it; "unixfd" of the entry may
+	then be used until PFfdPut(fd) is called. Without a limit on
+	the cache it is always open and this just returns it; with one
+	it is moved to the head of the LRU list, and opened again if
+	it was closed.
+
+RETURN VALUE:
+	The unix file descriptor, if ok.
+	PFE_UNIX	if the file can't be opened again.
+*****************************************************************************/
+static int PFfdGet(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  int unixfd;
+
+  if (PFfdmax == 0)
+    return (f->unixfd);
+  pthread_mutex_lock(&PFfdlatch);
+  if ((unixfd = f->unixfd) < 0)
+    unixfd = PFfdOpen(fd);
+  else {
+    f->fdpins++;
+    if (PFfdhead != fd) {
+      PFfdUnlink(fd);
+      PFfdLink(fd);
+    }
+  }
+  pthread_mutex_unlock(&PFfdlatch);
+  return (unixfd);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Let go of the unix file of file "fd", got with PFfdGet().
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFfdPut(int fd /* file descriptor */
+) {
+  if (PFfdmax == 0)
+    return;
+  pthread_mutex_lock(&PFfdlatch);
+  PFftab(fd).fdpins--;
+  pthread_mutex_unlock(&PFfdlatch);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Close the unix file of file "fd", if it is open, and take it
+	out of the descriptor cache.
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PFE_UNIX	if close() fails.
+*****************************************************************************/
+static int PFfdClose(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  int error = 0;
+
+  pthread_mutex_lock(&PFfdlatch);
+  if (f->unixfd >= 0) {
+    PFfdUnlink(fd);
+    error = close(f->unixfd);
+    f->unixfd = -1;
+    PFfdopen--;
+  }
+  f->fdpins = 0;
+  pthread_mutex_unlock(&PFfdlatch);
+  if (error == -1) {
+    PFerrno = PFE_UNIX;
+    return (PFerrno);
+  }
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Allocate a zeroed page of "size" bytes aligned as a frame, for
+	the header page, which is read and written outside the buffer
+	pool but must still suit O_DIRECT.
+
+RETURN VALUE:
+	The page, or NULL if no memory.
+*****************************************************************************/
+static char *PFallocPage(int size) {
+  void *page;
+
+  if (posix_memalign(&page, PF_FRAME_ALIGN, size) != 0)
+    return (NULL);
+  memset(page, 0, size);
+  return ((char *)page);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Fill "page", "pagesize" bytes, with the header page of a
+	version 2 file of pages of that size whose header is "hdr",
+	whose flags are "flags" and whose trailer, if it is
+	compressed, is at "tail" (0 if none).
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFhdrPage(char *page, int pagesize, PFhdr_str *hdr, int flags,
+                      off_t tail) {
+  PFhdr2_str hdr2;
+
+  hdr2.magic = PF_HDR_MAGIC;
+  hdr2.version = PF_FORMAT_VERSION;
+  hdr2.numpages = hdr->numpages;
+  hdr2.pagesize = pagesize;
+  hdr2.flags = flags;
+  hdr2.tail = (unsigned int)(tail / PF_EXTENT_ALIGN);
+  memset(page, 0, pagesize);
+  memcpy(page, &hdr2, sizeof(hdr2));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Set the header, format version, page size and flags of the
+	file table entry "f", and the end of the extents of a
+	compressed file, from the first "len" bytes of its file, at
+	"buf". The header page of a version 2 file need not all be
+	there: only its first PF_MIN_PAGE_SIZE bytes are looked at.
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PFE_HDRREAD	if the file is too short to hold a header.
+	PFE_FORMAT	if the file is of a version, page size or flags
+		this code does not know.
+*****************************************************************************/
+static int PFparseHdr(PFftab_ele *f, char *buf, size_t len) {
+  PFhdr2_str hdr2;
+
+  if (len >= sizeof(int) && *(int *)buf == PF_HDR_MAGIC) {
+    if (len < PF_MIN_PAGE_SIZE) {
+      PFerrno = PFE_HDRREAD;
+      return (PFerrno);
+    }
+    memcpy(&hdr2, buf, sizeof(hdr2));
+    if (hdr2.version != PF_FORMAT_VERSION ||
+        !PFvalidPageSize(hdr2.pagesize) ||
+        (hdr2.flags & ~PF_FILE_FLAGS) != 0) {
+      PFerrno = PFE_FORMAT;
+      return (PFerrno);
+    }
+    f->version = PF_FORMAT_VERSION;
+    f->pagesize = hdr2.pagesize;
+    f->checksum = (hdr2.flags & PF_FILE_CHECKSUM) != 0;
+    f->compress = (hdr2.flags & PF_FILE_COMPRESS) != 0;
+    f->tail = (off_t)hdr2.tail * PF_EXTENT_ALIGN;
+    f->hdr.firstfree = PF_PAGE_LIST_END;
+    f->hdr.numpages = hdr2.numpages;
+    return (PFE_OK);
+  }
+  if (len < PF_HDR_SIZE) {
+    PFerrno = PFE_HDRREAD;
+    return (PFerrno);
+  }
+  f->version = 1;
+  f->pagesize = PF_PAGE_SIZE;
+  f->checksum = FALSE;
+  f->compress = FALSE;
+  memcpy(&f->hdr, buf, PF_HDR_SIZE);
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write the header of file "fd" back to the file.
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PF error code if not.
+*****************************************************************************/
+static int PFwriteHdr(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  char *page;
+  ssize_t error;
+
+  if (f->version == 1) {
+    if ((error = pwrite(f->unixfd, (char *)&f->hdr, PF_HDR_SIZE, 0)) !=
+        PF_HDR_SIZE) {
+      PFerrno = (error < 0) ? PFE_UNIX : PFE_HDRWRITE;
+      return (PFerrno);
+    }
+    return (PFE_OK);
+  }
+  if ((page = PFallocPage(f->pagesize)) == NULL) {
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  PFhdrPage(page, f->pagesize, &f->hdr,
+            (f->checksum ? PF_FILE_CHECKSUM : 0) |
+                (f->compress ? PF_FILE_COMPRESS : 0),
+            f->compress ? f->tail : 0);
+  error = pwrite(f->unixfd, page, f->pagesize, 0);
+  free(page);
+  if (error != f->pagesize) {
+    PFerrno = (error < 0) ? PFE_UNIX : PFE_HDRWRITE;
+    return (PFerrno);
+  }
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Make room for "nmaps" bitmap pages of the version 2 file "fd",
+	zeroed past those it holds. The old array is kept until the
+	file is closed, as threads may be reading it. The file header
+	must be latched, or the file being opened.
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PFE_NOMEM	if no memory.
+*****************************************************************************/
+static int PFbitmapGrow(int fd,   /* file descriptor */
+                        int nmaps /* # of bitmap pages needed */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  void *map;
+  unsigned char **old;
+  char *changed;
+
+  if (nmaps <= f->nmaps)
+    return (PFE_OK);
+  if (posix_memalign(&map, PF_FRAME_ALIGN, (size_t)nmaps * f->pagesize) !=
+      0) {
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  memset(map, 0, (size_t)nmaps * f->pagesize);
+  if ((changed = (char *)realloc(f->mapchanged, nmaps)) == NULL) {
+    free(map);
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  f->mapchanged = changed;
+  memset(changed + f->nmaps, FALSE, nmaps - f->nmaps);
+  if (f->bitmap != NULL) {
+    if ((old = (unsigned char **)realloc(
+             f->oldmaps, (f->noldmaps + 1) * sizeof(unsigned char *))) ==
+        NULL) {
+      free(map);
+      PFerrno = PFE_NOMEM;
+      return (PFerrno);
+    }
+    f->oldmaps = old;
+    f->oldmaps[f->noldmaps++] = f->bitmap;
+    memcpy(map, f->bitmap, (size_t)f->nmaps * f->pagesize);
+  }
+  f->nmaps = nmaps;
+  PFatomicStore(f->bitmap, (unsigned char *)map);
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Mark page "pagenum" of the version 2 file "fd" used if "used"
+	is TRUE, free otherwise, in its bitmap page, which is written
+	back when the file is closed. The bitmap grows if the page is
+	past its end. The file header must be latched, or the file
+	being opened.
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PFE_NOMEM	if no memory.
+*****************************************************************************/
+static int PFbitmapSet(int fd,      /* file descriptor */
+                       int pagenum, /* page number */
+                       int used     /* TRUE if the page is used */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  unsigned char bits;
+  int error;
+
+  if ((error = PFbitmapGrow(fd, pagenum / PFmapPages(fd) + 1)) != PFE_OK)
+    return (error);
+  bits = f->bitmap[pagenum >> 3];
+  if (used)
+    bits |= 1 << (pagenum & 7);
+  else
+    bits &= ~(1 << (pagenum & 7));
+  PFatomicStore(f->bitmap[pagenum >> 3], bits);
+  f->mapchanged[pagenum / PFmapPages(fd)] = TRUE;
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Find the free page of the version 2 file "fd" closest to page
+	"hint", the one after it if two are as close. The file header
+	must be latched.
+
+RETURN VALUE:
+	The page number, or -1 if the file has no free page.
+*****************************************************************************/
+static int PFbitmapNearest(int fd,  /* file descriptor */
+                           int hint /* page to be close to */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  int numpages = f->hdr.numpages;
+  int after, before, limit;
+
+  if (f->nfree == 0)
+    return (-1);
+  if (hint < 0 || hint >= numpages)
+    hint = numpages - 1;
+
+  /* the first free page from "hint" on, skipping full bytes */
+  for (after = hint; after < numpages; after++) {
+    if ((after & 7) == 0 && f->bitmap[after >> 3] == 0xff)
+      after += 7;
+    else if (!(f->bitmap[after >> 3] & (1 << (after & 7))))
+      break;
+  }
+
+  /* then the last free page before it, if closer */
+  limit = (after < numpages) ? after - hint : numpages + 1;
+  for (before = hint - 1; before >= 0 && hint - before < limit; before--) {
+    if ((before & 7) == 7 && f->bitmap[before >> 3] == 0xff)
+      before -= 7;
+    else if (!(f->bitmap[before >> 3] & (1 << (before & 7))))
+      return (before);
+  }
+  return ((after < numpages) ? after : -1);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write the bitmap pages of the version 2 file "fd" that have
+	changed back to the file.
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PF error code if the write fails.
+*****************************************************************************/
+static int PFbitmapWrite(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  ssize_t error;
+  int i;
+
+  for (i = 0; i < f->nmaps; i++) {
+    if (!f->mapchanged[i])
+      continue;
+    if ((error = pwrite(f->unixfd, f->bitmap + (size_t)i * f->pagesize,
+                        f->pagesize, PFbitmapOffset(fd, i))) != f->pagesize) {
+      PFerrno = (error < 0) ? PFE_UNIX : PFE_INCOMPLETEWRITE;
+      return (PFerrno);
+    }
+    f->mapchanged[i] = FALSE;
+  }
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Give back the bitmap of file "fd".
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFbitmapRelease(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+
+  while (f->noldmaps > 0)
+    free(f->oldmaps[--f->noldmaps]);
+  free((char *)f->oldmaps);
+  free(f->bitmap);
+  free(f->mapchanged);
+  f->oldmaps = NULL;
+  f->bitmap = NULL;
+  f->mapchanged = NULL;
+  f->nmaps = 0;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Read the bitmap pages of the version 2 file "fd", which has
+	just been opened, and count its free pages. Bits of pages past
+	the last one are ignored.
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PF error code if other error. Nothing is left allocated.
+*****************************************************************************/
+static int PFbitmapLoad(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  int nmaps = (f->hdr.numpages + PFmapPages(fd) - 1) / PFmapPages(fd);
+  char *page;
+  ssize_t error;
+  int i;
+
+  f->bitmap = NULL;
+  f->mapchanged = NULL;
+  f->nmaps = 0;
+  f->oldmaps = NULL;
+  f->noldmaps = 0;
+  f->nfree = 0;
+  f->allochint = f->hdr.numpages - 1;
+  if (PFbitmapGrow(fd, nmaps) != PFE_OK)
+    return (PFerrno);
+  for (i = 0; i < nmaps; i++) {
+    page = (char *)f->bitmap + (size_t)i * f->pagesize;
+    if (f->map != NULL)
+      memcpy(page, f->map + PFbitmapOffset(fd, i), f->pagesize);
+    else if ((error = pread(f->unixfd, page, f->pagesize,
+                            PFbitmapOffset(fd, i))) != f->pagesize) {
+      PFerrno = (error < 0) ? PFE_UNIX : PFE_INCOMPLETEREAD;
+      PFbitmapRelease(fd);
+      return (PFerrno);
+    }
+  }
+  for (i = 0; i < f->hdr.numpages; i++)
+    if (!(f->bitmap[i >> 3] & (1 << (i & 7))))
+      f->nfree++;
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Make room in the extent map of the compressed file "fd" for
+	the first "n" pages, zeroed past those it holds. The extents
+	must be latched, or the file being opened.
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PFE_NOMEM	if no memory.
+*****************************************************************************/
+static int PFextentGrow(int fd, /* file descriptor */
+                        int n   /* # of pages to hold */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  PFextent *extents;
+  char *fresh;
+  int size;
+
+  if (n <= f->nextents)
+    return (PFE_OK);
+  for (size = (f->nextents > 0) ? f->nextents : 64; size < n; size *= 2)
+    ;
+  if ((fresh = (char *)realloc(f->extfresh, size)) == NULL) {
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  memset(fresh + f->nextents, FALSE, size - f->nextents);
+  f->extfresh = fresh;
+  if ((extents = (PFextent *)realloc(f->extents, size * sizeof(PFextent))) ==
+      NULL) {
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  memset(extents + f->nextents, 0, (size - f->nextents) * sizeof(PFextent));
+  f->extents = extents;
+  f->nextents = size;
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Give the "len" bytes at "off" among the extents of the
+	compressed file "fd" back, joining them to the holes next to
+	them. Space at the end of the extents is taken off them
+	instead. If there is no memory for the hole, the space stays
+	unused until the file is opened again. The extents must be
+	latched, or the file being opened.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFextentFree(int fd,    /* file descriptor */
+                         off_t off, /* where the space is */
+                         off_t len  /* # of bytes */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  PFhole *holes;
+  int lo, hi, mid;
+
+  if (len <= 0)
+    return;
+
+  /* the first hole after "off" */
+  for (lo = 0, hi = f->nholes; lo < hi;) {
+    mid = (lo + hi) / 2;
+    if (f->holes[mid].off < off)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo > 0 && f->holes[lo - 1].off + f->holes[lo - 1].len == off) {
+    /* it goes on the hole before it, and maybe the one after too */
+    f->holes[--lo].len += len;
+    if (lo + 1 < f->nholes &&
+        f->holes[lo].off + f->holes[lo].len == f->holes[lo + 1].off) {
+      f->holes[lo].len += f->holes[lo + 1].len;
+      memmove(&f->holes[lo + 1], &f->holes[lo + 2],
+              (f->nholes - lo - 2) * sizeof(PFhole));
+      f->nholes--;
+    }
+  } else if (lo < f->nholes && off + len == f->holes[lo].off) {
+    /* it goes in front of the hole after it */
+    f->holes[lo].off = off;
+    f->holes[lo].len += len;
+  } else {
+    /* a hole of its own */
+    if (f->nholes == f->maxholes) {
+      if ((holes = (PFhole *)realloc(f->holes, (f->maxholes + 16) * 2 *
+                                                   sizeof(PFhole))) == NULL)
+        return;
+      f->holes = holes;
+      f->maxholes = (f->maxholes + 16) * 2;
+    }
+    memmove(&f->holes[lo + 1], &f->holes[lo],
+            (f->nholes - lo) * sizeof(PFhole));
+    f->holes[lo].off = off;
+    f->holes[lo].len = len;
+    f->nholes++;
+  }
+
+  /* a hole at the end is no hole */
+  if (f->nholes > 0 &&
+      f->holes[f->nholes - 1].off + f->holes[f->nholes - 1].len ==
+          f->extend) {
+    f->extend = f->holes[--f->nholes].off;
+  }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Find room for an extent of "len" bytes in the compressed file
+	"fd": the first hole it fits, or the end of the extents. The
+	extents must be latched.
+
+RETURN VALUE:
+	Where the extent goes.
+*****************************************************************************/
+static off_t PFextentAlloc(int fd,   /* file descriptor */
+                           off_t len /* # of bytes */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  off_t off;
+  int i;
+
+  for (i = 0; i < f->nholes; i++)
+    if (f->holes[i].len >= len) {
+      off = f->holes[i].off;
+      f->holes[i].off += len;
+      if ((f->holes[i].len -= len) == 0) {
+        memmove(&f->holes[i], &f->holes[i + 1],
+                (f->nholes - i - 1) * sizeof(PFhole));
+        f->nholes--;
+      }
+      return (off);
+    }
+  off = f->extend;
+  f->extend += len;
+  return (off);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Give up the extent of page "pagenum" of the compressed file
+	"fd", which no longer holds the page. If it was written after
+	the trailer, its space is free at once; else the trailer on
+	disk still points to it, and it is kept until a new trailer is
+	(see PFextentWrite()). If there is no memory to keep it, the
+	space stays unused until the file is opened again. The extents
+	must be latched.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFextentGiveUp(int fd,     /* file descriptor */
+                           int pagenum /* page number */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  PFextent *e = &f->extents[pagenum];
+  PFhole *freed;
+
+  if (f->extfresh[pagenum])
+    PFextentFree(fd, (off_t)e->off * PF_EXTENT_ALIGN, PFextentRound(e->len));
+  else {
+    if (f->nfreed == f->maxfreed) {
+      if ((freed = (PFhole *)realloc(f->freed, (f->maxfreed + 16) * 2 *
+                                                   sizeof(PFhole))) == NULL)
+        return;
+      f->freed = freed;
+      f->maxfreed = (f->maxfreed + 16) * 2;
+    }
+    f->freed[f->nfreed].off = (off_t)e->off * PF_EXTENT_ALIGN;
+    f->freed[f->nfreed++].len = PFextentRound(e->len);
+  }
+}
+
+/* orders extents by where they are in the file, for qsort() */
+static int PFextentCmp(const void *a, const void *b) {
+  const PFextent *x = a, *y = b;
+
+  return ((x->off > y->off) - (x->off < y->off));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Read the extent map of the compressed file "fd", which has
+	just been opened, from its trailer, and find the holes among
+	the extents. New extents go after the trailer, which must stay
+	as it is until another has been written (see PFextentWrite()).
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PF error code if other error. Nothing is left allocated.
+*****************************************************************************/
+static int PFextentLoad(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  size_t len = (size_t)f->hdr.numpages * sizeof(PFextent);
+  PFextent *sorted;
+  off_t end;
+  ssize_t error;
+  int i, n;
+
+  f->extents = NULL;
+  f->extfresh = NULL;
+  f->nextents = 0;
+  f->holes = NULL;
+  f->nholes = f->maxholes = 0;
+  f->freed = NULL;
+  f->nfreed = f->maxfreed = 0;
+  f->extchanged = FALSE;
+  if (f->tail != 0)
+    f->tailend = f->extend = PFbitmapOffset(fd, f->nmaps);
+  else
+    f->tailend = f->extend = f->pagesize;
+  if (PFextentGrow(fd, f->hdr.numpages) != PFE_OK)
+    goto fail;
+  if (len > 0 &&
+      (error = pread(f->unixfd, f->extents, len, f->tail)) != (ssize_t)len) {
+    PFerrno = (error < 0) ? PFE_UNIX : PFE_INCOMPLETEREAD;
+    goto fail;
+  }
+
+  /* the holes are the gaps between the extents, and the trailer, in
+  file order */
+  if ((sorted = (PFextent *)malloc(len + sizeof(PFextent))) == NULL) {
+    PFerrno = PFE_NOMEM;
+    goto fail;
+  }
+  for (i = n = 0; i < f->hdr.numpages; i++)
+    if (f->extents[i].len != 0)
+      sorted[n++] = f->extents[i];
+  qsort(sorted, n, sizeof(PFextent), PFextentCmp);
+  if (f->tail != 0) {
+    sorted[n].off = (unsigned int)(f->tail / PF_EXTENT_ALIGN);
+    sorted[n++].len = 0;
+  }
+  for (i = 0, end = f->pagesize; i < n; i++) {
+    if ((off_t)sorted[i].off * PF_EXTENT_ALIGN > end)
+      PFextentFree(fd, end, (off_t)sorted[i].off * PF_EXTENT_ALIGN - end);
+    end = (off_t)sorted[i].off * PF_EXTENT_ALIGN +
+          PFextentRound(sorted[i].len);
+  }
+  free((char *)sorted);
+  pthread_mutex_init(&f->extlatch, NULL);
+  return (PFE_OK);
+
+fail:
+  free((char *)f->extents);
+  free(f->extfresh);
+  free((char *)f->holes);
+  f->extents = NULL;
+  f->extfresh = NULL;
+  f->nextents = 0;
+  f->holes = NULL;
+  f->nholes = f->maxholes = 0;
+  return (PFerrno);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Give back the extent of page "pagenum" of the compressed file
+	"fd", which has been disposed of.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFextentDispose(int fd,     /* file descriptor */
+                            int pagenum /* page number */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  PFextent *e;
+
+  pthread_mutex_lock(&f->extlatch);
+  if (pagenum < f->nextents && (e = &f->extents[pagenum])->len != 0) {
+    PFextentGiveUp(fd, pagenum);
+    e->off = e->len = 0;
+    f->extchanged = TRUE;
+  }
+  pthread_mutex_unlock(&f->extlatch);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write a new trailer of the compressed file "fd", the extent
+	map and all the bitmap pages, at the end of its extents, if
+	anything in it has changed, and cut the file off after it.
+	The file is synced, so that its pages and the trailer are on
+	disk before the header points to them; then the header is
+	written and synced too. Until then the trailer on disk and the
+	extents it points to are left alone, so a crash finds the file
+	as it was at the last trailer. Only once the new one is in
+	place are the old trailer and the extents given up since it
+	free to be used again.
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PF error code if a write or sync fails. The header may then
+	still point to the old trailer, which is kept.
+*****************************************************************************/
+static int PFextentWrite(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  size_t len = PFtrailerMapSize(fd);
+  off_t oldtail = f->tail, oldend = f->tailend;
+  char *map;
+  ssize_t error;
+  int i;
+
+  for (i = 0; i < f->nmaps && !f->mapchanged[i]; i++)
+    ;
+  if (!f->extchanged && !f->hdrchanged && i == f->nmaps)
+    return (PFE_OK);
+
+  if (PFextentGrow(fd, f->hdr.numpages) != PFE_OK)
+    return (PFerrno);
+  if ((map = calloc(1, len > 0 ? len : 1)) == NULL) {
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  memcpy(map, f->extents, (size_t)f->hdr.numpages * sizeof(PFextent));
+  error = pwrite(f->unixfd, map, len, f->extend);
+  free(map);
+  if (error != (ssize_t)len) {
+    PFerrno = (error < 0) ? PFE_UNIX : PFE_INCOMPLETEWRITE;
+    return (PFerrno);
+  }
+
+  /* the bitmap pages go after the map */
+  f->tail = f->extend;
+  memset(f->mapchanged, TRUE, f->nmaps);
+  if (PFbitmapWrite(fd) != PFE_OK)
+    goto restore;
+  if (ftruncate(f->unixfd, PFbitmapOffset(fd, f->nmaps)) < 0 ||
+      fdatasync(f->unixfd) < 0) {
+    PFerrno = PFE_UNIX;
+    goto restore;
+  }
+  if (PFwriteHdr(fd) != PFE_OK)
+    goto restore;
+  if (fdatasync(f->unixfd) < 0) {
+    /* the header may point to either trailer: keep both, and the
+    extents of each */
+    f->tailend = f->extend = PFbitmapOffset(fd, f->nmaps);
+    memset(f->extfresh, FALSE, f->nextents);
+    f->hdrchanged = TRUE;
+    PFerrno = PFE_UNIX;
+    return (PFerrno);
+  }
+  f->tailend = f->extend = PFbitmapOffset(fd, f->nmaps);
+  f->hdrchanged = FALSE;
+  f->extchanged = FALSE;
+
+  /* nothing on disk points to these any more */
+  if (oldtail != 0)
+    PFextentFree(fd, oldtail, oldend - oldtail);
+  for (i = 0; i < f->nfreed; i++)
+    PFextentFree(fd, f->freed[i].off, f->freed[i].len);
+  f->nfreed = 0;
+  memset(f->extfresh, FALSE, f->nextents);
+  return (PFE_OK);
+
+restore:
+  f->tail = oldtail;
+  memset(f->mapchanged, TRUE, f->nmaps);
+  return (PFerrno);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Give back the extent map of file "fd", if it is compressed.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFextentRelease(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+
+  if (!f->compress)
+    return;
+  free((char *)f->extents);
+  free(f->extfresh);
+  free((char *)f->holes);
+  free((char *)f->freed);
+  f->extents = NULL;
+  f->extfresh = NULL;
+  f->nextents = 0;
+  f->holes = NULL;
+  f->nholes = f->maxholes = 0;
+  f->freed = NULL;
+  f->nfreed = f->maxfreed = 0;
+  pthread_mutex_destroy(&f->extlatch);
+}
+
+/* where a read of a run of pages puts the bitmap page in the middle
+of it */
+static char PFmapSink[PF_MAX_PAGE_SIZE]
+    __attribute__((aligned(PF_FRAME_ALIGN)));
+
+/* # of bytes the "n" pages from "pagenum" on of file "fd" span */
+#define PFrunLength(fd,pagenum,n) (PFpageOffset(fd, (pagenum) + (n) - 1) + \
+				PFdiskPageSize(fd) - PFpageOffset(fd, pagenum))
+
+/****************************************************************************
+SPECIFICATIONS:
+	Fill iov[] with the places of the "n" buffers fpages[0] to
+	fpages[n-1] of pages "pagenum" on of file "fd" in on-disk
+	order: the frame of each, after its "nextfree" word in a
+	version 1 file. A bitmap page between two of the pages goes
+	to PFmapSink, so it must not be written this way.
+
+RETURN VALUE:
+	The # of entries of iov[] filled, at most 2*n.
+*****************************************************************************/
+static int PFpageIovec(int fd, int pagenum, PFfpage **fpages, int n,
+                       struct iovec *iov) {
+  int niov = 0;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (PFftab(fd).version == 1) {
+      iov[niov].iov_base = (char *)&fpages[i]->nextfree;
+      iov[niov++].iov_len = sizeof(fpages[i]->nextfree);
+    }
+    iov[niov].iov_base = fpages[i]->pagebuf;
+    iov[niov++].iov_len = PFftab(fd).pagesize;
+    if (i < n - 1 && PFmapBetween(fd, pagenum + i)) {
+      iov[niov].iov_base = PFmapSink;
+      iov[niov++].iov_len = PFftab(fd).pagesize;
+    }
+  }
+  return (niov);
+}
+
+/* checksum of page "pagenum" of file "fd", whose data is at "buf" */
+#define PFpageCrc(fd,pagenum,buf) PFcrc32c((unsigned int)(pagenum), (buf), \
+				PFftab(fd).pagesize - PF_CHECKSUM_SIZE)
+
+/* where the checksum of a page of file "fd" whose data is at "buf"
+is kept */
+#define PFpageCrcSlot(fd,buf) ((buf) + PFftab(fd).pagesize - PF_CHECKSUM_SIZE)
+
+/****************************************************************************
+SPECIFICATIONS:
+	Check page "pagenum" of file "fd", just read into "fpage",
+	against its checksum, if the file has them. A free page is not
+	checked. Every used page has been written with its checksum by
+	the time the header or bitmap on disk counts it used (see
+	PFbufStampFresh()), so one that does not match, all zeroes
+	included, is damaged.
+
+RETURN VALUE:
+	PFE_OK	if the page is good.
+	PFE_CHECKSUM	if not.
+*****************************************************************************/
+static int PFpageCheck(int fd,       /* file descriptor */
+                       int pagenum,  /* page number */
+                       PFfpage *fpage /* page read */
+) {
+  unsigned int crc;
+  char *buf = fpage->pagebuf;
+
+  if (!PFftab(fd).checksum || PFfreePage(fd, pagenum))
+    return (PFE_OK);
+  memcpy(&crc, PFpageCrcSlot(fd, buf), sizeof(crc));
+  if (crc != PFpageCrc(fd, pagenum, buf)) {
+    PFerrno = PFE_CHECKSUM;
+    return (PFerrno);
+  }
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Copy the extents of the "n" pages from "pagenum" on of the
+	compressed file "fd" into ext[], and find how many of them,
+	from the first on, one read can bring in: those whose extents
+	follow each other in the file, a page with no extent going
+	along with any, as long as the read is no longer than the
+	pages would be uncompressed. Set *off and *len to the place
+	and length of that read; *len is 0 if none of them has an
+	extent.
+
+RETURN VALUE:
+	The # of pages the read brings in, at least 1.
+*****************************************************************************/
+static int PFextentRun(int fd,        /* file descriptor */
+                       int pagenum,   /* first page */
+                       int n,         /* # of pages */
+                       PFextent *ext, /* their extents */
+                       off_t *off,    /* where to read */
+                       size_t *len    /* # of bytes to read */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  off_t start = -1, end = -1, eoff;
+  int i;
+
+  pthread_mutex_lock(&f->extlatch);
+  for (i = 0; i < n; i++)
+    if (pagenum + i < f->nextents)
+      ext[i] = f->extents[pagenum + i];
+    else
+      ext[i].off = ext[i].len = 0;
+  pthread_mutex_unlock(&f->extlatch);
+
+  for (i = 0; i < n; i++) {
+    if (ext[i].len == 0)
+      continue;
+    eoff = (off_t)ext[i].off * PF_EXTENT_ALIGN;
+    if (start < 0)
+      start = eoff;
+    else if (eoff < end ||
+             eoff + ext[i].len - start > (off_t)(i + 1) * f->pagesize)
+      break;
+    end = eoff + ext[i].len;
+  }
+  *off = (start < 0) ? 0 : start;
+  *len = (start < 0) ? 0 : (size_t)(end - start);
+  return ((i > 0) ? i : 1);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Decompress page "pagenum" of the compressed file "fd", whose
+	extent is "ext", from "src" into "fpage", then check it (see
+	PFpageCheck()). A page with no extent is all zeroes; one whose
+	extent is a whole page long is stored as it is.
+
+RETURN VALUE:
+	PFE_OK	if the page is good.
+	PFE_DECOMPRESS	if the extent is damaged.
+	PFE_CHECKSUM	if the page does not match its checksum.
+*****************************************************************************/
+static int PFextentDecode(int fd,         /* file descriptor */
+                          int pagenum,    /* page number */
+                          PFextent *ext,  /* its extent */
+                          char *src,      /* the extent read */
+                          PFfpage *fpage  /* page to fill */
+) {
+  int pagesize = PFftab(fd).pagesize;
+
+  if (ext->len == 0)
+    memset(fpage->pagebuf, 0, pagesize);
+  else if (ext->len == (unsigned int)pagesize)
+    memcpy(fpage->pagebuf, src, pagesize);
+  else if (PFlzDecompress(src, ext->len, fpage->pagebuf, pagesize) !=
+           pagesize) {
+    PFerrno = PFE_DECOMPRESS;
+    return (PFerrno);
+  }
+  return (PFpageCheck(fd, pagenum, fpage));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	PFreadfcn() for a compressed file: read the extents of the "n"
+	pages from "pagenum" on with as few pread() calls as
+	PFextentRun() allows, and decompress them into fpages[0] to
+	fpages[n-1].
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PF error code if not.
+*****************************************************************************/
+static int PFextentRead(int fd, int pagenum, PFfpage **fpages, int n) {
+  PFextent ext[PF_READ_AHEAD_MAX];
+  char *zbuf;
+  off_t off;
+  size_t len;
+  ssize_t error;
+  int done, k, i;
+
+  if ((zbuf = malloc((size_t)n * PFftab(fd).pagesize)) == NULL) {
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  for (done = 0; done < n; done += k) {
+    k = PFextentRun(fd, pagenum + done, n - done, ext, &off, &len);
+    if (len > 0 &&
+        (error = pread(PFftab(fd).unixfd, zbuf, len, off)) != (ssize_t)len) {
+      PFerrno = (error < 0) ? PFE_UNIX : PFE_INCOMPLETEREAD;
+      free(zbuf);
+      return (PFerrno);
+    }
+    for (i = 0; i < k; i++)
+      if (PFextentDecode(fd, pagenum + done + i, &ext[i],
+                         zbuf + ((off_t)ext[i].off * PF_EXTENT_ALIGN - off),
+                         fpages[done + i]) != PFE_OK) {
+        free(zbuf);
+        return (PFerrno);
+      }
+  }
+  free(zbuf);
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	PFwritefcn() for a compressed file: compress the "n" pages from
+	"pagenum" on, from fpages[0] to fpages[n-1], and write each to
+	its extent if no trailer on disk points to it and it still fits
+	there, giving back what it no longer needs, else to a new one
+	(see PFextentAlloc()), which the extent map then points to,
+	giving up the old (see PFextentGiveUp()). A page
+	that does not shrink is stored as it is. Extents that follow
+	each other in the file are written with one pwrite() call.
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PF error code if not.
+*****************************************************************************/
+static int PFextentStore(int fd, int pagenum, PFfpage **fpages, int n) {
+  PFftab_ele *f = &PFftab(fd);
+  int pagesize = f->pagesize;
+  off_t pos[PF_WRITE_RUN + 1]; /* where each page is in zbuf */
+  off_t off[PF_WRITE_RUN];     /* where each page goes in the file */
+  int zlen[PF_WRITE_RUN];      /* # of bytes each page takes */
+  PFextent *e;
+  char *zbuf;
+  ssize_t error;
+  int done, len, i;
+
+  if ((zbuf = malloc((size_t)n * PFextentRound(pagesize))) == NULL) {
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  pos[0] = 0;
+  for (i = 0; i < n; i++) {
+    if ((zlen[i] = PFlzCompress(fpages[i]->pagebuf, pagesize, zbuf + pos[i],
+                                pagesize - 1)) == 0) {
+      memcpy(zbuf + pos[i], fpages[i]->pagebuf, pagesize);
+      zlen[i] = pagesize;
+    }
+    pos[i + 1] = pos[i] + PFextentRound(zlen[i]);
+    memset(zbuf + pos[i] + zlen[i], 0, pos[i + 1] - pos[i] - zlen[i]);
+  }
+
+  /* give each page its place */
+  pthread_mutex_lock(&f->extlatch);
+  if (PFextentGrow(fd, pagenum + n) != PFE_OK) {
+    pthread_mutex_unlock(&f->extlatch);
+    free(zbuf);
+    return (PFerrno);
+  }
+  for (i = 0; i < n; i++) {
+    e = &f->extents[pagenum + i];
+    if (e->len != 0 && f->extfresh[pagenum + i] &&
+        PFextentRound(zlen[i]) <= PFextentRound(e->len)) {
+      if (PFextentRound(zlen[i]) < PFextentRound(e->len))
+        PFextentFree(fd,
+                     (off_t)e->off * PF_EXTENT_ALIGN + PFextentRound(zlen[i]),
+                     PFextentRound(e->len) - PFextentRound(zlen[i]));
+    } else {
+      if (e->len != 0)
+        PFextentGiveUp(fd, pagenum + i);
+      e->off = (unsigned int)(PFextentAlloc(fd, PFextentRound(zlen[i])) /
+                              PF_EXTENT_ALIGN);
+      f->extfresh[pagenum + i] = TRUE;
+    }
+    e->len = zlen[i];
+    off[i] = (off_t)e->off * PF_EXTENT_ALIGN;
+  }
+  f->extchanged = TRUE;
+  pthread_mutex_unlock(&f->extlatch);
+
+  /* write out runs of extents that follow each other */
+  for (done = 0; done < n; done += len) {
+    for (len = 1; done + len < n &&
+                  off[done + len] == off[done + len - 1] +
+                                         (pos[done + len] - pos[done + len - 1]);
+         len++)
+      ;
+    if ((error = pwrite(f->unixfd, zbuf + pos[done], pos[done + len] - pos[done],
+                        off[done])) != pos[done + len] - pos[done]) {
+      PFerrno = (error < 0) ? PFE_UNIX : PFE_INCOMPLETEWRITE;
+      free(zbuf);
+      return (PFerrno);
+    }
+  }
+  free(zbuf);
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Read the "n" pages numbered "pagenum" to "pagenum"+n-1 from the
+	file indexed by "fd" into the buffers fpages[0] to fpages[n-1]
+	with one preadv() call: the data of each goes to the frame at
+	its "pagebuf", and in a version 1 file its "nextfree" word to
+	its "nextfree". A bitmap page among them is read and dropped.
+	"n" is at most PF_READ_AHEAD_MAX. The read names its offset, so
+	threads reading other pages of the file at the same time do
+	not disturb it. The pages of a file with checksums are checked
+	(see PFpageCheck()). Those of a compressed file are read from
+	their extents instead (see PFextentRead()).
+
+AUTHOR: clc
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PFE_CHECKSUM	if a page does not match its checksum.
+	PF error code if not OK.
+*****************************************************************************/
+int PFreadfcn(int fd,           /* file descriptor */
+              int pagenum,      /* first page to read */
+              PFfpage **fpages, /* buffers to read the pages into */
+              int n             /* # of pages to read */
+) {
+  ssize_t error;
+  struct iovec iov[2 * PF_READ_AHEAD_MAX];
+  int unixfd, niov, i;
+
+  if ((unixfd = PFfdGet(fd)) < 0)
+    return (PFerrno);
+  if (PFftab(fd).compress) {
+    error = PFextentRead(fd, pagenum, fpages, n);
+    PFfdPut(fd);
+    return ((int)error);
+  }
+
+  /* read the data at the pages' place in the file */
+  niov = PFpageIovec(fd, pagenum, fpages, n, iov);
+  error = preadv(unixfd, iov, niov, PFpageOffset(fd, pagenum));
+  PFfdPut(fd);
+  if (error != (ssize_t)PFrunLength(fd, pagenum, n)) {
+    if (error < 0)
+      PFerrno = PFE_UNIX;
+    else
+      PFerrno = PFE_INCOMPLETEREAD;
+    return (PFerrno);
+  }
+
+  for (i = 0; i < n; i++)
+    if (PFpageCheck(fd, pagenum + i, fpages[i]) != PFE_OK)
+      return (PFerrno);
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write the "n" pages numbered "pagenum" to "pagenum"+n-1 from
+	the buffers fpages[0] to fpages[n-1] into the file indexed by
+	"fd", gathering the frame of each (and in a version 1 file its
+	"nextfree" word) into their places in one pwritev() call, or
+	two if a bitmap page lies between them. "n" is at most
+	PF_WRITE_RUN. Like PFreadfcn(), it does not move the file
+	offset. In a file with checksums each page is stamped with its
+	own first. The pages of a compressed file are written to their
+	extents instead (see PFextentStore()).
+
+AUTHOR: clc
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PF errod code if not OK.
+
+*****************************************************************************/
+int PFwritefcn(int fd,           /* file descriptor */
+               int pagenum,      /* first page to write */
+               PFfpage **fpages, /* buffers of the pages to write */
+               int n             /* # of pages to write */
+) {
+  ssize_t error;
+  struct iovec iov[2 * PF_WRITE_RUN];
+  unsigned int crc;
+  int unixfd, niov, done, len, i;
+
+  if (PFftab(fd).checksum)
+    for (i = 0; i < n; i++) {
+      crc = PFpageCrc(fd, pagenum + i, fpages[i]->pagebuf);
+      memcpy(PFpageCrcSlot(fd, fpages[i]->pagebuf), &crc, sizeof(crc));
+    }
+  if ((unixfd = PFfdGet(fd)) < 0)
+    return (PFerrno);
+  if (PFftab(fd).compress) {
+    error = PFextentStore(fd, pagenum, fpages, n);
+    PFfdPut(fd);
+    return ((int)error);
+  }
+
+  /* write out the pages at their place in the file, leaving out the
+  bitmap pages */
+  for (done = 0; done < n; done += len) {
+    for (len = 1; done + len < n && !PFmapBetween(fd, pagenum + done + len - 1);
+         len++)
+      ;
+    niov = PFpageIovec(fd, pagenum + done, fpages + done, len, iov);
+    if ((error = pwritev(unixfd, iov, niov,
+                         PFpageOffset(fd, pagenum + done))) !=
+        (ssize_t)PFrunLength(fd, pagenum + done, len)) {
+      PFfdPut(fd);
+      if (error < 0)
+        PFerrno = PFE_UNIX;
+      else
+        PFerrno = PFE_INCOMPLETEWRITE;
+      return (PFerrno);
+    }
+  }
+
+  PFfdPut(fd);
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	"check" of a request set up by PFreadprep() for a file with
+	checksums: check page "i" of those read by "req" with
+	PFpageCheck().
+
+RETURN VALUE:
+	As PFpageCheck().
+*****************************************************************************/
+static int PFreadCheck(PFioreq *req, /* request whose read is over */
+                       int i         /* which of its pages */
+) {
+  return (PFpageCheck(req->fd, req->pagenum + i, &req->bpages[i]->fpage));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	"check" of a request set up by PFreadprep() for a compressed
+	file: decompress page "i" of those read by "req" from
+	"req->zbuf", where the read put the extents from
+	"req->offset" on, with PFextentDecode(). The extent map is
+	looked at again, as a page being read in is not written.
+
+RETURN VALUE:
+	As PFextentDecode().
+	PFE_INCOMPLETEREAD	if the extent of the page was not read.
+*****************************************************************************/
+static int PFextentCheck(PFioreq *req, /* request whose read is over */
+                         int i         /* which of its pages */
+) {
+  PFftab_ele *f = &PFftab(req->fd);
+  int pagenum = req->pagenum + i;
+  PFextent ext = {0, 0};
+  off_t eoff;
+
+  pthread_mutex_lock(&f->extlatch);
+  if (pagenum < f->nextents)
+    ext = f->extents[pagenum];
+  pthread_mutex_unlock(&f->extlatch);
+  eoff = (off_t)ext.off * PF_EXTENT_ALIGN;
+  if (ext.len != 0 &&
+      (eoff < req->offset || eoff + ext.len > req->offset + req->len)) {
+    PFerrno = PFE_INCOMPLETEREAD;
+    return (PFerrno);
+  }
+  return (PFextentDecode(req->fd, pagenum, &ext,
+                         req->zbuf + (eoff - req->offset),
+                         &req->bpages[i]->fpage));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	"finish" of a request set up by PFreadprep(): let go of the
+	unix file it read from (see PFfdGet()).
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFreadFinish(PFioreq *req /* request whose read is over */
+) {
+  PFfdPut(req->fd);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Set up request "req" to read, as PFreadfcn() does, the "n"
+	pages numbered "pagenum" to "pagenum"+n-1 from the file indexed
+	by "fd" into the buffers fpages[0] to fpages[n-1]. The read is
+	started by PFbufPrefetch(), and may be over after "fd" has been
+	closed, which waits for it. The pages of a file with checksums
+	are then checked with PFpageCheck(). For a compressed file the
+	extents of the pages PFextentRun() finds one read can bring in
+	are read into "zbuf", and PFextentCheck() decompresses them;
+	the other pages are dropped and read when they are fixed. The
+	unix file of "fd" is held until the read is over, and let go of
+	by PFreadFinish().
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFreadprep(int fd,           /* file descriptor */
+                       int pagenum,      /* first page to read */
+                       PFfpage **fpages, /* buffers to read the pages into */
+                       int n,            /* # of pages to read */
+                       PFioreq *req      /* request to set up */
+) {
+  PFextent ext[PF_READ_AHEAD_MAX];
+  size_t len;
+
+  /* a read of a closed unix file fails, and the pages are read again
+  when they are fixed */
+  req->unixfd = PFfdGet(fd);
+  req->finish = req->unixfd >= 0 ? PFreadFinish : NULL;
+  req->zbuf = NULL;
+  if (PFftab(fd).compress) {
+    PFextentRun(fd, pagenum, n, ext, &req->offset, &len);
+    if ((req->zbuf = malloc(len > 0 ? len : 1)) == NULL)
+      len = 0; /* no page with an extent is read */
+    req->iov[0].iov_base = req->zbuf;
+    req->iov[0].iov_len = len;
+    req->niov = 1;
+    req->len = len;
+    req->check = PFextentCheck;
+    return;
+  }
+  req->offset = PFpageOffset(fd, pagenum);
+  req->niov = PFpageIovec(fd, pagenum, fpages, n, req->iov);
+  req->len = PFrunLength(fd, pagenum, n);
+  req->check = PFftab(fd).checksum ? PFreadCheck : NULL;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Give the kernel "advice" (see madvise()) about the "n" pages
+	from "pagenum" on of the mapped file "fd". The range is widened
+	to whole pages of memory. Advice is only a hint, so errors are
+	ignored.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFmapAdvise(int fd,      /* file descriptor */
+                        int pagenum, /* first page */
+                        int n,       /* # of pages */
+                        int advice   /* MADV_WILLNEED, ... */
+) {
+  uintptr_t start, end;
+  uintptr_t mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+
+  start = (uintptr_t)PFmapPage(fd, pagenum) & ~mask;
+  end = (uintptr_t)PFmapPage(fd, pagenum + n);
+  madvise((void *)start, end - start, advice);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Fix page "pagenum" of the mapped file "fd", if it is used, and
+	set *pagebuf to point to its data in the mapping. A fix only
+	counts; the page is never copied.
+
+RETURN VALUE:
+	TRUE	if the page is used, and now fixed.
+	FALSE	if it is free. It is not fixed then.
+*****************************************************************************/
+static int PFmapFix(int fd,         /* file descriptor */
+                    int pagenum,    /* page number */
+                    char **pagebuf /* pointer to pointer to page data */
+) {
+  int nextfree;
+
+  __atomic_fetch_add(&PFmappedRequests, 1, __ATOMIC_RELAXED);
+  if (PFftab(fd).version == 1) {
+    memcpy(&nextfree, PFftab(fd).map + PFpageOffset(fd, pagenum),
+           sizeof(int));
+    if (nextfree != PF_PAGE_USED)
+      return (FALSE);
+  } else if (PFfreePage(fd, pagenum))
+    return (FALSE);
+  __atomic_fetch_add(&PFftab(fd).mapfix[pagenum], 1, __ATOMIC_RELAXED);
+  *pagebuf = PFmapPage(fd, pagenum);
+  return (TRUE);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Take one fix away from page "pagenum" of the mapped file "fd".
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_READONLY	if "dirty" is TRUE: mapped pages can't be changed.
+	PFE_PAGEUNFIXED	if the page is not fixed.
+*****************************************************************************/
+static int PFmapUnfix(int fd,      /* file descriptor */
+                      int pagenum, /* page number */
+                      int dirty    /* TRUE if the page was changed */
+) {
+  int *fix = &PFftab(fd).mapfix[pagenum];
+  int count;
+
+  if (dirty) {
+    PFerrno = PFE_READONLY;
+    return (PFerrno);
+  }
+  count = PFatomicLoad(*fix);
+  do {
+    if (count <= 0) {
+      PFerrno = PFE_PAGEUNFIXED;
+      return (PFerrno);
+    }
+  } while (!__atomic_compare_exchange_n(fix, &count, count - 1, FALSE,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Note that page "pagenum" of file "fd" is about to be fixed by
+	PF_GetThisPage() or PF_GetNextPage(), and read ahead if the
+	file is being read in page order. A page right after the last
+	one asked for carries on the run; any other starts over. The
+	first time a run goes on PF_READ_AHEAD_MIN pages are read
+	ahead, from this page on, and whenever the run gets within
+	half a window of the end of the pages read ahead, twice as many
+	as last time are read after them, up to PFreadahead.
+	The pages are read with PFbufPrefetch(), so with asynchronous
+	I/O started (see PF_StartAsyncIO()) the caller does not wait
+	for them. For a mapped file the kernel is told that they will
+	be needed instead. Threads reading the same file at once may upset each
+	other's runs; that costs no more than a window read in vain.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFreadAhead(int fd,     /* file descriptor */
+                        int pagenum /* page about to be fixed */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  int pages[PF_READ_AHEAD_MAX];
+  int next, window;
+  int n, i;
+
+  if (PFreadahead == 0)
+    return;
+  if (pagenum != PFatomicLoad(f->ralast) + 1) {
+    /* not in order: start over */
+    PFatomicStore(f->ralast, pagenum);
+    PFatomicStore(f->ranext, pagenum + 1);
+    PFatomicStore(f->rawindow, 0);
+    return;
+  }
+  PFatomicStore(f->ralast, pagenum);
+
+  /* read ahead once the run comes near the end of the last window */
+  next = PFatomicLoad(f->ranext);
+  window = PFatomicLoad(f->rawindow);
+  if (next - pagenum > window / 2)
+    return;
+  if (window == 0)
+    window = PF_READ_AHEAD_MIN;
+  else
+    window *= 2;
+  if (window > PFreadahead)
+    window = PFreadahead;
+  if (next < pagenum)
+    next = pagenum;
+  PFatomicStore(f->ranext, next + window);
+  PFatomicStore(f->rawindow, window);
+
+  if ((n = f->hdr.numpages - next) > window)
+    n = window;
+  if (n > 0 && f->map != NULL) {
+    PFmapAdvise(fd, next, n, MADV_WILLNEED);
+    return;
+  }
+  for (i = 0; i < n; i++)
+    pages[i] = next + i;
+  if (n > 0)
+    PFbufPrefetch(fd, pages, n, PFreadprep);
+}
+
+/************************* Interface Routines ****************************/
+
+/****************************************************************************
+SPECIFICATIONS:
+	Initialize the PF interface. Must be the first function called
+	in order to use the PF ADT.
+
+AUTHOR: clc
+
+RETURN VALUE: none
+
+GLOBAL VARIABLES MODIFIED:
+	PFftab
+*****************************************************************************/
+void PF_Init() {
+  int i;
+  PFwarmJoin(TRUE);
+  /* init the buffer pool and its page tables */
+  PFbufInitPool(PFbufferPool.poolSize, PFbufferPool.numPartitions);
+
+  /* init the file table to be not used*/
+  PFftabfree = -1;
+  for (i = PFftabchunks * PF_FTAB_CHUNK - 1; i >= 0; i--) {
+    PFftab(i).fname = NULL;
+    PFftab(i).unixfd = -1;
+    PFftab(i).freenext = PFftabfree;
+    PFftabfree = i;
+  }
+  PFnamecount = 0;
+  if (PFnamebucket != NULL)
+    memset(PFnamebucket, 0xff, PFnamebuckets * sizeof(int));
+  PFfdopen = 0;
+  PFfdhead = PFfdtail = -1;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Set up the buffer pool to hold exactly "poolSize" pages and
+	use the given replacement policy, and clear the statistics.
+	Must be called before any file is opened.
+
+RETURN VALUE: none
+*****************************************************************************/
+void PF_InitWithOptions(int poolSize, int replacementPolicy) {
+    PF_InitPartitioned(poolSize, replacementPolicy, 1);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Like PF_InitWithOptions(), but split the pool into
+	"numPartitions" partitions, each with a latch, a page table,
+	a free list and replacement state of its own. A page always
+	lives in the partition picked by hashing its file and page
+	number, so threads working on different pages seldom wait for
+	each other. Each partition gets an equal share of the pages
+	and the policy runs inside it. There are never more partitions
+	than pages. Must be called before any file is opened, and
+	while no other thread uses the PF layer.
+
+RETURN VALUE: none
+*****************************************************************************/
+void PF_InitPartitioned(int poolSize, int replacementPolicy,
+                        int numPartitions) {
+    PFwarmJoin(TRUE);
+    PFbufferPool.replacement = replacementPolicy;
+
+    /* Tell buf.c to reinitialize its partitions */
+    PFbufInitPool(poolSize, numPartitions);
+    PF_ResetStats();
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Grow or shrink the buffer pool to "poolSize" pages while files
+	are open. Shrinking writes out and drops unfixed pages chosen
+	by the replacement policy.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_POOLSIZE	if poolSize < 1, or smaller than the number of
+		partitions.
+	PFE_NOBUF	if a partition has more pages fixed than its
+		share of poolSize.
+	other PF error code if writing a page fails.
+*****************************************************************************/
+int PF_ResizePool(int poolSize /* new # of buffer pages */
+) {
+  if (poolSize < 1) {
+    PFerrno = PFE_POOLSIZE;
+    return (PFerrno);
+  }
+  return (PFbufResizePool(poolSize, PFwritefcn));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Start a background writer thread that writes dirty, unfixed
+	pages ahead of the misses that would page them out. When fewer
+	than "lowPct" percent of the pages of a buffer partition are
+	clean (free, or unfixed and not dirty), it writes pages
+	nearest to being paged out until "highPct" percent are. It
+	looks every few milliseconds, and whenever a miss has had to
+	write its victim. If the writer runs already, it takes the new
+	watermarks.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_WATERMARK	unless 0 < lowPct <= highPct <= 100.
+	PFE_UNIX	if the thread can not be created.
+*****************************************************************************/
+int PF_StartWriter(int lowPct, /* % of pages to keep clean */
+                   int highPct /* % of pages to clean up to */
+) {
+  return (PFbufStartWriter(lowPct, highPct, PFwritefcn));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Stop the background writer started by PF_StartWriter(), if it
+	runs. Dirty pages are left to be written as they are paged out
+	or their file is closed.
+
+RETURN VALUE: none
+*****************************************************************************/
+void PF_StopWriter(void) {
+  PFbufStopWriter();
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Read at most "maxPages" pages ahead at a time when a file is
+	read in page order with PF_GetThisPage() or PF_GetNextPage();
+	0 turns read-ahead off. It is off unless this is called: with
+	a small pool the pages read ahead may be paged out again before
+	they are used.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_READAHEAD	unless 0 <= maxPages <= PF_READ_AHEAD_MAX.
+*****************************************************************************/
+int PF_SetReadAhead(int maxPages /* max # of pages read ahead, or 0 */
+) {
+  if (maxPages < 0 || maxPages > PF_READ_AHEAD_MAX) {
+    PFerrno = PFE_READAHEAD;
+    return (PFerrno);
+  }
+  PFreadahead = maxPages;
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Keep at most "maxFds" unix files open for the files opened with
+	PF_OpenFile() and PF_OpenFileDirect(), so that more files can
+	be open than the process may have file descriptors; 0, as
+	before this is called, sets no limit. With a limit, the unix
+	file used least recently, of those no I/O is using, is closed
+	when another must be opened, and opened again by name the next
+	time its file is read or written; files must then not be
+	renamed or removed while open. Buffer hits touch no unix file,
+	so they cost the same either way. Files opened with
+	PF_OpenFileMapped() hold no unix file. Unix files over a new,
+	lower limit are closed at once. Reads in flight are waited for
+	first; like PF_Init(), this must not run while other threads
+	use the PF layer.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_FDLIMIT	if maxFds < 0.
+*****************************************************************************/
+int PF_SetMaxOpenFds(int maxFds /* max # of unix files open, or 0 */
+) {
+  if (maxFds < 0) {
+    PFerrno = PFE_FDLIMIT;
+    return (PFerrno);
+  }
+  PFioDrain();
+  pthread_mutex_lock(&PFfdlatch);
+  PFfdmax = maxFds;
+  if (PFfdmax > 0)
+    PFfdTrim(0);
+  pthread_mutex_unlock(&PFfdlatch);
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Read pages ahead asynchronously from now on: PF_PrefetchPages()
+	and read-ahead start their reads and return, and a fix of a
+	page waits only if its read is not over yet. With "backend"
+	PF_ASYNC_URING the reads go through an io_uring, or through a
+	few threads if the kernel has none; PF_ASYNC_THREADS always
+	uses the threads. Until this is called pages read ahead are
+	read by the caller before it goes on.
+
+RETURN VALUE:
+	The backend started: PF_ASYNC_URING or PF_ASYNC_THREADS.
+	PFE_IOBACKEND	if "backend" is neither.
+	PFE_UNIX	if no thread can be created.
+*****************************************************************************/
+int PF_StartAsyncIO(int backend /* PF_ASYNC_URING or PF_ASYNC_THREADS */
+) {
+  int error;
+
+  if (backend != PF_ASYNC_URING && backend != PF_ASYNC_THREADS) {
+    PFerrno = PFE_IOBACKEND;
+    return (PFerrno);
+  }
+  error = PFioStart(backend);
+  PFbufferPool.asyncIO = (error < 0) ? PF_ASYNC_NONE : error;
+  return (error);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Wait for the reads in flight, then stop reading asynchronously
+	(see PF_StartAsyncIO()).
+
+RETURN VALUE: none
+*****************************************************************************/
+void PF_StopAsyncIO(void) {
+  PFioStop();
+  PFbufferPool.asyncIO = PF_ASYNC_NONE;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Start tracing page accesses into a new file "fname": every
+	fix, unfix and allocation of a page in the buffer is recorded
+	(see PF_TraceRec), with the time it was made, until
+	PF_StopTrace(). Records go through a ring of "nrecords"
+	records (a default size if 0), which a thread of the PF layer
+	writes out; if it fills up, records are dropped rather than
+	holding fixes up. Pages of mapped files are not traced. A
+	trace still on when the program exits is finished then.
+	pf_simulate replays a trace against the replacement policies.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_TRACE	if a trace is on already.
+	PFE_NOMEM	if no memory for the ring.
+	PFE_UNIX	if the file can't be written.
+*****************************************************************************/
+int PF_StartTrace(char *fname, /* trace file */
+                  int nrecords /* # of records in the ring, or 0 */
+) {
+  return (PFtraceStart(fname, nrecords));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Stop the trace started by PF_StartTrace(), write the records
+	still on the ring and close the trace file.
+
+RETURN VALUE:
+	If >= 0, the # of records dropped because the ring was full.
+	PFE_TRACE	if no trace is on.
+	PFE_UNIX	if a write to the trace file failed.
+*****************************************************************************/
+int PF_StopTrace(void) {
+  return (PFtraceStop());
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Start reading the "n" pages of file "fd" listed in pages[] into
+	the buffer, without fixing them, for a caller that will soon
+	fix them with PF_GetThisPage(). Pages already in the buffer are
+	skipped, and runs of consecutive pages are read with one call
+	each. Pages that would push the pool's other pages out too far
+	are left out (see PFbufPrefetch()); they are read as usual when
+	fixed. Returns at once with asynchronous I/O started (see
+	PF_StartAsyncIO()); reads the pages first otherwise. For a
+	mapped file the kernel is told that the pages will be needed.
+
+RETURN VALUE:
+	The # of pages whose read was started, which may be less
+	than "n".
+	PFE_INVALIDPAGE	if a page number is invalid. No page is read.
+	other PF error code if other error.
+*****************************************************************************/
+int PF_PrefetchPages(int fd,     /* file descriptor */
+                     int *pages, /* page numbers to read */
+                     int n       /* # of pages */
+) {
+  int i;
+
+  if (PFinvalidFd(fd)) {
+    PFerrno = PFE_FD;
+    return (PFerrno);
+  }
+
+  for (i = 0; i < n; i++)
+    if (PFinvalidPagenum(fd, pages[i])) {
+      PFerrno = PFE_INVALIDPAGE;
+      return (PFerrno);
+    }
+
+  if (PFftab(fd).map != NULL) {
+    for (i = 0; i < n; i++)
+      PFmapAdvise(fd, pages[i], 1, MADV_WILLNEED);
+    return (n);
+  }
+  return (PFbufPrefetch(fd, pages, n, PFreadprep));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Hint how much page "pagenum" of file "fd" is worth keeping in
+	the buffer: pages hinted PF_HINT_LOW are paged out before any
+	other, and PF_HINT_HIGH ones only when no other page can be, the
+	policy choosing among pages of the same priority. Call it on a
+	page just fixed: a page not in the buffer is left alone, and
+	one that leaves it comes back in at PF_HINT_NORMAL. No more than
+	half of the buffer is held high; past that a page is left as it
+	is. Mapped files have no pages in the buffer, so their hints
+	do nothing.
+
+RETURN VALUE:
+	PFE_OK	if OK.
+	PFE_FD	if "fd" is invalid.
+	PFE_INVALIDPAGE	if "pagenum" is invalid.
+	PFE_HINT	if "priority" is not a PF_HINT_... value.
+*****************************************************************************/
+int PF_SetPageHint(int fd,      /* file descriptor */
+                   int pagenum, /* page number */
+                   int priority /* PF_HINT_LOW, _NORMAL or _HIGH */
+) {
+  if (PFinvalidFd(fd)) {
+    PFerrno = PFE_FD;
+    return (PFerrno);
+  }
+  if (PFinvalidPagenum(fd, pagenum)) {
+    PFerrno = PFE_INVALIDPAGE;
+    return (PFerrno);
+  }
+  if (priority != PF_HINT_LOW && priority != PF_HINT_NORMAL &&
+      priority != PF_HINT_HIGH) {
+    PFerrno = PFE_HINT;
+    return (PFerrno);
+  }
+  if (PFftab(fd).map == NULL)
+    PFbufHint(fd, pagenum, priority);
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Order warm list entries by file descriptor, then by page
+	number (for qsort()).
+*****************************************************************************/
+static int PFwarmCmp(const void *a, const void *b) {
+  const PFwarment *x = (const PFwarment *)a;
+  const PFwarment *y = (const PFwarment *)b;
+
+  if (x->file != y->file)
+    return ((x->file < y->file) ? -1 : 1);
+  return ((x->page < y->page) ? -1 : (x->page > y->page));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Record the pages now in the buffer pool in the warm list file
+	"fname", hottest first (see PFbufWarmPages()), for
+	PF_LoadWarmList() to read back in after a restart. Files are
+	recorded by the name they were opened with. The list is
+	written to "fname".tmp and renamed, so a crash leaves the last
+	list whole. Mapped files have no pages in the pool and are
+	left out.
+
+RETURN VALUE:
+	The # of pages recorded.
+	PFE_NOMEM	if no memory.
+	PFE_UNIX	if the file can't be written.
+*****************************************************************************/
+int PF_SaveWarmList(char *fname /* warm list file */
+) {
+  char tmpname[PATH_MAX];
+  PFwarmpage *pages;
+  PFwarment ent;
+  PFwarmhdr hdr;
+  int *fileno = NULL;
+  int n, i, fd, len, nfd = PFftabchunks * PF_FTAB_CHUNK;
+  int error = PFE_OK;
+  FILE *f;
+
+  if ((n = PFbufWarmPages(&pages)) < 0)
+    return (n);
+  if (snprintf(tmpname, sizeof(tmpname), "%s.tmp", fname) >=
+      (int)sizeof(tmpname)) {
+    free((char *)pages);
+    PFerrno = PFE_UNIX;
+    return (PFerrno);
+  }
+  if ((fileno = (int *)malloc((nfd + 1) * sizeof(int))) == NULL) {
+    free((char *)pages);
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+
+  /* number the files that have pages in the pool */
+  memset(&hdr, 0, sizeof(hdr));
+  strcpy(hdr.magic, PF_WARM_MAGIC);
+  for (fd = 0; fd < nfd; fd++)
+    fileno[fd] = -1;
+  for (i = 0; i < n; i++)
+    if (!PFinvalidFd(pages[i].fd) && PFftab(pages[i].fd).map == NULL) {
+      if (fileno[pages[i].fd] < 0)
+        fileno[pages[i].fd] = hdr.nfiles++;
+      hdr.npages++;
+    }
+
+  if ((f = fopen(tmpname, "w")) == NULL) {
+    PFerrno = error = PFE_UNIX;
+    goto done;
+  }
+  if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+    error = PFE_UNIX;
+  for (i = 0; i < hdr.nfiles && error == PFE_OK; i++) {
+    for (fd = 0; fileno[fd] != i; fd++)
+      ;
+    len = strlen(PFftab(fd).fname);
+    if (fwrite(&len, sizeof(len), 1, f) != 1 ||
+        fwrite(PFftab(fd).fname, 1, len, f) != (size_t)len)
+      error = PFE_UNIX;
+  }
+  for (i = 0; i < n && error == PFE_OK; i++)
+    if (!PFinvalidFd(pages[i].fd) && PFftab(pages[i].fd).map == NULL) {
+      ent.file = fileno[pages[i].fd];
+      ent.page = pages[i].page;
+      if (fwrite(&ent, sizeof(ent), 1, f) != 1)
+        error = PFE_UNIX;
+    }
+  if (fclose(f) != 0 || error != PFE_OK || rename(tmpname, fname) != 0) {
+    unlink(tmpname);
+    PFerrno = error = PFE_UNIX;
+  }
+
+done:
+  free((char *)fileno);
+  free((char *)pages);
+  return (error == PFE_OK ? hdr.npages : error);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Read in the "n" pages of PFwarmpages, sorted by file and page,
+	a quarter of the pool at a time (as much as PFbufPrefetch()
+	takes), each run of consecutive pages with one read. The reads
+	of a batch are waited for before the next one is started, so
+	the reads ahead do not run out of frames. For a mapped file
+	the kernel is told the pages will be needed. Stops early if
+	PFwarmcancel is set. Each batch is taken from the list, and
+	its file noted in PFwarmfd until its reads are over, under
+	PFwarmlatch, so that PFwarmForget() can keep it off a file
+	being closed.
+
+RETURN VALUE:
+	The # of pages read.
+*****************************************************************************/
+static int PFwarmRead(void) {
+  int *pages;
+  int i, j, k, fd, batch, got, loaded = 0;
+
+  batch = PFbufferPool.poolSize / 4 > 0 ? PFbufferPool.poolSize / 4 : 1;
+  if ((pages = (int *)malloc(batch * sizeof(int))) == NULL)
+    return (0);
+  for (i = 0; i < PFwarmnpages && !PFatomicLoad(PFwarmcancel); i = j) {
+    pthread_mutex_lock(&PFwarmlatch);
+    fd = PFwarmpages[i].file;
+    for (j = i, k = 0; j < PFwarmnpages && PFwarmpages[j].file == fd &&
+                       k < batch;
+         j++)
+      pages[k++] = PFwarmpages[j].page;
+    PFwarmfd = fd;
+    pthread_mutex_unlock(&PFwarmlatch);
+    if (fd < 0)
+      /* its file was closed */
+      continue;
+
+    if (PFftab(fd).map != NULL) {
+      for (got = 0; got < k; got++)
+        PFmapAdvise(fd, pages[got], 1, MADV_WILLNEED);
+    } else if ((got = PFbufPrefetch(fd, pages, k, PFreadprep)) < 0)
+      got = 0;
+    PFioDrain();
+    loaded += got;
+
+    pthread_mutex_lock(&PFwarmlatch);
+    PFwarmfd = -1;
+    pthread_cond_broadcast(&PFwarmidle);
+    pthread_mutex_unlock(&PFwarmlatch);
+  }
+  free((char *)pages);
+  return (loaded);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	The loader thread started by PF_LoadWarmList().
+
+RETURN VALUE: NULL
+*****************************************************************************/
+static void *PFwarmLoader(void *arg) {
+  (void)arg;
+  /* read by PFwarmJoin() once the thread is joined */
+  PFwarmloaded = PFwarmRead();
+  return (NULL);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Wait for the warm list loader, if one was started, and let go
+	of its list. If "cancel" is TRUE it is told to stop first,
+	after the reads it has started. The latch is let go while the
+	loader is waited for, as it takes it between batches; its list
+	stays until then, so no other loader can start meanwhile.
+
+RETURN VALUE:
+	The # of pages it read, or 0 if none was started.
+*****************************************************************************/
+static int PFwarmJoin(int cancel) {
+  int loaded = 0;
+
+  pthread_mutex_lock(&PFwarmlatch);
+  if (PFwarmon) {
+    if (cancel)
+      PFatomicStore(PFwarmcancel, TRUE);
+    PFwarmon = FALSE;
+    pthread_mutex_unlock(&PFwarmlatch);
+    pthread_join(PFwarmthread, NULL);
+    pthread_mutex_lock(&PFwarmlatch);
+    loaded = PFwarmloaded;
+    free((char *)PFwarmpages);
+    PFwarmpages = NULL;
+  }
+  pthread_mutex_unlock(&PFwarmlatch);
+  return (loaded);
+}
 
-RETURN VALUE:
-	If >=0, the index of the free entry.
-	Otherwise, none can be found.
+/****************************************************************************
+SPECIFICATIONS:
+	Keep the warm list loader, if one runs, from reading pages of
+	file "fd", which is being closed: take its pages off the list,
+	and wait for the reads of a batch of them it has started. The
+	loader goes on with the other files.
 
+RETURN VALUE: none
 *****************************************************************************/
-int static PFftabFindFree() {
+static void PFwarmForget(int fd /* file descriptor */
+) {
   int i;
 
-  for (i = 0; i < PF_FTAB_SIZE; i++)
-    if (PFftab[i].fname == NULL)
-      return (i);
-  return (-1);
+  pthread_mutex_lock(&PFwarmlatch);
+  if (PFwarmpages != NULL)
+    for (i = 0; i < PFwarmnpages; i++)
+      if (PFwarmpages[i].file == fd)
+        PFwarmpages[i].file = -1;
+  while (PFwarmfd == fd)
+    pthread_cond_wait(&PFwarmidle, &PFwarmlatch);
+  pthread_mutex_unlock(&PFwarmlatch);
 }
 
 /****************************************************************************
 SPECIFICATIONS:
-	Read the paged numbered "pagenum" from the file indexed by "fd"
-	into the page buffer "buf".
-
-AUTHOR: clc
+	Read the pages listed in the warm list file "fname", written
+	by PF_SaveWarmList(), into the buffer pool, so that a process
+	just started finds the pages it used last time there. Only
+	pages of files that are open now, under the name they were
+	saved with, are read; open the files first. Pages that are
+	free or past the end of their file are left out, as are those
+	past the pool's size in each page size, the coldest first.
+	The rest are sorted by file and page, and runs of consecutive
+	pages are read with one call (see PF_PrefetchPages()); under
+	MRU nothing is read. With "background" FALSE this returns when
+	the pages are in. With TRUE a thread reads them while the
+	caller goes on; PF_WaitWarmList() waits for it, closing a file
+	keeps it off that file's pages, and setting up the pool stops
+	it.
 
 RETURN VALUE:
-	PFE_OK	if ok
-	PF error code if not OK.
+	The # of pages read, or, with "background", to be read.
+	PFE_WARMLIST	if the file is not a warm list, or a loader
+		started earlier still runs.
+	PFE_NOMEM	if no memory.
+	PFE_UNIX	if the file can't be read, or the thread can't be
+		started.
 *****************************************************************************/
-int PFreadfcn(int fd,      /* file descriptor */
-              int pagenum, /* page number */
-              PFfpage *buf) {
-  int error;
-
-  /* seek to the appropriate place */
-  if ((error = lseek(PFftab[fd].unixfd, pagenum * sizeof(PFfpage) + PF_HDR_SIZE,
-                     L_SET)) == -1) {
+int PF_LoadWarmList(char *fname, /* warm list file */
+                    int background /* TRUE to read in a thread */
+) {
+  char name[PATH_MAX];
+  PFwarment *pages = NULL;
+  PFwarmhdr hdr;
+  int *filefd = NULL;
+  int classpages[PF_SIZE_CLASSES];
+  int i, n, fd, len, c, error = PFE_OK;
+  FILE *f;
+
+  if ((f = fopen(fname, "r")) == NULL) {
     PFerrno = PFE_UNIX;
     return (PFerrno);
   }
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      memcmp(hdr.magic, PF_WARM_MAGIC, sizeof(hdr.magic)) != 0 ||
+      hdr.nfiles < 0 || hdr.npages < 0) {
+    PFerrno = error = PFE_WARMLIST;
+    goto done;
+  }
+  if ((filefd = (int *)malloc((hdr.nfiles + 1) * sizeof(int))) == NULL ||
+      (pages = (PFwarment *)malloc((hdr.npages + 1) * sizeof(PFwarment))) ==
+          NULL) {
+    PFerrno = error = PFE_NOMEM;
+    goto done;
+  }
 
-  /* read the data */
-  if ((error = read(PFftab[fd].unixfd, (char *)buf, sizeof(PFfpage))) !=
-      sizeof(PFfpage)) {
-    if (error < 0)
-      PFerrno = PFE_UNIX;
-    else
-      PFerrno = PFE_INCOMPLETEREAD;
-    return (PFerrno);
+  /* find the files open now */
+  for (i = 0; i < hdr.nfiles; i++) {
+    if (fread(&len, sizeof(len), 1, f) != 1 || len < 0 ||
+        len >= (int)sizeof(name) || fread(name, 1, len, f) != (size_t)len) {
+      PFerrno = error = PFE_WARMLIST;
+      goto done;
+    }
+    name[len] = '\0';
+    filefd[i] = PFtabFindFname(name);
   }
 
-  return (PFE_OK);
+  /* keep the hottest pages that are in use and fit in the pool */
+  memset(classpages, 0, sizeof(classpages));
+  for (i = n = 0; i < hdr.npages; i++) {
+    if (fread(&pages[n], sizeof(PFwarment), 1, f) != 1 ||
+        pages[n].file < 0 || pages[n].file >= hdr.nfiles) {
+      PFerrno = error = PFE_WARMLIST;
+      goto done;
+    }
+    if ((fd = filefd[pages[n].file]) < 0 ||
+        PFinvalidPagenum(fd, pages[n].page) ||
+        PFfreePage(fd, pages[n].page))
+      continue;
+    c = PFsizeClass(PFftab(fd).pagesize);
+    if (PFftab(fd).map == NULL && classpages[c] >= PFbufferPool.poolSize)
+      continue;
+    classpages[c]++;
+    pages[n++].file = fd;
+  }
+  qsort(pages, n, sizeof(PFwarment), PFwarmCmp);
+
+  pthread_mutex_lock(&PFwarmlatch);
+  if (PFwarmpages != NULL) {
+    pthread_mutex_unlock(&PFwarmlatch);
+    PFerrno = error = PFE_WARMLIST;
+    goto done;
+  }
+  PFwarmpages = pages;
+  PFwarmnpages = n;
+  PFwarmcancel = FALSE;
+  PFwarmloaded = 0;
+  if (background) {
+    if (pthread_create(&PFwarmthread, NULL, PFwarmLoader, NULL) != 0) {
+      PFwarmpages = NULL;
+      pthread_mutex_unlock(&PFwarmlatch);
+      PFerrno = error = PFE_UNIX;
+      goto done;
+    }
+    PFwarmon = TRUE;
+    pthread_mutex_unlock(&PFwarmlatch);
+    pages = NULL;
+  } else {
+    pthread_mutex_unlock(&PFwarmlatch);
+    n = PFwarmRead();
+    pthread_mutex_lock(&PFwarmlatch);
+    PFwarmpages = NULL;
+    pthread_mutex_unlock(&PFwarmlatch);
+  }
+
+done:
+  fclose(f);
+  free((char *)filefd);
+  free((char *)pages);
+  return (error == PFE_OK ? n : error);
 }
 
 /****************************************************************************
 SPECIFICATIONS:
-	Write the page numbered "pagenum" from the buffer indexed
-	by "buf" into the file indexed by "fd".
-
-AUTHOR: clc
+	Wait for the pages that PF_LoadWarmList() is reading in the
+	background.
 
 RETURN VALUE:
-	PFE_OK	if ok.
-	PF errod code if not OK.
-
+	The # of pages read, or 0 if no warm list was being loaded.
 *****************************************************************************/
-int PFwritefcn(int fd,      /* file descriptor */
-               int pagenum, /* page to read */
-               PFfpage *buf /* buffer where to read the page */
-) {
-  int error;
-
-  /* seek to the right place */
-  if ((error = lseek(PFftab[fd].unixfd, pagenum * sizeof(PFfpage) + PF_HDR_SIZE,
-                     L_SET)) == -1) {
-    PFerrno = PFE_UNIX;
-    return (PFerrno);
-  }
-
-  /* write out the page */
-  if ((error = write(PFftab[fd].unixfd, (char *)buf, sizeof(PFfpage))) !=
-      sizeof(PFfpage)) {
-    if (error < 0)
-      PFerrno = PFE_UNIX;
-    else
-      PFerrno = PFE_INCOMPLETEWRITE;
-    return (PFerrno);
-  }
-
-  return (PFE_OK);
+int PF_WaitWarmList(void) {
+  return (PFwarmJoin(FALSE));
 }
 
-/************************* Interface Routines ****************************/
-
 /****************************************************************************
 SPECIFICATIONS:
-	Initialize the PF interface. Must be the first function called
-	in order to use the PF ADT.
+	Create a paged file called "fname". The file should not have
+	already existed before. It is made in the latest format (see
+	pftypes.h), with a header page and page aligned pages of
+	PF_PAGE_SIZE bytes.
 
 AUTHOR: clc
 
-RETURN VALUE: none
-
-GLOBAL VARIABLES MODIFIED:
-	PFftab
+RETURN VALUE:
+	PFE_OK	if OK
+	PF error code if error.
 *****************************************************************************/
-void PF_Init() {
-  int i;
-  /* init the hash table */
-  PFhashInit();
-
-  /* init the file table to be not used*/
-  for (i = 0; i < PF_FTAB_SIZE; i++) {
-    PFftab[i].fname = NULL;
-  }
+int PF_CreateFile(char *fname /* name of file to create */
+) {
+  return (PF_CreateFileWithPageSize(fname, PF_PAGE_SIZE));
 }
 
-void PF_InitWithOptions(int poolSize, int replacementPolicy) {
-    PFbufferPool.poolSize = poolSize;
-    PFbufferPool.replacement = replacementPolicy;
-    PFbufferPool.logicalPageRequests = 0;
-    PFbufferPool.logicalPageHits = 0;
-    PFbufferPool.physicalReads = 0;
-    PFbufferPool.physicalWrites = 0;
+/****************************************************************************
+SPECIFICATIONS:
+	Create a paged file called "fname" whose pages are "pageSize"
+	bytes, as PF_CreateFile() does. "pageSize" must be a power of
+	two from PF_MIN_PAGE_SIZE to PF_MAX_PAGE_SIZE. Large pages
+	suit files read in scans or through O_DIRECT, at the price of
+	more memory per page in the buffer.
 
-    /* Tell buf.c to reinitialize its internal free lists */
-    PFbufInitPool(poolSize);
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_PAGESIZE	if "pageSize" is not a valid page size.
+	PF error code if other error.
+*****************************************************************************/
+int PF_CreateFileWithPageSize(char *fname, /* name of file to create */
+                              int pageSize /* # of bytes in a page */
+) {
+  return (PF_CreateFileWithOptions(fname, pageSize, 0));
 }
+
 /****************************************************************************
 SPECIFICATIONS:
-	Create a paged file called "fname". The file should not have
-	already existed before.
-
-AUTHOR: clc
+	Create a paged file called "fname" whose pages are "pageSize"
+	bytes, as PF_CreateFileWithPageSize() does, with "flags":
+	PF_FILE_CHECKSUM to end each page in a CRC-32C of the rest of
+	it, set when the page is written and checked when it is read
+	(not when the file is opened with PF_OpenFileMapped()). A page
+	that fails the check can not be fixed: PFE_CHECKSUM. The last
+	PF_CHECKSUM_SIZE bytes of each page are then not the caller's,
+	and PF_PageSize() leaves them out. With PF_FILE_COMPRESS pages
+	are written compressed, each to an extent of the size it
+	compresses to (see pftypes.h), so that a scan reads fewer
+	bytes; they are as large as ever in the buffer pool. Such a
+	file can not be opened with PF_OpenFileDirect() or
+	PF_OpenFileMapped().
 
 RETURN VALUE:
 	PFE_OK	if OK
-	PF error code if error.
+	PFE_PAGESIZE	if "pageSize" is not a valid page size.
+	PFE_FORMAT	if "flags" holds an unknown flag.
+	PF error code if other error.
 *****************************************************************************/
-int PF_CreateFile(char *fname /* name of file to create */
+int PF_CreateFileWithOptions(char *fname, /* name of file to create */
+                             int pageSize, /* # of bytes in a page */
+                             int flags     /* PF_FILE_CHECKSUM and
+                                              PF_FILE_COMPRESS, or 0 */
 ) {
   int fd;        /* unix file descripotr */
   PFhdr_str hdr; /* file header */
+  char *page;    /* header page */
   int error;
 
+  if (!PFvalidPageSize(pageSize)) {
+    PFerrno = PFE_PAGESIZE;
+    return (PFerrno);
+  }
+  if ((flags & ~PF_FILE_FLAGS) != 0) {
+    PFerrno = PFE_FORMAT;
+    return (PFerrno);
+  }
+  if ((page = PFallocPage(pageSize)) == NULL) {
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+
   /* create file for exclusive use */
   if ((fd = open(fname, O_CREAT | O_EXCL | O_WRONLY, 0664)) < 0) {
     /* unix error on open */
+    free(page);
     PFerrno = PFE_UNIX;
     return (PFE_UNIX);
   }
 
-  /* write out the file header */
+  /* write out the file header page */
   hdr.firstfree = PF_PAGE_LIST_END; /* no free pag yet */
   hdr.numpages = 0;
-  if ((error = write(fd, (char *)&hdr, sizeof(hdr))) != sizeof(hdr)) {
+  PFhdrPage(page, pageSize, &hdr, flags, 0);
+  error = write(fd, page, pageSize);
+  free(page);
+  if (error != pageSize) {
     /* error while writing. Abort everything. */
     if (error < 0)
       PFerrno = PFE_UNIX;
@@ -283,6 +2961,87 @@ int PF_DestroyFile(char *fname /* file name to destroy */
   return (PFE_OK);
 }
 
+/****************************************************************************
+SPECIFICATIONS:
+	Open the paged file whose name is fname for PF_OpenFile(), or
+	for PF_OpenFileDirect() if "direct" is TRUE.
+
+RETURN VALUE:
+	The file descriptor, which is >= 0, if no error.
+	PF error codes otherwise.
+*****************************************************************************/
+static int PFopen(char *fname, /* name of the file to open */
+                  int direct   /* TRUE to open it with O_DIRECT */
+) {
+  ssize_t count; /* # of bytes in read */
+  int fd;        /* file descriptor */
+  char *page;    /* header page */
+  int error;
+
+  /* find a free entry in the file table, and save the file name */
+  if ((fd = PFftabAlloc(fname)) < 0)
+    return (fd);
+  PFftab(fd).direct = direct;
+
+  /* open the file */
+  pthread_mutex_lock(&PFfdlatch);
+  error = PFfdOpen(fd);
+  pthread_mutex_unlock(&PFfdlatch);
+  if (error < 0) {
+    /* can't open the file */
+    PFftabRelease(fd);
+    return (PFerrno);
+  }
+
+  /* Read the file header, the first page in case it is the header
+  page of a version 2 file */
+  if ((page = PFallocPage(PF_MIN_PAGE_SIZE)) == NULL) {
+    PFerrno = error = PFE_NOMEM;
+    goto closefile;
+  }
+  count = pread(PFftab(fd).unixfd, page, PF_MIN_PAGE_SIZE, 0);
+  if (count < 0)
+    PFerrno = error = PFE_UNIX;
+  else
+    error = PFparseHdr(&PFftab(fd), page, count);
+  free(page);
+  if (error != PFE_OK)
+    goto closefile;
+  if (direct && (PFftab(fd).version == 1 || PFftab(fd).compress)) {
+    /* its pages are not aligned */
+    PFerrno = error = PFE_FORMAT;
+    goto closefile;
+  }
+
+  /* set file header to be not changed */
+  PFftab(fd).hdrchanged = FALSE;
+  PFftab(fd).ralast = -2;
+  PFftab(fd).ranext = 0;
+  PFftab(fd).rawindow = 0;
+  PFftab(fd).map = NULL;
+  PFftab(fd).mapfix = NULL;
+  PFftab(fd).bitmap = NULL;
+  PFftab(fd).allochint = PFftab(fd).hdr.numpages - 1;
+  if (PFftab(fd).version != 1 && (error = PFbitmapLoad(fd)) != PFE_OK)
+    goto closefile;
+  if (PFftab(fd).compress && (error = PFextentLoad(fd)) != PFE_OK) {
+    PFbitmapRelease(fd);
+    goto closefile;
+  }
+  if ((error = PFbufSetPageSize(fd, PFftab(fd).pagesize)) != PFE_OK) {
+    PFextentRelease(fd);
+    PFbitmapRelease(fd);
+    goto closefile;
+  }
+  PFfdPut(fd);
+  return (fd);
+
+closefile:
+  PFfdClose(fd);
+  PFftabRelease(fd);
+  return (error);
+}
+
 /****************************************************************************
 SPECIFICATIONS:
 	Open the paged file whose name is fname.  It is possible to open
@@ -304,46 +3063,221 @@ IMPLEMENTATION NOTES:
 *****************************************************************************/
 int PF_OpenFile(char *fname /* name of the file to open */
 ) {
-  int count; /* # of bytes in read */
-  int fd;    /* file descriptor */
+  return (PFopen(fname, FALSE));
+}
 
-  /* find a free entry in the file table */
-  if ((fd = PFftabFindFree()) < 0) {
-    /* file table full */
-    PFerrno = PFE_FTABFULL;
-    return (PFerrno);
-  }
+/****************************************************************************
+SPECIFICATIONS:
+	Open the paged file whose name is fname as PF_OpenFile() does,
+	but with O_DIRECT, so that its pages go straight between the
+	disk and the buffer pool's frames, which are page aligned,
+	without a second copy in the kernel's page cache. Only a file
+	in the latest format can be opened so, as its pages are page
+	aligned in the file too. The file system must support
+	O_DIRECT.
 
-  /* open the file */
-  if ((PFftab[fd].unixfd = open(fname, O_RDWR)) < 0) {
-    /* can't open the file */
+RETURN VALUE:
+	The file descriptor, which is >= 0, if no error.
+	PFE_FORMAT	if the file is in the version 1 format, or
+		compressed.
+	PF error codes otherwise.
+*****************************************************************************/
+int PF_OpenFileDirect(char *fname /* name of the file to open */
+) {
+  return (PFopen(fname, TRUE));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Open the paged file whose name is fname for reading only, and
+	map it into memory instead of reading its pages into the
+	buffer pool. PF_GetThisPage(), PF_GetFirstPage() and
+	PF_GetNextPage() then return pointers straight into the
+	mapping, so the pages are not copied and take no frames; the
+	kernel's page cache holds them. Fixes are counted as for a
+	buffered file, so PF_UnfixPage() must still be called, and
+	closing the file with pages fixed is an error. Pages can't be
+	changed: PF_AllocPage(), PF_DisposePage() and PF_UnfixPage()
+	with "dirty" TRUE fail with PFE_READONLY. The kernel is told
+	to expect random access, except on runs of pages asked for in
+	page order, which are read ahead (see PFreadAhead()). The file
+	must not be changed through another descriptor while it is
+	open here.
+
+RETURN VALUE:
+	The file descriptor, which is >= 0, if no error.
+	PFE_FORMAT	if the file is compressed.
+	PF error codes otherwise.
+*****************************************************************************/
+int PF_OpenFileMapped(char *fname /* name of the file to open */
+) {
+  PFftab_ele *f;
+  struct stat st;
+  int fd;
+
+  /* find a free entry in the file table, and save the file name */
+  if ((fd = PFftabAlloc(fname)) < 0)
+    return (fd);
+  f = &PFftab(fd);
+
+  /* open and map the file; the header says how many pages it has */
+  if ((f->unixfd = open(fname, O_RDONLY)) < 0) {
     PFerrno = PFE_UNIX;
+    PFftabRelease(fd);
     return (PFerrno);
   }
+  if (fstat(f->unixfd, &st) < 0) {
+    PFerrno = PFE_UNIX;
+    goto closefile;
+  }
+  if (st.st_size < (off_t)PF_HDR_SIZE) {
+    PFerrno = PFE_HDRREAD;
+    goto closefile;
+  }
+  f->maplen = st.st_size;
+  if ((f->map = mmap(NULL, f->maplen, PROT_READ, MAP_SHARED, f->unixfd, 0)) ==
+      MAP_FAILED) {
+    PFerrno = PFE_UNIX;
+    goto closefile;
+  }
+  if (PFparseHdr(f, f->map, f->maplen) != PFE_OK)
+    goto unmap;
+  if (f->compress) {
+    /* its pages can't be used where they are */
+    PFerrno = PFE_FORMAT;
+    goto unmap;
+  }
+  if (f->hdr.numpages < 0 ||
+      (size_t)PFpageOffset(fd, f->hdr.numpages) > f->maplen) {
+    /* the last pages are missing */
+    PFerrno = PFE_INCOMPLETEREAD;
+    goto unmap;
+  }
+  if ((f->mapfix = (int *)calloc(f->hdr.numpages + 1, sizeof(int))) ==
+      NULL) {
+    PFerrno = PFE_NOMEM;
+    goto unmap;
+  }
+  f->bitmap = NULL;
+  if (f->version != 1 && PFbitmapLoad(fd) != PFE_OK)
+    goto freefix;
+  madvise(f->map, f->maplen, MADV_RANDOM);
+
+  f->hdrchanged = FALSE;
+  f->direct = FALSE;
+  f->ralast = -2;
+  f->ranext = 0;
+  f->rawindow = 0;
+
+  /* the mapping stays when the unix file is closed, and takes no
+  room in the descriptor cache */
+  close(f->unixfd);
+  f->unixfd = -1;
+  return (fd);
 
-  /* Read the file header */
-  if ((count = read(PFftab[fd].unixfd, (char *)&PFftab[fd].hdr, PF_HDR_SIZE)) !=
-      PF_HDR_SIZE) {
-    if (count < 0)
-      /* unix error */
-      PFerrno = PFE_UNIX;
-    else /* not enough bytes in file */
-      PFerrno = PFE_HDRREAD;
-    close(PFftab[fd].unixfd);
+freefix:
+  free((char *)f->mapfix);
+unmap:
+  munmap(f->map, f->maplen);
+closefile:
+  f->map = NULL;
+  f->mapfix = NULL;
+  close(f->unixfd);
+  f->unixfd = -1;
+  PFftabRelease(fd);
+  return (PFerrno);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Tell how many bytes the pages of file "fd" are: PF_PAGE_SIZE
+	unless it was made by PF_CreateFileWithPageSize(). With
+	checksums, those the caller may use: PF_CHECKSUM_SIZE fewer.
+
+RETURN VALUE:
+	The page size, if OK.
+	PFE_FD	if "fd" is not an open file.
+*****************************************************************************/
+int PF_PageSize(int fd /* file descriptor */
+) {
+  if (PFinvalidFd(fd)) {
+    PFerrno = PFE_FD;
     return (PFerrno);
   }
-  /* set file header to be not changed */
-  PFftab[fd].hdrchanged = FALSE;
+  return (PFftab(fd).pagesize -
+          (PFftab(fd).checksum ? PF_CHECKSUM_SIZE : 0));
+}
 
-  /* save the file name */
-  if ((PFftab[fd].fname = savestr(fname)) == NULL) {
-    /* no memory */
-    close(PFftab[fd].unixfd);
-    PFerrno = PFE_NOMEM;
+/****************************************************************************
+SPECIFICATIONS:
+	Write what has changed of the bitmap, or the trailer of a
+	compressed file, and the header of file "fd", which is not
+	mapped, back to the file. "hdrlatch" is held meanwhile, and
+	"extlatch" too for a compressed file, so pages may be
+	allocated and written at the same time.
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PF error code if not.
+*****************************************************************************/
+static int PFwriteMeta(int fd /* file descriptor */
+) {
+  PFftab_ele *f = &PFftab(fd);
+  int error = PFE_OK;
+
+  if (PFfdGet(fd) < 0)
     return (PFerrno);
-  }
+  pthread_mutex_lock(&f->hdrlatch);
+  if (f->compress) {
+    pthread_mutex_lock(&f->extlatch);
+    error = PFextentWrite(fd);
+    pthread_mutex_unlock(&f->extlatch);
+  } else if (f->bitmap != NULL)
+    error = PFbitmapWrite(fd);
+  if (error == PFE_OK && f->hdrchanged && (error = PFwriteHdr(fd)) == PFE_OK)
+    f->hdrchanged = FALSE;
+  pthread_mutex_unlock(&f->hdrlatch);
+  PFfdPut(fd);
+  return (error);
+}
 
-  return (fd);
+/****************************************************************************
+SPECIFICATIONS:
+	Write the dirty pages of file "fd" that are not fixed, then
+	its bitmap, or the trailer of a compressed file, and its header
+	back to the file, as PF_CloseFile() does, but keep the file
+	open and its pages in the buffer, now clean. Pages still fixed
+	are left dirty, as they may yet change; in a file with
+	checksums, those never written yet are written as zeroes with
+	their checksum (see PFbufStampFresh()). The data is handed to
+	the kernel; it is not synced to disk, but for a compressed
+	file, whose new trailer is only used once the file is synced
+	(see PFextentWrite()), so that a crash finds it as it was at
+	the last flush or close. Only the pages of "fd"
+	are looked at, not the whole buffer. A mapped file has nothing
+	to write.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_FD	if "fd" is not an open file.
+	PF error code if writing fails.
+*****************************************************************************/
+int PF_FlushFile(int fd /* file descriptor */
+) {
+  int error;
+
+  if (PFinvalidFd(fd)) {
+    PFerrno = PFE_FD;
+    return (PFerrno);
+  }
+  if (PFftab(fd).map != NULL)
+    return (PFE_OK);
+  if ((error = PFbufFlushFile(fd, PFwritefcn)) != PFE_OK)
+    return (error);
+  if (PFftab(fd).checksum &&
+      (error = PFbufStampFresh(fd, PFwritefcn)) != PFE_OK)
+    return (error);
+  return (PFwriteMeta(fd));
 }
 
 /****************************************************************************
@@ -362,6 +3296,7 @@ RETURN VALUE:
 int PF_CloseFile(int fd /* file descriptor to close */
 ) {
   int error;
+  int i;
 
   if (PFinvalidFd(fd)) {
     /* invalid file descriptor */
@@ -369,40 +3304,39 @@ int PF_CloseFile(int fd /* file descriptor to close */
     return (PFerrno);
   }
 
-  /* Flush all buffers for this file */
-  if ((error = PFbufReleaseFile(fd, PFwritefcn)) != PFE_OK)
-    return (error);
-
-  if (PFftab[fd].hdrchanged) {
-    /* write the header back to the file */
-    /* First seek to the appropriate place */
-    if ((error = lseek(PFftab[fd].unixfd, (unsigned)0, L_SET)) == -1) {
-      /* seek error */
-      PFerrno = PFE_UNIX;
-      return (PFerrno);
-    }
+  /* the warm list loader may be reading pages of the file */
+  PFwarmForget(fd);
+
+  if (PFftab(fd).map != NULL) {
+    /* a mapped file has nothing to write back */
+    for (i = 0; i < PFftab(fd).hdr.numpages; i++)
+      if (PFatomicLoad(PFftab(fd).mapfix[i]) > 0) {
+        PFerrno = PFE_PAGEFIXED;
+        return (PFerrno);
+      }
+    munmap(PFftab(fd).map, PFftab(fd).maplen);
+    free((char *)PFftab(fd).mapfix);
+    PFftab(fd).map = NULL;
+    PFftab(fd).mapfix = NULL;
+  } else {
+    /* Flush all buffers for this file */
+    if ((error = PFbufReleaseFile(fd, PFwritefcn)) != PFE_OK)
+      return (error);
 
-    /* write header*/
-    if ((error = write(PFftab[fd].unixfd, (char *)&PFftab[fd].hdr,
-                       PF_HDR_SIZE)) != PF_HDR_SIZE) {
-      if (error < 0)
-        PFerrno = PFE_UNIX;
-      else
-        PFerrno = PFE_HDRWRITE;
-      return (PFerrno);
-    }
-    PFftab[fd].hdrchanged = FALSE;
+    /* write the bitmap, or the trailer of a compressed file, and
+    the header back to the file */
+    if ((error = PFwriteMeta(fd)) != PFE_OK)
+      return (error);
   }
+  PFextentRelease(fd);
+  PFbitmapRelease(fd);
 
   /* close the file */
-  if ((error = close(PFftab[fd].unixfd)) == -1) {
-    PFerrno = PFE_UNIX;
-    return (PFerrno);
-  }
+  if ((error = PFfdClose(fd)) != PFE_OK)
+    return (error);
 
-  /* free the file name space */
-  free((char *)PFftab[fd].fname);
-  PFftab[fd].fname = NULL;
+  /* give the entry back */
+  PFftabRelease(fd);
 
   return (PFE_OK);
 }
@@ -439,6 +3373,8 @@ SPECIFICATIONS:
 	until PFunfix() is called.
 	Note that PF_GetNextPage() with *pagenum == -1 will return the 
 	first valid page. PFgetFirst() is just a short hand for this.
+	Pages further on are read ahead as the scan goes (see
+	PFreadAhead()).
 
 AUTHOR: clc
 
@@ -464,18 +3400,29 @@ int PF_GetNextPage(
     return (PFerrno);
   }
 
-  if (*pagenum < -1 || *pagenum >= PFftab[fd].hdr.numpages) {
+  if (*pagenum < -1 || *pagenum >= PFftab(fd).hdr.numpages) {
     PFerrno = PFE_INVALIDPAGE;
     return (PFerrno);
   }
 
   /* scan the file until a valid used page is found */
-  for (temppage = *pagenum + 1; temppage < PFftab[fd].hdr.numpages;
+  for (temppage = *pagenum + 1; temppage < PFftab(fd).hdr.numpages;
        temppage++) {
+    PFreadAhead(fd, temppage);
+    if (PFftab(fd).map != NULL) {
+      if (PFmapFix(fd, temppage, pagebuf)) {
+        *pagenum = temppage;
+        return (PFE_OK);
+      }
+      continue;
+    }
+    if (PFfreePage(fd, temppage))
+      /* a free page of a version 2 file need not be read to tell */
+      continue;
     if ((error = PFbufGet(fd, temppage, &fpage, PFreadfcn, PFwritefcn)) !=
         PFE_OK)
       return (error);
-    else if (fpage->nextfree == PF_PAGE_USED) {
+    else if (PFftab(fd).version != 1 || fpage->nextfree == PF_PAGE_USED) {
       /* found a used page */
       *pagenum = temppage;
       *pagebuf = (char *)fpage->pagebuf;
@@ -496,15 +3443,17 @@ int PF_GetNextPage(
 SPECIFICATIONS:
 	Read the page specifeid by "pagenum" and set *pagebuf to point
 	to the page data. The page number should be valid.
+	A page may be fixed more than once: every call adds one to its
+	fix count and must be matched by a PF_UnfixPage(). The page
+	stays in the buffer until all the fixes are gone.
+	If pages are asked for in page order, the pages after them are
+	read ahead (see PFreadAhead()).
 
 AUTHOR: clc
 
 RETURN VALUE:
 	PFE_OK	if no error.
 	PFE_INVALIDPAGE if invalid page number is specified.
-	PFE_PAGEFIXED if page already fixed in memory. In this case,
-		*pagebuf  is still set to point to the buffer that contains
-		the page data.
 	other PF error codes if other error encountered.
 *****************************************************************************/
 int PF_GetThisPage(int fd,        /* file descriptor */
@@ -524,14 +3473,22 @@ int PF_GetThisPage(int fd,        /* file descriptor */
     return (PFerrno);
   }
 
+  PFreadAhead(fd, pagenum);
+  if (PFftab(fd).map != NULL) {
+    if (PFmapFix(fd, pagenum, pagebuf))
+      return (PFE_OK);
+    PFerrno = PFE_INVALIDPAGE;
+    return (PFerrno);
+  }
+  if (PFfreePage(fd, pagenum)) {
+    PFerrno = PFE_INVALIDPAGE;
+    return (PFerrno);
+  }
   if ((error = PFbufGet(fd, pagenum, &fpage, PFreadfcn, PFwritefcn)) !=
-      PFE_OK) {
-    if (error == PFE_PAGEFIXED)
-      *pagebuf = fpage->pagebuf;
+      PFE_OK)
     return (error);
-  }
 
-  if (fpage->nextfree == PF_PAGE_USED) {
+  if (PFftab(fd).version != 1 || fpage->nextfree == PF_PAGE_USED) {
     /* page is used*/
     *pagebuf = (char *)fpage->pagebuf;
     return (PFE_OK);
@@ -552,45 +3509,98 @@ SPECIFICATIONS:
 	set *pagenum to the new page number. 
 	Set *pagebuf to point to the buffer for that page.
 	The page allocated is fixed in the buffer.
+	The file header is latched meanwhile, so threads allocating
+	pages of the same file get different pages.
+	In a version 2 file the free page closest to the page last
+	allocated or disposed is taken, and is not read.
 
 AUTHOR: clc
 
 RETURN VALUE:
 	PFE_OK	if ok
+	PFE_READONLY	if the file was opened with PF_OpenFileMapped().
 	PF error codes if not ok.
 
 *****************************************************************************/
 int PF_AllocPage(int fd,        /* file descriptor */
                  int *pagenum,  /* page number */
                  char **pagebuf /* pointer to pointer to page buffer*/
+) {
+  return (PF_AllocPageNear(fd, -1, pagenum, pagebuf));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Allocate a new page for file "fd" as PF_AllocPage() does, but
+	in a version 2 file take the free page closest to page "hint",
+	so that pages used together, such as a B+ tree leaf and the
+	one split off it, lie together in the file. With "hint" < 0,
+	or in a version 1 file, this is PF_AllocPage(). If the file
+	has no free page it grows, wherever "hint" is.
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PFE_READONLY	if the file was opened with PF_OpenFileMapped().
+	PF error codes if not ok.
+*****************************************************************************/
+int PF_AllocPageNear(int fd,        /* file descriptor */
+                     int hint,      /* page to be close to */
+                     int *pagenum,  /* page number */
+                     char **pagebuf /* pointer to pointer to page buffer*/
 ) {
   PFfpage *fpage; /* pointer to file page */
-  int error;
+  int error = PFE_OK;
 
   if (PFinvalidFd(fd)) {
     PFerrno = PFE_FD;
     return (PFerrno);
   }
 
-  if (PFftab[fd].hdr.firstfree != PF_PAGE_LIST_END) {
+  if (PFftab(fd).map != NULL) {
+    PFerrno = PFE_READONLY;
+    return (PFerrno);
+  }
+
+  pthread_mutex_lock(&PFftab(fd).hdrlatch);
+  if (hint < 0)
+    hint = PFftab(fd).allochint;
+  if (PFftab(fd).version != 1 &&
+      (*pagenum = PFbitmapNearest(fd, hint)) >= 0) {
+    /* take a free page found in the bitmap; a copy of it read ahead
+    is of no use */
+    if ((error = PFbufDrop(fd, *pagenum)) != PFE_OK ||
+        (error = PFbufAlloc(fd, *pagenum, &fpage, PFwritefcn)) != PFE_OK)
+      goto unlock;
+    PFbitmapSet(fd, *pagenum, TRUE);
+    PFftab(fd).nfree--;
+
+    /* mark this page dirty, as the frame holds nothing of it */
+    if ((error = PFbufUsed(fd, *pagenum)) != PFE_OK) {
+      printf("internal error: PFalloc()\n");
+      exit(1);
+    }
+  } else if (PFftab(fd).hdr.firstfree != PF_PAGE_LIST_END) {
     /* get a page from the free list */
-    *pagenum = PFftab[fd].hdr.firstfree;
+    *pagenum = PFftab(fd).hdr.firstfree;
     if ((error = PFbufGet(fd, *pagenum, &fpage, PFreadfcn, PFwritefcn)) !=
         PFE_OK)
       /* can't get the page */
-      return (error);
-    PFftab[fd].hdr.firstfree = fpage->nextfree;
-    PFftab[fd].hdrchanged = TRUE;
+      goto unlock;
+    PFftab(fd).hdr.firstfree = fpage->nextfree;
+    PFftab(fd).hdrchanged = TRUE;
   } else {
     /* Free list empty, allocate one more page from the file */
-    *pagenum = PFftab[fd].hdr.numpages;
+    *pagenum = PFftab(fd).hdr.numpages;
+    if (PFftab(fd).version != 1 &&
+        (error = PFbitmapSet(fd, *pagenum, TRUE)) != PFE_OK)
+      goto unlock;
     if ((error = PFbufAlloc(fd, *pagenum, &fpage, PFwritefcn)) != PFE_OK)
       /* can't allocate a page */
-      return (error);
+      goto unlock;
 
     /* increment # of pages for this file */
-    PFftab[fd].hdr.numpages++;
-    PFftab[fd].hdrchanged = TRUE;
+    PFftab(fd).hdr.numpages++;
+    PFftab(fd).hdrchanged = TRUE;
 
     /* mark this page dirty */
     if ((error = PFbufUsed(fd, *pagenum)) != PFE_OK) {
@@ -602,7 +3612,7 @@ int PF_AllocPage(int fd,        /* file descriptor */
   /* zero out the page. Seems to be a nice thing to do,
   at least for debugging. */
   /*
-  bzero(fpage->pagebuf,PF_PAGE_SIZE);
+  bzero(fpage->pagebuf,PFftab(fd).pagesize);
   */
 
   /* Mark the new page used */
@@ -610,19 +3620,27 @@ int PF_AllocPage(int fd,        /* file descriptor */
 
   /* set return value */
   *pagebuf = fpage->pagebuf;
+  PFftab(fd).allochint = *pagenum;
 
-  return (PFE_OK);
+unlock:
+  pthread_mutex_unlock(&PFftab(fd).hdrlatch);
+  return (error);
 }
 
 /****************************************************************************
 SPECIFICATIONS:
 	Dispose the page numbered "pagenum" of the file "fd".
 	Only a page that is not fixed in the buffer can be disposed.
+	The file header is latched while the page goes onto the
+	free list. In a version 2 file the page is not read: it is
+	dropped from the buffer and its bit in the bitmap cleared,
+	and in a compressed file its extent is given back.
 
 AUTHOR: clc
 
 RETURN VALUE:
 	PFE_OK	if no error.
+	PFE_READONLY	if the file was opened with PF_OpenFileMapped().
 	PF error code if error.
 
 *****************************************************************************/
@@ -642,9 +3660,36 @@ int PF_DisposePage(int fd,     /* file descriptor */
     return (PFerrno);
   }
 
+  if (PFftab(fd).map != NULL) {
+    PFerrno = PFE_READONLY;
+    return (PFerrno);
+  }
+
+  if (PFbufFixCount(fd, pagenum) > 0) {
+    /* somebody is still using this page */
+    PFerrno = PFE_PAGEFIXED;
+    return (PFerrno);
+  }
+
+  pthread_mutex_lock(&PFftab(fd).hdrlatch);
+  if (PFftab(fd).version != 1) {
+    if (PFfreePage(fd, pagenum)) {
+      PFerrno = error = PFE_PAGEFREE;
+      goto unlock;
+    }
+    if ((error = PFbufDrop(fd, pagenum)) != PFE_OK)
+      goto unlock;
+    if (PFftab(fd).compress)
+      PFextentDispose(fd, pagenum);
+    PFbitmapSet(fd, pagenum, FALSE);
+    PFftab(fd).nfree++;
+    PFftab(fd).allochint = pagenum;
+    goto unlock;
+  }
+
   if ((error = PFbufGet(fd, pagenum, &fpage, PFreadfcn, PFwritefcn)) != PFE_OK)
     /* can't get this page */
-    return (error);
+    goto unlock;
 
   if (fpage->nextfree != PF_PAGE_USED) {
     /* this page already freed */
@@ -652,17 +3697,21 @@ int PF_DisposePage(int fd,     /* file descriptor */
       printf("internal error: PFdispose()\n");
       exit(1);
     }
-    PFerrno = PFE_PAGEFREE;
-    return (PFerrno);
+    PFerrno = error = PFE_PAGEFREE;
+    goto unlock;
   }
 
   /* put this page into the free list */
-  fpage->nextfree = PFftab[fd].hdr.firstfree;
-  PFftab[fd].hdr.firstfree = pagenum;
-  PFftab[fd].hdrchanged = TRUE;
+  fpage->nextfree = PFftab(fd).hdr.firstfree;
+  PFftab(fd).hdr.firstfree = pagenum;
+  PFftab(fd).hdrchanged = TRUE;
 
   /* unfix this page */
-  return (PFbufUnfix(fd, pagenum, TRUE));
+  error = PFbufUnfix(fd, pagenum, TRUE);
+
+unlock:
+  pthread_mutex_unlock(&PFftab(fd).hdrlatch);
+  return (error);
 }
 
 /****************************************************************************
@@ -670,11 +3719,15 @@ SPECIFICATIONS:
 	Tell the Paged File Interface that the page numbered "pagenum"
 	of the file "fd" is no longer needed in the buffer.
 	Set the variable "dirty" to TRUE if page has been modified.
+	If the page has been fixed more than once, this drops one fix
+	and the page stays fixed until the rest are dropped too.
 
 AUTHOR: clc
 
 RETURN VALUE:
 	PFE_OK	if no error
+	PFE_READONLY	if "dirty" is TRUE and the file was opened with
+		PF_OpenFileMapped().
 	PF error code if error.
 
 *****************************************************************************/
@@ -693,6 +3746,8 @@ int PF_UnfixPage(int fd,      /* file descriptor */
     return (PFerrno);
   }
 
+  if (PFftab(fd).map != NULL)
+    return (PFmapUnfix(fd, pagenum, dirty));
   return (PFbufUnfix(fd, pagenum, dirty));
 }
 
@@ -716,7 +3771,20 @@ static char *PFerrormsg[] = {"No error",
                              "page already unfixed",
                              "new page to be allocated already in buffer",
                              "hash table entry not found",
-                             "page already in hash table"};
+                             "page already in hash table",
+                             "invalid buffer pool size",
+                             "invalid background writer watermarks",
+                             "invalid read-ahead window",
+                             "invalid asynchronous I/O backend",
+                             "file opened read-only",
+                             "unsupported file format",
+                             "invalid page size",
+                             "page checksum mismatch",
+                             "damaged compressed page",
+                             "invalid limit on open files",
+                             "trace already on, or not on",
+                             "not a warm list, or one is loading",
+                             "invalid page hint"};
 
 /****************************************************************************
 SPECIFICATIONS:
@@ -1,6 +1,8 @@
 /* pf.h: externs and error codes for Paged File Interface*/
 #pragma once
 
+#include <stdio.h>
+
 #ifndef TRUE
 #define TRUE 1		
 #endif
@@ -32,17 +34,62 @@
 #define PFE_HASHNOTFOUND -18	/* hash table entry not found */
 #define PFE_HASHPAGEEXIST -19	/* page already exist in hash table */
 
+#define PFE_POOLSIZE	-20	/* invalid buffer pool size */
+#define PFE_WATERMARK	-21	/* invalid background writer watermarks */
+#define PFE_READAHEAD	-22	/* invalid read-ahead window */
+#define PFE_IOBACKEND	-23	/* invalid asynchronous I/O backend */
+#define PFE_READONLY	-24	/* file opened read-only */
+#define PFE_FORMAT	-25	/* file format not supported */
+#define PFE_PAGESIZE	-26	/* invalid page size */
+#define PFE_CHECKSUM	-27	/* page read does not match its checksum */
+#define PFE_DECOMPRESS	-28	/* compressed page read is damaged */
+#define PFE_FDLIMIT	-29	/* invalid limit on open unix files */
+#define PFE_TRACE	-30	/* a trace is on already, or is not on */
+#define PFE_WARMLIST	-31	/* bad warm list file, or one is loading */
+#define PFE_HINT	-32	/* invalid page hint */
+
 
-/* page size */
+/* page size: that of files made by PF_CreateFile(), and of all version 1
+files. PF_CreateFileWithPageSize() makes files whose pages are any power
+of two from PF_MIN_PAGE_SIZE to PF_MAX_PAGE_SIZE bytes. */
 #define PF_PAGE_SIZE	4096
+#define PF_MIN_PAGE_SIZE 4096
+#define PF_MAX_PAGE_SIZE 65536
+
+/* flags of PF_CreateFileWithOptions() */
+#define PF_FILE_CHECKSUM 1	/* each page ends in a CRC-32C of its data,
+				checked when it is read */
+#define PF_FILE_COMPRESS 2	/* pages are written compressed, each to
+				an extent of its own size */
 
 /* externs from the PF layer */
-extern int PFerrno;		/* error number of last error */
+extern _Thread_local int PFerrno; /* error number of the last error
+				made by this thread */
 void PF_Init();
 void PF_PrintError(char* s);
 
 #define PF_REPLACEMENT_LRU 0
 #define PF_REPLACEMENT_MRU 1
+#define PF_REPLACEMENT_CLOCK 2	/* second chance: a clock hand sweeps the
+				frames, sparing pages used since it passed */
+#define PF_REPLACEMENT_2Q 3	/* 2Q: pages used once wait in a small FIFO
+				before they can displace hot pages */
+#define PF_REPLACEMENT_LRU2 4	/* LRU-2: page out the page whose second
+				most recent use is oldest */
+#define PF_REPLACEMENT_ARC 5	/* ARC: balances recency and frequency,
+				tuning itself from the pages it misses */
+
+/* page hints, see PF_SetPageHint() */
+#define PF_HINT_LOW -1		/* paged out before any other page */
+#define PF_HINT_NORMAL 0	/* as the policy says; every page comes in
+				so */
+#define PF_HINT_HIGH 1		/* paged out only when no other page can
+				be */
+
+#define PF_ASYNC_NONE 0		/* pages are read by the thread that
+				wants them */
+#define PF_ASYNC_URING 1	/* reads ahead go through an io_uring */
+#define PF_ASYNC_THREADS 2	/* reads ahead are done by a few threads */
 
 typedef struct PF_Frame {
     int fileDesc;         /* which file this frame belongs to */
@@ -57,19 +104,123 @@ typedef struct PF_Frame {
 typedef struct PF_BufferPool {
     PF_Frame *frames; /* array of frames */
     int poolSize;     /* number of frames */
-    int replacement;  /* PF_REPLACEMENT_LRU / PF_REPLACEMENT_MRU */
+    int numPartitions; /* # of latched partitions the pool is split into */
+    int replacement;  /* PF_REPLACEMENT_LRU / _MRU / _CLOCK / _2Q / _LRU2 / _ARC */
     PF_Frame *lru_head; /* head = MRU or LRU depending on convention */
     PF_Frame *lru_tail;
     /* Hash map from (fileDesc,pageNum) -> frame index (use simple chaining or fixed hash) */
-    /* Stats */
+    /* Stats, summed over the partitions by PF_CollectStats() */
     unsigned long logicalPageRequests;
     unsigned long logicalPageHits;
+    unsigned long logicalPageMisses; /* requests that did not find the page
+                                     in the buffer, or waited for its read */
     unsigned long physicalReads;
     unsigned long physicalWrites;
     unsigned long pageAllocations;
+    unsigned long evictions;      /* pages paged out to make room */
+    unsigned long dirtyEvictions; /* victims that had to be written first */
+    unsigned long writerWrites;   /* pages written by the background writer */
+    unsigned long writeCalls;     /* write system calls; physicalWrites
+                                     counts the pages they wrote */
+    unsigned long readCalls;      /* read system calls; physicalReads
+                                     counts the pages they read */
+    unsigned long readAheadPages; /* pages read before they were asked for */
+    unsigned long ioWaits;        /* fixes that waited for a read ahead */
+    unsigned long mappedPageRequests; /* fixes of pages of mapped files,
+                                     which bypass the pool */
+    int asyncIO;      /* PF_ASYNC_NONE / _URING / _THREADS */
+    int arcTarget;    /* ARC: target # of pages seen once (p), summed
+                         over the partitions */
 } PF_BufferPool;
 
+/* Counters of one open file, filled in by PF_GetFileStats(). They start
+at 0 when the file is opened and when PF_ResetStats() is called. */
+typedef struct PF_FileStats {
+    unsigned long hits;           /* fixes that found the page in the buffer */
+    unsigned long misses;         /* fixes that read the page, or waited
+                                     for its read ahead */
+    unsigned long reads;          /* pages read, also ahead */
+    unsigned long writes;         /* pages written */
+    unsigned long evictions;      /* pages paged out to make room */
+    unsigned long dirtyEvictions; /* of those, pages that were dirty */
+    unsigned long pinWaits;       /* fixes that waited for a read in flight */
+    unsigned long allocations;    /* pages allocated */
+    int residentPages;            /* pages in the buffer now */
+    int dirtyPages;               /* of those, pages that are dirty */
+} PF_FileStats;
+
+/* Snapshot of the whole buffer pool, filled in by PF_GetStats() */
+typedef struct PF_Stats {
+    PF_FileStats total;           /* counters of all the files together */
+    unsigned long requests;       /* fixes asked for: hits + misses */
+    unsigned long readCalls;      /* read system calls */
+    unsigned long writeCalls;     /* write system calls */
+    unsigned long readAheadPages; /* pages read before they were asked for */
+    unsigned long writerWrites;   /* pages written by the background writer */
+    unsigned long mappedRequests; /* fixes of pages of mapped files */
+    int poolSize;                 /* # of frames the pool may hold, of
+                                     every page size together */
+    int numPartitions;            /* # of partitions per page size */
+    int replacement;              /* PF_REPLACEMENT_... */
+    int openFiles;                /* # of files open */
+} PF_Stats;
+
+/* A page access trace, taken by PF_StartTrace(), is a PF_TraceHdr
+followed by a PF_TraceRec for each fix, unfix and allocation, in the
+order they were put in the buffer's trace ring. */
+#define PF_TRACE_MAGIC "PFTRACE1"
+
+typedef struct PF_TraceHdr {
+    char magic[8];                /* PF_TRACE_MAGIC, not terminated */
+    int recsize;                  /* sizeof(PF_TraceRec) */
+    int unused;
+} PF_TraceHdr;
+
+#define PF_TRACE_GET 0		/* page fixed by PF_GetThisPage() & co */
+#define PF_TRACE_UNFIX 1	/* page unfixed */
+#define PF_TRACE_ALLOC 2	/* page allocated, fixed, not read */
+
+typedef struct PF_TraceRec {
+    unsigned long time;           /* ns since the trace started */
+    int fd;                       /* PF file descriptor */
+    int page;                     /* page number */
+    unsigned char op;             /* PF_TRACE_... */
+    unsigned char dirty;          /* unfix: TRUE if marked dirty */
+    unsigned short pad;
+} PF_TraceRec;
+
+/* formats of PF_DumpStatsTo() */
+#define PF_STATS_TEXT 0		/* lines for people to read */
+#define PF_STATS_JSON 1		/* one JSON object, for monitoring */
+
 void PF_InitWithOptions(int poolSize, int replacementPolicy);
-void PFbufInitPool(int poolSize);
+void PF_InitPartitioned(int poolSize, int replacementPolicy, int numPartitions);
+int PF_ResizePool(int poolSize);
+int PF_StartWriter(int lowPct, int highPct);
+void PF_StopWriter(void);
+int PF_SetReadAhead(int maxPages);
+int PF_SetMaxOpenFds(int maxFds);
+int PF_StartAsyncIO(int backend);
+void PF_StopAsyncIO(void);
+int PF_PrefetchPages(int fd, int *pages, int n);
+int PF_SetPageHint(int fd, int pagenum, int priority);
+int PF_OpenFileMapped(char *fname);
+int PF_OpenFileDirect(char *fname);
+int PF_AllocPageNear(int fd, int hint, int *pagenum, char **pagebuf);
+int PF_CreateFileWithPageSize(char *fname, int pageSize);
+int PF_CreateFileWithOptions(char *fname, int pageSize, int flags);
+int PF_PageSize(int fd);
+int PF_FlushFile(int fd);
+void PFbufInitPool(int poolSize, int numParts);
 extern struct PF_BufferPool PFbufferPool;
+void PF_CollectStats();
+void PF_ResetStats();
 void PF_DumpStats();
+int PF_GetStats(PF_Stats *stats);
+int PF_GetFileStats(int fd, PF_FileStats *stats);
+void PF_DumpStatsTo(FILE *out, int format);
+int PF_StartTrace(char *fname, int nrecords);
+int PF_StopTrace(void);
+int PF_SaveWarmList(char *fname);
+int PF_LoadWarmList(char *fname, int background);
+int PF_WaitWarmList(void);
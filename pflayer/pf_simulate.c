@@ -0,0 +1,404 @@
+/* pf_simulate.c: replays a page access trace against replacement policies.
+ *
+ * Usage:
+ *   ./pf_simulate tracefile [maxPool]
+ *
+ * The trace is one taken by PF_StartTrace() (see pf.h), for instance
+ * by running a program with PF_TRACE=tracefile set:
+ *   PF_TRACE=queries.trace ./test_queries 3 range 900000 960000
+ * Its fixes and allocations are replayed, in order, against a pool of
+ * 1, 2, 4, ... pages, up to the # of distinct pages in the trace (or
+ * "maxPool"), under:
+ *   LRU:   page out the least recently used page;
+ *   MRU:   page out the most recently used page;
+ *   CLOCK: second chance, as PF_REPLACEMENT_CLOCK;
+ *   OPT:   Belady's optimal policy, which pages out the page used
+ *          again furthest in the future; no policy can miss less.
+ * For each pool size the miss ratio of each policy is printed: the %
+ * of fixes (PF_TRACE_GET) that did not find their page in the pool.
+ * An allocation brings its page in without reading it, so it takes a
+ * frame but is neither a hit nor a miss. Unfixes are not replayed: the
+ * simulated pools never hold a page fixed, so they may page out pages
+ * a real pool could not.
+ *
+ * Results are printed and written to pf_simulate_results.csv.
+ */
+#include "pf.h"
+#include "pftypes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CSVFILE "pf_simulate_results.csv"
+
+#define SIM_LRU   0
+#define SIM_MRU   1
+#define SIM_CLOCK 2
+#define SIM_OPT   3
+#define SIM_POLICIES 4
+
+static const char *simname[SIM_POLICIES] = {"LRU", "MRU", "CLOCK", "OPT"};
+
+static int nrefs;         /* # of fixes and allocations replayed */
+static int *ref;          /* page of each, as a dense id */
+static char *isget;       /* TRUE if it is a fix, FALSE an allocation */
+static int *nextuse;      /* index of the next reference to the same
+                             page, or nrefs if none */
+static int npages;        /* # of distinct pages */
+static int nfiles;        /* # of distinct file descriptors */
+static long ngets;        /* # of fixes */
+static unsigned long span; /* ns from the start of the trace to its
+                              last record */
+
+static void *xmalloc(size_t size)
+{
+    void *p;
+
+    if ((p = malloc(size > 0 ? size : 1)) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    return p;
+}
+
+/* Reads the trace "fname" into ref[] and isget[], numbering its pages
+   with an open-addressed hash table on (fd, page) */
+static void load(const char *fname)
+{
+    PF_TraceHdr hdr;
+    PF_TraceRec rec;
+    unsigned long *keys, key, h;
+    int *ids, cap = 1024, mask, maxrefs = 1024, i;
+    char seenfd[PF_FTAB_MAX];
+    FILE *f;
+
+    if ((f = fopen(fname, "r")) == NULL) {
+        perror(fname);
+        exit(1);
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(hdr.magic, PF_TRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.recsize != sizeof(PF_TraceRec)) {
+        printf("%s is not a PF trace\n", fname);
+        exit(1);
+    }
+
+    memset(seenfd, 0, sizeof(seenfd));
+    keys = xmalloc(cap * sizeof(*keys));
+    ids = xmalloc(cap * sizeof(*ids));
+    memset(ids, 0xff, cap * sizeof(*ids));
+    ref = xmalloc(maxrefs * sizeof(*ref));
+    isget = xmalloc(maxrefs);
+    while (fread(&rec, sizeof(rec), 1, f) == 1) {
+        if (rec.time > span)
+            span = rec.time;
+        if (rec.op == PF_TRACE_UNFIX)
+            continue;
+        if (rec.fd >= 0 && rec.fd < PF_FTAB_MAX && !seenfd[rec.fd]) {
+            seenfd[rec.fd] = TRUE;
+            nfiles++;
+        }
+
+        /* look the page up, growing the table when half full */
+        if (2 * (npages + 1) > cap) {
+            unsigned long *okeys = keys;
+            int *oids = ids, ocap = cap;
+
+            cap *= 2;
+            keys = xmalloc(cap * sizeof(*keys));
+            ids = xmalloc(cap * sizeof(*ids));
+            memset(ids, 0xff, cap * sizeof(*ids));
+            for (i = 0; i < ocap; i++)
+                if (oids[i] >= 0) {
+                    for (h = PFhash((int)(okeys[i] >> 32), (int)okeys[i]) &
+                             (cap - 1);
+                         ids[h] >= 0; h = (h + 1) & (cap - 1))
+                        ;
+                    keys[h] = okeys[i];
+                    ids[h] = oids[i];
+                }
+            free(okeys);
+            free(oids);
+        }
+        mask = cap - 1;
+        key = ((unsigned long)(unsigned int)rec.fd << 32) |
+              (unsigned int)rec.page;
+        for (h = PFhash(rec.fd, rec.page) & mask;
+             ids[h] >= 0 && keys[h] != key; h = (h + 1) & mask)
+            ;
+        if (ids[h] < 0) {
+            keys[h] = key;
+            ids[h] = npages++;
+        }
+
+        if (nrefs == maxrefs) {
+            maxrefs *= 2;
+            if ((ref = realloc(ref, maxrefs * sizeof(*ref))) == NULL ||
+                (isget = realloc(isget, maxrefs)) == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        ref[nrefs] = ids[h];
+        isget[nrefs] = (rec.op == PF_TRACE_GET);
+        ngets += isget[nrefs];
+        nrefs++;
+    }
+    fclose(f);
+    free(keys);
+    free(ids);
+}
+
+/* Fills in nextuse[], walking the trace backwards */
+static void find_next_uses(void)
+{
+    int *last = xmalloc(npages * sizeof(*last));
+    int i;
+
+    nextuse = xmalloc(nrefs * sizeof(*nextuse));
+    for (i = 0; i < npages; i++)
+        last[i] = nrefs;
+    for (i = nrefs - 1; i >= 0; i--) {
+        nextuse[i] = last[ref[i]];
+        last[ref[i]] = i;
+    }
+    free(last);
+}
+
+/* LRU and MRU: the pages in a list, most recently used first */
+static long sim_list(int pool, int mru)
+{
+    int *prev = xmalloc(npages * sizeof(*prev));
+    int *next = xmalloc(npages * sizeof(*next));
+    char *in = xmalloc(npages);
+    int head = -1, tail = -1, used = 0, i, p, v;
+    long misses = 0;
+
+    memset(in, 0, npages);
+    for (i = 0; i < nrefs; i++) {
+        p = ref[i];
+        if (in[p]) {
+            /* hit: unlink, to be put back first */
+            if (p == head)
+                continue;
+            next[prev[p]] = next[p];
+            if (p == tail)
+                tail = prev[p];
+            else
+                prev[next[p]] = prev[p];
+        } else {
+            misses += isget[i];
+            if (used == pool) {
+                v = mru ? head : tail;
+                if (v == head)
+                    head = next[v];
+                else
+                    next[prev[v]] = next[v];
+                if (v == tail)
+                    tail = prev[v];
+                else
+                    prev[next[v]] = prev[v];
+                in[v] = FALSE;
+                used--;
+            }
+            in[p] = TRUE;
+            used++;
+        }
+        prev[p] = -1;
+        next[p] = head;
+        if (head >= 0)
+            prev[head] = p;
+        head = p;
+        if (tail < 0)
+            tail = p;
+    }
+    free(prev);
+    free(next);
+    free(in);
+    return misses;
+}
+
+/* CLOCK: a hand sweeps the frames, giving referenced pages a second
+   chance; a page comes in with its reference bit set, as the pool
+   sets it when the page is unfixed */
+static long sim_clock(int pool)
+{
+    int *frame = xmalloc(pool * sizeof(*frame));
+    char *refbit = xmalloc(pool);
+    int *where = xmalloc(npages * sizeof(*where));
+    int used = 0, hand = 0, i, p;
+    long misses = 0;
+
+    for (i = 0; i < npages; i++)
+        where[i] = -1;
+    for (i = 0; i < nrefs; i++) {
+        p = ref[i];
+        if (where[p] >= 0) {
+            refbit[where[p]] = TRUE;
+            continue;
+        }
+        misses += isget[i];
+        if (used < pool)
+            hand = used++;
+        else {
+            while (refbit[hand]) {
+                refbit[hand] = FALSE;
+                hand = (hand + 1) % pool;
+            }
+            where[frame[hand]] = -1;
+        }
+        frame[hand] = p;
+        refbit[hand] = TRUE;
+        where[p] = hand;
+        hand = (hand + 1) % pool;
+    }
+    free(frame);
+    free(refbit);
+    free(where);
+    return misses;
+}
+
+/* OPT: the pages in a heap on the time of their next use, latest on
+   top, which is the victim */
+static int *heap, *heapkey, *heappos;
+
+static void heap_swap(int a, int b)
+{
+    int t = heap[a], k = heapkey[a];
+
+    heap[a] = heap[b];
+    heapkey[a] = heapkey[b];
+    heap[b] = t;
+    heapkey[b] = k;
+    heappos[heap[a]] = a;
+    heappos[heap[b]] = b;
+}
+
+static void heap_up(int i)
+{
+    while (i > 0 && heapkey[(i - 1) / 2] < heapkey[i]) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(int i, int n)
+{
+    int c;
+
+    while ((c = 2 * i + 1) < n) {
+        if (c + 1 < n && heapkey[c + 1] > heapkey[c])
+            c++;
+        if (heapkey[i] >= heapkey[c])
+            break;
+        heap_swap(i, c);
+        i = c;
+    }
+}
+
+static long sim_opt(int pool)
+{
+    int used = 0, i, p;
+    long misses = 0;
+
+    heap = xmalloc(pool * sizeof(*heap));
+    heapkey = xmalloc(pool * sizeof(*heapkey));
+    heappos = xmalloc(npages * sizeof(*heappos));
+    for (i = 0; i < npages; i++)
+        heappos[i] = -1;
+    for (i = 0; i < nrefs; i++) {
+        p = ref[i];
+        if (heappos[p] >= 0) {
+            /* its next use only gets later */
+            heapkey[heappos[p]] = nextuse[i];
+            heap_up(heappos[p]);
+            continue;
+        }
+        misses += isget[i];
+        if (used == pool) {
+            heappos[heap[0]] = -1;
+            if (--used > 0) {
+                heap[0] = heap[used];
+                heapkey[0] = heapkey[used];
+                heappos[heap[0]] = 0;
+                heap_down(0, used);
+            }
+        }
+        heap[used] = p;
+        heapkey[used] = nextuse[i];
+        heappos[p] = used;
+        heap_up(used++);
+    }
+    free(heap);
+    free(heapkey);
+    free(heappos);
+    return misses;
+}
+
+static long simulate(int policy, int pool)
+{
+    switch (policy) {
+    case SIM_LRU:
+        return sim_list(pool, FALSE);
+    case SIM_MRU:
+        return sim_list(pool, TRUE);
+    case SIM_CLOCK:
+        return sim_clock(pool);
+    default:
+        return sim_opt(pool);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int maxpool, pool, last, policy;
+    double ratio;
+    FILE *csv;
+
+    if (argc < 2) {
+        printf("Usage: %s tracefile [maxPool]\n", argv[0]);
+        return 1;
+    }
+    load(argv[1]);
+    if (ngets == 0) {
+        printf("%s has no fixes to replay\n", argv[1]);
+        return 1;
+    }
+    find_next_uses();
+    maxpool = (argc > 2) ? atoi(argv[2]) : npages;
+    if (maxpool <= 0 || maxpool > npages)
+        maxpool = npages;
+
+    if ((csv = fopen(CSVFILE, "w")) == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(csv, "poolPages,policy,fixes,misses,missRatio\n");
+
+    printf("Trace %s: %ld fixes, %d allocations of %d pages in %d files, "
+           "%.3f s\n",
+           argv[1], ngets, nrefs - (int)ngets, npages, nfiles, span / 1e9);
+    printf("  Miss ratio (%% of fixes)\n");
+    printf("  %8s", "pool");
+    for (policy = 0; policy < SIM_POLICIES; policy++)
+        printf(" | %7s", simname[policy]);
+    printf("\n");
+    for (pool = 1, last = 0; last < maxpool; pool *= 2) {
+        if (pool > maxpool)
+            pool = maxpool;
+        last = pool;
+        printf("  %8d", pool);
+        for (policy = 0; policy < SIM_POLICIES; policy++) {
+            long misses = simulate(policy, pool);
+
+            ratio = 100.0 * misses / ngets;
+            printf(" | %6.2f%%", ratio);
+            fprintf(csv, "%d,%s,%ld,%ld,%.4f\n", pool, simname[policy],
+                    ngets, misses, ratio);
+        }
+        printf("\n");
+    }
+    fclose(csv);
+    printf("Results stored in: %s\n", CSVFILE);
+    return 0;
+}
@@ -1,42 +1,231 @@
 /* pftypes.h: declarations for Paged File interface */
 #pragma once
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include "pf.h"
 
 /**************************** File Page Decls *********************/
-/* Each file contains a header, which is a integer pointing
-to the first free page, or -1 if no more free pages in the file.
-Followed by this header are the file pages as declared in struct PFfpage */
+/* There are two file formats. A version 1 file contains a header,
+which is a integer pointing to the first free page, or -1 if no more
+free pages in the file, and the # of pages. Followed by this header are
+the file pages as declared in struct PFfpage */
 typedef struct PFhdr_str {
 	int	firstfree;	/* first free page in the linked list of
-				free pages */
+				free pages; PF_PAGE_LIST_END in a
+				version 2 file */
 	int	numpages;	/* # of pages in the file */
 } PFhdr_str;
 
-#define PF_HDR_SIZE sizeof(PFhdr_str)	/* size of file header */
+#define PF_HDR_SIZE sizeof(PFhdr_str)	/* size of the version 1 file
+					header */
 
-/* actual page struct to be written onto the file */
+/* A version 2 file has pages of "pagesize" bytes, set when it is
+created: a power of two from PF_MIN_PAGE_SIZE to PF_MAX_PAGE_SIZE. It
+starts with a header page: struct PFhdr2_str, then zeroes. The pages
+follow, with nothing but their data, so every page is aligned in the
+file and can be read with O_DIRECT. Instead of a "nextfree" word in
+every page, which pages are used is kept in bitmap pages: the pages come
+in groups of 8*pagesize, and each group is preceded by a bitmap page
+with a bit set for each page of the group in use (page n is bit n%8 of
+byte n/8). Page n is thus at (n + n/(8*pagesize) + 2)*pagesize.
+PF_CreateFile() makes version 2 files of PF_PAGE_SIZE pages; version 1
+files, whose pages are always PF_PAGE_SIZE bytes, can still be
+opened. A version 2 file made with PF_FILE_CHECKSUM keeps in the last
+PF_CHECKSUM_SIZE bytes of each page a CRC-32C of the rest of it, seeded
+with the page number, so that a page written to the wrong place is
+caught too; the header and bitmap pages have none. Headers written
+before "flags" and "tail" were added have zeroes there.
+
+A version 2 file made with PF_FILE_COMPRESS is laid out otherwise. Its
+pages are still "pagesize" bytes in the buffer pool, but each is written
+compressed (see lz.c) to an extent of its own size, aligned on
+PF_EXTENT_ALIGN bytes, after the header page. Where each page is, the
+extent map, is kept in memory while the file is open and written, with
+the bitmap pages after it, past the end of the extents when the file
+is closed or flushed: the trailer, whose place "tail" records. New
+extents go after the trailer, which the file's header points to until
+a new one is written, synced, and the header updated and synced in
+turn; only then is the space of the old trailer, and of extents given
+up since, used again. A page is so rewritten in place only if its
+extent was written after the last trailer and it still fits there;
+else it goes in the first hole left by other extents that it fits, or
+at the end of the extents. The holes are not kept in the file; they
+are found from the extent map when it is opened. A page stored raw, as
+it would not shrink, has an extent "pagesize" bytes long; a page never
+written has none. */
+#define PF_HDR_MAGIC	(-0x50463200)	/* first word of a version 2
+					header; "firstfree" of a version 1
+					file is never below -1 */
+#define PF_FORMAT_VERSION 2		/* latest format */
+typedef struct PFhdr2_str {
+	int	magic;		/* PF_HDR_MAGIC */
+	int	version;	/* PF_FORMAT_VERSION */
+	int	numpages;	/* # of pages in the file */
+	int	pagesize;	/* # of bytes in a page */
+	int	flags;		/* PF_FILE_CHECKSUM, PF_FILE_COMPRESS, or 0 */
+	unsigned int tail;	/* PF_FILE_COMPRESS: where the trailer
+				is, in PF_EXTENT_ALIGN units, or 0 if
+				none has been written */
+} PFhdr2_str;
+
+#define PF_CHECKSUM_SIZE 4	/* # of bytes of the checksum of a page */
+
+#define PF_EXTENT_ALIGN	16	/* extents of a compressed file start on
+				multiples of this */
+#define PFextentRound(len) (((off_t)(len) + PF_EXTENT_ALIGN - 1) & \
+				~(off_t)(PF_EXTENT_ALIGN - 1))
+
+/* extent map entry of a page of a compressed file */
+typedef struct PFextent {
+	unsigned int off;	/* where the extent is, in PF_EXTENT_ALIGN
+				units */
+	unsigned int len;	/* # of bytes in it, 0 if the page has
+				never been written */
+} PFextent;
+
+/* a hole among the extents of a compressed file */
+typedef struct PFhole {
+	off_t	off;		/* where it is */
+	off_t	len;		/* # of bytes in it */
+} PFhole;
+
+/* A version 1 file page is "nextfree" followed by PF_PAGE_SIZE bytes
+of data. In memory the two parts are kept apart so that the data can
+sit on its own page-aligned frame; PFreadfcn() and PFwritefcn() scatter
+and gather them to and from the on-disk layout. In both formats pages
+follow each other in the file, but for the bitmap pages of a version 2
+file, so a run of consecutive pages is read with one PFreadfcn() call
+and written with one PFwritefcn() call (two if it spans a bitmap
+page). */
 #define PF_PAGE_LIST_END	-1	/* end of list of free pages */
 #define PF_PAGE_USED		-2	/* page is being used */
 typedef struct PFfpage {
 	int nextfree;	/* page number of next free page in the linked
 			list of free pages, or PF_PAGE_LIST_END if
-			end of list, or PF_PAGE_USED if this page is not free */
-	char pagebuf[PF_PAGE_SIZE];	/* actual page data */
+			end of list, or PF_PAGE_USED if this page is not free;
+			not used in version 2 files */
+	char *pagebuf;	/* actual page data, PF_PAGE_SIZE bytes */
 } PFfpage;
 
+#define PF_FPAGE_SIZE	(sizeof(int) + PF_PAGE_SIZE) /* size of a page
+						in a version 1 file */
+#define PF_WRITE_RUN	64	/* max # of pages written by one call */
+#define PF_EVICT_RUN	8	/* max # of pages written when a dirty
+				victim is paged out: the victim and the
+				dirty, unfixed pages next to it */
+#define PF_EVICT_TRIES	16	/* max # of victims tried for one frame,
+				each fixed by a latch-free hit first */
+#define PF_READ_AHEAD_MAX 32	/* max # of pages read ahead by one call */
+#define PF_READ_AHEAD_MIN 4	/* # of pages first read ahead when a
+				file is found to be read in page order */
+
 /*************************** Opened File Table **********************/
-#define PF_FTAB_SIZE	20	/* size of open file table */
+/* The table grows as files are opened, a chunk of PF_FTAB_CHUNK entries
+at a time, up to PF_FTAB_MAX. A chunk never moves once allocated, so a
+file descriptor indexes its entry without a latch while other files are
+opened. */
+#define PF_FTAB_CHUNK	64	/* # of entries in a chunk of the table */
+#define PF_FTAB_CHUNKS	1024	/* max # of chunks */
+#define PF_FTAB_MAX	(PF_FTAB_CHUNK * PF_FTAB_CHUNKS) /* max # of
+				files open at a time */
 
 /* open file table entry */
 typedef struct PFftab_ele {
 	char *fname;	/* file name, or NULL if entry not used */
-	int unixfd;	/* unix file descriptor*/
+	char *namebuf;	/* room for the name, kept for the next file
+			to use the entry */
+	size_t namecap;	/* # of bytes at namebuf */
+	unsigned int namehash; /* hash of the name */
+	int namenext;	/* next entry in the same bucket of the name
+			hash table, or -1 */
+	int freenext;	/* next free entry, or -1, while the entry is free */
+	int unixfd;	/* unix file descriptor, or -1 while it is
+			closed by the descriptor cache (see
+			PF_SetMaxOpenFds()) or the file is mapped */
+	int fdpins;	/* # of I/O calls using unixfd, which keep it
+			from being closed; counted only while the
+			descriptor cache has a limit */
+	int fdprev;	/* previous entry in the descriptor cache's LRU
+			list of open unix files, or -1 */
+	int fdnext;	/* next entry in that list, or -1 */
 	PFhdr_str hdr;	/* file header */
 	short hdrchanged; /* TRUE if file header has changed */
+	short version;	/* file format: 1 or PF_FORMAT_VERSION */
+	short direct;	/* TRUE if opened with O_DIRECT */
+	short checksum;	/* TRUE if its pages end in a checksum */
+	int	pagesize;	/* # of bytes in a page */
+	unsigned char *bitmap;	/* version 2: the bitmap pages, one after
+				the other and page aligned; read without
+				latches */
+	char	*mapchanged;	/* TRUE for each bitmap page changed */
+	int	nmaps;		/* # of bitmap pages held */
+	unsigned char **oldmaps; /* arrays replaced by a bigger "bitmap",
+				kept until the file is closed as readers
+				may still be in them */
+	int	noldmaps;	/* # of arrays in oldmaps */
+	int	nfree;		/* version 2: # of free pages */
+	int	allochint;	/* page last allocated or disposed; the
+				next page is allocated as close to it as
+				can be */
+	pthread_mutex_t hdrlatch; /* guards "hdr" while pages are
+				allocated and disposed */
+	int	ralast;		/* last page asked for by PF_GetThisPage()
+				or PF_GetNextPage(), -2 if none */
+	int	ranext;		/* first page after those read ahead */
+	int	rawindow;	/* # of pages read ahead last time, 0
+				if the file is not being read in order */
+	char	*map;		/* the file, mapped read-only by
+				PF_OpenFileMapped(), or NULL if its
+				pages go through the buffer pool */
+	size_t	maplen;		/* # of bytes mapped at "map" */
+	int	*mapfix;	/* fix count of each page of a mapped
+				file */
+	short	compress;	/* TRUE if its pages are compressed */
+	short	extchanged;	/* TRUE if an extent has been written
+				since the trailer was */
+	PFextent *extents;	/* compressed file: extent map */
+	char	*extfresh;	/* TRUE for each extent written since
+				the trailer was: no trailer on disk
+				points to it */
+	int	nextents;	/* # of entries extents can hold */
+	off_t	tail;		/* where the trailer on disk is, 0 if
+				none has been written */
+	off_t	tailend;	/* end of the trailer on disk */
+	off_t	extend;		/* end of the extents, past the trailer:
+				where the next one goes if no hole fits
+				it */
+	PFhole	*holes;		/* holes among the extents, in file
+				order */
+	int	nholes;		/* # of holes */
+	int	maxholes;	/* # of entries holes can hold */
+	PFhole	*freed;		/* extents given up since the trailer
+				was written, which it still points to */
+	int	nfreed;		/* # of them */
+	int	maxfreed;	/* # of entries freed can hold */
+	pthread_mutex_t extlatch; /* guards the thirteen above */
 } PFftab_ele;
 
 /************************** Buffer Page Decls *********************/
-#define PF_MAX_BUFS	20	/* max # of buffers */
+#define PF_MAX_BUFS	20	/* # of buffers unless PF_InitWithOptions()
+				or PF_ResizePool() says otherwise */
+
+/* Page size classes. Frames come in one size per class, from
+PF_MIN_PAGE_SIZE up to PF_MAX_PAGE_SIZE, each twice the last; the pages
+of a file go to the frames of the class of its page size. */
+#define PF_SIZE_CLASSES	5	/* # of page sizes */
+#define PFsizeClass(pagesize) (__builtin_ctz(pagesize) - \
+				__builtin_ctz(PF_MIN_PAGE_SIZE))
+
+/* Frame arena. Page data lives in chunks of anonymous memory, one
+frame after another, so every frame is page aligned; all the frames of
+a chunk are of one size class. Chunks are backed by huge pages when the
+system has them. The buffer page descriptors below live in a dense
+array per chunk, apart from the data, so walking the buffer lists does
+not touch page data. */
+#define PF_FRAME_ALIGN		4096		/* alignment of page frames */
+#define PF_HUGE_PAGE_SIZE	(2 * 1024 * 1024) /* huge page size */
 
 /* buffer page decl */
 typedef struct PFbpage {
@@ -44,36 +233,249 @@ typedef struct PFbpage {
 					buffer page */
 	struct PFbpage *prevpage;	/* previous in the linked list
 					of buffer pages */
-	unsigned short	dirty:1,		/* TRUE if page is dirty */
-		fixed:1;		/* TRUE if page is fixed in buffer*/
+	char	dirty;			/* TRUE if page is dirty */
+	char	refbit;			/* TRUE if used since the clock
+					hand last passed (CLOCK only) */
+	char	cleaning;		/* TRUE while the background writer
+					holds one of the fixes */
+	char	prefetched;		/* TRUE if read ahead and not fixed
+					with the latch since */
+	char	reading;		/* TRUE while PFbufPrefetch() reads
+					the page in; it holds one of the
+					fixes meanwhile */
+	char	priority;		/* PF_HINT_LOW, _NORMAL or _HIGH,
+					set by PFbufHint(); _NORMAL when
+					the page comes in */
+	char	fresh;			/* TRUE if allocated by PFbufAlloc()
+					and not written since */
+	struct PFbpage *lownext;	/* next on the partition's list of
+					PF_HINT_LOW pages */
+	struct PFbpage *lowprev;	/* previous on that list */
+	int	fixcount;		/* # of fixes not yet unfixed; the
+					page can be paged out only at 0.
+					PF_FIX_EVICTING is added while
+					the page is being paged out */
 	int	page;			/* page number of this page */
-	int	fd;			/* file desciptor of this page */
+	int	fd;			/* file desciptor of this page,
+					or -1 if the page is free */
+	int	frameno;		/* index in the frame table */
+	struct PFbpage *qnext;		/* next on the policy queue */
+	struct PFbpage *qprev;		/* previous on the policy queue */
+	short	queue;			/* policy queue holding the page */
+	int	heapidx;		/* LRU-2: position in the heap,
+					or -1 if fixed */
+	unsigned long lastref[2];	/* LRU-2: times of the last two
+					references, 0 if none */
 	PFfpage fpage; /* page data from the file */
+	struct PFarena *arena;		/* chunk holding this page */
+	struct PFbpage *fnext;		/* next page of its file in the
+					buffer (see PFbfile) */
+	struct PFbpage *fprev;		/* previous page of its file */
 } PFbpage;
 
+#define PF_CACHE_LINE	64	/* partitions and file lists are aligned
+				on cache lines */
+
+/* Pages of a file in the buffer. A page is on the list of its file
+from when it is entered in a page table until it leaves it, so that
+closing or flushing a file walks its own pages only. The list is
+changed under the latch of the page's partition, and then the file's;
+with every partition of the file's size class latched, it can be
+walked without the file's. */
+typedef struct PFbfile {
+	PFbpage	*first;			/* first page, or NULL */
+	int	npages;			/* # of pages on the list */
+	pthread_spinlock_t latch;	/* guards the two above */
+
+	/* statistics of the file (see PF_FileStats); hits are counted
+	on the latch-free path too, so all are updated with atomic adds */
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long evictions;
+	unsigned long dirtyEvictions;
+	unsigned long pinWaits;
+	unsigned long allocations;
+} __attribute__((aligned(PF_CACHE_LINE))) PFbfile;
+
+/* The latch-free hit path (see buf.c) fixes and unfixes pages without
+the partition latch, so "fixcount", "fd", "page", "dirty" and "refbit"
+may change under latched code. These access them. */
+#define PFatomicLoad(x)		__atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define PFatomicStore(x, v)	__atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define PF_FIX_EVICTING	(-(1 << 30))	/* added to "fixcount" of a page
+					being paged out */
+
+/* a chunk of the frame arena */
+typedef struct PFarena {
+	struct PFarena *next;	/* next chunk, or NULL */
+	PFbpage *bpages;	/* descriptors of the frames */
+	char	*frames;	/* page data of the frames */
+	size_t	maplen;		/* # of bytes mapped at "frames" */
+	int	nframes;	/* # of frames in the chunk */
+	int	nretired;	/* # of frames taken out of the pool */
+	short	hugetlb;	/* TRUE if mapped with MAP_HUGETLB */
+} PFarena;
+
 
 
 /******************** Hash Table Decls ****************************/
-#define PF_HASH_TBL_SIZE	20	/* size of PF hash table */
+/* The page table is an open-addressing (linear probing) table whose
+size is a power of two picked from the number of buffer frames, so that
+it is never more than half full. Slots are stored inline; nothing is
+malloc()ed when pages are inserted or deleted. */
+#define PF_HASH_MIN_SIZE	32	/* smallest # of slots in the table */
+#define PF_HASH_EMPTY		-1	/* fd of an unused slot */
 
-/* Hash table bucket entries*/
+/* Hash table slot */
 typedef struct PFhash_entry {
-	struct PFhash_entry *nextentry; /* next hash table element, or NULL */
-	struct PFhash_entry *preventry;/*previous hash table element,or NULL*/
-	int fd;		/* file descriptor */
+	int fd;		/* file descriptor, or PF_HASH_EMPTY */
 	int page;	/* page number */
 	struct PFbpage *bpage; /* pointer to buffer holding this page */
 } PFhash_entry;
 
-/* Hash function for hash table */
-#define PFhash(fd,page) (((fd)+(page)) % PF_HASH_TBL_SIZE)
+/* A hash table. All zeroes is an empty table with no slots yet.
+PFhashPeek() reads it without the latch; "seq" is odd while entries
+are being moved, and is changed by every move, so a reader can tell
+that what it saw may be torn. Slot arrays replaced by a rehash are
+kept in "oldslots" until PFhashFree(), as readers may still be in
+them. */
+typedef struct PFhashtab {
+	PFhash_entry *slots;	/* array of slots, or NULL */
+	unsigned int mask;	/* # of slots - 1 */
+	int	count;		/* # of slots in use */
+	unsigned long seq;	/* sequence number, odd while writing */
+	PFhash_entry **oldslots; /* slot arrays replaced by a rehash */
+	int	noldslots;	/* # of arrays in oldslots */
+} PFhashtab;
+
+/* Hash function for hash table: a 64-bit finalizer (murmur3 fmix64)
+applied to (fd,page) packed into one word. Callers mask off the low
+bits to get a slot number. */
+static inline unsigned long long PFhash(int fd, int page) {
+	unsigned long long k;
+
+	k = ((unsigned long long)(unsigned int)fd << 32) | (unsigned int)page;
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return (k);
+}
+
+/*********************** Background Writer ******************************/
+/* The background writer is a thread that writes dirty, unfixed pages
+near the cold end of each partition when too few of its pages are
+clean, so that a miss seldom has to write its victim first. */
+#define PF_WRITER_INTERVAL	10	/* ms between passes when no miss
+					wakes the writer */
+#define PF_HINT_SCAN		32	/* max # of pages PFbufVictim() looks
+					at for one below the policy's choice */
+#define PF_WRITER_BATCH		16	/* max # of pages fixed for writing
+					at a time in a partition */
+
+/********************** Buffer Pool Partitions ***************************/
+/* The pool is split into partitions, each holding the pages whose
+(fd,page) hash picks it. A partition has its own latch, used list, free
+list, frame table, page table, replacement state and statistics, so
+threads working on pages of different partitions do not wait for each
+other. The latch is held across the I/O of a miss in the partition.
+The frame arena is shared by all partitions under a latch of its own,
+taken only while a partition grows or shrinks; a partition latch is
+always taken first. Pages read ahead are read without the latch;
+their frames stay in the page table, marked "reading", and a fix of
+one waits on "iodone" until the read is over. A fix of a page that
+PFbufFlushFile() has closed to fixes, to write it without the latch,
+waits on it too. */
+
+typedef struct PFpart {
+	pthread_mutex_t latch;		/* guards everything below */
+	int	sizeclass;		/* size class of its frames */
+	int	framesize;		/* # of bytes in a frame */
+	int	poolsize;		/* # of pages the partition may hold */
+	int	numbpage;		/* # of buffer pages in the partition */
+	PFbpage *firstbpage;		/* first buffer page, or NULL */
+	PFbpage *lastbpage;		/* last buffer page, or NULL */
+	PFbpage *freebpage;		/* list of free buffer pages */
+	PFbpage **frametbl;		/* every page of the partition, free
+					or used, indexed by frameno */
+	int	frametblsize;		/* # of entries frametbl can hold */
+	int	clockhand;		/* next frame the CLOCK hand looks at */
+	PFhashtab hash;			/* page table */
+	struct PFrepl *repl;		/* 2Q, LRU-2 and ARC state, or NULL
+					until first needed */
+	pthread_cond_t iodone;		/* a page of the partition has been
+					read in by PFbufPrefetch(), or
+					written by PFbufFlushFile() */
+	int	nreading;		/* # of pages being read in */
+	int	nlow;			/* # of pages hinted PF_HINT_LOW */
+	int	nhigh;			/* # of pages hinted PF_HINT_HIGH */
+	PFbpage	*lowfirst;		/* the PF_HINT_LOW pages, in the order */
+	PFbpage	*lowlast;		/* they were hinted, through "lownext" */
+
+	/* statistics, added up into PFbufferPool by PF_CollectStats().
+	Hits on the latch-free path are counted too, so they are only
+	updated with atomic adds. */
+	unsigned long logicalPageRequests;
+	unsigned long logicalPageMisses; /* hits are the requests less
+					these */
+	unsigned long physicalReads;
+	unsigned long physicalWrites;
+	unsigned long pageAllocations;
+	unsigned long evictions;
+	unsigned long dirtyEvictions;
+	unsigned long writerWrites;
+	unsigned long writeCalls;
+	unsigned long readCalls;
+	unsigned long readAheadPages;
+	unsigned long ioWaits;
+} __attribute__((aligned(PF_CACHE_LINE))) PFpart;
+
+/************************ Asynchronous Reads ****************************/
+/* PFbufPrefetch() reads runs of consecutive pages through io.c, which
+calls the "done" function of a request when its read is over. */
+#define PF_IO_DEPTH	64	/* max # of reads in flight */
+#define PF_IO_THREADS	4	/* # of threads reading when there is no
+				io_uring */
+#define PF_IO_TRIES	100	/* # of times a submission is offered to
+				the io_uring before it is read here */
+#define PF_IO_NAP	1000000	/* ns the reaper sleeps between looks at
+				a ring it cannot wait on */
+
+typedef struct PFioreq {
+	struct PFioreq *next;	/* next in the queue of the threads */
+	int	unixfd;		/* unix file descriptor to read */
+	off_t	offset;		/* where to read from */
+	struct iovec iov[2 * PF_READ_AHEAD_MAX]; /* where to read into */
+	int	niov;		/* # of entries of iov in use */
+	ssize_t	len;		/* # of bytes to read */
+	void	(*done)(struct PFioreq *req, int error); /* called, with
+				PFE_OK or a PF error code, when the read
+				is over */
+	char	*zbuf;		/* where the extents of a compressed
+				file are read to, or NULL */
+	int	(*check)(struct PFioreq *req, int i); /* checks page i
+				of those read, and decompresses it from
+				"zbuf"; or NULL */
+	void	(*finish)(struct PFioreq *req); /* lets go of "unixfd"
+				once the read is over; or NULL */
+	int	fd;		/* PF file descriptor */
+	int	pagenum;	/* first page read */
+	int	n;		/* # of pages read */
+	PFbpage *bpages[PF_READ_AHEAD_MAX]; /* their buffer pages */
+} PFioreq;
 
 /******************* Interface functions from Hash Table ****************/
-void PFhashInit();
-PFbpage *PFhashFind();
-int PFhashInsert();
-int PFhashDelete();
-void PFhashPrint();
+void PFhashInit(PFhashtab *tab, int numbuf);
+void PFhashFree(PFhashtab *tab);
+int PFhashResize(PFhashtab *tab, int numbuf);
+PFbpage *PFhashFind(PFhashtab *tab, int fd, int page);
+PFbpage *PFhashPeek(PFhashtab *tab, int fd, int page);
+int PFhashInsert(PFhashtab *tab, int fd, int page, PFbpage *bpage);
+int PFhashDelete(PFhashtab *tab, int fd, int page);
+void PFhashPrint(PFhashtab *tab);
 
 /****************** Interface functions from Buffer Manager *************/
 // int PFbufGet();
@@ -86,27 +488,143 @@ int PFbufUsed(int fd,     /* file descriptor */
               int pagenum /* page number */
 );
 
+int PFbufFixCount(int fd,     /* file descriptor */
+                  int pagenum /* page number */
+);
+
+int PFbufDrop(int fd,     /* file descriptor */
+              int pagenum /* page number */
+);
+
 int PFbufAlloc(int fd,          /* file descriptor */
                int pagenum,     /* page number */
                PFfpage **fpage, /* pointer to file page */
-               int (*writefcn)(int, int, PFfpage*));
+               int (*writefcn)(int, int, PFfpage **, int));
+
+int PFbufSetPageSize(int fd,       /* file descriptor */
+                     int pagesize); /* # of bytes in its pages */
+int PFbufResizePool(int poolSize, /* new # of buffer pages */
+                    int (*writefcn)(int, int, PFfpage **, int));
 
 int PFbufReleaseFile(
     int fd,                              /* file descriptor */
-    int (*writefcn)(int, int, PFfpage *) /* function to write a page of file */
+    int (*writefcn)(int, int, PFfpage **, int) /* writes pages of the file */
+);
+
+int PFbufFlushFile(
+    int fd,                              /* file descriptor */
+    int (*writefcn)(int, int, PFfpage **, int) /* writes pages of the file */
+);
+int PFbufStampFresh(
+    int fd,                              /* file descriptor */
+    int (*writefcn)(int, int, PFfpage **, int) /* writes pages of the file */
 );
 
 int PFbufGet(int fd,          /* file descriptor */
              int pagenum,     /* page number */
              PFfpage **fpage, /* pointer to pointer to file page */
-             int (*readfcn)(int, int, PFfpage *), /* function to read a page */
-             int (*writefcn)(int, int, PFfpage *) /* function to write a page */
+             int (*readfcn)(int, int, PFfpage **, int), /* reads pages */
+             int (*writefcn)(int, int, PFfpage **, int) /* writes pages */
 );
 
+int PFbufPrefetch(int fd,     /* file descriptor */
+                  int *pages, /* pages to read in */
+                  int n,      /* # of pages */
+                  void (*prepfcn)(int, int, PFfpage **, int, PFioreq *));
+
+void PFbufHint(int fd, int pagenum, int priority);
+
+int PFbufStartWriter(int lowPct, int highPct,
+                     int (*writefcn)(int, int, PFfpage **, int));
+void PFbufStopWriter(void);
+
+void PFbufCollectStats(void);
+void PFbufResetStats(void);
+void PFbufFileStats(int fd, PF_FileStats *stats);
+void PFbufOccupancy(int *resident, int *dirty);
+
+/* a page in the buffer, and how hot it is (see PFbufWarmPages()) */
+typedef struct PFwarmpage {
+	int	fd;			/* file descriptor */
+	int	page;			/* page number */
+	double	heat;			/* higher is hotter */
+} PFwarmpage;
+
+int PFbufWarmPages(PFwarmpage **pages);
+
+/* A warm list file, written by PF_SaveWarmList(): a PFwarmhdr, then
+the names of its "nfiles" files, each an int length and that many
+bytes, then "npages" PFwarment, hottest first. */
+#define PF_WARM_MAGIC	"PFWARM1"
+
+typedef struct PFwarmhdr {
+	char	magic[8];		/* PF_WARM_MAGIC, with its 0 */
+	int	nfiles;			/* # of file names */
+	int	npages;			/* # of pages */
+} PFwarmhdr;
+
+typedef struct PFwarment {
+	int	file;			/* index of the file's name; a file
+					descriptor once loaded */
+	int	page;			/* page number */
+} PFwarment;
+void PFbufHashPrint(void);
+
+/******************* Interface functions from io.c **********************/
+int PFioStart(int backend);
+void PFioStop(void);
+void PFioDrain(void);
+void PFioSubmit(PFioreq *req);
+
+/******************* Interface functions from trace.c *******************/
+#define PF_TRACE_RING	65536	/* # of records the ring holds unless
+				told otherwise */
+
+extern int PFtraceon;		/* TRUE while a trace is taken */
+
+/* record operation "op" on page "page" of file "fd" if a trace is on;
+costs one load otherwise */
+#define PFtrace(fd, page, op, dirty) \
+	do { \
+		if (__builtin_expect(__atomic_load_n(&PFtraceon, \
+				__ATOMIC_RELAXED), 0)) \
+			PFtraceRecord(fd, page, op, dirty); \
+	} while (0)
+
+void PFtraceRecord(int fd, int page, int op, int dirty);
+int PFtraceStart(char *fname, int nrecords);
+int PFtraceStop(void);
+
+/****************** Interface functions from CRC32C *********************/
+/* how PFcrc32c() computes */
+#define PF_CRC_SOFT	0	/* in software */
+#define PF_CRC_SSE42	1	/* with the crc32 instruction */
+#define PF_CRC_VPCLMUL	2	/* folding with AVX-512 VPCLMULQDQ */
+
+unsigned int PFcrc32c(unsigned int crc, const void *buf, size_t len);
+unsigned int PFcrc32cSoft(unsigned int crc, const void *buf, size_t len);
+int PFcrc32cSetMethod(int method);
+
+/****************** Interface functions from lz.c ***********************/
+int PFlzCompress(const char *src, int srclen, char *dst, int dstcap);
+int PFlzDecompress(const char *src, int srclen, char *dst, int dstlen);
+
+/************* Interface functions from Replacement Policies ************/
+void PFreplInit(PFpart *part, int poolSize);
+void PFreplFree(PFpart *part);
+int PFreplResize(PFpart *part, int poolSize);
+int PFreplArcTarget(PFpart *part);
+int PFreplHot(PFbpage *bpage);
+int PFreplMiss(PFpart *part, int fd, int page);
+void PFreplAdmit(PFpart *part, PFbpage *bpage, int missed);
+void PFreplRef(PFpart *part, PFbpage *bpage);
+void PFreplFirstUse(PFpart *part, PFbpage *bpage);
+void PFreplUnfix(PFpart *part, PFbpage *bpage);
+void PFreplRemove(PFpart *part, PFbpage *bpage, int paged);
+PFbpage *PFreplVictim(PFpart *part);
+PFbpage *PFreplNextCold(PFpart *part, PFbpage *bpage);
+
 /************ More declarations that the compiler needs to see **********/
-PFbpage *PFhashFind(int fd, int page);
-int PFhashInsert(int fd, int page, PFbpage* bpage);
-int PFhashDelete(int fd, int page);
 int PF_CreateFile(char* fname);
 int PF_OpenFile(char* fname);
 int PF_DisposePage(int fd, int pagenum);
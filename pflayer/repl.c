@@ -0,0 +1,764 @@
+/* repl.c: replacement policies that keep their own queues of buffer
+pages: 2Q, LRU-2 and ARC. The buffer manager calls PFreplMiss(),
+PFreplAdmit(), PFreplRef(), PFreplUnfix() and PFreplRemove() as pages
+are missed, come, are used and go (PFreplFirstUse() for the first use
+of a page read ahead), and PFreplVictim() to choose a page
+to write out. PFreplNextCold() lets the background writer see which
+pages are to go next. LRU, MRU and CLOCK need none of this and are handled in
+buf.c; for them these functions do nothing.
+
+All three policies remember pages they have recently paged out in a
+ghost directory: the (fd,page) of the page and, for LRU-2, the time of
+its last reference. Ghosts take no buffer space.
+
+Every partition of the pool has policy state of its own, and the
+caller holds the latch of the partition it passes in. */
+#include <stdio.h>
+#include <stdlib.h>
+#include "pf.h"
+#include "pftypes.h"
+
+/* resident queues */
+#define PF_Q_NONE	0	/* not on any queue */
+#define PF_Q_A1IN	1	/* 2Q: pages referenced once, FIFO */
+#define PF_Q_AM		2	/* 2Q: pages referenced again, LRU */
+#define PF_Q_T1		3	/* ARC: pages referenced once, LRU */
+#define PF_Q_T2		4	/* ARC: pages referenced again, LRU */
+#define PF_NQUEUES	5
+
+/* ghost lists */
+#define PF_G_NONE	-1	/* no ghost list */
+#define PF_G_A1OUT	0	/* 2Q: pages paged out of A1in */
+#define PF_G_HIST	1	/* LRU-2: pages paged out, with history */
+#define PF_G_B1		2	/* ARC: pages paged out of T1 */
+#define PF_G_B2		3	/* ARC: pages paged out of T2 */
+#define PF_NGHOSTS	4
+
+#define PF_GHOST_NIL	-1	/* end of a ghost list or chain */
+
+typedef struct PFreplq {
+	PFbpage *head;		/* most recently queued page */
+	PFbpage *tail;		/* least recently queued page */
+	int	count;		/* # of pages on the queue */
+} PFreplq;
+
+typedef struct PFghost {
+	int	fd;		/* file descriptor */
+	int	page;		/* page number */
+	unsigned long lastref;	/* LRU-2: time of the last reference */
+	int	list;		/* ghost list holding the entry */
+	int	next;		/* next (older) entry on the list */
+	int	prev;		/* previous (newer) entry on the list */
+	int	hnext;		/* next entry on the hash chain */
+} PFghost;
+
+/* The policy state of one partition of the pool; each partition
+replaces its own pages. */
+typedef struct PFrepl {
+	PFreplq	queue[PF_NQUEUES];	/* resident queues */
+	int	size;			/* # of pages in the partition */
+	int	Kin;			/* 2Q: target size of A1in */
+	int	Kout;			/* 2Q: max size of A1out */
+	int	arcp;			/* ARC: target size of T1, "p" in
+					the paper */
+	int	arcmiss;		/* ARC: ghost list of the page being
+					missed, or PF_G_NONE */
+
+	PFghost	*ghosttbl;		/* ghost entries */
+	int	*ghostbucket;		/* hash chains of ghost entries */
+	int	ghostmask;		/* # of hash chains - 1 */
+	int	ghostsize;		/* # of ghost entries */
+	int	ghostfree;		/* list of free ghost entries */
+	int	ghosthead[PF_NGHOSTS];	/* newest entry of each list */
+	int	ghosttail[PF_NGHOSTS];	/* oldest entry of each list */
+	int	ghostcount[PF_NGHOSTS];	/* # of entries of each list */
+
+	PFbpage	**heap;			/* LRU-2: unfixed pages, min-heap */
+	int	heapsize;		/* # of pages in the heap */
+	unsigned long clock;		/* LRU-2: reference counter */
+} PFrepl;
+
+/* TRUE if the current policy is handled here */
+#define PFreplActive() (PFbufferPool.replacement == PF_REPLACEMENT_2Q || \
+			PFbufferPool.replacement == PF_REPLACEMENT_LRU2 || \
+			PFbufferPool.replacement == PF_REPLACEMENT_ARC)
+
+/************************ Resident queues ***********************************/
+
+/****************************************************************************
+SPECIFICATIONS:
+	Put "bpage" at the head of resident queue "q".
+*****************************************************************************/
+static void PFreplqPush(PFrepl *r, int q, PFbpage *bpage) {
+  PFreplq *queue = &r->queue[q];
+
+  bpage->qprev = NULL;
+  bpage->qnext = queue->head;
+  if (queue->head != NULL)
+    queue->head->qprev = bpage;
+  queue->head = bpage;
+  if (queue->tail == NULL)
+    queue->tail = bpage;
+  queue->count++;
+  bpage->queue = q;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Take "bpage" off the resident queue it is on, if any.
+*****************************************************************************/
+static void PFreplqRemove(PFrepl *r, PFbpage *bpage) {
+  PFreplq *queue;
+
+  if (bpage->queue == PF_Q_NONE)
+    return;
+  queue = &r->queue[bpage->queue];
+  if (bpage->qprev != NULL)
+    bpage->qprev->qnext = bpage->qnext;
+  else
+    queue->head = bpage->qnext;
+  if (bpage->qnext != NULL)
+    bpage->qnext->qprev = bpage->qprev;
+  else
+    queue->tail = bpage->qprev;
+  queue->count--;
+  bpage->qnext = bpage->qprev = NULL;
+  bpage->queue = PF_Q_NONE;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Find the unfixed page nearest the tail of resident queue "q".
+
+RETURN VALUE:
+	The page, or NULL if every page on the queue is fixed.
+*****************************************************************************/
+static PFbpage *PFreplqOldest(PFrepl *r, int q) {
+  PFbpage *bpage;
+
+  for (bpage = r->queue[q].tail; bpage != NULL; bpage = bpage->qprev)
+    if (bpage->fixcount == 0)
+      break;
+  return (bpage);
+}
+
+/************************ Ghost directory ***********************************/
+
+/****************************************************************************
+SPECIFICATIONS:
+	Throw away every ghost and make room for "size" of them.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_NOMEM	if no memory. The directory is then empty and
+		remembers nothing until the next successful call.
+*****************************************************************************/
+static int PFghostInit(PFrepl *r, int size) {
+  int nbuckets;
+  int i;
+
+  free((char *)r->ghosttbl);
+  free((char *)r->ghostbucket);
+  r->ghosttbl = NULL;
+  r->ghostbucket = NULL;
+  r->ghostsize = 0;
+  r->ghostfree = PF_GHOST_NIL;
+  for (i = 0; i < PF_NGHOSTS; i++) {
+    r->ghosthead[i] = r->ghosttail[i] = PF_GHOST_NIL;
+    r->ghostcount[i] = 0;
+  }
+
+  for (nbuckets = PF_HASH_MIN_SIZE; nbuckets < size; nbuckets <<= 1)
+    ;
+  if ((r->ghosttbl = (PFghost *)malloc(size * sizeof(PFghost))) == NULL ||
+      (r->ghostbucket = (int *)malloc(nbuckets * sizeof(int))) == NULL) {
+    free((char *)r->ghosttbl);
+    r->ghosttbl = NULL;
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  r->ghostsize = size;
+  r->ghostmask = nbuckets - 1;
+  for (i = 0; i < nbuckets; i++)
+    r->ghostbucket[i] = PF_GHOST_NIL;
+  for (i = 0; i < size; i++)
+    r->ghosttbl[i].next = (i + 1 < size) ? i + 1 : PF_GHOST_NIL;
+  r->ghostfree = (size > 0) ? 0 : PF_GHOST_NIL;
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Find the ghost of page "page" of file "fd".
+
+RETURN VALUE:
+	Index of the ghost, or PF_GHOST_NIL if there is none.
+*****************************************************************************/
+static int PFghostFind(PFrepl *r, int fd, int page) {
+  int i;
+
+  if (r->ghostsize == 0)
+    return (PF_GHOST_NIL);
+  for (i = r->ghostbucket[PFhash(fd, page) & r->ghostmask]; i != PF_GHOST_NIL;
+       i = r->ghosttbl[i].hnext)
+    if (r->ghosttbl[i].fd == fd && r->ghosttbl[i].page == page)
+      break;
+  return (i);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Forget ghost "g", returning its entry to the free list.
+*****************************************************************************/
+static void PFghostDrop(PFrepl *r, int g) {
+  PFghost *ghost = &r->ghosttbl[g];
+  int *pi;
+
+  /* off the hash chain */
+  for (pi = &r->ghostbucket[PFhash(ghost->fd, ghost->page) & r->ghostmask];
+       *pi != g; pi = &r->ghosttbl[*pi].hnext)
+    ;
+  *pi = ghost->hnext;
+
+  /* off its list */
+  if (ghost->prev != PF_GHOST_NIL)
+    r->ghosttbl[ghost->prev].next = ghost->next;
+  else
+    r->ghosthead[ghost->list] = ghost->next;
+  if (ghost->next != PF_GHOST_NIL)
+    r->ghosttbl[ghost->next].prev = ghost->prev;
+  else
+    r->ghosttail[ghost->list] = ghost->prev;
+  r->ghostcount[ghost->list]--;
+
+  ghost->next = r->ghostfree;
+  r->ghostfree = g;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Remember the page of "bpage" as the newest ghost on ghost list
+	"list". If no entry is free, the oldest ghost of that list (or
+	failing that, of any list) is forgotten to make room.
+
+RETURN VALUE:
+	Index of the ghost, or PF_GHOST_NIL if the directory has no
+	room at all.
+*****************************************************************************/
+static int PFghostAdd(PFrepl *r, int list, PFbpage *bpage) {
+  PFghost *ghost;
+  int g;
+  int i;
+
+  if (r->ghostfree == PF_GHOST_NIL) {
+    if (r->ghosttail[list] != PF_GHOST_NIL)
+      PFghostDrop(r, r->ghosttail[list]);
+    else
+      for (i = 0; i < PF_NGHOSTS; i++)
+        if (r->ghosttail[i] != PF_GHOST_NIL) {
+          PFghostDrop(r, r->ghosttail[i]);
+          break;
+        }
+    if (r->ghostfree == PF_GHOST_NIL)
+      return (PF_GHOST_NIL);
+  }
+
+  g = r->ghostfree;
+  ghost = &r->ghosttbl[g];
+  r->ghostfree = ghost->next;
+
+  ghost->fd = bpage->fd;
+  ghost->page = bpage->page;
+  ghost->lastref = bpage->lastref[0];
+  ghost->list = list;
+
+  /* on the hash chain */
+  i = PFhash(ghost->fd, ghost->page) & r->ghostmask;
+  ghost->hnext = r->ghostbucket[i];
+  r->ghostbucket[i] = g;
+
+  /* at the head of its list */
+  ghost->prev = PF_GHOST_NIL;
+  ghost->next = r->ghosthead[list];
+  if (r->ghosthead[list] != PF_GHOST_NIL)
+    r->ghosttbl[r->ghosthead[list]].prev = g;
+  r->ghosthead[list] = g;
+  if (r->ghosttail[list] == PF_GHOST_NIL)
+    r->ghosttail[list] = g;
+  r->ghostcount[list]++;
+  return (g);
+}
+
+/************************ LRU-2 heap ****************************************/
+
+/* TRUE if "a" should be paged out before "b": the page whose second
+most recent reference is older goes first, pages referenced only once
+(lastref[1] == 0) going before all others, oldest first. */
+#define PFheapBefore(a, b) ((a)->lastref[1] < (b)->lastref[1] || \
+			((a)->lastref[1] == (b)->lastref[1] && \
+			(a)->lastref[0] < (b)->lastref[0]))
+
+/****************************************************************************
+SPECIFICATIONS:
+	Put the page at heap position "i" where it belongs.
+*****************************************************************************/
+static void PFheapFix(PFrepl *r, int i) {
+  PFbpage *bpage = r->heap[i];
+  int child;
+
+  /* up */
+  while (i > 0 && PFheapBefore(bpage, r->heap[(i - 1) / 2])) {
+    r->heap[i] = r->heap[(i - 1) / 2];
+    r->heap[i]->heapidx = i;
+    i = (i - 1) / 2;
+  }
+
+  /* down */
+  while ((child = 2 * i + 1) < r->heapsize) {
+    if (child + 1 < r->heapsize &&
+        PFheapBefore(r->heap[child + 1], r->heap[child]))
+      child++;
+    if (!PFheapBefore(r->heap[child], bpage))
+      break;
+    r->heap[i] = r->heap[child];
+    r->heap[i]->heapidx = i;
+    i = child;
+  }
+  r->heap[i] = bpage;
+  bpage->heapidx = i;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Take "bpage" out of the heap, if it is there.
+*****************************************************************************/
+static void PFheapRemove(PFrepl *r, PFbpage *bpage) {
+  int i = bpage->heapidx;
+
+  if (i < 0)
+    return;
+  bpage->heapidx = -1;
+  if (i == --r->heapsize)
+    return;
+  r->heap[i] = r->heap[r->heapsize];
+  PFheapFix(r, i);
+}
+
+/************************* Interface to the buffer manager ***************/
+
+/****************************************************************************
+SPECIFICATIONS:
+	Forget every page and ghost and size the policy state of
+	partition "part" for "poolSize" pages. Called when the pool is
+	set up; no page may be in the partition.
+
+RETURN VALUE: none
+*****************************************************************************/
+void PFreplInit(PFpart *part, int poolSize) {
+  PFrepl *r;
+  int q;
+
+  if (part->repl == NULL &&
+      (part->repl = (PFrepl *)calloc(1, sizeof(PFrepl))) == NULL) {
+    printf("Internal error:PFreplInit()\n");
+    exit(1);
+  }
+  r = part->repl;
+  for (q = 0; q < PF_NQUEUES; q++) {
+    r->queue[q].head = r->queue[q].tail = NULL;
+    r->queue[q].count = 0;
+  }
+  r->heapsize = 0;
+  r->clock = 0;
+  r->arcmiss = PF_G_NONE;
+  r->arcp = 0;
+  if (PFreplResize(part, poolSize) != PFE_OK) {
+    printf("Internal error:PFreplInit()\n");
+    exit(1);
+  }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Give back the policy state of partition "part".
+*****************************************************************************/
+void PFreplFree(PFpart *part) {
+  PFrepl *r = part->repl;
+
+  if (r == NULL)
+    return;
+  free((char *)r->ghosttbl);
+  free((char *)r->ghostbucket);
+  free((char *)r->heap);
+  free((char *)r);
+  part->repl = NULL;
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Size the policy state of partition "part" for "poolSize"
+	pages. The pages in the partition keep their places; ghosts
+	are forgotten. The directory has room for two partitions'
+	worth of ghosts, which is as many as ARC keeps.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_NOMEM	if no memory.
+*****************************************************************************/
+int PFreplResize(PFpart *part, int poolSize) {
+  PFrepl *r = part->repl;
+  PFbpage **heap;
+
+  if (r == NULL)
+    /* not set up yet; it will be sized when it is */
+    return (PFE_OK);
+
+  /* 2Q: A1in holds a quarter of the pool, A1out remembers half */
+  r->size = poolSize;
+  r->Kin = (poolSize / 4 > 0) ? poolSize / 4 : 1;
+  r->Kout = (poolSize / 2 > 0) ? poolSize / 2 : 1;
+  if (r->arcp > poolSize)
+    r->arcp = poolSize;
+
+  if ((heap = (PFbpage **)realloc((char *)r->heap,
+                                  poolSize * sizeof(PFbpage *))) == NULL) {
+    PFerrno = PFE_NOMEM;
+    return (PFerrno);
+  }
+  r->heap = heap;
+  return (PFghostInit(r, 2 * poolSize));
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Find the ARC target of partition "part".
+
+RETURN VALUE:
+	p, or 0 if the partition has no policy state yet.
+*****************************************************************************/
+int PFreplArcTarget(PFpart *part) {
+  return ((part->repl != NULL) ? part->repl->arcp : 0);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Tell whether the buffer page "bpage" is on the frequency side
+	of its policy: in Am under 2Q, in T2 under ARC, or referenced
+	twice under LRU-2. The other policies keep no such state.
+	The partition latch is held.
+
+RETURN VALUE:
+	TRUE if it is, FALSE otherwise.
+*****************************************************************************/
+int PFreplHot(PFbpage *bpage) {
+  switch (PFbufferPool.replacement) {
+  case PF_REPLACEMENT_2Q:
+    return (bpage->queue == PF_Q_AM);
+  case PF_REPLACEMENT_ARC:
+    return (bpage->queue == PF_Q_T2);
+  case PF_REPLACEMENT_LRU2:
+    return (bpage->lastref[1] != 0);
+  }
+  return (FALSE);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Page "page" of file "fd" is not in the buffer and is about to
+	be brought in. Only ARC cares. If the page has a ghost, ARC
+	adapts its target: a ghost in B1 means T1 was too small, so p
+	grows, and a ghost in B2 means T2 was, so p shrinks. Each step
+	is the ratio of the sizes of the other ghost list to this one,
+	at least 1. Otherwise the oldest ghost of B1 is dropped if T1
+	and B1 together fill the pool. Then ghosts are dropped, oldest
+	of B2 first, until all four lists hold less than two pools'
+	worth, leaving room for the page coming in. "part" is the
+	partition the page belongs to.
+
+RETURN VALUE:
+	The ghost list the page was found on under ARC, else PF_G_NONE,
+	to be handed to PFreplAdmit() once the page is in: the latch
+	may be let go in between, and other pages missed meanwhile.
+*****************************************************************************/
+int PFreplMiss(PFpart *part, int fd, int page) {
+  PFrepl *r;
+  int g;
+  int b1, b2; /* sizes of B1 and B2 */
+  int step;
+
+  if (PFbufferPool.replacement != PF_REPLACEMENT_ARC)
+    return (PF_G_NONE);
+  if (part->repl == NULL)
+    /* the pool was never set up */
+    PFreplInit(part, part->poolsize);
+  r = part->repl;
+  r->arcmiss = PF_G_NONE;
+
+  b1 = r->ghostcount[PF_G_B1];
+  b2 = r->ghostcount[PF_G_B2];
+  if ((g = PFghostFind(r, fd, page)) != PF_GHOST_NIL) {
+    r->arcmiss = r->ghosttbl[g].list;
+    if (r->arcmiss == PF_G_B1) {
+      step = (b2 / b1 > 1) ? b2 / b1 : 1;
+      r->arcp = (r->arcp + step < r->size) ? r->arcp + step : r->size;
+    } else {
+      step = (b1 / b2 > 1) ? b1 / b2 : 1;
+      r->arcp = (r->arcp - step > 0) ? r->arcp - step : 0;
+    }
+  } else if (r->queue[PF_Q_T1].count + b1 >= r->size && b1 > 0)
+    PFghostDrop(r, r->ghosttail[PF_G_B1]);
+
+  /* Fixed pages can make the victim come from the other list than
+  the paper would take it from, so cap the total explicitly rather
+  than trust the case analysis alone */
+  while (r->queue[PF_Q_T1].count + r->queue[PF_Q_T2].count +
+             r->ghostcount[PF_G_B1] + r->ghostcount[PF_G_B2] >=
+         2 * r->size) {
+    if (r->ghostcount[PF_G_B2] > 0)
+      PFghostDrop(r, r->ghosttail[PF_G_B2]);
+    else if (r->ghostcount[PF_G_B1] > 0)
+      PFghostDrop(r, r->ghosttail[PF_G_B1]);
+    else
+      break;
+  }
+  return (r->arcmiss);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Page "bpage" has just been read into the buffer (or allocated)
+	and is fixed. 2Q puts it on Am if it has a ghost in A1out,
+	else on A1in. ARC puts it on T2 if it had a ghost when it was
+	missed ("missed", as PFreplMiss() returned), else on T1. LRU-2
+	starts its history, picking up the last reference from its
+	ghost if it has one.
+*****************************************************************************/
+void PFreplAdmit(PFpart *part, PFbpage *bpage, int missed) {
+  PFrepl *r;
+  int g;
+
+  bpage->queue = PF_Q_NONE;
+  bpage->heapidx = -1;
+  if (!PFreplActive())
+    return;
+  if (part->repl == NULL)
+    /* the pool was never set up */
+    PFreplInit(part, part->poolsize);
+  r = part->repl;
+
+  g = PFghostFind(r, bpage->fd, bpage->page);
+  if (PFbufferPool.replacement == PF_REPLACEMENT_ARC) {
+    if (g != PF_GHOST_NIL)
+      PFghostDrop(r, g);
+    PFreplqPush(r, (missed != PF_G_NONE) ? PF_Q_T2 : PF_Q_T1, bpage);
+    r->arcmiss = PF_G_NONE;
+  } else if (PFbufferPool.replacement == PF_REPLACEMENT_2Q) {
+    if (g != PF_GHOST_NIL) {
+      PFghostDrop(r, g);
+      PFreplqPush(r, PF_Q_AM, bpage);
+    } else
+      PFreplqPush(r, PF_Q_A1IN, bpage);
+  } else {
+    bpage->lastref[1] = 0;
+    if (g != PF_GHOST_NIL) {
+      bpage->lastref[1] = r->ghosttbl[g].lastref;
+      PFghostDrop(r, g);
+    }
+    bpage->lastref[0] = ++r->clock;
+  }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Page "bpage", already in the buffer, has just been fixed again.
+	2Q moves the page to the head of Am, whichever queue it was
+	on. (The 2Q paper leaves pages on A1in alone, taking a second
+	reference there to be correlated with the first; here a fix
+	and unfix is one use of a page, so a second fix is a genuine
+	re-use. Without this a hot set that fits in the pool never
+	reaches Am, and the next scan flushes it through A1out.)
+	ARC moves it to the head of T2. LRU-2 records the reference
+	and takes the page out of the heap while it is fixed.
+*****************************************************************************/
+void PFreplRef(PFpart *part, PFbpage *bpage) {
+  PFrepl *r = part->repl;
+
+  if (PFbufferPool.replacement == PF_REPLACEMENT_2Q) {
+    PFreplqRemove(r, bpage);
+    PFreplqPush(r, PF_Q_AM, bpage);
+  } else if (PFbufferPool.replacement == PF_REPLACEMENT_ARC) {
+    PFreplqRemove(r, bpage);
+    PFreplqPush(r, PF_Q_T2, bpage);
+  } else if (PFbufferPool.replacement == PF_REPLACEMENT_LRU2) {
+    PFheapRemove(r, bpage);
+    bpage->lastref[1] = bpage->lastref[0];
+    bpage->lastref[0] = ++r->clock;
+  }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Page "bpage", read ahead and not used since, has just been
+	fixed for the first time. Its admission stands for this use,
+	so 2Q and ARC leave it where it is: a page a scan reads ahead
+	must not look re-used when the scan gets to it. LRU-2 takes
+	it out of the heap while it is fixed.
+*****************************************************************************/
+void PFreplFirstUse(PFpart *part, PFbpage *bpage) {
+  if (PFbufferPool.replacement == PF_REPLACEMENT_LRU2)
+    PFheapRemove(part->repl, bpage);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Page "bpage" has just been unfixed. LRU-2 puts it (back) in the
+	heap of pages that may be paged out.
+*****************************************************************************/
+void PFreplUnfix(PFpart *part, PFbpage *bpage) {
+  PFrepl *r = part->repl;
+
+  if (PFbufferPool.replacement == PF_REPLACEMENT_LRU2 && bpage->heapidx < 0) {
+    r->heap[r->heapsize] = bpage;
+    r->heapsize++;
+    PFheapFix(r, r->heapsize - 1);
+  }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Page "bpage" is leaving the buffer. If "paged" is TRUE it is
+	being paged out to make room, and is remembered as a ghost: by
+	2Q if it leaves from A1in, by LRU-2 always (keeping no more
+	ghosts than there are pages in the pool), and by ARC on B1 or
+	B2 as it leaves T1 or T2. Pages dropped when their file is
+	closed leave no ghost.
+*****************************************************************************/
+void PFreplRemove(PFpart *part, PFbpage *bpage, int paged) {
+  PFrepl *r = part->repl;
+  int q = bpage->queue;
+
+  if (!PFreplActive())
+    return;
+  PFreplqRemove(r, bpage);
+  PFheapRemove(r, bpage);
+  if (!paged)
+    return;
+
+  if (PFbufferPool.replacement == PF_REPLACEMENT_2Q) {
+    if (q == PF_Q_A1IN) {
+      PFghostAdd(r, PF_G_A1OUT, bpage);
+      while (r->ghostcount[PF_G_A1OUT] > r->Kout)
+        PFghostDrop(r, r->ghosttail[PF_G_A1OUT]);
+    }
+  } else if (PFbufferPool.replacement == PF_REPLACEMENT_ARC)
+    PFghostAdd(r, (q == PF_Q_T1) ? PF_G_B1 : PF_G_B2, bpage);
+  else {
+    PFghostAdd(r, PF_G_HIST, bpage);
+    while (r->ghostcount[PF_G_HIST] > r->size)
+      PFghostDrop(r, r->ghosttail[PF_G_HIST]);
+  }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Set *first and *second to the resident queues 2Q or ARC takes
+	victims from, in the order it looks at them. 2Q takes from A1in
+	first while A1in holds more than its share of the partition,
+	else from Am. ARC takes from T1 first if T1 is over its target
+	p (or at it, when the page being missed has a ghost in B2),
+	else from T2.
+*****************************************************************************/
+static void PFreplVictimQueues(PFrepl *r, int *first, int *second) {
+  int t1;
+
+  if (PFbufferPool.replacement == PF_REPLACEMENT_ARC) {
+    t1 = r->queue[PF_Q_T1].count;
+    if (t1 > 0 && (t1 > r->arcp || (r->arcmiss == PF_G_B2 && t1 == r->arcp))) {
+      *first = PF_Q_T1;
+      *second = PF_Q_T2;
+    } else {
+      *first = PF_Q_T2;
+      *second = PF_Q_T1;
+    }
+  } else if (r->queue[PF_Q_A1IN].count > r->Kin) {
+    *first = PF_Q_A1IN;
+    *second = PF_Q_AM;
+  } else {
+    *first = PF_Q_AM;
+    *second = PF_Q_A1IN;
+  }
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Choose the unfixed page of partition "part" to page out next.
+	2Q takes the oldest page of A1in while A1in holds more than its
+	share of the partition, else the least recently used page of Am. LRU-2 takes the page
+	whose second most recent reference is oldest; only the
+	background writer fixes pages without taking them out of the
+	heap, so the top is seldom passed over. ARC takes the
+	least recently used page of T1 if T1 is over its target p (or
+	at it, when the page being missed has a ghost in B2), else
+	that of T2.
+
+RETURN VALUE:
+	The victim, or NULL if every page in the buffer is fixed.
+*****************************************************************************/
+PFbpage *PFreplVictim(PFpart *part) {
+  PFrepl *r = part->repl;
+  PFbpage *bpage;
+  int first, second; /* queues to take the victim from, in order */
+  int i;
+
+  if (PFbufferPool.replacement == PF_REPLACEMENT_LRU2) {
+    if (r->heapsize == 0)
+      return (NULL);
+    if (r->heap[0]->fixcount == 0)
+      return (r->heap[0]);
+
+    /* the top is held by the background writer: take the best
+    of the others */
+    bpage = NULL;
+    for (i = 1; i < r->heapsize; i++)
+      if (r->heap[i]->fixcount == 0 &&
+          (bpage == NULL || PFheapBefore(r->heap[i], bpage)))
+        bpage = r->heap[i];
+    return (bpage);
+  }
+
+  PFreplVictimQueues(r, &first, &second);
+  if ((bpage = PFreplqOldest(r, first)) == NULL)
+    bpage = PFreplqOldest(r, second);
+  return (bpage);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Walk the pages of partition "part" that may be paged out, in
+	about the order PFreplVictim() would choose them: give the
+	page after "bpage", or the first if "bpage" is NULL. 2Q and
+	ARC give the queue victims are taken from first, oldest page
+	first, then the other. LRU-2 gives its heap in array order,
+	which puts pages whose second last use is old near the front.
+	Fixed pages may be given.
+
+RETURN VALUE:
+	The page, or NULL if there are no more.
+*****************************************************************************/
+PFbpage *PFreplNextCold(PFpart *part, PFbpage *bpage) {
+  PFrepl *r = part->repl;
+  int first, second;
+  int i;
+
+  if (PFbufferPool.replacement == PF_REPLACEMENT_LRU2) {
+    i = (bpage == NULL) ? 0 : bpage->heapidx + 1;
+    return ((i < r->heapsize) ? r->heap[i] : NULL);
+  }
+
+  PFreplVictimQueues(r, &first, &second);
+  if (bpage == NULL)
+    return (r->queue[first].tail);
+  if (bpage->qprev != NULL)
+    return (bpage->qprev);
+  return ((bpage->queue == first) ? r->queue[second].tail : NULL);
+}
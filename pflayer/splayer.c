@@ -31,12 +31,12 @@ typedef struct {
 
 #define SP_MAGIC_VAL 0x53504C54 /* "SPLT" */
 
-static void sp_init_page(char *pagebuf) {
+static void sp_init_page(char *pagebuf, int pageSize) {
     SP_PageHeader hdr;
     hdr.magic = SP_MAGIC_VAL;
     hdr.slot_count = 0;
-    hdr.free_offset = (uint16_t)PF_PAGE_SIZE; /* data grows downward from end */
-    hdr.free_space = (uint16_t)(PF_PAGE_SIZE - SP_HEADER_SIZE);
+    hdr.free_offset = (uint16_t)pageSize; /* data grows downward from end */
+    hdr.free_space = (uint16_t)(pageSize - SP_HEADER_SIZE);
     memcpy(pagebuf, &hdr, SP_HEADER_SIZE);
 }
 
@@ -67,6 +67,24 @@ int SP_CreateFile(const char *fileName) {
     return PF_CreateFile((char *)fileName);
 }
 
+/* Pages larger than SP_MAX_PAGE_SIZE would overflow the 16-bit offsets */
+int SP_CreateFileWithPageSize(const char *fileName, int pageSize) {
+    if (pageSize > SP_MAX_PAGE_SIZE) {
+        PFerrno = PFE_PAGESIZE;
+        return PFerrno;
+    }
+    return PF_CreateFileWithPageSize((char *)fileName, pageSize);
+}
+
+/* PF_FILE_COMPRESS suits record text well: pages are written compressed */
+int SP_CreateFileWithOptions(const char *fileName, int pageSize, int flags) {
+    if (pageSize > SP_MAX_PAGE_SIZE) {
+        PFerrno = PFE_PAGESIZE;
+        return PFerrno;
+    }
+    return PF_CreateFileWithOptions((char *)fileName, pageSize, flags);
+}
+
 int SP_DestroyFile(const char *fileName) {
     return PF_DestroyFile((char *)fileName);
 }
@@ -75,6 +93,10 @@ int SP_OpenFile(const char *fileName) {
     return PF_OpenFile((char *)fileName);
 }
 
+int SP_OpenFileMapped(const char *fileName) {
+    return PF_OpenFileMapped((char *)fileName);
+}
+
 int SP_CloseFile(int fd) {
     return PF_CloseFile(fd);
 }
@@ -91,7 +113,7 @@ static int sp_find_page_for_insert(int fd, int rec_len, int *outPageNum, char **
     if (err == PFE_EOF) {
         /* empty file: allocate new page */
         if (PF_AllocPage(fd, &pageNum, &pagebuf) != PFE_OK) return -1;
-        sp_init_page(pagebuf);
+        sp_init_page(pagebuf, PF_PageSize(fd));
         *outPageNum = pageNum;
         *outPageBuf = pagebuf;
         return 0;
@@ -131,7 +153,7 @@ static int sp_find_page_for_insert(int fd, int rec_len, int *outPageNum, char **
 
     /* no existing page had enough space -> allocate new page */
     if (PF_AllocPage(fd, &pageNum, &pagebuf) != PFE_OK) return -1;
-    sp_init_page(pagebuf);
+    sp_init_page(pagebuf, PF_PageSize(fd));
     *outPageNum = pageNum;
     *outPageBuf = pagebuf;
     return 0;
@@ -139,7 +161,7 @@ static int sp_find_page_for_insert(int fd, int rec_len, int *outPageNum, char **
 
 /* Insert record */
 int SP_InsertRecord(int fd, const char *data, int len, SP_RecId *recId) {
-    if (len <= 0 || len > PF_PAGE_SIZE - SP_HEADER_SIZE - SP_SLOT_SIZE) return -1;
+    if (len <= 0 || len > PF_PageSize(fd) - SP_HEADER_SIZE - SP_SLOT_SIZE) return -1;
 
     int pageNum;
     char *pagebuf;
@@ -271,12 +293,13 @@ int SP_CompactPage(int fd, int pageNum) {
     sp_read_header(pagebuf, &hdr);
 
     /* allocate temporary snapshot of page content */
-    char *tmp = malloc(PF_PAGE_SIZE);
+    int pageSize = PF_PageSize(fd);
+    char *tmp = malloc(pageSize);
     if (!tmp) { PF_UnfixPage(fd, pageNum, FALSE); return -1; }
-    memcpy(tmp, pagebuf, PF_PAGE_SIZE);
+    memcpy(tmp, pagebuf, pageSize);
 
-    /* rebuild data: start filling from PF_PAGE_SIZE downward */
-    int cur_free = PF_PAGE_SIZE;
+    /* rebuild data: start filling from the page end downward */
+    int cur_free = pageSize;
     for (int i = 0; i < hdr.slot_count; i++) {
         SP_SlotEntry *s = (SP_SlotEntry *)(tmp + SP_HEADER_SIZE + i * SP_SLOT_SIZE);
         if (s->offset == -1) continue;
@@ -323,6 +346,8 @@ int SP_ScanNext(SP_Scan *scan, char **outBuf, int *outLen, SP_RecId *outRecId) {
         scan->pageBuf = pagebuf;
         scan->slotIndex = 0;
         scan->initialized = 1;
+        /* a scan reads each page once: let it go before others */
+        PF_SetPageHint(scan->fd, pageNum, PF_HINT_LOW);
     }
 
     while (1) {
@@ -354,6 +379,7 @@ int SP_ScanNext(SP_Scan *scan, char **outBuf, int *outLen, SP_RecId *outRecId) {
             return -1;
         }
         if (rc != PFE_OK) return -1;
+        PF_SetPageHint(scan->fd, scan->curPageNum, PF_HINT_LOW);
         scan->slotIndex = 0;
     }
 }
@@ -408,7 +434,7 @@ double SP_ComputeSpaceUtilization(int fd, int *out_pages, long *out_total_bytes)
     if (out_total_bytes) *out_total_bytes = total_bytes;
     double util = 0.0;
     if (pages > 0) {
-        util = ((double)total_bytes) / ((double)pages * (double)PF_PAGE_SIZE) * 100.0;
+        util = ((double)total_bytes) / ((double)pages * (double)PF_PageSize(fd)) * 100.0;
     }
     return util;
 }
@@ -8,9 +8,15 @@ typedef unsigned int SP_RecId; /* encoded: (pageNum << 16) | slotIndex */
 
 #define SP_MAGIC 0x53504C54 /* "SPLT" */
 
+/* largest page an SP file may have: record offsets are 16 bits */
+#define SP_MAX_PAGE_SIZE 32768
+
 int SP_CreateFile(const char *fileName);
+int SP_CreateFileWithPageSize(const char *fileName, int pageSize);
+int SP_CreateFileWithOptions(const char *fileName, int pageSize, int flags); /* see PF_CreateFileWithOptions */
 int SP_DestroyFile(const char *fileName);
 int SP_OpenFile(const char *fileName);
+int SP_OpenFileMapped(const char *fileName); /* read-only, see PF_OpenFileMapped */
 int SP_CloseFile(int fd);
 
 /* Insert record data (len bytes). Returns AME_OK (0) on success and sets *recId */
@@ -0,0 +1,204 @@
+/* test_crc_bench.c: cost of the page checksums.
+ *
+ * First checks that every way of computing the CRC-32C the processor
+ * has agrees with the software one, on buffers of many lengths and
+ * alignments up to a few pages. Then times, per 4 KB page, a memcpy()
+ * of the page and the CRC-32C of it each of those ways, over a pool of
+ * 1 MB of pages that stays in cache. Last, a
+ * file of NPAGES pages is written and scanned through the buffer pool
+ * with and without PF_FILE_CHECKSUM, the kernel page cache warm, so
+ * the I/O costs little next to the checksums.
+ *
+ * Results are printed and written to pf_crc_bench.csv.
+ */
+#include "pf.h"
+#include "pftypes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CSVFILE "pf_crc_bench.csv"
+#define TESTFILE "pf_crc_testfile.dat"
+
+#define PAGE     4096
+#define POOL     256        /* pages in the in-cache pool: 1 MB */
+#define ROUNDS   200        /* passes over the pool per timing */
+#define NPAGES   8192       /* pages of the scanned file: 32 MB */
+#define SCANS    5          /* scans of the file per timing */
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const char *methods[] = {"software", "crc32 instruction",
+                                 "VPCLMULQDQ folding"};
+
+/* The CRCs of PFcrc32c() computing by "method" and of the software
+   must be the same for every length and alignment. */
+static void check_agree(int method, const char *pool)
+{
+    unsigned int hw, sw;
+    int off, len;
+
+    for (off = 0; off < 8; off++)
+        for (len = 0; len <= 3 * PAGE + 100; len += (len < 300 ? 1 : 37)) {
+            hw = PFcrc32c(off, pool + off, len);
+            sw = PFcrc32cSoft(off, pool + off, len);
+            if (hw != sw) {
+                printf("CRC mismatch, %s: offset %d length %d: "
+                       "%08x vs %08x\n", methods[method], off, len, hw, sw);
+                exit(1);
+            }
+        }
+    /* the check value of CRC-32C */
+    if (PFcrc32c(0, "123456789", 9) != 0xe3069283) {
+        printf("CRC-32C of \"123456789\" is %08x, not e3069283\n",
+               PFcrc32c(0, "123456789", 9));
+        exit(1);
+    }
+}
+
+/* ns per page of "kind": 0 memcpy, 1 PFcrc32c() */
+static double time_pages(int kind, char *pool, char *dst, unsigned int *sink)
+{
+    double t0, t1;
+    unsigned int acc = 0;
+    int r, i;
+
+    t0 = now_ns();
+    for (r = 0; r < ROUNDS; r++)
+        for (i = 0; i < POOL; i++) {
+            char *page = pool + (size_t)i * PAGE;
+
+            if (kind == 0) {
+                memcpy(dst, page, PAGE);
+                acc += (unsigned char)dst[r % PAGE];
+                /* keep the compiler from dropping the copies */
+                __asm__ volatile("" : : "r"(dst) : "memory");
+            } else
+                acc += PFcrc32c(i, page, PAGE - PF_CHECKSUM_SIZE);
+        }
+    t1 = now_ns();
+    *sink += acc;
+    return (t1 - t0) / ((double)ROUNDS * POOL);
+}
+
+/* Write NPAGES pages to a new file with "flags", then scan it SCANS
+   times. Sets the ns per page written and read. */
+static void run_file(int flags, double *writens, double *readns)
+{
+    char *buf;
+    int fd, pagenum, error, s, size;
+    double t0;
+
+    unlink(TESTFILE);
+    if (PF_CreateFileWithOptions(TESTFILE, PAGE, flags) != PFE_OK ||
+        (fd = PF_OpenFile(TESTFILE)) < 0) {
+        PF_PrintError("create " TESTFILE);
+        exit(1);
+    }
+    size = PF_PageSize(fd);
+    t0 = now_ns();
+    for (s = 0; s < NPAGES; s++) {
+        if (PF_AllocPage(fd, &pagenum, &buf) != PFE_OK) {
+            PF_PrintError("alloc");
+            exit(1);
+        }
+        memset(buf, s, size);
+        PF_UnfixPage(fd, pagenum, TRUE);
+    }
+    PF_CloseFile(fd);
+    *writens = (now_ns() - t0) / NPAGES;
+
+    if ((fd = PF_OpenFile(TESTFILE)) < 0) {
+        PF_PrintError("open " TESTFILE);
+        exit(1);
+    }
+    t0 = now_ns();
+    for (s = 0; s < SCANS; s++) {
+        pagenum = -1;
+        while ((error = PF_GetNextPage(fd, &pagenum, &buf)) == PFE_OK)
+            PF_UnfixPage(fd, pagenum, FALSE);
+        if (error != PFE_EOF) {
+            PF_PrintError("scan");
+            exit(1);
+        }
+    }
+    *readns = (now_ns() - t0) / ((double)SCANS * NPAGES);
+    PF_CloseFile(fd);
+    PF_DestroyFile(TESTFILE);
+}
+
+int main()
+{
+    char *pool, *dst;
+    unsigned int sink = 0;
+    double copy, crc, w0, r0, w1, r1;
+    FILE *csv;
+    int best, m, i;
+
+    if ((pool = malloc((size_t)POOL * PAGE)) == NULL ||
+        (dst = malloc(PAGE)) == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    srand(42);
+    for (i = 0; i < POOL * PAGE; i++)
+        pool[i] = rand();
+    best = PFcrc32cSetMethod(-1);
+    for (m = best; m >= PF_CRC_SOFT; m--) {
+        PFcrc32cSetMethod(m);
+        check_agree(m, pool);
+    }
+
+    if ((csv = fopen(CSVFILE, "w")) == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(csv, "test,ns_per_page,relative_to_memcpy\n");
+
+    /* warm up, then time */
+    time_pages(0, pool, dst, &sink);
+    copy = time_pages(0, pool, dst, &sink);
+    printf("Per 4 KB page\n");
+    printf("  memcpy                      : %7.1f ns\n", copy);
+    fprintf(csv, "memcpy,%.1f,1.00\n", copy);
+    for (m = best; m >= PF_CRC_SOFT; m--) {
+        PFcrc32cSetMethod(m);
+        time_pages(1, pool, dst, &sink);
+        crc = time_pages(1, pool, dst, &sink);
+        printf("  CRC-32C, %-18s : %7.1f ns (%.2fx memcpy)\n", methods[m],
+               crc, crc / copy);
+        fprintf(csv, "crc32c %s,%.1f,%.2f\n", methods[m], crc, crc / copy);
+    }
+    PFcrc32cSetMethod(-1);
+
+    PF_InitWithOptions(1024, PF_REPLACEMENT_LRU);
+    run_file(0, &w0, &r0); /* warms the page cache */
+    run_file(0, &w0, &r0);
+    run_file(PF_FILE_CHECKSUM, &w1, &r1);
+    printf("Write and scan of %d pages through the pool (%s)\n", NPAGES,
+           methods[best]);
+    printf("  no checksums                : write %6.0f ns/page"
+           "  scan %6.0f ns/page\n", w0, r0);
+    printf("  checksums                   : write %6.0f ns/page"
+           "  scan %6.0f ns/page\n", w1, r1);
+    fprintf(csv, "file_write,%.1f,\n", w0);
+    fprintf(csv, "file_write_checksum,%.1f,\n", w1);
+    fprintf(csv, "file_scan,%.1f,\n", r0);
+    fprintf(csv, "file_scan_checksum,%.1f,\n", r1);
+
+    if (sink == 0)
+        printf("(no data?)\n");
+    fclose(csv);
+    free(pool);
+    free(dst);
+    printf("Results stored in: %s\n", CSVFILE);
+    return 0;
+}
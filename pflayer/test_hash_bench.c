@@ -0,0 +1,178 @@
+/* test_hash_bench.c: microbenchmark of page table lookups.
+ *
+ * Fills the page table with one entry per buffer frame for pools of
+ * 20, 1000 and 100000 frames, then times random lookups of resident
+ * pages (hits) and of pages that are not in the table (misses).
+ * For comparison the same lookups are run against a copy of the old
+ * 20-bucket chained table.
+ *
+ * Results are printed and written to pf_hash_bench.csv.
+ */
+#include "pf.h"
+#include "pftypes.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CSVFILE "pf_hash_bench.csv"
+
+#define NFILES   8          /* pages are spread over this many files */
+#define LOOKUPS  4000000L   /* lookups per open-addressing run */
+#define CHAINED_WORK 40000000L /* bound on chain entries walked per run */
+
+/* The former chained table: 20 buckets, (fd+page)%20 */
+#define OLD_TBL_SIZE 20
+typedef struct OLDentry {
+    struct OLDentry *next;
+    int fd;
+    int page;
+    PFbpage *bpage;
+} OLDentry;
+static OLDentry *OLDtbl[OLD_TBL_SIZE];
+
+static PFhashtab tab; /* the open-addressing table under test */
+
+static void old_insert(int fd, int page, PFbpage *bpage)
+{
+    OLDentry *e = malloc(sizeof(OLDentry));
+    int b = (fd + page) % OLD_TBL_SIZE;
+
+    e->fd = fd;
+    e->page = page;
+    e->bpage = bpage;
+    e->next = OLDtbl[b];
+    OLDtbl[b] = e;
+}
+
+static PFbpage *old_find(int fd, int page)
+{
+    OLDentry *e;
+
+    for (e = OLDtbl[(fd + page) % OLD_TBL_SIZE]; e != NULL; e = e->next)
+        if (e->fd == fd && e->page == page)
+            return e->bpage;
+    return NULL;
+}
+
+static void old_clear(void)
+{
+    OLDentry *e, *n;
+    int b;
+
+    for (b = 0; b < OLD_TBL_SIZE; b++) {
+        for (e = OLDtbl[b]; e != NULL; e = n) {
+            n = e->next;
+            free(e);
+        }
+        OLDtbl[b] = NULL;
+    }
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Key i of a pool: round-robin over the files, consecutive pages */
+#define KEY_FD(i)   ((i) % NFILES)
+#define KEY_PAGE(i) ((i) / NFILES)
+
+/* Time "ops" lookups of the keys in "keys" (indexes into the key space).
+   Keys >= nframes are misses. Returns ns per lookup. */
+static double time_lookups(int chained, const int *keys, long ops,
+                           uintptr_t *sink)
+{
+    double t0, t1;
+    uintptr_t acc = 0;
+    long i;
+
+    t0 = now_ns();
+    for (i = 0; i < ops; i++) {
+        int k = keys[i];
+        if (chained)
+            acc += (uintptr_t)old_find(KEY_FD(k), KEY_PAGE(k));
+        else
+            acc += (uintptr_t)PFhashFind(&tab, KEY_FD(k), KEY_PAGE(k));
+    }
+    t1 = now_ns();
+    *sink += acc;
+    return (t1 - t0) / ops;
+}
+
+static void run(int nframes, FILE *csv)
+{
+    int *hitkeys, *misskeys;
+    long ops, oldops;
+    uintptr_t sink = 0;
+    double hit, miss, oldhit, oldmiss;
+    int i;
+
+    PFhashInit(&tab, nframes);
+    for (i = 0; i < nframes; i++) {
+        if (PFhashInsert(&tab, KEY_FD(i), KEY_PAGE(i),
+                         (PFbpage *)(uintptr_t)(i + 1)) != PFE_OK) {
+            PF_PrintError("PFhashInsert");
+            exit(1);
+        }
+        old_insert(KEY_FD(i), KEY_PAGE(i), (PFbpage *)(uintptr_t)(i + 1));
+    }
+
+    ops = LOOKUPS;
+    hitkeys = malloc(ops * sizeof(int));
+    misskeys = malloc(ops * sizeof(int));
+    for (i = 0; i < ops; i++) {
+        hitkeys[i] = rand() % nframes;
+        misskeys[i] = nframes + rand() % nframes;
+    }
+
+    /* the chained table walks ~nframes/20 entries per lookup */
+    oldops = CHAINED_WORK / (nframes / OLD_TBL_SIZE + 1);
+    if (oldops > ops)
+        oldops = ops;
+
+    hit = time_lookups(0, hitkeys, ops, &sink);
+    miss = time_lookups(0, misskeys, ops, &sink);
+    oldhit = time_lookups(1, hitkeys, oldops, &sink);
+    oldmiss = time_lookups(1, misskeys, oldops, &sink);
+
+    printf("%8d frames | open addressing: hit %7.1f ns  miss %7.1f ns"
+           " | chained(20): hit %9.1f ns  miss %9.1f ns\n",
+           nframes, hit, miss, oldhit, oldmiss);
+    fprintf(csv, "%d,%.2f,%.2f,%.2f,%.2f\n",
+            nframes, hit, miss, oldhit, oldmiss);
+    fflush(csv);
+
+    if (sink == 0)
+        printf("(no hits?)\n");
+
+    free(hitkeys);
+    free(misskeys);
+    old_clear();
+}
+
+int main()
+{
+    int sizes[] = {20, 1000, 100000};
+    int i;
+    FILE *csv;
+
+    srand(42);
+
+    if ((csv = fopen(CSVFILE, "w")) == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(csv, "frames,hit_ns,miss_ns,chained_hit_ns,chained_miss_ns\n");
+
+    printf("Page table lookup cost (ns per lookup)\n");
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+        run(sizes[i], csv);
+
+    fclose(csv);
+    printf("Results stored in: %s\n", CSVFILE);
+    return 0;
+}
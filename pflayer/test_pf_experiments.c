@@ -7,31 +7,98 @@
 
 #define TESTFILE "pf_auto_testfile.dat"
 #define CSVFILE  "pf_results.csv"
+#define SCANCSVFILE "pf_scan_results.csv"
+#define POLICYCSVFILE "pf_policy_results.csv"
+#define WRITERCSVFILE "pf_writer_results.csv"
 
 /* Number of ops per experiment */
 #define OPS_PER_RUN 50000
 #define MAXPAGE     50
 
-/* Runs one experiment */
-void run_workload(int readPct, int ops, int maxPage, FILE *csv)
+/* Scan + hot-set workload: point lookups on a small hot set, with a
+   full scan of a much larger region every few rounds */
+#define POOL_FRAMES  20
+#define HOT_PAGES    12     /* hot set, fits in the pool */
+#define SCAN_PAGES   200    /* scanned region, 10x the pool */
+#define ROUNDS       400
+#define HOT_PER_ROUND 100   /* hot lookups per round */
+#define SCAN_EVERY   4      /* a scan every SCAN_EVERY rounds */
+
+/* Access patterns for the read/write mixes */
+#define PATTERN_UNIFORM 0   /* every page equally likely */
+#define PATTERN_PHASED  1   /* alternating recency and frequency phases */
+#define PHASE_OPS    2500   /* ops per phase */
+#define LOOP_PAGES   (POOL_FRAMES + 5) /* recency phase: cyclic sweep */
+#define FREQ_HOT     10     /* frequency phase: hot pages... */
+#define FREQ_HOT_PCT 90     /* ...taking this % of the ops */
+#define COMPARE_OPS  20000  /* ops per run of the policy comparison */
+
+/* Background writer: write-heavy mixes with and without it */
+#define WRITER_LOW   25     /* keep 25% of the pool clean... */
+#define WRITER_HIGH  50     /* ...cleaning up to 50% */
+#define WRITER_OPS   20000  /* ops per run */
+
+/* Page for op "i" of a run under "pattern". The phased pattern
+   alternates a sweep round a loop a little bigger than the pool
+   (recency matters, as in an index build) with lookups skewed
+   towards a few hot pages (frequency matters, as in repeated point
+   queries). */
+static int pick_page(int pattern, int i, int maxPage)
+{
+    if (pattern == PATTERN_UNIFORM)
+        return rand() % maxPage;
+    if ((i / PHASE_OPS) % 2 == 0)
+        return i % LOOP_PAGES;
+    if (rand() % 100 < FREQ_HOT_PCT)
+        return maxPage - 1 - rand() % FREQ_HOT;
+    return rand() % maxPage;
+}
+
+/* Runs "ops" random reads and writes on the first "maxPage" pages of
+   file "fd", "readPct" percent of them reads */
+static void do_ops(int fd, int readPct, int ops, int maxPage, int pattern,
+                   int verbose)
 {
-    int fd;
-    int pageNum;
     char *pageBuf;
     int i;
 
-    printf("\n====================================================\n");
-    printf(" Running workload: %d ops | %d%% reads | %d%% writes\n",
-            ops, readPct, 100 - readPct);
-    printf("====================================================\n");
+    for (i = 0; i < ops; i++) {
+        int r = rand() % 100;
+        int target = pick_page(pattern, i, maxPage);
 
-    fflush(stdout);
+        if (r < readPct) {
+            /* READ */
+            if (PF_GetThisPage(fd, target, &pageBuf) != PFE_OK) {
+                PF_PrintError("Read Get");
+                exit(1);
+            }
+            PF_UnfixPage(fd, target, FALSE);
+        } else {
+            /* WRITE */
+            if (PF_GetThisPage(fd, target, &pageBuf) != PFE_OK) {
+                PF_PrintError("Write Get");
+                exit(1);
+            }
+            pageBuf[0] = (char)(target & 0xFF);
+            pageBuf[1] = (char)(i & 0xFF);
+            PF_UnfixPage(fd, target, TRUE);
+        }
 
-    /* Reset PF stats */
-    PFbufferPool.logicalPageRequests = 0;
-    PFbufferPool.logicalPageHits     = 0;
-    PFbufferPool.physicalReads       = 0;
-    PFbufferPool.physicalWrites      = 0;
+        /* Print a dot every 5000 ops for user feedback */
+        if (verbose && i % 5000 == 0) {
+            printf(".");
+            fflush(stdout);
+        }
+    }
+}
+
+/* Creates the test file with "maxPage" zeroed pages and opens it */
+static int make_test_file(int maxPage)
+{
+    int fd;
+    int pageNum;
+    char *pageBuf;
+    int i;
 
     /* Always recreate test file */
     PF_DestroyFile(TESTFILE);
@@ -55,41 +122,33 @@ void run_workload(int readPct, int ops, int maxPage, FILE *csv)
         memset(pageBuf, 0, PF_PAGE_SIZE);
         PF_UnfixPage(fd, pageNum, TRUE);
     }
+    return fd;
+}
 
-    /* Random ops */
-    for (i = 0; i < ops; i++) {
-        int r = rand() % 100;
-        int target = rand() % maxPage;
+/* Runs one experiment */
+void run_workload(int readPct, int ops, int maxPage, FILE *csv)
+{
+    int fd;
 
-        if (r < readPct) {
-            /* READ */
-            if (PF_GetThisPage(fd, target, &pageBuf) != PFE_OK) {
-                PF_PrintError("Read Get");
-                exit(1);
-            }
-            PF_UnfixPage(fd, target, FALSE);
-        } else {
-            /* WRITE */
-            if (PF_GetThisPage(fd, target, &pageBuf) != PFE_OK) {
-                PF_PrintError("Write Get");
-                exit(1);
-            }
-            pageBuf[0] = (char)(target & 0xFF);
-            pageBuf[1] = (char)(i & 0xFF);
-            PF_UnfixPage(fd, target, TRUE);
-        }
+    printf("\n====================================================\n");
+    printf(" Running workload: %d ops | %d%% reads | %d%% writes\n",
+            ops, readPct, 100 - readPct);
+    printf("====================================================\n");
 
-        /* Print a dot every 5000 ops for user feedback */
-        if (i % 5000 == 0) {
-            printf(".");
-            fflush(stdout);
-        }
-    }
+    fflush(stdout);
+
+    /* Reset PF stats */
+    PF_ResetStats();
+
+    fd = make_test_file(maxPage);
+
+    /* Random ops */
+    do_ops(fd, readPct, ops, maxPage, PATTERN_UNIFORM, TRUE);
 
     PF_CloseFile(fd);
 
     printf("\n---- Results for %d%% Reads ----\n", readPct);
-    PF_DumpStats();
+    PF_DumpStats();  /* also brings PFbufferPool up to date */
     printf("-----------------------------------\n");
 
     /* Write CSV row */
@@ -105,13 +164,252 @@ void run_workload(int readPct, int ops, int maxPage, FILE *csv)
     fflush(csv);
 }
 
-int main()
+/* Replacement policies selectable on the command line */
+static struct {
+    const char *name;
+    int policy;
+} policies[] = {
+    {"lru",   PF_REPLACEMENT_LRU},
+    {"mru",   PF_REPLACEMENT_MRU},
+    {"clock", PF_REPLACEMENT_CLOCK},
+    {"2q",    PF_REPLACEMENT_2Q},
+    {"lru2",  PF_REPLACEMENT_LRU2},
+    {"arc",   PF_REPLACEMENT_ARC},
+};
+#define NPOLICIES ((int)(sizeof(policies) / sizeof(policies[0])))
+
+/* Fix and unfix one page, for the scan + hot-set workload */
+static void touch_page(int fd, int page)
+{
+    char *pageBuf;
+
+    if (PF_GetThisPage(fd, page, &pageBuf) != PFE_OK) {
+        PF_PrintError("Touch Get");
+        exit(1);
+    }
+    PF_UnfixPage(fd, page, FALSE);
+}
+
+/* Runs the scan + hot-set workload under policy "p". Pages
+   0..HOT_PAGES-1 of the test file are the hot set (think B+ tree
+   root and internal pages); the rest is scanned in page order, as
+   SP_ScanNext/PF_GetNextPage would. Reports the overall hit ratio and
+   that of the hot lookups alone. */
+static void run_scan_workload(int p, FILE *csv)
+{
+    int fd;
+    int i, round;
+    unsigned long hotReq = 0, hotHits = 0, before;
+    double hitRatio, hotRatio;
+
+    /* Build the file first so that the pool starts out empty */
+    fd = make_test_file(HOT_PAGES + SCAN_PAGES);
+    PF_CloseFile(fd);
+
+    /* Fresh pool and statistics for the policy */
+    PF_InitWithOptions(POOL_FRAMES, policies[p].policy);
+    if ((fd = PF_OpenFile(TESTFILE)) < 0) {
+        PF_PrintError("OpenFile");
+        exit(1);
+    }
+
+    srand(7);
+    for (round = 0; round < ROUNDS; round++) {
+        if (round % SCAN_EVERY == SCAN_EVERY - 1)
+            for (i = 0; i < SCAN_PAGES; i++)
+                touch_page(fd, HOT_PAGES + i);
+
+        PF_CollectStats();
+        before = PFbufferPool.logicalPageHits;
+        for (i = 0; i < HOT_PER_ROUND; i++)
+            touch_page(fd, rand() % HOT_PAGES);
+        hotReq += HOT_PER_ROUND;
+        PF_CollectStats();
+        hotHits += PFbufferPool.logicalPageHits - before;
+    }
+    PF_CloseFile(fd);
+    PF_CollectStats();
+
+    hitRatio = 100.0 * PFbufferPool.logicalPageHits /
+               PFbufferPool.logicalPageRequests;
+    hotRatio = 100.0 * hotHits / hotReq;
+    printf("  %-6s | requests %7lu | hit ratio %6.2f%% | hot-set hit ratio"
+           " %6.2f%% | reads %6lu\n",
+           policies[p].name, PFbufferPool.logicalPageRequests, hitRatio,
+           hotRatio, PFbufferPool.physicalReads);
+    fprintf(csv, "%s,%lu,%lu,%.2f,%lu,%lu,%.2f,%lu\n", policies[p].name,
+            PFbufferPool.logicalPageRequests, PFbufferPool.logicalPageHits,
+            hitRatio, hotReq, hotHits, hotRatio, PFbufferPool.physicalReads);
+    fflush(csv);
+}
+
+/* Runs the read/write mix "readPct" under "pattern" and policy "p"
+   on a fresh pool, and prints its hit ratio and physical I/O count */
+static void run_mix(int p, int readPct, int pattern, FILE *csv)
+{
+    int fd;
+    double hitRatio;
+
+    /* Build the file first so that the pool starts out empty */
+    fd = make_test_file(MAXPAGE);
+    PF_CloseFile(fd);
+
+    PF_InitWithOptions(POOL_FRAMES, policies[p].policy);
+    if ((fd = PF_OpenFile(TESTFILE)) < 0) {
+        PF_PrintError("OpenFile");
+        exit(1);
+    }
+    srand(11);
+    do_ops(fd, readPct, COMPARE_OPS, MAXPAGE, pattern, FALSE);
+    PF_CloseFile(fd);
+    PF_CollectStats();
+
+    hitRatio = 100.0 * PFbufferPool.logicalPageHits /
+               PFbufferPool.logicalPageRequests;
+    fprintf(csv, "%s,%s,%d,%lu,%lu,%.2f,%lu,%lu,%d\n",
+            pattern == PATTERN_UNIFORM ? "uniform" : "phased",
+            policies[p].name, readPct, PFbufferPool.logicalPageRequests,
+            PFbufferPool.logicalPageHits, hitRatio,
+            PFbufferPool.physicalReads, PFbufferPool.physicalWrites,
+            PFbufferPool.arcTarget);
+    printf(" %6.2f/%-6lu", hitRatio,
+           PFbufferPool.physicalReads + PFbufferPool.physicalWrites);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Runs the read/write mix "readPct" under policy "p" on a fresh
+   pool, with the background writer if "writer" is TRUE, and prints
+   the time per op and how many misses had to write their victim */
+static void run_writer_mix(int p, int readPct, int writer, FILE *csv)
+{
+    int fd;
+    double t0, usPerOp;
+
+    fd = make_test_file(MAXPAGE);
+    PF_CloseFile(fd);
+
+    PF_InitWithOptions(POOL_FRAMES, policies[p].policy);
+    if ((fd = PF_OpenFile(TESTFILE)) < 0) {
+        PF_PrintError("OpenFile");
+        exit(1);
+    }
+    if (writer && PF_StartWriter(WRITER_LOW, WRITER_HIGH) != PFE_OK) {
+        PF_PrintError("StartWriter");
+        exit(1);
+    }
+    srand(13);
+    t0 = now_sec();
+    do_ops(fd, readPct, WRITER_OPS, MAXPAGE, PATTERN_UNIFORM, FALSE);
+    usPerOp = (now_sec() - t0) * 1e6 / WRITER_OPS;
+    PF_StopWriter();
+    PF_CloseFile(fd);
+    PF_CollectStats();
+
+    printf(" | %6.2f us/op  dirty evictions %5lu  background writes %5lu",
+           usPerOp, PFbufferPool.dirtyEvictions, PFbufferPool.writerWrites);
+    fprintf(csv, "%s,%d,%s,%.3f,%lu,%lu,%lu,%lu\n", policies[p].name,
+            readPct, writer ? "on" : "off", usPerOp,
+            PFbufferPool.physicalReads, PFbufferPool.physicalWrites,
+            PFbufferPool.dirtyEvictions, PFbufferPool.writerWrites);
+    fflush(csv);
+}
+
+/* The write-heavy mixes under policy "p", without and with the
+   background writer */
+static int compare_writer(int p)
+{
+    int percentages[] = {30, 20, 10, 0};
+    FILE *csv;
+    int i;
+
+    if ((csv = fopen(WRITERCSVFILE, "w")) == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(csv, "policy,readPct,writer,usPerOp,physicalReads,"
+                 "physicalWrites,dirtyEvictions,writerWrites\n");
+
+    printf("\n====================================================\n");
+    printf(" Background writer (%s): %d frames, %d ops, clean\n"
+           " %d%% of the pool when less than %d%% is\n",
+           policies[p].name, POOL_FRAMES, WRITER_OPS, WRITER_HIGH,
+           WRITER_LOW);
+    printf("====================================================\n");
+    for (i = 0; i < 4; i++) {
+        printf("  %3d%% reads, writer off", percentages[i]);
+        run_writer_mix(p, percentages[i], FALSE, csv);
+        printf("\n  %3d%% reads, writer on ", percentages[i]);
+        run_writer_mix(p, percentages[i], TRUE, csv);
+        printf("\n");
+    }
+    fclose(csv);
+    return 0;
+}
+
+/* Hit ratio of every policy over the read/write mixes, for both
+   access patterns */
+static int compare_policies(const int *percentages, int npct)
+{
+    FILE *csv;
+    int pattern, i, p;
+
+    if ((csv = fopen(POLICYCSVFILE, "w")) == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(csv, "pattern,policy,readPct,logicalReq,hits,hitRatio,"
+                 "physicalReads,physicalWrites,arcTarget\n");
+
+    for (pattern = PATTERN_UNIFORM; pattern <= PATTERN_PHASED; pattern++) {
+        printf("\n====================================================\n");
+        printf(" Hit ratio (%%) / physical I/Os by policy, %s access,\n"
+               " %d frames, %d ops\n",
+               pattern == PATTERN_UNIFORM ? "uniform" : "phased",
+               POOL_FRAMES, COMPARE_OPS);
+        printf("====================================================\n");
+        printf("  read%%");
+        for (p = 0; p < NPOLICIES; p++)
+            printf(" %-13s", policies[p].name);
+        printf("\n");
+        for (i = 0; i < npct; i++) {
+            printf("  %5d", percentages[i]);
+            for (p = 0; p < NPOLICIES; p++)
+                run_mix(p, percentages[i], pattern, csv);
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+    fclose(csv);
+    return 0;
+}
+
+int main(int argc, char *argv[])
 {
+    int policy = 0;
+
     srand(time(NULL));
 
-    printf("Initializing PF System...\n");
+    if (argc > 1) {
+        for (policy = 0; policy < NPOLICIES; policy++)
+            if (strcmp(argv[1], policies[policy].name) == 0)
+                break;
+        if (policy == NPOLICIES) {
+            fprintf(stderr, "usage: %s [lru|mru|clock|2q|lru2|arc]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    printf("Initializing PF System (%s)...\n", policies[policy].name);
     PF_Init();
-    PF_InitWithOptions(20, PF_REPLACEMENT_LRU);  /* 20 frames, LRU */
+    PF_InitWithOptions(20, policies[policy].policy);  /* 20 frames */
 
     FILE *csv = fopen(CSVFILE, "w");
     if (!csv) {
@@ -131,9 +429,34 @@ int main()
 
     fclose(csv);
 
+    /* Scan + hot-set workload under every policy */
+    printf("\n====================================================\n");
+    printf(" Scan + hot-set workload: %d frames, %d hot pages,\n"
+           " scan of %d pages every %d rounds of %d hot lookups\n",
+           POOL_FRAMES, HOT_PAGES, SCAN_PAGES, SCAN_EVERY, HOT_PER_ROUND);
+    printf("====================================================\n");
+    if ((csv = fopen(SCANCSVFILE, "w")) == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(csv, "policy,logicalReq,hits,hitRatio,hotReq,hotHits,"
+                 "hotHitRatio,physicalReads\n");
+    for (int p = 0; p < NPOLICIES; p++)
+        run_scan_workload(p, csv);
+    fclose(csv);
+
+    /* Every policy over the read/write mixes */
+    if (compare_policies(percentages, 11) != 0)
+        return 1;
+
+    /* Write-heavy mixes with and without the background writer */
+    if (compare_writer(policy) != 0)
+        return 1;
+
     printf("\n====================================================\n");
     printf(" All experiments completed.\n");
-    printf(" Results stored in: %s\n", CSVFILE);
+    printf(" Results stored in: %s, %s, %s, %s\n", CSVFILE, SCANCSVFILE,
+           POLICYCSVFILE, WRITERCSVFILE);
     printf("====================================================\n\n");
 
     return 0;
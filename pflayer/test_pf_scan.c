@@ -0,0 +1,307 @@
+/* test_pf_scan.c: sequential scan benchmark, with and without
+ * read-ahead, and with pages read synchronously or asynchronously.
+ *
+ * Two files are scanned from a cold buffer pool much smaller than
+ * either:
+ *   pf: a paged file of NPAGES pages, each holding its own page
+ *       number, read with PF_GetFirstPage()/PF_GetNextPage();
+ *   sp: a slotted-page file of SP_RECORDS records, read with
+ *       SP_ScanNext().
+ * The paged file is also scanned as "direct", opened with
+ * PF_OpenFileDirect() so that its pages bypass the kernel page cache.
+ * Each scan is run with read-ahead off (one read call per page) and
+ * on, under LRU and under CLOCK, and reports pages per second and the
+ * read calls made. Read-ahead is run with the reads done by the
+ * scanning thread, through an io_uring and through the I/O threads
+ * (see PF_StartAsyncIO()). Every page of the pf scan is checked to
+ * hold its own number, and the sp scan must return every record.
+ *
+ * Then random pages of the paged file are fixed in batches of BATCH,
+ * with and without PF_PrefetchPages() of the batch first, as an
+ * index lookup that knows the pages it needs would.
+ *
+ * Results are printed and written to pf_readahead_results.csv.
+ */
+#include "pf.h"
+#include "pftypes.h"
+#include "splayer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PFFILE  "pf_scan_testfile.dat"
+#define SPFILE  "sp_scan_testfile.dat"
+#define CSVFILE "pf_readahead_results.csv"
+
+#define NPAGES     4096    /* pages in the paged file */
+#define SP_RECORDS 16000   /* records in the slotted-page file */
+#define SP_RECLEN  96      /* bytes per record */
+#define POOL       128     /* buffer pool size for the scans */
+#define ROUNDS     5       /* scans per run; the best is reported */
+#define BATCH      32      /* pages per batch of random fixes */
+#define NBATCHES   128     /* batches per random run */
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Builds the paged file: page i holds the number i */
+static void make_pf_file(void)
+{
+    char *buf;
+    int fd, pagenum, i;
+
+    PF_DestroyFile(PFFILE);
+    if (PF_CreateFile(PFFILE) != PFE_OK) {
+        PF_PrintError("CreateFile");
+        exit(1);
+    }
+    if ((fd = PF_OpenFile(PFFILE)) < 0) {
+        PF_PrintError("OpenFile");
+        exit(1);
+    }
+    for (i = 0; i < NPAGES; i++) {
+        if (PF_AllocPage(fd, &pagenum, &buf) != PFE_OK) {
+            PF_PrintError("AllocPage");
+            exit(1);
+        }
+        memcpy(buf, &pagenum, sizeof(int));
+        if (PF_UnfixPage(fd, pagenum, TRUE) != PFE_OK) {
+            PF_PrintError("UnfixPage");
+            exit(1);
+        }
+    }
+    if (PF_CloseFile(fd) != PFE_OK) {
+        PF_PrintError("CloseFile");
+        exit(1);
+    }
+}
+
+/* Builds the slotted-page file of SP_RECORDS records */
+static void make_sp_file(void)
+{
+    char rec[SP_RECLEN];
+    SP_RecId rid;
+    int fd, i;
+
+    SP_DestroyFile(SPFILE);
+    if (SP_CreateFile(SPFILE) != PFE_OK ||
+        (fd = SP_OpenFile(SPFILE)) < 0) {
+        printf("cannot create %s\n", SPFILE);
+        exit(1);
+    }
+    for (i = 0; i < SP_RECORDS; i++) {
+        memset(rec, 'a' + i % 26, sizeof(rec));
+        memcpy(rec, &i, sizeof(int));
+        if (SP_InsertRecord(fd, rec, sizeof(rec), &rid) != 0) {
+            printf("SP_InsertRecord failed for record %d\n", i);
+            exit(1);
+        }
+    }
+    SP_CloseFile(fd);
+}
+
+/* Scans the paged file once, with O_DIRECT if "direct" is TRUE;
+   returns the # of pages read */
+static int scan_pf(int direct)
+{
+    char *buf;
+    int fd, pagenum, stored, error;
+    int pages = 0;
+
+    if ((fd = direct ? PF_OpenFileDirect(PFFILE) : PF_OpenFile(PFFILE)) < 0) {
+        PF_PrintError("OpenFile");
+        exit(1);
+    }
+    pagenum = -1;
+    while ((error = PF_GetNextPage(fd, &pagenum, &buf)) == PFE_OK) {
+        memcpy(&stored, buf, sizeof(int));
+        if (stored != pagenum) {
+            printf("page %d holds %d\n", pagenum, stored);
+            exit(1);
+        }
+        pages++;
+        if (PF_UnfixPage(fd, pagenum, FALSE) != PFE_OK) {
+            PF_PrintError("UnfixPage");
+            exit(1);
+        }
+    }
+    if (error != PFE_EOF) {
+        PF_PrintError("GetNextPage");
+        exit(1);
+    }
+    PF_CloseFile(fd);
+    return pages;
+}
+
+/* Scans the slotted-page file once; returns the # of pages read */
+static int scan_sp(void)
+{
+    SP_Scan scan;
+    SP_RecId rid;
+    char *rec;
+    int fd, len, lastpage = -1;
+    int pages = 0, records = 0;
+
+    if ((fd = SP_OpenFile(SPFILE)) < 0) {
+        printf("cannot open %s\n", SPFILE);
+        exit(1);
+    }
+    SP_ScanInit(&scan, fd);
+    while (SP_ScanNext(&scan, &rec, &len, &rid) == 0) {
+        records++;
+        if (scan.curPageNum != lastpage) {
+            lastpage = scan.curPageNum;
+            pages++;
+        }
+    }
+    SP_ScanClose(&scan);
+    SP_CloseFile(fd);
+    if (records != SP_RECORDS) {
+        printf("sp scan returned %d of %d records\n", records, SP_RECORDS);
+        exit(1);
+    }
+    return pages;
+}
+
+/* Fixes NBATCHES batches of BATCH random pages of the paged file,
+   each batch prefetched first if "prefetch" is TRUE; returns the # of
+   pages fixed */
+static int fix_random(int prefetch)
+{
+    int batch[BATCH];
+    unsigned int seed = 42;
+    char *buf;
+    int fd, stored, b, i;
+
+    if ((fd = PF_OpenFile(PFFILE)) < 0) {
+        PF_PrintError("OpenFile");
+        exit(1);
+    }
+    for (b = 0; b < NBATCHES; b++) {
+        for (i = 0; i < BATCH; i++)
+            batch[i] = rand_r(&seed) % NPAGES;
+        if (prefetch && PF_PrefetchPages(fd, batch, BATCH) < 0) {
+            PF_PrintError("PrefetchPages");
+            exit(1);
+        }
+        for (i = 0; i < BATCH; i++) {
+            if (PF_GetThisPage(fd, batch[i], &buf) != PFE_OK) {
+                PF_PrintError("GetThisPage");
+                exit(1);
+            }
+            memcpy(&stored, buf, sizeof(int));
+            if (stored != batch[i]) {
+                printf("page %d holds %d\n", batch[i], stored);
+                exit(1);
+            }
+            if (PF_UnfixPage(fd, batch[i], FALSE) != PFE_OK) {
+                PF_PrintError("UnfixPage");
+                exit(1);
+            }
+        }
+    }
+    PF_CloseFile(fd);
+    return NBATCHES * BATCH;
+}
+
+/* Runs ROUNDS passes of a workload under "policy", each from a fresh
+   pool, and prints the fastest. "load" is "pf", "direct" or "sp" for a scan
+   with read-ahead "ra" pages (0: off), or "random" for random fixes,
+   prefetched if "ra" is not 0. Reads go through the "async" backend */
+static void run(const char *load, int policy, int ra, int async, FILE *csv)
+{
+    const char *pname = policy == PF_REPLACEMENT_CLOCK ? "clock" : "lru";
+    const char *aname;
+    double t0, secs, best = 0;
+    unsigned long readCalls = 0, physicalReads = 0, ioWaits = 0;
+    int pages = 0, r;
+
+    if (PF_SetReadAhead(strcmp(load, "random") == 0 ? 0 : ra) != PFE_OK) {
+        PF_PrintError("SetReadAhead");
+        exit(1);
+    }
+    if (async != PF_ASYNC_NONE && (async = PF_StartAsyncIO(async)) < 0) {
+        PF_PrintError("StartAsyncIO");
+        exit(1);
+    }
+    aname = async == PF_ASYNC_URING     ? "io_uring"
+            : async == PF_ASYNC_THREADS ? "threads"
+                                        : "sync";
+    for (r = 0; r < ROUNDS; r++) {
+        PF_InitWithOptions(POOL, policy);
+        PF_ResetStats();
+        t0 = now_sec();
+        if (strcmp(load, "random") == 0)
+            pages = fix_random(ra != 0);
+        else if (strcmp(load, "sp") == 0)
+            pages = scan_sp();
+        else
+            pages = scan_pf(strcmp(load, "direct") == 0);
+        secs = now_sec() - t0;
+        if (r == 0 || secs < best)
+            best = secs;
+        PF_CollectStats();
+        readCalls = PFbufferPool.readCalls;
+        physicalReads = PFbufferPool.physicalReads;
+        ioWaits = PFbufferPool.ioWaits;
+    }
+    PF_StopAsyncIO();
+
+    printf("  %-6s | %-5s | read-ahead %2d | %-8s | %5d pages |"
+           " %10.0f pages/s | read calls %5lu | pages read %5lu"
+           " | waits %4lu\n",
+           load, pname, ra, aname, pages, pages / best, readCalls,
+           physicalReads, ioWaits);
+    fprintf(csv, "%s,%s,%d,%s,%d,%.0f,%lu,%lu,%lu\n", load, pname, ra,
+            aname, pages, pages / best, readCalls, physicalReads, ioWaits);
+    fflush(csv);
+}
+
+int main()
+{
+    int policies[] = {PF_REPLACEMENT_LRU, PF_REPLACEMENT_CLOCK};
+    const char *files[] = {"pf", "direct", "sp"};
+    int f, p;
+    FILE *csv;
+
+    PF_Init();
+    make_pf_file();
+    make_sp_file();
+
+    if ((csv = fopen(CSVFILE, "w")) == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(csv, "workload,policy,readAhead,asyncIO,pages,pagesPerSec,"
+                 "readCalls,physicalReads,ioWaits\n");
+
+    printf("Sequential scans, %d-page pool\n", POOL);
+    for (f = 0; f < 3; f++)
+        for (p = 0; p < 2; p++) {
+            run(files[f], policies[p], 0, PF_ASYNC_NONE, csv);
+            run(files[f], policies[p], PF_READ_AHEAD_MAX, PF_ASYNC_NONE,
+                csv);
+            run(files[f], policies[p], PF_READ_AHEAD_MAX, PF_ASYNC_URING,
+                csv);
+            run(files[f], policies[p], PF_READ_AHEAD_MAX, PF_ASYNC_THREADS,
+                csv);
+        }
+
+    printf("Random fixes in batches of %d, %d-page pool\n", BATCH, POOL);
+    run("random", PF_REPLACEMENT_LRU, 0, PF_ASYNC_NONE, csv);
+    run("random", PF_REPLACEMENT_LRU, BATCH, PF_ASYNC_NONE, csv);
+    run("random", PF_REPLACEMENT_LRU, BATCH, PF_ASYNC_URING, csv);
+    run("random", PF_REPLACEMENT_LRU, BATCH, PF_ASYNC_THREADS, csv);
+
+    fclose(csv);
+    PF_DestroyFile(PFFILE);
+    SP_DestroyFile(SPFILE);
+    printf("Results stored in: %s\n", CSVFILE);
+    return 0;
+}
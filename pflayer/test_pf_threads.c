@@ -0,0 +1,210 @@
+/* test_pf_threads.c: multi-threaded read benchmark of the buffer pool.
+ *
+ * A file is built whose pages each hold their own page number. Then
+ * 1, 2, 4, 8 and 16 threads fix and unfix pages of it, with the pool
+ * in one partition and in 16. Three workloads are run:
+ *   hit:  random pages; the pool is bigger than the file and warmed
+ *         first, so every request is a hit and only the latches are
+ *         measured;
+ *   miss: random pages; the pool holds a quarter of the file, so most
+ *         requests page something out and read from the file;
+ *   root: every thread fixes page 0 over and over, as every lookup
+ *         in a B+ tree fixes its root.
+ * Each is run under LRU, whose hits take the partition latch, and
+ * under CLOCK, whose hits take no latch.
+ * Every page fixed is checked to hold its own number.
+ *
+ * Results are printed and written to pf_thread_results.csv.
+ */
+#include "pf.h"
+#include "pftypes.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TESTFILE "pf_thread_testfile.dat"
+#define CSVFILE  "pf_thread_results.csv"
+
+#define NPAGES       512     /* pages in the file */
+#define HIT_POOL     (2 * NPAGES) /* room for every page in any partition */
+#define MISS_POOL    (NPAGES / 4)
+#define HIT_OPS      200000  /* fixes per thread, hit workload */
+#define MISS_OPS     20000   /* fixes per thread, miss workload */
+#define ROOT_OPS     200000  /* fixes per thread, root workload */
+#define MAX_THREADS  16
+
+typedef struct {
+    int fd;
+    int ops;
+    int root;               /* TRUE: fix page 0 only */
+    unsigned int seed;
+} worker_arg;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Builds the file: page i holds the number i */
+static void make_test_file(void)
+{
+    char *buf;
+    int fd, pagenum, i;
+
+    PF_DestroyFile(TESTFILE);
+    if (PF_CreateFile(TESTFILE) != PFE_OK) {
+        PF_PrintError("CreateFile");
+        exit(1);
+    }
+    if ((fd = PF_OpenFile(TESTFILE)) < 0) {
+        PF_PrintError("OpenFile");
+        exit(1);
+    }
+    for (i = 0; i < NPAGES; i++) {
+        if (PF_AllocPage(fd, &pagenum, &buf) != PFE_OK) {
+            PF_PrintError("AllocPage");
+            exit(1);
+        }
+        memcpy(buf, &pagenum, sizeof(int));
+        if (PF_UnfixPage(fd, pagenum, TRUE) != PFE_OK) {
+            PF_PrintError("UnfixPage");
+            exit(1);
+        }
+    }
+    if (PF_CloseFile(fd) != PFE_OK) {
+        PF_PrintError("CloseFile");
+        exit(1);
+    }
+}
+
+/* Fixes "ops" random pages one after another, checking each */
+static void *worker(void *p)
+{
+    worker_arg *arg = p;
+    char *buf;
+    int i, page, stored;
+
+    for (i = 0; i < arg->ops; i++) {
+        page = arg->root ? 0 : rand_r(&arg->seed) % NPAGES;
+        if (PF_GetThisPage(arg->fd, page, &buf) != PFE_OK) {
+            PF_PrintError("GetThisPage");
+            exit(1);
+        }
+        memcpy(&stored, buf, sizeof(int));
+        if (stored != page) {
+            printf("page %d holds %d\n", page, stored);
+            exit(1);
+        }
+        if (PF_UnfixPage(arg->fd, page, FALSE) != PFE_OK) {
+            PF_PrintError("UnfixPage");
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+/* Runs "nthreads" workers against a fresh pool of "pool" pages in
+   "nparts" partitions under "policy", and prints the throughput */
+static void run(const char *load, int policy, int pool, int ops,
+                int nthreads, int nparts, FILE *csv)
+{
+    const char *pname = policy == PF_REPLACEMENT_CLOCK ? "clock" : "lru";
+    pthread_t tid[MAX_THREADS];
+    worker_arg arg[MAX_THREADS];
+    char *buf;
+    double t0, secs, rate, hitRatio;
+    int fd, i;
+
+    PF_InitPartitioned(pool, policy, nparts);
+    if ((fd = PF_OpenFile(TESTFILE)) < 0) {
+        PF_PrintError("OpenFile");
+        exit(1);
+    }
+
+    /* warm the pool */
+    for (i = 0; i < NPAGES; i++) {
+        if (PF_GetThisPage(fd, i, &buf) != PFE_OK) {
+            PF_PrintError("GetThisPage");
+            exit(1);
+        }
+        PF_UnfixPage(fd, i, FALSE);
+    }
+    PF_ResetStats();
+
+    t0 = now_sec();
+    for (i = 0; i < nthreads; i++) {
+        arg[i].fd = fd;
+        arg[i].ops = ops;
+        arg[i].root = strcmp(load, "root") == 0;
+        arg[i].seed = 1000 + i;
+        if (pthread_create(&tid[i], NULL, worker, &arg[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tid[i], NULL);
+    secs = now_sec() - t0;
+
+    PF_CollectStats();
+    rate = (double)nthreads * ops / secs;
+    hitRatio = 100.0 * PFbufferPool.logicalPageHits /
+               PFbufferPool.logicalPageRequests;
+    printf("  %-4s | %-5s | %2d threads | %2d partitions | %10.0f ops/s"
+           " | hit ratio %6.2f%% | reads %7lu\n",
+           load, pname, nthreads, nparts, rate, hitRatio,
+           PFbufferPool.physicalReads);
+    fprintf(csv, "%s,%s,%d,%d,%d,%.0f,%lu,%lu,%lu\n", load, pname, nthreads,
+            nparts, pool, rate, PFbufferPool.logicalPageRequests,
+            PFbufferPool.logicalPageHits, PFbufferPool.physicalReads);
+    fflush(csv);
+
+    if (PF_CloseFile(fd) != PFE_OK) {
+        PF_PrintError("CloseFile");
+        exit(1);
+    }
+}
+
+int main()
+{
+    int threads[] = {1, 2, 4, 8, 16};
+    int parts[] = {1, 16};
+    int policies[] = {PF_REPLACEMENT_LRU, PF_REPLACEMENT_CLOCK};
+    int t, p, k;
+    FILE *csv;
+
+    PF_Init();
+    make_test_file();
+
+    if ((csv = fopen(CSVFILE, "w")) == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(csv, "workload,policy,threads,partitions,poolSize,opsPerSec,"
+                 "logicalRequests,logicalHits,physicalReads\n");
+
+    printf("Concurrent page fixes (%d-page file)\n", NPAGES);
+    for (k = 0; k < 2; k++)
+        for (p = 0; p < 2; p++)
+            for (t = 0; t < 5; t++)
+                run("hit", policies[k], HIT_POOL, HIT_OPS, threads[t],
+                    parts[p], csv);
+    for (k = 0; k < 2; k++)
+        for (p = 0; p < 2; p++)
+            for (t = 0; t < 5; t++)
+                run("miss", policies[k], MISS_POOL, MISS_OPS, threads[t],
+                    parts[p], csv);
+    for (k = 0; k < 2; k++)
+        for (t = 0; t < 5; t++)
+            run("root", policies[k], HIT_POOL, ROOT_OPS, threads[t], 1, csv);
+
+    fclose(csv);
+    PF_DestroyFile(TESTFILE);
+    printf("Results stored in: %s\n", CSVFILE);
+    return 0;
+}
@@ -0,0 +1,228 @@
+/* test_sp_compress.c: compressed slotted-page files against plain ones.
+ *
+ * The records of student.txt are loaded into two slotted-page files,
+ * one made with PF_FILE_COMPRESS and one without, and each is then
+ * scanned from a buffer pool much smaller than it, as a full table
+ * scan would:
+ *   warm: the file is in the kernel's page cache, so a scan costs
+ *         the copies and, if compressed, decompressing the pages;
+ *   cold: the file is dropped from the page cache before each scan
+ *         (posix_fadvise() DONTNEED), so every byte comes from disk.
+ * Scans are run with read-ahead, with the reads done by the scanning
+ * thread and through an io_uring (see PF_StartAsyncIO()), and must
+ * return every record. For each file the size on disk, the ratio of
+ * the plain file's size to its own, the load time and the scan
+ * throughput in pages and records per second, and the read calls the
+ * scan made, are reported.
+ *
+ * Results are printed and written to sp_compress_results.csv.
+ */
+#include "pf.h"
+#include "pftypes.h"
+#include "splayer.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STUDENT_FILE "student.txt"
+#define PLAINFILE    "sp_plain_testfile.dat"
+#define ZFILE        "sp_compress_testfile.dat"
+#define CSVFILE      "sp_compress_results.csv"
+
+#define MAX_LINE_LEN 4096
+#define POOL         32      /* buffer pool size for the scans */
+#define ROUNDS       5       /* scans per run; the best is reported */
+
+static long nrecords;        /* records in student.txt */
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long file_size(const char *fname)
+{
+    struct stat st;
+
+    return stat(fname, &st) == 0 ? (long)st.st_size : -1;
+}
+
+/* Drops "fname" from the kernel's page cache */
+static void drop_cache(const char *fname)
+{
+    int fd;
+
+    if ((fd = open(fname, O_RDONLY)) < 0) {
+        perror(fname);
+        exit(1);
+    }
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+/* Loads student.txt into a new slotted-page file "fname", made with
+   "flags"; returns the seconds it took */
+static double load(const char *fname, int flags)
+{
+    char line[MAX_LINE_LEN];
+    SP_RecId rid;
+    FILE *sf;
+    double t0;
+    size_t len;
+    int fd;
+
+    if ((sf = fopen(STUDENT_FILE, "r")) == NULL) {
+        perror(STUDENT_FILE);
+        exit(1);
+    }
+    SP_DestroyFile(fname);
+    if (SP_CreateFileWithOptions(fname, PF_PAGE_SIZE, flags) != PFE_OK ||
+        (fd = SP_OpenFile(fname)) < 0) {
+        PF_PrintError("create");
+        exit(1);
+    }
+    PF_InitWithOptions(POOL, PF_REPLACEMENT_LRU);
+    t0 = now_sec();
+    nrecords = 0;
+    while (fgets(line, sizeof(line), sf) != NULL) {
+        len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = 0;
+        if (len == 0)
+            continue;
+        if (SP_InsertRecord(fd, line, (int)len, &rid) != 0) {
+            printf("SP_InsertRecord failed for record %ld\n", nrecords);
+            exit(1);
+        }
+        nrecords++;
+    }
+    if (SP_CloseFile(fd) != PFE_OK) {
+        PF_PrintError("close");
+        exit(1);
+    }
+    fclose(sf);
+    return now_sec() - t0;
+}
+
+/* Scans "fname" once; returns the # of pages read */
+static int scan(const char *fname)
+{
+    SP_Scan sc;
+    SP_RecId rid;
+    char *rec;
+    int fd, len, lastpage = -1;
+    int pages = 0;
+    long records = 0;
+
+    if ((fd = SP_OpenFile(fname)) < 0) {
+        PF_PrintError("open");
+        exit(1);
+    }
+    SP_ScanInit(&sc, fd);
+    while (SP_ScanNext(&sc, &rec, &len, &rid) == 0) {
+        records++;
+        if (sc.curPageNum != lastpage) {
+            lastpage = sc.curPageNum;
+            pages++;
+        }
+    }
+    SP_ScanClose(&sc);
+    SP_CloseFile(fd);
+    if (records != nrecords) {
+        printf("scan of %s returned %ld of %ld records\n", fname, records,
+               nrecords);
+        exit(1);
+    }
+    return pages;
+}
+
+/* Runs ROUNDS scans of "fname", from the page cache unless "cold",
+   with the reads of the "async" backend, and prints the fastest */
+static void run(const char *name, const char *fname, long plainsize,
+                double loadsecs, int cold, int async, FILE *csv)
+{
+    const char *aname;
+    double t0, secs, best = 0;
+    unsigned long readCalls = 0;
+    int pages = 0, r;
+    long size = file_size(fname);
+
+    if (async != PF_ASYNC_NONE && (async = PF_StartAsyncIO(async)) < 0) {
+        PF_PrintError("StartAsyncIO");
+        exit(1);
+    }
+    aname = async == PF_ASYNC_URING     ? "io_uring"
+            : async == PF_ASYNC_THREADS ? "threads"
+                                        : "sync";
+    PF_SetReadAhead(PF_READ_AHEAD_MAX);
+    for (r = 0; r < ROUNDS; r++) {
+        PF_InitWithOptions(POOL, PF_REPLACEMENT_LRU);
+        if (cold)
+            drop_cache(fname);
+        t0 = now_sec();
+        pages = scan(fname);
+        secs = now_sec() - t0;
+        if (r == 0 || secs < best)
+            best = secs;
+        PF_CollectStats();
+        readCalls = PFbufferPool.readCalls;
+    }
+    PF_StopAsyncIO();
+
+    printf("  %-10s | %-4s | %-8s | %4d pages | %8ld bytes | ratio %5.2f |"
+           " load %6.3f s | %9.0f pages/s | %10.0f records/s |"
+           " read calls %4lu\n",
+           name, cold ? "cold" : "warm", aname, pages, size,
+           (double)plainsize / size, loadsecs, pages / best,
+           nrecords / best, readCalls);
+    fprintf(csv, "%s,%s,%s,%d,%ld,%.2f,%.3f,%.0f,%.0f,%lu\n", name,
+            cold ? "cold" : "warm", aname, pages, size,
+            (double)plainsize / size, loadsecs, pages / best,
+            nrecords / best, readCalls);
+    fflush(csv);
+}
+
+int main()
+{
+    double plainload, zload;
+    long plainsize;
+    int cold;
+    FILE *csv;
+
+    PF_Init();
+    plainload = load(PLAINFILE, 0);
+    zload = load(ZFILE, PF_FILE_COMPRESS);
+    plainsize = file_size(PLAINFILE);
+
+    if ((csv = fopen(CSVFILE, "w")) == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(csv, "format,cache,asyncIO,pages,fileBytes,ratio,loadSecs,"
+                 "pagesPerSec,recordsPerSec,readCalls\n");
+
+    printf("Scans of %ld student records, %d-page pool\n", nrecords, POOL);
+    for (cold = 0; cold < 2; cold++) {
+        run("plain", PLAINFILE, plainsize, plainload, cold, PF_ASYNC_NONE,
+            csv);
+        run("compressed", ZFILE, plainsize, zload, cold, PF_ASYNC_NONE, csv);
+        run("plain", PLAINFILE, plainsize, plainload, cold, PF_ASYNC_URING,
+            csv);
+        run("compressed", ZFILE, plainsize, zload, cold, PF_ASYNC_URING,
+            csv);
+    }
+
+    fclose(csv);
+    SP_DestroyFile(PLAINFILE);
+    SP_DestroyFile(ZFILE);
+    printf("Results stored in: %s\n", CSVFILE);
+    return 0;
+}
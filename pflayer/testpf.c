@@ -1,20 +1,39 @@
 /* testpf.c */
 #include "pf.h"
 #include "pftypes.h"
+#include <dirent.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #define FILE1 "file1"
 #define FILE2 "file2"
+#define FILE3 "file3"
+#define FILE3CRASH "file3.crash" /* file3 as a crash would leave it */
 void writefile(char *fname);
 void readfile(char *fname);
 void printfile(int fd);
+void resizetest(char *fname);
+void freetest(char *fname);
+void sizetest(char *fname);
+void checksumtest(void);
+void compresstest(void);
+void copyfile(char *from, char *to);
+int newfile(char *fname, int npages);
+void manyfilestest(void);
+void flushtest(void);
+void statstest(void);
+void tracetest(void);
+void warmtest(void);
+void hinttest(void);
 
 int main() {
   int error;
   int i;
   int pagenum;
-  char *buf;
+  char *buf, *samebuf;
   int *buf1, *buf2;
   int fd1, fd2;
 
@@ -253,11 +272,25 @@ int main() {
   error = PF_DisposePage(fd1, 1);
   PF_PrintError("dispose page1, should fail");
 
-  /* Now unfix it */
+  /* fix it a second time: both fixes share the buffer */
+  if ((error = PF_GetThisPage(fd1, 1, &samebuf)) != PFE_OK) {
+    PF_PrintError("get page1 again");
+    exit(1);
+  }
+  printf("got page%d again, %s buffer\n", *samebuf,
+         samebuf == buf ? "same" : "different");
+
+  /* Now unfix it twice; it stays fixed after the first */
   if ((error = PF_UnfixPage(fd1, 1, FALSE)) != PFE_OK) {
     PF_PrintError("get this on fd2");
     exit(1);
   }
+  error = PF_DisposePage(fd1, 1);
+  PF_PrintError("dispose page1 still fixed once, should fail");
+  if ((error = PF_UnfixPage(fd1, 1, FALSE)) != PFE_OK) {
+    PF_PrintError("unfix page1 second fix");
+    exit(1);
+  }
 
   error = PF_UnfixPage(fd1, 1, FALSE);
   PF_PrintError("unfix fd1 again, should fail");
@@ -288,7 +321,1070 @@ int main() {
 
   /* print the hash table */
   printf("hash table:\n");
-  PFhashPrint();
+  PFbufHashPrint();
+
+  /* grow and shrink the buffer pool with file1 open */
+  resizetest(FILE1);
+
+  /* free and reuse pages without reading them */
+  freetest(FILE1);
+
+  /* a file of 16K pages, open together with file1 */
+  sizetest(FILE1);
+
+  /* pages damaged on disk are caught */
+  checksumtest();
+
+  /* pages written compressed read back the same */
+  compresstest();
+
+  /* more files open than the old table held, on few unix files */
+  manyfilestest();
+
+  /* a file flushed while open */
+  flushtest();
+
+  /* statistics of the pool and of a file */
+  statstest();
+
+  /* a trace of page accesses */
+  tracetest();
+
+  /* the pool's pages saved and read back in after a restart */
+  warmtest();
+
+  /* pages hinted high stay, pages hinted low go first */
+  hinttest();
+}
+
+/************************************************************
+Grow the buffer pool to twice its size and fix that many
+pages of the file at once, then shrink it while pages are
+still fixed (which should fail) and after unfixing them.
+Every page handed out must be frame aligned.
+******************************************************************/
+void resizetest(char *fname) {
+  int i;
+  int fd, pagenum;
+  int pages[PF_MAX_BUFS * 2];
+  char *buf;
+  int error;
+
+  if ((fd = PF_OpenFile(fname)) < 0) {
+    PF_PrintError("open file1");
+    exit(1);
+  }
+  printf("opened %s\n", fname);
+
+  if ((error = PF_ResizePool(PF_MAX_BUFS * 2)) != PFE_OK) {
+    PF_PrintError("grow pool");
+    exit(1);
+  }
+  printf("pool grown to %d pages\n", PFbufferPool.poolSize);
+
+  for (i = 0; i < PF_MAX_BUFS * 2; i++) {
+    if ((error = PF_AllocPage(fd, &pagenum, &buf)) != PFE_OK) {
+      PF_PrintError("alloc in grown pool");
+      exit(1);
+    }
+    if ((uintptr_t)buf % PF_FRAME_ALIGN != 0) {
+      printf("page %d is not frame aligned\n", pagenum);
+      exit(1);
+    }
+    *((int *)buf) = pagenum;
+    pages[i] = pagenum;
+  }
+  if ((error = PF_AllocPage(fd, &pagenum, &buf)) == PFE_OK) {
+    printf("too many buffers, and it's still OK\n");
+    exit(1);
+  }
+  printf("%d pages fixed\n", PF_MAX_BUFS * 2);
+
+  if ((error = PF_ResizePool(PF_MAX_BUFS / 2)) == PFE_OK) {
+    printf("shrunk the pool below the fixed pages, and it's still OK\n");
+    exit(1);
+  }
+  PF_PrintError("shrink with pages fixed, should fail");
+
+  /* unfix the pages */
+  for (i = 0; i < PF_MAX_BUFS * 2; i++) {
+    if ((error = PF_UnfixPage(fd, pages[i], TRUE)) != PFE_OK) {
+      PF_PrintError("unfix in grown pool");
+      exit(1);
+    }
+  }
+
+  if ((error = PF_ResizePool(PF_MAX_BUFS / 2)) != PFE_OK) {
+    PF_PrintError("shrink pool");
+    exit(1);
+  }
+  printf("pool shrunk to %d pages\n", PFbufferPool.poolSize);
+
+  printfile(fd);
+
+  if ((error = PF_CloseFile(fd)) != PFE_OK) {
+    PF_PrintError("close file1");
+    exit(1);
+  }
+
+  /* put the pool back */
+  if ((error = PF_ResizePool(PF_MAX_BUFS)) != PFE_OK) {
+    PF_PrintError("restore pool");
+    exit(1);
+  }
+}
+
+/************************************************************
+Dispose pages 5 to 14 of the file, then allocate three pages
+near page 12, which must be the free pages closest to it,
+and one more, which follows the last. Neither needs a page to
+be read. The free pages must stay free after a reopen.
+******************************************************************/
+void freetest(char *fname) {
+  int i;
+  int fd, pagenum;
+  unsigned long reads;
+  char *buf;
+
+  if ((fd = PF_OpenFile(fname)) < 0) {
+    PF_PrintError("open file1");
+    exit(1);
+  }
+  PF_CollectStats();
+  reads = PFbufferPool.physicalReads;
+  for (i = 5; i < 15; i++)
+    if (PF_DisposePage(fd, i) != PFE_OK) {
+      PF_PrintError("dispose in freetest");
+      exit(1);
+    }
+  for (i = 0; i < 4; i++) {
+    if (PF_AllocPageNear(fd, i < 3 ? 12 : -1, &pagenum, &buf) != PFE_OK) {
+      PF_PrintError("alloc near page 12");
+      exit(1);
+    }
+    *((int *)buf) = pagenum;
+    printf("allocated page %d near %d\n", pagenum, i < 3 ? 12 : -1);
+    if (PF_UnfixPage(fd, pagenum, TRUE) != PFE_OK) {
+      PF_PrintError("unfix in freetest");
+      exit(1);
+    }
+  }
+  PF_CollectStats();
+  printf("%lu pages read to free and reuse pages\n",
+         PFbufferPool.physicalReads - reads);
+  if (PF_CloseFile(fd) != PFE_OK) {
+    PF_PrintError("close in freetest");
+    exit(1);
+  }
+
+  if ((fd = PF_OpenFile(fname)) < 0) {
+    PF_PrintError("reopen file1");
+    exit(1);
+  }
+  if (PF_GetThisPage(fd, 6, &buf) == PFE_OK) {
+    printf("free page 6 fixed after reopen\n");
+    exit(1);
+  }
+  PF_PrintError("get free page 6, should fail");
+  printfile(fd);
+  PF_CloseFile(fd);
+}
+
+/************************************************************
+Create a file of 16K pages, after checking that a size not a
+power of two is refused. Fill twice as many pages as the pool
+holds, so that some go out through the buffer, then read them
+back with a page of the 4K file "fname" fixed all along: both
+must come through whole, and the two page sizes together must
+not hold more pages than the pool.
+******************************************************************/
+void sizetest(char *fname) {
+  int i;
+  int fd, fd3, pagenum, pagenum1;
+  int n = 0;
+  char *buf, *buf1;
+  PF_Stats ps;
+  int error;
+
+  if (PF_CreateFileWithPageSize(FILE3, 5000) == PFE_OK) {
+    printf("created a file of 5000 byte pages\n");
+    exit(1);
+  }
+  PF_PrintError("create with 5000 byte pages, should fail");
+  if ((error = PF_CreateFileWithPageSize(FILE3, 16384)) != PFE_OK) {
+    PF_PrintError("create file3");
+    exit(1);
+  }
+  if ((fd3 = PF_OpenFile(FILE3)) < 0) {
+    PF_PrintError("open file3");
+    exit(1);
+  }
+  printf("opened %s: %d byte pages\n", FILE3, PF_PageSize(fd3));
+  for (i = 0; i < PF_MAX_BUFS * 2; i++) {
+    if ((error = PF_AllocPage(fd3, &pagenum, &buf)) != PFE_OK) {
+      PF_PrintError("alloc in file3");
+      exit(1);
+    }
+    memset(buf, pagenum, PF_PageSize(fd3));
+    *((int *)(buf + PF_PageSize(fd3)) - 1) = pagenum;
+    if ((error = PF_UnfixPage(fd3, pagenum, TRUE)) != PFE_OK) {
+      PF_PrintError("unfix in file3");
+      exit(1);
+    }
+  }
+  if ((error = PF_CloseFile(fd3)) != PFE_OK) {
+    PF_PrintError("close file3");
+    exit(1);
+  }
+
+  if ((fd = PF_OpenFile(fname)) < 0 || (fd3 = PF_OpenFile(FILE3)) < 0) {
+    PF_PrintError("reopen in sizetest");
+    exit(1);
+  }
+  if ((error = PF_GetFirstPage(fd, &pagenum1, &buf1)) != PFE_OK) {
+    PF_PrintError("first page of file1");
+    exit(1);
+  }
+  pagenum = -1;
+  while ((error = PF_GetNextPage(fd3, &pagenum, &buf)) == PFE_OK) {
+    if (*((int *)(buf + PF_PageSize(fd3)) - 1) != pagenum ||
+        buf[PF_PageSize(fd3) / 2] != (char)pagenum) {
+      printf("page %d of file3 is wrong\n", pagenum);
+      exit(1);
+    }
+    n++;
+    PF_UnfixPage(fd3, pagenum, FALSE);
+  }
+  printf("%d pages of file3 read back, file1 page %d holds %d\n", n,
+         pagenum1, *((int *)buf1));
+  PF_GetStats(&ps);
+  if (ps.total.residentPages > ps.poolSize) {
+    printf("%d pages in a pool of %d\n", ps.total.residentPages,
+           ps.poolSize);
+    exit(1);
+  }
+  PF_UnfixPage(fd, pagenum1, FALSE);
+  PF_CloseFile(fd);
+  PF_CloseFile(fd3);
+  PF_DestroyFile(FILE3);
+}
+
+/************************************************************
+Create a file with checksums, write CK_PAGES pages and damage
+one byte of two of them on disk. Reading the pages back in
+order, the damaged ones must fail with PFE_CHECKSUM, whether
+read on their own or ahead of time, and the others come through.
+A page allocated and still fixed at a flush must read back as
+zeroes from a copy of the file taken then, and a page zeroed
+on disk must fail.
+******************************************************************/
+#define CK_PAGES 8
+void checksumtest(void) {
+  int i, j, ra, damaged;
+  int fd, pagenum;
+  char *buf;
+  int error;
+  FILE *f;
+
+  if ((error = PF_CreateFileWithOptions(FILE3, PF_PAGE_SIZE,
+                                        PF_FILE_CHECKSUM)) != PFE_OK ||
+      (fd = PF_OpenFile(FILE3)) < 0) {
+    PF_PrintError("create file3 with checksums");
+    exit(1);
+  }
+  printf("opened %s with checksums: %d byte pages\n", FILE3,
+         PF_PageSize(fd));
+  for (i = 0; i < CK_PAGES; i++) {
+    if ((error = PF_AllocPage(fd, &pagenum, &buf)) != PFE_OK) {
+      PF_PrintError("alloc in file3");
+      exit(1);
+    }
+    memset(buf, 'a' + pagenum, PF_PageSize(fd));
+    PF_UnfixPage(fd, pagenum, TRUE);
+  }
+  PF_CloseFile(fd);
+
+  /* page n is at (n+2)*PF_PAGE_SIZE: past the header and bitmap */
+  if ((f = fopen(FILE3, "r+")) == NULL) {
+    perror("file3");
+    exit(1);
+  }
+  fseek(f, 3 * PF_PAGE_SIZE + 100, SEEK_SET);
+  fputc('X', f);
+  fseek(f, 6 * PF_PAGE_SIZE + PF_PAGE_SIZE - 1, SEEK_SET);
+  fputc('X', f);
+  fclose(f);
+
+  /* first page by page, then with the pages read ahead */
+  for (ra = 0; ra <= PF_READ_AHEAD_MAX; ra += PF_READ_AHEAD_MAX) {
+    PF_SetReadAhead(ra);
+    if ((fd = PF_OpenFile(FILE3)) < 0) {
+      PF_PrintError("reopen file3");
+      exit(1);
+    }
+    damaged = 0;
+    for (i = 0; i < CK_PAGES; i++) {
+      if ((error = PF_GetThisPage(fd, i, &buf)) == PFE_CHECKSUM) {
+        if (i != 1 && i != 4) {
+          printf("page %d of file3 fails its checksum\n", i);
+          exit(1);
+        }
+        damaged++;
+        continue;
+      }
+      if (error != PFE_OK) {
+        PF_PrintError("get page of file3");
+        exit(1);
+      }
+      for (j = 0; j < PF_PageSize(fd); j++)
+        if (buf[j] != 'a' + i) {
+          printf("page %d of file3 is wrong at byte %d\n", i, j);
+          exit(1);
+        }
+      PF_UnfixPage(fd, i, FALSE);
+    }
+    PF_CloseFile(fd);
+    if (damaged != 2) {
+      printf("%d pages of file3 fail their checksum, not 2\n", damaged);
+      exit(1);
+    }
+    printf("read ahead %d: pages 1 and 4 of file3 are damaged, the others "
+           "good\n",
+           ra);
+  }
+  PF_SetReadAhead(0);
+
+  /* a page still fixed when the file is flushed has never been
+  written; a crash then must find it good, and all zeroes */
+  if ((fd = PF_OpenFile(FILE3)) < 0 ||
+      PF_AllocPage(fd, &pagenum, &buf) != PFE_OK) {
+    PF_PrintError("alloc in file3");
+    exit(1);
+  }
+  memset(buf, 'z', PF_PageSize(fd));
+  if (PF_FlushFile(fd) != PFE_OK) {
+    PF_PrintError("flush file3");
+    exit(1);
+  }
+  copyfile(FILE3, FILE3CRASH);
+  PF_UnfixPage(fd, pagenum, TRUE);
+  PF_CloseFile(fd);
+  if ((fd = PF_OpenFile(FILE3CRASH)) < 0) {
+    PF_PrintError("open crashed file3");
+    exit(1);
+  }
+  if (PF_GetThisPage(fd, pagenum, &buf) != PFE_OK) {
+    PF_PrintError("get page fixed at the flush");
+    exit(1);
+  }
+  for (j = 0; j < PF_PageSize(fd); j++)
+    if (buf[j] != 0) {
+      printf("page %d of crashed file3 is not zeroes\n", pagenum);
+      exit(1);
+    }
+  PF_UnfixPage(fd, pagenum, FALSE);
+  PF_CloseFile(fd);
+
+  /* a written page that is now all zeroes is damaged */
+  if ((f = fopen(FILE3CRASH, "r+")) == NULL) {
+    perror("crashed file3");
+    exit(1);
+  }
+  fseek(f, 2 * PF_PAGE_SIZE, SEEK_SET);
+  for (j = 0; j < PF_PAGE_SIZE; j++)
+    fputc(0, f);
+  fclose(f);
+  if ((fd = PF_OpenFile(FILE3CRASH)) < 0) {
+    PF_PrintError("open crashed file3");
+    exit(1);
+  }
+  if (PF_GetThisPage(fd, 0, &buf) != PFE_CHECKSUM) {
+    printf("page 0 of crashed file3, zeroed, passes its checksum\n");
+    exit(1);
+  }
+  PF_CloseFile(fd);
+  printf("a page fixed at a flush is zeroes after a crash; a zeroed page "
+         "fails\n");
+  PF_DestroyFile(FILE3CRASH);
+  PF_DestroyFile(FILE3);
+}
+
+/************************************************************
+Fill "buf", "len" bytes, with what page "pagenum" holds in
+round "round" of compresstest(): text that compresses well if
+pagenum+round is even, random bytes that do not if it is odd.
+******************************************************************/
+void czfill(char *buf, int len, int pagenum, int round) {
+  unsigned int x = pagenum * 2654435761U + round;
+  int i, n;
+
+  if ((pagenum + round) % 2 == 0) {
+    for (i = 0; i < len; i += n)
+      n = snprintf(buf + i, len - i, "%d;student %d;XXXXXXXXX;", round,
+                   pagenum);
+    return;
+  }
+  for (i = 0; i < len; i++) {
+    x = x * 1103515245 + 12345;
+    buf[i] = (char)(x >> 16);
+  }
+}
+
+/************************************************************
+Create a compressed file of CZ_PAGES pages, more than the
+buffer holds, half of them compressible, and check that it
+takes less room than they would uncompressed. Then read
+them all back, in a scan (read ahead) and one by one, rewrite
+them so that the compressible ones are not any more and the
+others are, dispose of one, and read them back again after
+reopening the file. The file can not be opened with O_DIRECT.
+Last, pages written after a flush must not touch what the file
+holds on disk as of the flush.
+******************************************************************/
+#define CZ_PAGES 48
+void compresstest(void) {
+  char page[PF_PAGE_SIZE];
+  int i, round;
+  int fd, pagenum;
+  char *buf;
+  FILE *f;
+  long size;
+
+  if (PF_CreateFileWithOptions(FILE3, PF_PAGE_SIZE,
+                               PF_FILE_COMPRESS | PF_FILE_CHECKSUM) !=
+          PFE_OK ||
+      (fd = PF_OpenFile(FILE3)) < 0) {
+    PF_PrintError("create compressed file3");
+    exit(1);
+  }
+  for (i = 0; i < CZ_PAGES; i++) {
+    if (PF_AllocPage(fd, &pagenum, &buf) != PFE_OK) {
+      PF_PrintError("alloc in compressed file3");
+      exit(1);
+    }
+    czfill(buf, PF_PageSize(fd), pagenum, 0);
+    PF_UnfixPage(fd, pagenum, TRUE);
+  }
+  PF_CloseFile(fd);
+  if ((f = fopen(FILE3, "r")) == NULL) {
+    perror("file3");
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fclose(f);
+  printf("compressed file3: %d pages in %ld bytes\n", CZ_PAGES, size);
+  if (size >= (long)(CZ_PAGES / 2 + 2) * PF_PAGE_SIZE + PF_PAGE_SIZE) {
+    printf("compressed file3 is too big\n");
+    exit(1);
+  }
+  if ((fd = PF_OpenFileDirect(FILE3)) != PFE_FORMAT) {
+    printf("compressed file3 opened with O_DIRECT\n");
+    exit(1);
+  }
+
+  PF_SetReadAhead(PF_READ_AHEAD_MAX);
+  for (round = 0; round < 2; round++) {
+    if ((fd = PF_OpenFile(FILE3)) < 0) {
+      PF_PrintError("open compressed file3");
+      exit(1);
+    }
+    /* a scan, which reads ahead, then every page on its own */
+    for (i = 0, pagenum = -1;
+         PF_GetNextPage(fd, &pagenum, &buf) == PFE_OK; i++) {
+      czfill(page, PF_PageSize(fd), pagenum, round);
+      if (memcmp(buf, page, PF_PageSize(fd)) != 0) {
+        printf("page %d of compressed file3 is wrong\n", pagenum);
+        exit(1);
+      }
+      PF_UnfixPage(fd, pagenum, FALSE);
+    }
+    if (PFerrno != PFE_EOF || i != CZ_PAGES - round) {
+      PF_PrintError("scan compressed file3");
+      exit(1);
+    }
+    for (i = CZ_PAGES - 1; i >= 0; i--) {
+      if (round > 0 && i == CZ_PAGES / 2)
+        continue;
+      if (PF_GetThisPage(fd, i, &buf) != PFE_OK) {
+        PF_PrintError("get page of compressed file3");
+        exit(1);
+      }
+      czfill(page, PF_PageSize(fd), i, round);
+      if (memcmp(buf, page, PF_PageSize(fd)) != 0) {
+        printf("page %d of compressed file3 is wrong\n", i);
+        exit(1);
+      }
+      if (round == 0)
+        czfill(buf, PF_PageSize(fd), i, 1);
+      PF_UnfixPage(fd, i, round == 0);
+    }
+    if (round == 0 && PF_DisposePage(fd, CZ_PAGES / 2) != PFE_OK) {
+      PF_PrintError("dispose page of compressed file3");
+      exit(1);
+    }
+    PF_CloseFile(fd);
+    printf("compressed file3 reads back right, round %d\n", round);
+  }
+  PF_SetReadAhead(0);
+
+  /* flush round 2, then write round 3 over it, more pages than the
+  buffer holds, and copy the file as a crash would leave it: the copy
+  must hold round 2 */
+  if ((fd = PF_OpenFile(FILE3)) < 0) {
+    PF_PrintError("open compressed file3");
+    exit(1);
+  }
+  for (round = 2; round < 4; round++) {
+    for (i = 0; i < CZ_PAGES; i++) {
+      if (i == CZ_PAGES / 2)
+        continue;
+      if (PF_GetThisPage(fd, i, &buf) != PFE_OK) {
+        PF_PrintError("get page of compressed file3");
+        exit(1);
+      }
+      czfill(buf, PF_PageSize(fd), i, round);
+      PF_UnfixPage(fd, i, TRUE);
+    }
+    if (round == 2 && PF_FlushFile(fd) != PFE_OK) {
+      PF_PrintError("flush compressed file3");
+      exit(1);
+    }
+  }
+  copyfile(FILE3, FILE3CRASH);
+  PF_CloseFile(fd);
+  if ((fd = PF_OpenFile(FILE3CRASH)) < 0) {
+    PF_PrintError("open crashed copy of compressed file3");
+    exit(1);
+  }
+  for (i = 0; i < CZ_PAGES; i++) {
+    if (i == CZ_PAGES / 2)
+      continue;
+    if (PF_GetThisPage(fd, i, &buf) != PFE_OK) {
+      PF_PrintError("get page of crashed copy of compressed file3");
+      exit(1);
+    }
+    czfill(page, PF_PageSize(fd), i, 2);
+    if (memcmp(buf, page, PF_PageSize(fd)) != 0) {
+      printf("page %d of crashed copy of compressed file3 is wrong\n", i);
+      exit(1);
+    }
+    PF_UnfixPage(fd, i, FALSE);
+  }
+  PF_CloseFile(fd);
+  printf("crashed copy of compressed file3 holds the last flush\n");
+  PF_DestroyFile(FILE3CRASH);
+  PF_DestroyFile(FILE3);
+}
+
+/************************************************************
+Copy the file "from" to "to", as it is on disk.
+******************************************************************/
+void copyfile(char *from, char *to) {
+  char buf[8192];
+  FILE *in, *out;
+  size_t n;
+
+  if ((in = fopen(from, "r")) == NULL || (out = fopen(to, "w")) == NULL) {
+    perror("copyfile");
+    exit(1);
+  }
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    fwrite(buf, 1, n, out);
+  fclose(in);
+  fclose(out);
+}
+
+/************************************************************
+Count the file descriptors the process has open.
+******************************************************************/
+int countfds(void) {
+  DIR *d;
+  int n = 0;
+
+  if ((d = opendir("/proc/self/fd")) == NULL)
+    return (-1);
+  while (readdir(d) != NULL)
+    n++;
+  closedir(d);
+  return (n - 3); /* ".", ".." and d's own */
+}
+
+/************************************************************
+Open MF_FILES files at once, many more than the file table used
+to hold, with the descriptor cache keeping at most MF_FDS unix
+files open, and write MF_PAGES pages to each, going round the
+files so that unix files are closed and opened again, and pages
+paged out to them. An open file can not be destroyed. Close and
+reopen every other file, reusing their entries, and read all
+the pages back.
+******************************************************************/
+#define MF_FILES 100
+#define MF_FDS 8
+#define MF_PAGES 3
+void manyfilestest(void) {
+  char fname[MF_FILES][16];
+  int fd[MF_FILES];
+  int i, j, basefds, pagenum;
+  char *buf;
+
+  basefds = countfds();
+  if (PF_SetMaxOpenFds(-1) != PFE_FDLIMIT ||
+      PF_SetMaxOpenFds(MF_FDS) != PFE_OK) {
+    printf("PF_SetMaxOpenFds is wrong\n");
+    exit(1);
+  }
+  for (i = 0; i < MF_FILES; i++) {
+    sprintf(fname[i], "mfile%d", i);
+    PF_DestroyFile(fname[i]);
+    if (PF_CreateFile(fname[i]) != PFE_OK ||
+        (fd[i] = PF_OpenFile(fname[i])) < 0) {
+      PF_PrintError("open mfile");
+      exit(1);
+    }
+  }
+  for (j = 0; j < MF_PAGES; j++)
+    for (i = 0; i < MF_FILES; i++) {
+      if (PF_AllocPage(fd[i], &pagenum, &buf) != PFE_OK || pagenum != j) {
+        PF_PrintError("alloc in mfile");
+        exit(1);
+      }
+      sprintf(buf, "%s page %d", fname[i], j);
+      PF_UnfixPage(fd[i], pagenum, TRUE);
+    }
+  if (countfds() > basefds + MF_FDS) {
+    printf("%d unix files open for %d files\n", countfds() - basefds,
+           MF_FILES);
+    exit(1);
+  }
+  if (PF_DestroyFile(fname[MF_FILES - 1]) != PFE_FILEOPEN) {
+    printf("open mfile destroyed\n");
+    exit(1);
+  }
+  for (i = 0; i < MF_FILES; i += 2)
+    if (PF_CloseFile(fd[i]) != PFE_OK ||
+        (fd[i] = PF_OpenFile(fname[i])) < 0) {
+      PF_PrintError("reopen mfile");
+      exit(1);
+    }
+  for (i = 0; i < MF_FILES; i++) {
+    for (j = 0; j < MF_PAGES; j++) {
+      if (PF_GetThisPage(fd[i], j, &buf) != PFE_OK) {
+        PF_PrintError("get page of mfile");
+        exit(1);
+      }
+      if (strncmp(buf, fname[i], strlen(fname[i])) != 0 ||
+          atoi(buf + strlen(fname[i]) + 6) != j) {
+        printf("page %d of %s is wrong: %s\n", j, fname[i], buf);
+        exit(1);
+      }
+      PF_UnfixPage(fd[i], j, FALSE);
+    }
+    if (PF_CloseFile(fd[i]) != PFE_OK ||
+        PF_DestroyFile(fname[i]) != PFE_OK) {
+      PF_PrintError("close mfile");
+      exit(1);
+    }
+  }
+  PF_SetMaxOpenFds(0);
+  printf("%d files open on %d unix files read back right\n", MF_FILES,
+         MF_FDS);
+}
+
+/************************************************************
+Create the file "fname" anew, open it and allocate "npages"
+pages in it, each filled with 'a' plus its number and unfixed
+dirty. Return its file descriptor.
+******************************************************************/
+int newfile(char *fname, int npages) {
+  int i, fd, pagenum;
+  char *buf;
+
+  PF_DestroyFile(fname);
+  if (PF_CreateFile(fname) != PFE_OK || (fd = PF_OpenFile(fname)) < 0) {
+    PF_PrintError(fname);
+    exit(1);
+  }
+  for (i = 0; i < npages; i++) {
+    if (PF_AllocPage(fd, &pagenum, &buf) != PFE_OK) {
+      PF_PrintError(fname);
+      exit(1);
+    }
+    memset(buf, 'a' + pagenum, PF_PAGE_SIZE);
+    PF_UnfixPage(fd, pagenum, TRUE);
+  }
+  return (fd);
+}
+
+/************************************************************
+Write FL_PAGES pages to a new file, one left fixed, and flush
+it while it is open: the unfixed pages must then be in the file
+on disk, the fixed one not, and the pages still in the buffer,
+clean, so that closing the file writes only the fixed one.
+******************************************************************/
+#define FL_PAGES 6
+void flushtest(void) {
+  char page[PF_PAGE_SIZE];
+  int i, fd, pagenum;
+  unsigned long writes;
+  char *buf;
+  FILE *f;
+
+  fd = newfile(FILE3, FL_PAGES - 1);
+  if (PF_AllocPage(fd, &pagenum, &buf) != PFE_OK) {
+    PF_PrintError("alloc in file3");
+    exit(1);
+  }
+  memset(buf, 'a' + pagenum, PF_PAGE_SIZE);
+  if (PF_FlushFile(fd) != PFE_OK) {
+    PF_PrintError("flush file3");
+    exit(1);
+  }
+
+  /* page n is at (n+2)*PF_PAGE_SIZE: past the header and bitmap */
+  if ((f = fopen(FILE3, "r")) == NULL) {
+    perror("file3");
+    exit(1);
+  }
+  for (i = 0; i < FL_PAGES; i++) {
+    fseek(f, (long)(i + 2) * PF_PAGE_SIZE, SEEK_SET);
+    if ((fread(page, 1, PF_PAGE_SIZE, f) == PF_PAGE_SIZE &&
+         page[0] == 'a' + i) != (i < FL_PAGES - 1)) {
+      printf("page %d of file3 is wrong on disk after a flush\n", i);
+      exit(1);
+    }
+  }
+  fclose(f);
+
+  PF_UnfixPage(fd, FL_PAGES - 1, TRUE);
+  PF_CollectStats();
+  writes = PFbufferPool.physicalWrites;
+  PF_CloseFile(fd);
+  PF_CollectStats();
+  if (PFbufferPool.physicalWrites - writes != 1) {
+    printf("closing flushed file3 wrote %lu pages\n",
+           PFbufferPool.physicalWrites - writes);
+    exit(1);
+  }
+  PF_DestroyFile(FILE3);
+  printf("flushed file3 is on disk\n");
+}
+
+/************************************************************
+Allocate ST_PAGES pages in a new file, fix each again twice
+and flush it, checking its counters and dirty pages along the
+way, that the pool's hits and misses add up to its requests,
+and that the JSON dump shows the file.
+******************************************************************/
+#define ST_PAGES 4
+void statstest(void) {
+  PF_FileStats fs;
+  PF_Stats ps;
+  char json[4096];
+  int i, r, fd;
+  char *buf;
+  size_t len;
+  FILE *f;
+
+  PF_ResetStats();
+  fd = newfile(FILE3, ST_PAGES);
+  PF_GetFileStats(fd, &fs);
+  if (fs.allocations != ST_PAGES || fs.residentPages != ST_PAGES ||
+      fs.dirtyPages != ST_PAGES || fs.hits != 0 || fs.misses != 0) {
+    printf("file3 counts %lu allocations, %d pages, %d dirty\n",
+           fs.allocations, fs.residentPages, fs.dirtyPages);
+    exit(1);
+  }
+  for (r = 0; r < 2; r++)
+    for (i = 0; i < ST_PAGES; i++) {
+      if (PF_GetThisPage(fd, i, &buf) != PFE_OK) {
+        PF_PrintError("get in file3");
+        exit(1);
+      }
+      PF_UnfixPage(fd, i, FALSE);
+    }
+  if (PF_FlushFile(fd) != PFE_OK) {
+    PF_PrintError("flush file3");
+    exit(1);
+  }
+  PF_GetFileStats(fd, &fs);
+  if (fs.hits != 2 * ST_PAGES || fs.misses != 0 || fs.writes != ST_PAGES ||
+      fs.dirtyPages != 0 || fs.residentPages != ST_PAGES) {
+    printf("file3 counts %lu hits, %lu misses, %lu writes, %d dirty\n",
+           fs.hits, fs.misses, fs.writes, fs.dirtyPages);
+    exit(1);
+  }
+  PF_GetStats(&ps);
+  if (ps.total.hits + ps.total.misses != ps.requests ||
+      ps.total.hits < 2 * ST_PAGES || ps.openFiles < 1) {
+    printf("pool counts %lu requests, %lu hits, %lu misses\n", ps.requests,
+           ps.total.hits, ps.total.misses);
+    exit(1);
+  }
+  if (PF_GetFileStats(-1, &fs) != PFE_FD) {
+    printf("statistics of a bad file descriptor\n");
+    exit(1);
+  }
+
+  if ((f = tmpfile()) == NULL) {
+    perror("tmpfile");
+    exit(1);
+  }
+  PF_DumpStatsTo(f, PF_STATS_JSON);
+  rewind(f);
+  len = fread(json, 1, sizeof(json) - 1, f);
+  json[len] = 0;
+  fclose(f);
+  if (json[0] != '{' || len < 2 || strcmp(json + len - 2, "}\n") != 0 ||
+      strstr(json, "\"name\": \"file3\"") == NULL ||
+      strstr(json, "\"hits\": 8") == NULL) {
+    printf("JSON statistics are wrong: %s", json);
+    exit(1);
+  }
+
+  PF_CloseFile(fd);
+  PF_DestroyFile(FILE3);
+  printf("statistics of file3 add up\n");
+}
+
+/************************************************************
+Trace the allocation of TR_PAGES pages of a new file, each
+unfixed dirty, then a fix and a clean unfix of each, and read
+the trace back: its records must be those, in that order.
+******************************************************************/
+#define TR_PAGES 5
+#define TRACEFILE "file3.trace"
+void tracetest(void) {
+  static const int ops[4] = {PF_TRACE_ALLOC, PF_TRACE_UNFIX, PF_TRACE_GET,
+                             PF_TRACE_UNFIX};
+  PF_TraceHdr hdr;
+  PF_TraceRec rec;
+  unsigned long last = 0;
+  int i, r, fd;
+  char *buf;
+  FILE *f;
+
+  if (PF_StartTrace(TRACEFILE, 0) != PFE_OK) {
+    PF_PrintError("start trace");
+    exit(1);
+  }
+  if (PF_StartTrace(TRACEFILE, 0) != PFE_TRACE) {
+    printf("two traces on at once\n");
+    exit(1);
+  }
+  fd = newfile(FILE3, TR_PAGES);
+  for (i = 0; i < TR_PAGES; i++) {
+    if (PF_GetThisPage(fd, i, &buf) != PFE_OK) {
+      PF_PrintError("get in file3");
+      exit(1);
+    }
+    PF_UnfixPage(fd, i, FALSE);
+  }
+  if (PF_StopTrace() != 0 || PF_StopTrace() != PFE_TRACE) {
+    printf("trace of file3 did not stop right\n");
+    exit(1);
+  }
+  PF_CloseFile(fd);
+  PF_DestroyFile(FILE3);
+
+  if ((f = fopen(TRACEFILE, "r")) == NULL) {
+    perror(TRACEFILE);
+    exit(1);
+  }
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      memcmp(hdr.magic, PF_TRACE_MAGIC, sizeof(hdr.magic)) != 0) {
+    printf("trace has no header\n");
+    exit(1);
+  }
+  for (r = 0; r < 2; r++)
+    for (i = 0; i < TR_PAGES; i++) {
+      if (fread(&rec, sizeof(rec), 1, f) != 1 || rec.fd != fd ||
+          rec.page != i || rec.op != ops[2 * r] || rec.time < last) {
+        printf("trace record of page %d is wrong\n", i);
+        exit(1);
+      }
+      if (fread(&rec, sizeof(rec), 1, f) != 1 || rec.page != i ||
+          rec.op != ops[2 * r + 1] || rec.dirty != (r == 0)) {
+        printf("trace record of the unfix of page %d is wrong\n", i);
+        exit(1);
+      }
+      last = rec.time;
+    }
+  if (fread(&rec, sizeof(rec), 1, f) != 0) {
+    printf("trace has records too many\n");
+    exit(1);
+  }
+  fclose(f);
+  unlink(TRACEFILE);
+  printf("trace of file3 reads back right\n");
+}
+
+/************************************************************
+Fix WL_HOT of the WL_PAGES pages of each of two new files, with
+the pool otherwise empty, and save the warm list. Then, twice,
+start the pool over, reopen the files and load the list, once
+while waiting and once in the background: fixing the same pages
+of file3 again must not read any. In the background round the
+other file, whose pages come first, is closed at once, which
+must not keep file3 from warming. A file that is no warm list
+must be refused.
+******************************************************************/
+#define WL_PAGES 20
+#define WL_HOT 3
+#define WARMFILE "file3.warm"
+#define WL_OTHER "file3.other"
+void warmtest(void) {
+  static const int hot[WL_HOT] = {3, 7, 11};
+  static char *fname[2] = {WL_OTHER, FILE3};
+  PF_FileStats fs;
+  int i, f, n, bg;
+  int fd[2];
+  char *buf;
+
+  for (f = 0; f < 2; f++)
+    PF_CloseFile(newfile(fname[f], WL_PAGES));
+
+  PF_Init();
+  for (f = 0; f < 2; f++) {
+    if ((fd[f] = PF_OpenFile(fname[f])) < 0) {
+      PF_PrintError("open file to warm");
+      exit(1);
+    }
+    for (i = 0; i < WL_HOT; i++) {
+      if (PF_GetThisPage(fd[f], hot[i], &buf) != PFE_OK) {
+        PF_PrintError("get in file to warm");
+        exit(1);
+      }
+      PF_UnfixPage(fd[f], hot[i], FALSE);
+    }
+  }
+  if ((n = PF_SaveWarmList(WARMFILE)) != 2 * WL_HOT) {
+    printf("warm list of file3 has %d pages\n", n);
+    exit(1);
+  }
+  for (f = 0; f < 2; f++)
+    PF_CloseFile(fd[f]);
+
+  for (bg = FALSE; bg <= TRUE; bg++) {
+    PF_Init();
+    for (f = 0; f < 2; f++)
+      if ((fd[f] = PF_OpenFile(fname[f])) < 0) {
+        PF_PrintError("open file to warm");
+        exit(1);
+      }
+    n = PF_LoadWarmList(WARMFILE, bg);
+    if (bg && n == 2 * WL_HOT) {
+      PF_CloseFile(fd[0]);
+      n = PF_WaitWarmList();
+      if (n >= WL_HOT)
+        n = 2 * WL_HOT;
+    } else
+      PF_CloseFile(fd[0]);
+    if (n != 2 * WL_HOT) {
+      printf("warm list of file3 loaded %d pages\n", n);
+      exit(1);
+    }
+    PF_ResetStats();
+    for (i = 0; i < WL_HOT; i++) {
+      if (PF_GetThisPage(fd[1], hot[i], &buf) != PFE_OK) {
+        PF_PrintError("get in file3");
+        exit(1);
+      }
+      PF_UnfixPage(fd[1], hot[i], FALSE);
+    }
+    PF_GetFileStats(fd[1], &fs);
+    if (fs.misses != 0 || fs.hits != WL_HOT) {
+      printf("warmed file3 counts %lu hits, %lu misses\n", fs.hits,
+             fs.misses);
+      exit(1);
+    }
+    PF_CloseFile(fd[1]);
+  }
+
+  if (PF_LoadWarmList(FILE3, FALSE) != PFE_WARMLIST) {
+    printf("file3 taken for a warm list\n");
+    exit(1);
+  }
+  unlink(WARMFILE);
+  PF_DestroyFile(WL_OTHER);
+  PF_DestroyFile(FILE3);
+  printf("warm list of file3 reads its pages back in\n");
+}
+
+/************************************************************
+Fix page "pagenum" of file "fd" and unfix it, hinted "priority"
+if that is not PF_HINT_NORMAL; return TRUE if it was missed.
+******************************************************************/
+int hintfix(int fd, int pagenum, int priority) {
+  PF_FileStats before, after;
+  char *buf;
+
+  PF_GetFileStats(fd, &before);
+  if (PF_GetThisPage(fd, pagenum, &buf) != PFE_OK ||
+      (priority != PF_HINT_NORMAL &&
+       PF_SetPageHint(fd, pagenum, priority) != PFE_OK) ||
+      PF_UnfixPage(fd, pagenum, FALSE) != PFE_OK) {
+    PF_PrintError("hinted fix in file3");
+    exit(1);
+  }
+  PF_GetFileStats(fd, &after);
+  return (after.misses != before.misses);
+}
+
+/************************************************************
+Under each policy, with a pool of HT_POOL pages: a page hinted
+high must stay in while the other pages pass through twice, and
+a page hinted low must be the next to go, before pages used
+earlier.
+******************************************************************/
+#define HT_POOL 4
+#define HT_PAGES 8
+void hinttest(void) {
+  static const int policies[] = {
+      PF_REPLACEMENT_LRU, PF_REPLACEMENT_MRU,  PF_REPLACEMENT_CLOCK,
+      PF_REPLACEMENT_2Q,  PF_REPLACEMENT_LRU2, PF_REPLACEMENT_ARC};
+  int i, p, fd;
+
+  fd = newfile(FILE3, HT_PAGES);
+  if (PF_SetPageHint(fd, 0, 2) != PFE_HINT ||
+      PF_SetPageHint(-1, 0, PF_HINT_LOW) != PFE_FD ||
+      PF_SetPageHint(fd, HT_PAGES, PF_HINT_LOW) != PFE_INVALIDPAGE) {
+    printf("bad page hints taken\n");
+    exit(1);
+  }
+  PF_CloseFile(fd);
+
+  for (p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+    PF_InitWithOptions(HT_POOL, policies[p]);
+    if ((fd = PF_OpenFile(FILE3)) < 0) {
+      PF_PrintError("open file3");
+      exit(1);
+    }
+
+    /* page 0 high, then the rest passes through twice */
+    hintfix(fd, 0, PF_HINT_HIGH);
+    for (i = 1; i < 2 * HT_PAGES; i++)
+      hintfix(fd, 1 + i % (HT_PAGES - 1), PF_HINT_NORMAL);
+    if (hintfix(fd, 0, PF_HINT_NORMAL)) {
+      printf("policy %d paged out the high page\n", policies[p]);
+      exit(1);
+    }
+
+    /* page 1, used last but hinted low, makes room for page 4 */
+    hintfix(fd, 2, PF_HINT_NORMAL);
+    hintfix(fd, 3, PF_HINT_NORMAL);
+    hintfix(fd, 1, PF_HINT_LOW);
+    hintfix(fd, 4, PF_HINT_NORMAL);
+    if (hintfix(fd, 0, PF_HINT_NORMAL) || !hintfix(fd, 1, PF_HINT_NORMAL)) {
+      printf("policy %d did not page out the low page first\n", policies[p]);
+      exit(1);
+    }
+    PF_CloseFile(fd);
+  }
+
+  PF_Init();
+  PF_DestroyFile(FILE3);
+  printf("page hints of file3 are followed\n");
 }
 
 /************************************************************
@@ -0,0 +1,276 @@
+/* trace.c: page access traces of the buffer manager. While a trace is
+on, PFbufGet(), PFbufUnfix() and PFbufAlloc() hand a PF_TraceRec for
+each call that succeeds to PFtraceRecord(), which puts it in a ring
+buffer without taking a latch; a thread of its own takes the records
+off the ring in order and writes them to the trace file, behind a
+PF_TraceHdr. pf_simulate replays such a file against several
+replacement policies.
+
+The ring is a bounded queue of cells, each with a sequence number
+that tells whose turn it is: cell i % n is free for the record of slot
+i when its number is i, and holds that record when it is i + 1. A
+thread takes a slot by moving "head" on with a compare-and-swap, so
+threads never wait for each other; if the ring is full the record is
+dropped and counted rather than waiting for the writer. Only the
+writer moves "tail", and it hands a cell back to the producers by
+setting its number to i + n. */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#define PF_TRACE_BATCH	1024	/* max # of records written at once */
+#define PF_TRACE_NAP	1000000	/* ns the writer sleeps when the ring
+				is empty */
+
+typedef struct PFtracecell {
+	unsigned long seq;		/* sequence number, see above */
+	PF_TraceRec rec;		/* the record */
+} PFtracecell;
+
+typedef struct PFtracering {
+	unsigned long mask;		/* # of cells, less 1 */
+	PFtracecell cells[];
+} PFtracering;
+
+int PFtraceon = FALSE;			/* TRUE while a trace is taken;
+					read by the buffer manager */
+static pthread_mutex_t PFtracelatch = PTHREAD_MUTEX_INITIALIZER;
+					/* serializes starting and
+					stopping a trace */
+static PFtracering *PFtracebuf = NULL;	/* the ring */
+static PFtracering *PFtraceretired[64];	/* rings outgrown, never freed:
+					each is at least twice the last */
+static int PFtracenretired = 0;		/* # of them */
+static unsigned long PFtracehead;	/* next slot to take */
+static unsigned long PFtracetail;	/* next slot to write out */
+static unsigned long PFtracedropped;	/* records the ring had no room for */
+static unsigned long PFtracestart;	/* time the trace started, in ns */
+static FILE *PFtracefile = NULL;	/* the trace file */
+static int PFtraceerror;		/* PFE_UNIX once a write failed */
+static int PFtracestopping;		/* TRUE when the writer is to stop */
+static pthread_t PFtracethread;		/* the writer */
+static int PFtraceatexit = FALSE;	/* TRUE once PFtraceExit() is
+					registered */
+
+/* the time, in ns, of the monotonic clock */
+static unsigned long PFtraceNow(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Put a record of operation "op" (PF_TRACE_GET, _UNFIX or
+	_ALLOC) on page "page" of file "fd" in the ring, with "dirty"
+	for an unfix. Called by the buffer manager, by any thread,
+	with or without a latch, while PFtraceon is TRUE.
+
+RETURN VALUE: none
+*****************************************************************************/
+void PFtraceRecord(int fd, int page, int op, int dirty) {
+  PFtracering *ring = PFatomicLoad(PFtracebuf);
+  PFtracecell *cell;
+  unsigned long pos, seq;
+
+  pos = __atomic_load_n(&PFtracehead, __ATOMIC_RELAXED);
+  for (;;) {
+    cell = &ring->cells[pos & ring->mask];
+    seq = PFatomicLoad(cell->seq);
+    if (seq == pos) {
+      if (__atomic_compare_exchange_n(&PFtracehead, &pos, pos + 1, TRUE,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (seq < pos) {
+      /* full: the writer has not taken this cell off yet */
+      __atomic_fetch_add(&PFtracedropped, 1, __ATOMIC_RELAXED);
+      return;
+    } else
+      pos = __atomic_load_n(&PFtracehead, __ATOMIC_RELAXED);
+  }
+
+  cell->rec.time = PFtraceNow() - PFtracestart;
+  cell->rec.fd = fd;
+  cell->rec.page = page;
+  cell->rec.op = op;
+  cell->rec.dirty = (dirty != FALSE);
+  cell->rec.pad = 0;
+  PFatomicStore(cell->seq, pos + 1);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Write the records on the ring that are ready, in order, to the
+	trace file. Only the writer thread, or PFtraceStop() once it is
+	gone, calls this.
+
+RETURN VALUE:
+	The # of records written.
+*****************************************************************************/
+static int PFtraceDrain(void) {
+  PF_TraceRec batch[PF_TRACE_BATCH];
+  PFtracecell *cell;
+  int n, total = 0;
+
+  do {
+    for (n = 0; n < PF_TRACE_BATCH; n++) {
+      cell = &PFtracebuf->cells[PFtracetail & PFtracebuf->mask];
+      if (PFatomicLoad(cell->seq) != PFtracetail + 1)
+        break;
+      batch[n] = cell->rec;
+      PFatomicStore(cell->seq, PFtracetail + PFtracebuf->mask + 1);
+      PFtracetail++;
+    }
+    if (n > 0 && fwrite(batch, sizeof(PF_TraceRec), n, PFtracefile) != (size_t)n)
+      PFtraceerror = PFE_UNIX;
+    total += n;
+  } while (n == PF_TRACE_BATCH);
+  return (total);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	The writer thread: drain the ring, napping while it is empty,
+	until told to stop.
+
+RETURN VALUE: NULL
+*****************************************************************************/
+static void *PFtraceWriter(void *arg) {
+  struct timespec nap = {0, PF_TRACE_NAP};
+
+  (void)arg;
+  while (!PFatomicLoad(PFtracestopping))
+    if (PFtraceDrain() == 0)
+      nanosleep(&nap, NULL);
+  return (NULL);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Stop the trace, if one is on, as the program exits, so that
+	the trace file is complete even if PFtraceStop() is never
+	called.
+
+RETURN VALUE: none
+*****************************************************************************/
+static void PFtraceExit(void) {
+  if (PFatomicLoad(PFtraceon))
+    PFtraceStop();
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Start a trace into a new file "fname", with a ring of at least
+	"nrecords" records (PF_TRACE_RING if 0), rounded up to a power
+	of two. The ring of the last trace is reused if it is big
+	enough. A trace still on when the program exits is stopped
+	then.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_TRACE	if a trace is on already.
+	PFE_NOMEM	if no memory for the ring.
+	PFE_UNIX	if the file can't be written or the writer can't
+		be started.
+*****************************************************************************/
+int PFtraceStart(char *fname, int nrecords) {
+  PF_TraceHdr hdr;
+  PFtracering *ring;
+  unsigned long n, i;
+
+  pthread_mutex_lock(&PFtracelatch);
+  if (PFtraceon) {
+    pthread_mutex_unlock(&PFtracelatch);
+    PFerrno = PFE_TRACE;
+    return (PFerrno);
+  }
+  for (n = 1; n < (unsigned long)(nrecords > 0 ? nrecords : PF_TRACE_RING);
+       n <<= 1)
+    ;
+
+  /* a ring too small is kept, not freed: a fix that saw the last
+  trace on may still be putting its record in it */
+  if (PFtracebuf == NULL || PFtracebuf->mask + 1 < n) {
+    if ((ring = (PFtracering *)malloc(sizeof(PFtracering) +
+                                      n * sizeof(PFtracecell))) == NULL) {
+      pthread_mutex_unlock(&PFtracelatch);
+      PFerrno = PFE_NOMEM;
+      return (PFerrno);
+    }
+    ring->mask = n - 1;
+    if (PFtracebuf != NULL)
+      PFtraceretired[PFtracenretired++] = PFtracebuf;
+    PFatomicStore(PFtracebuf, ring);
+  }
+  for (i = 0; i <= PFtracebuf->mask; i++)
+    PFtracebuf->cells[i].seq = i;
+  PFtracehead = PFtracetail = 0;
+  PFtracedropped = 0;
+  PFtraceerror = PFE_OK;
+  PFtracestopping = FALSE;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, PF_TRACE_MAGIC, sizeof(hdr.magic));
+  hdr.recsize = sizeof(PF_TraceRec);
+  if ((PFtracefile = fopen(fname, "w")) == NULL) {
+    pthread_mutex_unlock(&PFtracelatch);
+    PFerrno = PFE_UNIX;
+    return (PFerrno);
+  }
+  if (fwrite(&hdr, sizeof(hdr), 1, PFtracefile) != 1 ||
+      pthread_create(&PFtracethread, NULL, PFtraceWriter, NULL) != 0) {
+    fclose(PFtracefile);
+    PFtracefile = NULL;
+    pthread_mutex_unlock(&PFtracelatch);
+    PFerrno = PFE_UNIX;
+    return (PFerrno);
+  }
+  if (!PFtraceatexit)
+    PFtraceatexit = (atexit(PFtraceExit) == 0);
+  PFtracestart = PFtraceNow();
+  PFatomicStore(PFtraceon, TRUE);
+  pthread_mutex_unlock(&PFtracelatch);
+  return (PFE_OK);
+}
+
+/****************************************************************************
+SPECIFICATIONS:
+	Stop the trace: stop the writer, write what is left on the
+	ring, and close the file. A fix that overlaps the stop may
+	leave its record out.
+
+RETURN VALUE:
+	If >= 0, the # of records dropped because the ring was full.
+	PFE_TRACE	if no trace is on.
+	PFE_UNIX	if a write to the trace file failed.
+*****************************************************************************/
+int PFtraceStop(void) {
+  int error;
+
+  pthread_mutex_lock(&PFtracelatch);
+  if (!PFtraceon) {
+    pthread_mutex_unlock(&PFtracelatch);
+    PFerrno = PFE_TRACE;
+    return (PFerrno);
+  }
+  PFatomicStore(PFtraceon, FALSE);
+  PFatomicStore(PFtracestopping, TRUE);
+  pthread_join(PFtracethread, NULL);
+  PFtraceDrain();
+  if (fclose(PFtracefile) != 0)
+    PFtraceerror = PFE_UNIX;
+  PFtracefile = NULL;
+  error = PFtraceerror;
+  pthread_mutex_unlock(&PFtracelatch);
+
+  if (error != PFE_OK) {
+    PFerrno = error;
+    return (PFerrno);
+  }
+  return ((int)__atomic_load_n(&PFtracedropped, __ATOMIC_RELAXED));
+}